@@ -29,8 +29,6 @@
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
 
-static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
-
 static void bo_del(struct fd_bo *bo);
 
 /* set buffer name, and add to table, call w/ table_lock held: */
@@ -76,17 +74,25 @@ static struct fd_bo * bo_from_handle(struct fd_device *dev,
 	return bo;
 }
 
-/* Frees older cached buffers.  Called under table_lock */
+/* Frees older cached buffers.  Takes cache_lock, but frees them only
+ * once it is dropped:
+ */
 void fd_cleanup_bo_cache(struct fd_device *dev, time_t time)
 {
+	struct list_head expired;
+	struct fd_bo *bo;
 	int i;
 
-	if (dev->time == time)
+	pthread_mutex_lock(&dev->cache_lock);
+
+	if (dev->time == time) {
+		pthread_mutex_unlock(&dev->cache_lock);
 		return;
+	}
 
+	list_inithead(&expired);
 	for (i = 0; i < dev->num_buckets; i++) {
 		struct fd_bo_bucket *bucket = &dev->cache_bucket[i];
-		struct fd_bo *bo;
 
 		while (!LIST_IS_EMPTY(&bucket->list)) {
 			bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
@@ -96,11 +102,18 @@ void fd_cleanup_bo_cache(struct fd_device *dev, time_t time)
 				break;
 
 			list_del(&bo->list);
-			bo_del(bo);
+			list_addtail(&bo->list, &expired);
 		}
 	}
 
 	dev->time = time;
+	pthread_mutex_unlock(&dev->cache_lock);
+
+	while (!LIST_IS_EMPTY(&expired)) {
+		bo = LIST_ENTRY(struct fd_bo, expired.next, list);
+		list_del(&bo->list);
+		bo_del(bo);
+	}
 }
 
 static struct fd_bo_bucket * get_bucket(struct fd_device *dev, uint32_t size)
@@ -128,36 +141,79 @@ static int is_idle(struct fd_bo *bo)
 			DRM_FREEDRENO_PREP_NOSYNC) == 0;
 }
 
+/* flags a cached bo has to have been allocated with to be reused: */
+static int is_compatible(struct fd_bo *bo, uint32_t flags)
+{
+	return bo->flags == (flags & ~DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER);
+}
+
 static struct fd_bo *find_in_bucket(struct fd_device *dev,
 		struct fd_bo_bucket *bucket, uint32_t flags)
 {
-	struct fd_bo *bo = NULL;
+	struct fd_bo *bo = NULL, *tmp;
+	struct list_head candidates;
+	unsigned busy = 0, n = 0;
+
+	list_inithead(&candidates);
 
-	/* TODO .. if we had an ALLOC_FOR_RENDER flag like intel, we could
-	 * skip the busy check.. if it is only going to be a render target
-	 * then we probably don't need to stall..
-	 *
-	 * NOTE that intel takes ALLOC_FOR_RENDER bo's from the list tail
-	 * (MRU, since likely to be in GPU cache), rather than head (LRU)..
+	pthread_mutex_lock(&dev->cache_lock);
+
+	/* like intel's ALLOC_FOR_RENDER: the GPU orders its own accesses, so
+	 * a render target needn't be idle, and the MRU bo is the most likely
+	 * to still be in the GPU cache:
 	 */
-	pthread_mutex_lock(&table_lock);
-	while (!LIST_IS_EMPTY(&bucket->list)) {
-		bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
-		if (0 /* TODO: if madvise tells us bo is gone... */) {
-			list_del(&bo->list);
-			bo_del(bo);
-			bo = NULL;
-			continue;
+	if (flags & DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER) {
+		LIST_FOR_EACH_ENTRY_SAFE_REV(bo, tmp, &bucket->list, list) {
+			if (is_compatible(bo, flags)) {
+				list_del(&bo->list);
+				dev->cache_stats.hits++;
+				pthread_mutex_unlock(&dev->cache_lock);
+				return bo;
+			}
 		}
-		/* TODO check for compatible flags? */
-		if (is_idle(bo)) {
-			list_del(&bo->list);
+		dev->cache_stats.misses++;
+		pthread_mutex_unlock(&dev->cache_lock);
+		return NULL;
+	}
+
+	/* otherwise the oldest few compatible ones, which nobody else finds
+	 * while we probe them unlocked:
+	 */
+	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &bucket->list, list) {
+		/* TODO: if madvise tells us bo is gone... */
+		if (!is_compatible(bo, flags))
+			continue;
+		list_del(&bo->list);
+		list_addtail(&bo->list, &candidates);
+		if (++n == FD_BO_CACHE_WINDOW)
+			break;
+	}
+	pthread_mutex_unlock(&dev->cache_lock);
+
+	bo = NULL;
+	LIST_FOR_EACH_ENTRY(tmp, &candidates, list) {
+		if (is_idle(tmp)) {
+			bo = tmp;
 			break;
 		}
-		bo = NULL;
-		break;
+		busy++;
 	}
-	pthread_mutex_unlock(&table_lock);
+	if (bo)
+		list_del(&bo->list);
+
+	/* the rest go back to the head, still the oldest: */
+	pthread_mutex_lock(&dev->cache_lock);
+	while (!LIST_IS_EMPTY(&candidates)) {
+		tmp = LIST_ENTRY(struct fd_bo, candidates.prev, list);
+		list_del(&tmp->list);
+		list_add(&tmp->list, &bucket->list);
+	}
+	if (bo)
+		dev->cache_stats.hits++;
+	else
+		dev->cache_stats.misses++;
+	dev->cache_stats.busy += busy;
+	pthread_mutex_unlock(&dev->cache_lock);
 
 	return bo;
 }
@@ -185,14 +241,16 @@ struct fd_bo * fd_bo_new(struct fd_device *dev,
 		}
 	}
 
+	flags &= ~DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER;
 	ret = dev->funcs->bo_new_handle(dev, size, flags, &handle);
 	if (ret)
 		return NULL;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 	bo = bo_from_handle(dev, size, handle);
 	bo->bo_reuse = 1;
-	pthread_mutex_unlock(&table_lock);
+	bo->flags = flags;
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -202,9 +260,9 @@ struct fd_bo *fd_bo_from_handle(struct fd_device *dev,
 {
 	struct fd_bo *bo = NULL;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 	bo = bo_from_handle(dev, size, handle);
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -216,7 +274,7 @@ struct fd_bo * fd_bo_from_name(struct fd_device *dev, uint32_t name)
 	};
 	struct fd_bo *bo;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 
 	/* check name table first, to see if bo is already open: */
 	bo = lookup_bo(dev->name_table, name);
@@ -237,7 +295,7 @@ struct fd_bo * fd_bo_from_name(struct fd_device *dev, uint32_t name)
 		set_name(bo, name);
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -255,8 +313,6 @@ void fd_bo_del(struct fd_bo *bo)
 	if (!atomic_dec_and_test(&bo->refcnt))
 		return;
 
-	pthread_mutex_lock(&table_lock);
-
 	if (bo->bo_reuse) {
 		struct fd_bo_bucket *bucket = get_bucket(dev, bo->size);
 
@@ -267,7 +323,9 @@ void fd_bo_del(struct fd_bo *bo)
 			clock_gettime(CLOCK_MONOTONIC, &time);
 
 			bo->free_time = time.tv_sec;
+			pthread_mutex_lock(&dev->cache_lock);
 			list_addtail(&bo->list, &bucket->list);
+			pthread_mutex_unlock(&dev->cache_lock);
 			fd_cleanup_bo_cache(dev, time.tv_sec);
 
 			/* bo's in the bucket cache don't have a ref and
@@ -280,13 +338,17 @@ void fd_bo_del(struct fd_bo *bo)
 
 	bo_del(bo);
 out:
-	fd_device_del_locked(dev);
-	pthread_mutex_unlock(&table_lock);
+	fd_device_del(dev);
 }
 
-/* Called under table_lock */
+/* Called without table_lock, takes it to drop the bo from the tables and
+ * close its handle, so that an import can't get the handle back before
+ * it's closed:
+ */
 static void bo_del(struct fd_bo *bo)
 {
+	struct fd_device *dev = bo->dev;
+
 	if (bo->map)
 		munmap(bo->map, bo->size);
 
@@ -298,10 +360,12 @@ static void bo_del(struct fd_bo *bo)
 		struct drm_gem_close req = {
 				.handle = bo->handle,
 		};
-		drmHashDelete(bo->dev->handle_table, bo->handle);
+		pthread_mutex_lock(&dev->table_lock);
+		drmHashDelete(dev->handle_table, bo->handle);
 		if (bo->name)
-			drmHashDelete(bo->dev->name_table, bo->name);
-		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+			drmHashDelete(dev->name_table, bo->name);
+		drmIoctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+		pthread_mutex_unlock(&dev->table_lock);
 	}
 
 	bo->funcs->destroy(bo);
@@ -320,9 +384,11 @@ int fd_bo_get_name(struct fd_bo *bo, uint32_t *name)
 			return ret;
 		}
 
-		pthread_mutex_lock(&table_lock);
+		pthread_mutex_lock(&bo->dev->table_lock);
 		set_name(bo, req.name);
-		pthread_mutex_unlock(&table_lock);
+		/* it may come back through fd_bo_from_name, so never cache it: */
+		bo->bo_reuse = 0;
+		pthread_mutex_unlock(&bo->dev->table_lock);
 	}
 
 	*name = bo->name;
@@ -33,8 +33,6 @@
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
 
-static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
-
 struct fd_device * kgsl_device_new(int fd);
 struct fd_device * msm_device_new(int fd);
 
@@ -105,6 +103,8 @@ struct fd_device * fd_device_new(int fd)
 
 	atomic_set(&dev->refcnt, 1);
 	dev->fd = fd;
+	pthread_mutex_init(&dev->table_lock, NULL);
+	pthread_mutex_init(&dev->cache_lock, NULL);
 	dev->handle_table = drmHashCreate();
 	dev->name_table = drmHashCreate();
 	init_cache_buckets(dev);
@@ -129,28 +129,24 @@ struct fd_device * fd_device_ref(struct fd_device *dev)
 	return dev;
 }
 
-static void fd_device_del_impl(struct fd_device *dev)
+void fd_device_del(struct fd_device *dev)
 {
+	if (!atomic_dec_and_test(&dev->refcnt))
+		return;
 	fd_cleanup_bo_cache(dev, 0);
 	drmHashDestroy(dev->handle_table);
 	drmHashDestroy(dev->name_table);
+	pthread_mutex_destroy(&dev->table_lock);
+	pthread_mutex_destroy(&dev->cache_lock);
 	if (dev->closefd)
 		close(dev->fd);
 	dev->funcs->destroy(dev);
 }
 
-void fd_device_del_locked(struct fd_device *dev)
-{
-	if (!atomic_dec_and_test(&dev->refcnt))
-		return;
-	fd_device_del_impl(dev);
-}
-
-void fd_device_del(struct fd_device *dev)
+void fd_device_get_bo_cache_stats(struct fd_device *dev,
+		struct fd_bo_cache_stats *stats)
 {
-	if (!atomic_dec_and_test(&dev->refcnt))
-		return;
-	pthread_mutex_lock(&table_lock);
-	fd_device_del_impl(dev);
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_lock(&dev->cache_lock);
+	*stats = dev->cache_stats;
+	pthread_mutex_unlock(&dev->cache_lock);
 }
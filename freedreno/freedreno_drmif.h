@@ -63,12 +63,21 @@ enum fd_param_id {
 #define DRM_FREEDRENO_GEM_CACHE_WBACKWA   0x00800000
 #define DRM_FREEDRENO_GEM_CACHE_MASK      0x00f00000
 #define DRM_FREEDRENO_GEM_GPUREADONLY     0x01000000
+/* only to be rendered to, so a cached bo may be reused while still busy: */
+#define DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER 0x02000000
 
 /* bo access flags: (keep aligned to MSM_PREP_x) */
 #define DRM_FREEDRENO_PREP_READ           0x01
 #define DRM_FREEDRENO_PREP_WRITE          0x02
 #define DRM_FREEDRENO_PREP_NOSYNC         0x04
 
+/* bo cache counters, for fd_bo_new's of sizes the cache has buckets for: */
+struct fd_bo_cache_stats {
+	uint32_t hits;           /* reused a cached bo */
+	uint32_t misses;         /* allocated a new one */
+	uint32_t busy;           /* cached bo's passed over as busy */
+};
+
 /* device functions:
  */
 
@@ -76,6 +85,8 @@ struct fd_device * fd_device_new(int fd);
 struct fd_device * fd_device_new_dup(int fd);
 struct fd_device * fd_device_ref(struct fd_device *dev);
 void fd_device_del(struct fd_device *dev);
+void fd_device_get_bo_cache_stats(struct fd_device *dev,
+		struct fd_bo_cache_stats *stats);
 
 
 /* pipe functions:
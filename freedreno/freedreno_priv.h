@@ -76,22 +76,31 @@ struct fd_device {
 	 * We end up needing two tables, because DRM_IOCTL_GEM_OPEN always
 	 * returns a new handle.  So we need to figure out if the bo is already
 	 * open in the process first, before calling gem-open.
+	 *
+	 * Both are protected by table_lock, which is also held across
+	 * GEM_CLOSE so a handle is never reused while still in a table.
 	 */
+	pthread_mutex_t table_lock;
 	void *handle_table, *name_table;
 
 	struct fd_device_funcs *funcs;
 
+	/* protects the cache buckets and time, may be taken before
+	 * table_lock but never after it, and never held across an ioctl:
+	 */
+	pthread_mutex_t cache_lock;
 	struct fd_bo_bucket cache_bucket[14 * 4];
 	int num_buckets;
 	time_t time;
+	struct fd_bo_cache_stats cache_stats;
 
 	int closefd;        /* call close(fd) upon destruction */
 };
 
-void fd_cleanup_bo_cache(struct fd_device *dev, time_t time);
+/* how many compatible bo's of a bucket are probed for an idle one: */
+#define FD_BO_CACHE_WINDOW 4
 
-/* for where @table_lock is already held: */
-void fd_device_del_locked(struct fd_device *dev);
+void fd_cleanup_bo_cache(struct fd_device *dev, time_t time);
 
 struct fd_pipe_funcs {
 	struct fd_ringbuffer * (*ringbuffer_new)(struct fd_pipe *pipe, uint32_t size);
@@ -139,6 +148,7 @@ struct fd_bo {
 	struct fd_bo_funcs *funcs;
 
 	int bo_reuse;
+	uint32_t flags;          /* what it was allocated with, for reuse */
 	struct list_head list;   /* bucket-list entry */
 	time_t free_time;        /* time when added to bucket-list */
 };
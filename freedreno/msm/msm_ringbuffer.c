@@ -47,7 +47,11 @@ struct msm_ringbuffer {
 	struct fd_ringbuffer **rings;
 	uint32_t nr_rings, max_rings;
 
-	/* reloc's table: */
+	/* cmd's by (bo, offset, size, type), open addressed, idx plus 1: */
+	uint32_t *cmd_hash;
+	uint32_t cmd_hash_size;
+
+	/* reloc's table, sorted by submit_offset: */
 	struct drm_msm_gem_submit_reloc *relocs;
 	uint32_t nr_relocs, max_relocs;
 };
@@ -114,23 +118,76 @@ static uint32_t offset_bytes(void *end, void *start)
 	return ((char *)end) - ((char *)start);
 }
 
+static uint32_t cmd_hash(uint32_t handle, uint32_t submit_offset,
+		uint32_t size, uint32_t type)
+{
+	uint32_t hash = handle * 0x9e3779b1;
+	hash = (hash ^ submit_offset) * 0x85ebca6b;
+	hash = (hash ^ size) * 0xc2b2ae35;
+	return (hash ^ type) ^ (hash >> 16);
+}
+
+static void cmd_hash_insert(struct msm_ringbuffer *msm_ring, uint32_t idx)
+{
+	struct drm_msm_gem_submit_cmd *cmd = &msm_ring->cmds[idx];
+	uint32_t mask = msm_ring->cmd_hash_size - 1;
+	uint32_t i = cmd_hash(msm_ring->bos[cmd->submit_idx].handle,
+			cmd->submit_offset, cmd->size, cmd->type);
+
+	while (msm_ring->cmd_hash[i & mask])
+		i++;
+	msm_ring->cmd_hash[i & mask] = idx + 1;
+}
+
+/* keep the table at most half full, without it get_cmd() scans: */
+static void cmd_hash_grow(struct msm_ringbuffer *msm_ring)
+{
+	uint32_t i, size = msm_ring->cmd_hash_size;
+
+	if (msm_ring->nr_cmds * 2 <= size)
+		return;
+
+	/* from scratch after a failed allocation, so size for all the cmds: */
+	for (size = 64; size < msm_ring->nr_cmds * 2; size *= 2)
+		;
+	free(msm_ring->cmd_hash);
+	msm_ring->cmd_hash = calloc(size, sizeof(msm_ring->cmd_hash[0]));
+	msm_ring->cmd_hash_size = msm_ring->cmd_hash ? size : 0;
+
+	for (i = 0; msm_ring->cmd_hash && i < msm_ring->nr_cmds - 1; i++)
+		cmd_hash_insert(msm_ring, i);
+}
+
 static struct drm_msm_gem_submit_cmd * get_cmd(struct fd_ringbuffer *ring,
 		struct fd_ringbuffer *target_ring, struct fd_bo *target_bo,
 		uint32_t submit_offset, uint32_t size, uint32_t type)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
 	struct drm_msm_gem_submit_cmd *cmd = NULL;
-	uint32_t i;
+	uint32_t i, mask = msm_ring->cmd_hash_size - 1;
 
 	/* figure out if we already have a cmd buf: */
-	for (i = 0; i < msm_ring->nr_cmds; i++) {
-		cmd = &msm_ring->cmds[i];
-		if ((cmd->submit_offset == submit_offset) &&
-				(cmd->size == size) &&
-				(cmd->type == type) &&
-				check_cmd_bo(ring, cmd, target_bo))
-			break;
+	if (msm_ring->cmd_hash) {
+		i = cmd_hash(target_bo->handle, submit_offset, size, type);
+		for (; msm_ring->cmd_hash[i & mask]; i++) {
+			cmd = &msm_ring->cmds[msm_ring->cmd_hash[i & mask] - 1];
+			if ((cmd->submit_offset == submit_offset) &&
+					(cmd->size == size) &&
+					(cmd->type == type) &&
+					check_cmd_bo(ring, cmd, target_bo))
+				return cmd;
+		}
 		cmd = NULL;
+	} else {
+		for (i = 0; i < msm_ring->nr_cmds; i++) {
+			cmd = &msm_ring->cmds[i];
+			if ((cmd->submit_offset == submit_offset) &&
+					(cmd->size == size) &&
+					(cmd->type == type) &&
+					check_cmd_bo(ring, cmd, target_bo))
+				break;
+			cmd = NULL;
+		}
 	}
 
 	/* create cmd buf if not: */
@@ -144,6 +201,10 @@ static struct drm_msm_gem_submit_cmd * get_cmd(struct fd_ringbuffer *ring,
 		cmd->submit_offset = submit_offset;
 		cmd->size = size;
 		cmd->pad = 0;
+
+		cmd_hash_grow(msm_ring);
+		if (msm_ring->cmd_hash)
+			cmd_hash_insert(msm_ring, idx);
 	}
 
 	return cmd;
@@ -155,19 +216,21 @@ static void * msm_ringbuffer_hostptr(struct fd_ringbuffer *ring)
 	return fd_bo_map(msm_ring->ring_bo);
 }
 
+/* first reloc from start on at or past offset: */
 static uint32_t find_next_reloc_idx(struct msm_ringbuffer *msm_ring,
 		uint32_t start, uint32_t offset)
 {
-	uint32_t i;
+	uint32_t end = msm_ring->nr_relocs;
 
-	/* a binary search would be more clever.. */
-	for (i = start; i < msm_ring->nr_relocs; i++) {
-		struct drm_msm_gem_submit_reloc *reloc = &msm_ring->relocs[i];
-		if (reloc->submit_offset >= offset)
-			return i;
+	while (start < end) {
+		uint32_t mid = start + (end - start) / 2;
+		if (msm_ring->relocs[mid].submit_offset < offset)
+			start = mid + 1;
+		else
+			end = mid;
 	}
 
-	return i;
+	return start;
 }
 
 static void flush_reset(struct fd_ringbuffer *ring)
@@ -184,6 +247,10 @@ static void flush_reset(struct fd_ringbuffer *ring)
 	msm_ring->nr_relocs = 0;
 	msm_ring->nr_cmds = 0;
 	msm_ring->nr_bos = 0;
+
+	if (msm_ring->cmd_hash)
+		memset(msm_ring->cmd_hash, 0, msm_ring->cmd_hash_size *
+				sizeof(msm_ring->cmd_hash[0]));
 }
 
 static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start)
@@ -257,16 +324,23 @@ static void msm_ringbuffer_emit_reloc(struct fd_ringbuffer *ring,
 	struct fd_ringbuffer *parent = ring->parent ? ring->parent : ring;
 	struct msm_bo *msm_bo = to_msm_bo(r->bo);
 	struct drm_msm_gem_submit_reloc *reloc;
-	uint32_t idx = APPEND(msm_ring, relocs);
+	uint32_t submit_offset = offset_bytes(ring->cur, ring->start);
+	uint32_t nr = msm_ring->nr_relocs, idx = nr;
 	uint32_t addr;
 
+	/* the kernel wants them sorted, should cur have been moved back: */
+	if (nr && (msm_ring->relocs[nr - 1].submit_offset > submit_offset))
+		idx = find_next_reloc_idx(msm_ring, 0, submit_offset + 1);
+
+	APPEND(msm_ring, relocs);
 	reloc = &msm_ring->relocs[idx];
+	memmove(reloc + 1, reloc, (nr - idx) * sizeof(*reloc));
 
 	reloc->reloc_idx = bo2idx(parent, r->bo, r->flags);
 	reloc->reloc_offset = r->offset;
 	reloc->or = r->or;
 	reloc->shift = r->shift;
-	reloc->submit_offset = offset_bytes(ring->cur, ring->start);
+	reloc->submit_offset = submit_offset;
 
 	addr = msm_bo->presumed;
 	if (r->shift < 0)
@@ -302,6 +376,11 @@ static void msm_ringbuffer_destroy(struct fd_ringbuffer *ring)
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
 	if (msm_ring->ring_bo)
 		fd_bo_del(msm_ring->ring_bo);
+	free(msm_ring->bos);
+	free(msm_ring->cmds);
+	free(msm_ring->rings);
+	free(msm_ring->cmd_hash);
+	free(msm_ring->relocs);
 	free(msm_ring);
 }
 
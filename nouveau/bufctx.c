@@ -38,36 +38,6 @@
 #include "nouveau.h"
 #include "private.h"
 
-struct nouveau_bufref_priv {
-	struct nouveau_bufref base;
-	struct nouveau_bufref_priv *next;
-	struct nouveau_bufctx *bufctx;
-};
-
-static inline struct nouveau_bufref_priv *
-nouveau_bufref(struct nouveau_bufref *bctx)
-{
-	return (struct nouveau_bufref_priv *)bctx;
-}
-
-struct nouveau_bufbin_priv {
-	struct nouveau_bufref_priv *list;
-	int relocs;
-};
-
-struct nouveau_bufctx_priv {
-	struct nouveau_bufctx base;
-	struct nouveau_bufref_priv *free;
-	int nr_bins;
-	struct nouveau_bufbin_priv bins[];
-};
-
-static inline struct nouveau_bufctx_priv *
-nouveau_bufctx(struct nouveau_bufctx *bctx)
-{
-	return (struct nouveau_bufctx_priv *)bctx;
-}
-
 int
 nouveau_bufctx_new(struct nouveau_client *client, int bins,
 		   struct nouveau_bufctx **pbctx)
@@ -92,13 +62,13 @@ void
 nouveau_bufctx_del(struct nouveau_bufctx **pbctx)
 {
 	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(*pbctx);
-	struct nouveau_bufref_priv *pref;
+	struct nouveau_bufref_arena *arena;
 	if (pctx) {
 		while (pctx->nr_bins--)
-			nouveau_bufctx_reset(&pctx->base, pctx->nr_bins);
-		while ((pref = pctx->free)) {
-			pctx->free = pref->next;
-			free(pref);
+			free(pctx->bins[pctx->nr_bins].refs);
+		while ((arena = pctx->arena)) {
+			pctx->arena = arena->next;
+			free(arena);
 		}
 		free(pctx);
 		*pbctx = NULL;
@@ -110,31 +80,65 @@ nouveau_bufctx_reset(struct nouveau_bufctx *bctx, int bin)
 {
 	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(bctx);
 	struct nouveau_bufbin_priv *pbin = &pctx->bins[bin];
-	struct nouveau_bufref_priv *pref;
-
-	while ((pref = pbin->list)) {
-		DRMLISTDELINIT(&pref->base.thead);
-		pbin->list = pref->next;
-		pref->next = pctx->free;
-		pctx->free = pref;
+	int i;
+
+	/* the only bin in use, drop the lists wholesale */
+	if (pbin->nr == pctx->nr_refs) {
+		DRMINITLISTHEAD(&bctx->pending);
+		DRMINITLISTHEAD(&bctx->current);
+	} else {
+		for (i = 0; i < pbin->nr; i++)
+			DRMLISTDEL(&pbin->refs[i]->base.thead);
 	}
 
+	pctx->nr_refs -= pbin->nr;
+	pbin->nr = 0;
+	pbin->pending = 0;
+
 	bctx->relocs -= pbin->relocs;
 	pbin->relocs  = 0;
 }
 
+static struct nouveau_bufref_priv *
+bufctx_ref_new(struct nouveau_bufctx_priv *pctx, struct nouveau_bufbin_priv *pbin)
+{
+	struct nouveau_bufref_arena *arena = pctx->arena;
+	struct nouveau_bufref_priv **refs;
+
+	if (pbin->nr_alloc == pbin->max) {
+		int max = pbin->max ? pbin->max * 2 : 16;
+		refs = realloc(pbin->refs, sizeof(*refs) * max);
+		if (!refs)
+			return NULL;
+		pbin->refs = refs;
+		pbin->max = max;
+	}
+
+	if (!arena || pctx->arena_used == NOUVEAU_BUFCTX_ARENA) {
+		arena = malloc(sizeof(*arena));
+		if (!arena)
+			return NULL;
+		arena->next = pctx->arena;
+		pctx->arena = arena;
+		pctx->arena_used = 0;
+	}
+
+	pbin->refs[pbin->nr_alloc++] = &arena->ref[pctx->arena_used++];
+	return pbin->refs[pbin->nr];
+}
+
 struct nouveau_bufref *
 nouveau_bufctx_refn(struct nouveau_bufctx *bctx, int bin,
 		    struct nouveau_bo *bo, uint32_t flags)
 {
 	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(bctx);
 	struct nouveau_bufbin_priv *pbin = &pctx->bins[bin];
-	struct nouveau_bufref_priv *pref = pctx->free;
+	struct nouveau_bufref_priv *pref;
 
-	if (!pref)
-		pref = malloc(sizeof(*pref));
+	if (pbin->nr < pbin->nr_alloc)
+		pref = pbin->refs[pbin->nr];
 	else
-		pctx->free = pref->next;
+		pref = bufctx_ref_new(pctx, pbin);
 
 	if (pref) {
 		pref->base.bo = bo;
@@ -143,8 +147,8 @@ nouveau_bufctx_refn(struct nouveau_bufctx *bctx, int bin,
 
 		DRMLISTADDTAIL(&pref->base.thead, &bctx->pending);
 		pref->bufctx = bctx;
-		pref->next = pbin->list;
-		pbin->list = pref;
+		pbin->nr++;
+		pctx->nr_refs++;
 	}
 
 	return &pref->base;
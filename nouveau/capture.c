@@ -0,0 +1,223 @@
+/*
+ * Copyright 2012 Red Hat Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "private.h"
+#include "capture.h"
+
+/* records are written out in chunks of this, or whole when bigger */
+#define CAPTURE_BUFFER_SIZE (1 << 20)
+
+struct nouveau_capture {
+	pthread_mutex_t lock;
+	int fd;
+	int err;
+	size_t used;
+	char buffer[CAPTURE_BUFFER_SIZE];
+};
+
+static int
+capture_write_fd(struct nouveau_capture *cap, const void *data, size_t size)
+{
+	const char *ptr = data;
+	ssize_t ret;
+
+	while (size) {
+		ret = write(cap->fd, ptr, size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		ptr += ret;
+		size -= ret;
+	}
+	return 0;
+}
+
+static int
+capture_flush(struct nouveau_capture *cap)
+{
+	int ret = capture_write_fd(cap, cap->buffer, cap->used);
+	cap->used = 0;
+	return ret;
+}
+
+static int
+capture_write(struct nouveau_capture *cap, const void *data, size_t size)
+{
+	int ret;
+
+	if (cap->used + size > CAPTURE_BUFFER_SIZE) {
+		ret = capture_flush(cap);
+		if (ret)
+			return ret;
+		if (size > CAPTURE_BUFFER_SIZE)
+			return capture_write_fd(cap, data, size);
+	}
+
+	memcpy(cap->buffer + cap->used, data, size);
+	cap->used += size;
+	return 0;
+}
+
+int
+capture_open(struct nouveau_capture **pcap, const char *path)
+{
+	struct nouveau_capture_header header = {
+		.magic = NOUVEAU_CAPTURE_MAGIC,
+		.version = NOUVEAU_CAPTURE_VERSION,
+	};
+	struct nouveau_capture *cap;
+	int ret;
+
+	cap = malloc(sizeof(*cap));
+	if (!cap)
+		return -ENOMEM;
+
+	cap->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (cap->fd < 0) {
+		free(cap);
+		return -errno;
+	}
+	pthread_mutex_init(&cap->lock, NULL);
+	cap->err = 0;
+	cap->used = 0;
+	ret = capture_write(cap, &header, sizeof(header));
+	if (ret) {
+		close(cap->fd);
+		pthread_mutex_destroy(&cap->lock);
+		free(cap);
+		return ret;
+	}
+	*pcap = cap;
+	return 0;
+}
+
+int
+capture_close(struct nouveau_capture *cap)
+{
+	int ret = cap->err;
+
+	if (!ret)
+		ret = capture_flush(cap);
+	close(cap->fd);
+	pthread_mutex_destroy(&cap->lock);
+	free(cap);
+	return ret;
+}
+
+static int
+capture_req(struct nouveau_capture *cap, struct drm_nouveau_gem_pushbuf *req,
+	    const uint8_t *domains)
+{
+	struct drm_nouveau_gem_pushbuf_bo *kref = (void *)(unsigned long)
+						  req->buffers;
+	struct drm_nouveau_gem_pushbuf_push *kpsh = (void *)(unsigned long)
+						    req->push;
+	struct nouveau_capture_krec rec = {
+		.magic = NOUVEAU_CAPTURE_KREC,
+		.channel = req->channel,
+		.nr_buffer = req->nr_buffers,
+		.nr_reloc = req->nr_relocs,
+		.nr_push = req->nr_push,
+		.suffix0 = req->suffix0,
+		.suffix1 = req->suffix1,
+	};
+	static const char pad[8];
+	struct nouveau_capture_bo cbo = {};
+	struct nouveau_bo *bo;
+	uint64_t relocs, contents = 0;
+	uint32_t i;
+	int ret;
+
+	relocs = rec.nr_reloc * sizeof(struct drm_nouveau_gem_pushbuf_reloc);
+	for (i = 0; i < req->nr_push; i++) {
+		bo = (void *)(unsigned long)kref[kpsh[i].bo_index].user_priv;
+		if (bo->map)
+			contents += kpsh[i].length;
+	}
+	rec.size = rec.nr_buffer * sizeof(cbo) +
+		   NOUVEAU_CAPTURE_ALIGN(relocs) +
+		   rec.nr_push * sizeof(*kpsh) +
+		   NOUVEAU_CAPTURE_ALIGN(contents);
+
+	ret = capture_write(cap, &rec, sizeof(rec));
+	for (i = 0; !ret && i < req->nr_buffers; i++) {
+		bo = (void *)(unsigned long)kref[i].user_priv;
+		cbo.handle = kref[i].handle;
+		cbo.flags = bo->map ? NOUVEAU_CAPTURE_BO_MAPPED : 0;
+		cbo.domains = domains[i];
+		cbo.valid_domains = kref[i].valid_domains;
+		cbo.read_domains = kref[i].read_domains;
+		cbo.write_domains = kref[i].write_domains;
+		cbo.presumed_domain = kref[i].presumed.domain;
+		cbo.presumed_offset = kref[i].presumed.offset;
+		cbo.size = bo->size;
+		ret = capture_write(cap, &cbo, sizeof(cbo));
+	}
+	if (!ret)
+		ret = capture_write(cap, (void *)(unsigned long)req->relocs,
+				    relocs);
+	if (!ret)
+		ret = capture_write(cap, pad,
+				    NOUVEAU_CAPTURE_ALIGN(relocs) - relocs);
+	if (!ret)
+		ret = capture_write(cap, kpsh, rec.nr_push * sizeof(*kpsh));
+	for (i = 0; !ret && i < req->nr_push; i++) {
+		bo = (void *)(unsigned long)kref[kpsh[i].bo_index].user_priv;
+		if (bo->map)
+			ret = capture_write(cap, (char *)bo->map +
+					    kpsh[i].offset, kpsh[i].length);
+	}
+	if (!ret)
+		ret = capture_write(cap, pad,
+				    NOUVEAU_CAPTURE_ALIGN(contents) - contents);
+	return ret;
+}
+
+/* a failed write stops the capture, its last record may be cut short */
+void
+capture_submit(struct nouveau_capture *cap, struct drm_nouveau_gem_pushbuf *req,
+	       const uint8_t *domains)
+{
+	pthread_mutex_lock(&cap->lock);
+	if (!cap->err) {
+		cap->err = capture_req(cap, req, domains);
+		if (cap->err)
+			err("stopping pushbuf capture: %s\n",
+			    strerror(-cap->err));
+	}
+	pthread_mutex_unlock(&cap->lock);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2012 Red Hat Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef __NOUVEAU_LIBDRM_CAPTURE_H__
+#define __NOUVEAU_LIBDRM_CAPTURE_H__
+
+#include <stdint.h>
+
+/*
+ * Capture files hold what pushbufs submitted, in the order the kernel was
+ * given it, in host byte order.  A header is followed by one record per
+ * submission:
+ *
+ *	struct nouveau_capture_krec
+ *	struct nouveau_capture_bo            bo[nr_buffer]
+ *	struct drm_nouveau_gem_pushbuf_reloc reloc[nr_reloc]
+ *	struct drm_nouveau_gem_pushbuf_push  push[nr_push]
+ *	the contents of each push, when its bo was mapped, in push order
+ *
+ * with the relocs and the contents padded to a multiple of 8 bytes.
+ */
+#define NOUVEAU_CAPTURE_ALIGN(size) (((size) + 7) & ~7ULL)
+
+#define NOUVEAU_CAPTURE_MAGIC	0x4350564e	/* "NVPC" */
+#define NOUVEAU_CAPTURE_KREC	0x4345524b	/* "KREC" */
+#define NOUVEAU_CAPTURE_VERSION	1
+
+struct nouveau_capture_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct nouveau_capture_krec {
+	uint32_t magic;
+	uint32_t channel;
+	uint32_t nr_buffer;
+	uint32_t nr_reloc;
+	uint32_t nr_push;
+	uint32_t suffix0;
+	uint32_t suffix1;
+	uint32_t pad;
+	uint64_t size;		/* of what follows, up to the next record */
+};
+
+#define NOUVEAU_CAPTURE_BO_MAPPED 0x00000001
+
+/* valid_domains is where the bo was planned to go, out of domains */
+struct nouveau_capture_bo {
+	uint32_t handle;
+	uint32_t flags;
+	uint32_t domains;
+	uint32_t valid_domains;
+	uint32_t read_domains;
+	uint32_t write_domains;
+	uint32_t presumed_domain;
+	uint32_t pad;
+	uint64_t presumed_offset;
+	uint64_t size;
+};
+
+#endif
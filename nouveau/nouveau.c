@@ -35,6 +35,8 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <time.h>
+#include <sched.h>
 
 #include <xf86drm.h>
 #include <xf86atomic.h>
@@ -58,6 +60,198 @@ debug_init(char *args)
 }
 #endif
 
+/*
+ * Freed private bos are kept per device, in buckets of the same sizes as
+ * the other drivers use, and handed back by nouveau_bo_new when idle,
+ * still mapped.
+ */
+#define BO_CACHE_MAX_SIZE (64 * 1024 * 1024)
+
+static uint64_t
+bo_cache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+bo_cache_add_bucket(struct nouveau_device_priv *nvdev, uint64_t size)
+{
+	struct nouveau_bo_bucket *bucket = &nvdev->bucket[nvdev->nr_bucket++];
+
+	bucket->size = size;
+	DRMINITLISTHEAD(&bucket->list);
+}
+
+/* powers of two with 3 sizes in between, at most a quarter is wasted */
+static void
+bo_cache_init(struct nouveau_device_priv *nvdev)
+{
+	uint64_t size;
+
+	bo_cache_add_bucket(nvdev, 4096);
+	bo_cache_add_bucket(nvdev, 4096 * 2);
+	bo_cache_add_bucket(nvdev, 4096 * 3);
+	for (size = 4 * 4096; size <= BO_CACHE_MAX_SIZE; size *= 2) {
+		bo_cache_add_bucket(nvdev, size);
+		bo_cache_add_bucket(nvdev, size + size * 1 / 4);
+		bo_cache_add_bucket(nvdev, size + size * 2 / 4);
+		bo_cache_add_bucket(nvdev, size + size * 3 / 4);
+	}
+	DRMINITLISTHEAD(&nvdev->cache_lru);
+}
+
+static struct nouveau_bo_bucket *
+bo_cache_bucket(struct nouveau_device_priv *nvdev, uint64_t size)
+{
+	int i;
+
+	for (i = 0; i < nvdev->nr_bucket; i++) {
+		if (nvdev->bucket[i].size >= size)
+			return &nvdev->bucket[i];
+	}
+	return NULL;
+}
+
+static void
+bo_close(struct nouveau_bo_priv *nvbo)
+{
+	struct nouveau_bo *bo = &nvbo->base;
+	struct drm_gem_close req = { bo->handle };
+
+	drmIoctl(bo->device->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	if (bo->map)
+		munmap(bo->map, bo->size);
+	free(nvbo);
+}
+
+static void
+bo_cache_remove(struct nouveau_device_priv *nvdev, struct nouveau_bo_priv *nvbo)
+{
+	DRMLISTDEL(&nvbo->bucket_head);
+	DRMLISTDEL(&nvbo->lru_head);
+	nvdev->cache_bytes -= nvbo->base.size;
+}
+
+/* undo bo_cache_remove, keeping the lru in free order, cache_lock held */
+static void
+bo_cache_restore(struct nouveau_device_priv *nvdev,
+		 struct nouveau_bo_bucket *bucket, struct nouveau_bo_priv *nvbo)
+{
+	struct nouveau_list *pos = nvdev->cache_lru.next;
+
+	while (pos != &nvdev->cache_lru &&
+	       DRMLISTENTRY(struct nouveau_bo_priv, pos, lru_head)->free_time <=
+	       nvbo->free_time)
+		pos = pos->next;
+	DRMLISTADD(&nvbo->bucket_head, &bucket->list);
+	DRMLISTADDTAIL(&nvbo->lru_head, pos);
+	nvdev->cache_bytes += nvbo->base.size;
+}
+
+/* drop the bos over budget or too old, oldest first, cache_lock held */
+static void
+bo_cache_trim(struct nouveau_device_priv *nvdev, uint64_t now,
+	      uint64_t max_bytes)
+{
+	struct nouveau_bo_priv *nvbo;
+
+	while (!DRMLISTEMPTY(&nvdev->cache_lru)) {
+		nvbo = DRMLISTENTRY(struct nouveau_bo_priv,
+				    nvdev->cache_lru.next, lru_head);
+		if (nvdev->cache_bytes <= max_bytes &&
+		    now - nvbo->free_time <= nvdev->cache_max_age)
+			break;
+		bo_cache_remove(nvdev, nvbo);
+		bo_close(nvbo);
+	}
+}
+
+static bool
+bo_cache_match(struct nouveau_bo_priv *nvbo, uint32_t flags, uint32_t align,
+	       union nouveau_bo_config *config)
+{
+	if (nvbo->new_flags != flags || nvbo->new_align != align ||
+	    nvbo->has_config != (config != NULL))
+		return false;
+	return !config || !memcmp(&nvbo->new_config, config, sizeof(*config));
+}
+
+/*
+ * The oldest matching bo of the bucket, if the gpu is done with it.  Newer
+ * ones were freed later and are not likely to be idle when it is not.  It
+ * is taken out of the cache to be probed without cache_lock, and goes back
+ * when busy.
+ */
+static struct nouveau_bo_priv *
+bo_cache_find(struct nouveau_device_priv *nvdev,
+	      struct nouveau_bo_bucket *bucket, uint32_t flags,
+	      uint32_t align, union nouveau_bo_config *config)
+{
+	struct nouveau_bo_priv *nvbo, *found = NULL;
+	struct drm_nouveau_gem_cpu_prep req;
+
+	pthread_mutex_lock(&nvdev->cache_lock);
+	DRMLISTFOREACHENTRY(nvbo, &bucket->list, bucket_head) {
+		if (bo_cache_match(nvbo, flags, align, config)) {
+			bo_cache_remove(nvdev, nvbo);
+			found = nvbo;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&nvdev->cache_lock);
+	if (!found)
+		return NULL;
+
+	req.handle = found->base.handle;
+	req.flags = NOUVEAU_GEM_CPU_PREP_NOWAIT | NOUVEAU_GEM_CPU_PREP_WRITE;
+	if (!drmCommandWrite(nvdev->base.fd, DRM_NOUVEAU_GEM_CPU_PREP,
+			     &req, sizeof(req)))
+		return found;
+
+	pthread_mutex_lock(&nvdev->cache_lock);
+	bo_cache_restore(nvdev, bucket, found);
+	pthread_mutex_unlock(&nvdev->cache_lock);
+	return NULL;
+}
+
+/* false when the bo does not go to the cache and has to be closed */
+static bool
+bo_cache_put(struct nouveau_device_priv *nvdev, struct nouveau_bo_priv *nvbo)
+{
+	struct nouveau_bo_bucket *bucket;
+	bool cached = false;
+
+	pthread_mutex_lock(&nvdev->cache_lock);
+	bucket = bo_cache_bucket(nvdev, nvbo->base.size);
+	if (bucket && nvbo->base.size <= nvdev->cache_max_bytes) {
+		nvbo->free_time = bo_cache_now();
+		nvbo->access = 0;
+		DRMLISTADDTAIL(&nvbo->bucket_head, &bucket->list);
+		DRMLISTADDTAIL(&nvbo->lru_head, &nvdev->cache_lru);
+		nvdev->cache_bytes += nvbo->base.size;
+		bo_cache_trim(nvdev, nvbo->free_time, nvdev->cache_max_bytes);
+		cached = true;
+	}
+	pthread_mutex_unlock(&nvdev->cache_lock);
+	return cached;
+}
+
+void
+nouveau_device_set_bo_cache(struct nouveau_device *dev, uint64_t max_bytes,
+			    uint32_t max_age)
+{
+	struct nouveau_device_priv *nvdev = nouveau_device(dev);
+
+	pthread_mutex_lock(&nvdev->cache_lock);
+	nvdev->cache_max_bytes = max_bytes;
+	nvdev->cache_max_age = max_age;
+	bo_cache_trim(nvdev, bo_cache_now(), max_bytes);
+	pthread_mutex_unlock(&nvdev->cache_lock);
+}
+
 /* this is the old libdrm's version of nouveau_device_wrap(), the symbol
  * is kept here to prevent AIGLX from crashing if the DDX is linked against
  * the new libdrm, but the DRI driver against the old
@@ -90,6 +284,13 @@ nouveau_device_wrap(int fd, int close, struct nouveau_device **pdev)
 		free(nvdev);
 		return ret;
 	}
+	ret = pthread_mutex_init(&nvdev->cache_lock, NULL);
+	if (ret) {
+		pthread_mutex_destroy(&nvdev->lock);
+		free(nvdev);
+		return ret;
+	}
+	bo_cache_init(nvdev);
 
 	nvdev->base.fd = fd;
 
@@ -132,7 +333,6 @@ nouveau_device_wrap(int fd, int close, struct nouveau_device **pdev)
 		nvdev->gart_limit_percent = atoi(tmp);
 	else
 		nvdev->gart_limit_percent = 80;
-	DRMINITLISTHEAD(&nvdev->bo_list);
 	nvdev->base.object.oclass = NOUVEAU_DEVICE_CLASS;
 	nvdev->base.lib_version = 0x01000000;
 	nvdev->base.chipset = chipset;
@@ -143,6 +343,14 @@ nouveau_device_wrap(int fd, int close, struct nouveau_device **pdev)
 	nvdev->base.gart_limit =
 		(nvdev->base.gart_size * nvdev->gart_limit_percent) / 100;
 
+	tmp = getenv("NOUVEAU_LIBDRM_CAPTURE");
+	if (tmp) {
+		ret = nouveau_device_capture(dev, tmp);
+		if (ret)
+			err("no pushbuf capture to %s: %s\n", tmp,
+			    strerror(-ret));
+	}
+
 	*pdev = &nvdev->base;
 	return 0;
 }
@@ -164,15 +372,51 @@ nouveau_device_del(struct nouveau_device **pdev)
 {
 	struct nouveau_device_priv *nvdev = nouveau_device(*pdev);
 	if (nvdev) {
+		if (nvdev->async)
+			pushbuf_async_fini(&nvdev->base);
+		if (nvdev->capture)
+			capture_close(nvdev->capture);
+		pthread_mutex_lock(&nvdev->cache_lock);
+		bo_cache_trim(nvdev, 0, 0);
+		pthread_mutex_unlock(&nvdev->cache_lock);
 		if (nvdev->close)
 			drmClose(nvdev->base.fd);
 		free(nvdev->client);
+		free(nvdev->by_handle.slot);
+		free(nvdev->by_name.slot);
+		pthread_mutex_destroy(&nvdev->cache_lock);
 		pthread_mutex_destroy(&nvdev->lock);
 		free(nvdev);
 		*pdev = NULL;
 	}
 }
 
+int
+nouveau_device_capture(struct nouveau_device *dev, const char *path)
+{
+	struct nouveau_device_priv *nvdev = nouveau_device(dev);
+	struct nouveau_capture *capture = NULL, *old;
+	struct nouveau_pushbuf_async *async;
+	int ret = 0;
+
+	if (path) {
+		ret = capture_open(&capture, path);
+		if (ret)
+			return ret;
+	}
+
+	/* the submission thread uses the capture after the kicks returned,
+	 * it is kept off it until the old one is replaced */
+	async = pushbuf_async_drain(dev);
+	old = nvdev->capture;
+	nvdev->capture = capture;
+	pushbuf_async_unlock(async);
+
+	if (old)
+		ret = capture_close(old);
+	return ret;
+}
+
 int
 nouveau_getparam(struct nouveau_device *dev, uint64_t param, uint64_t *value)
 {
@@ -229,17 +473,49 @@ unlock:
 	return ret;
 }
 
+/* sets up the page a handle's kref lives in, the directory only grows */
+struct nouveau_client_kref *
+cli_kref_page(struct nouveau_client_priv *pcli, uint32_t handle)
+{
+	struct nouveau_client_kref **kref;
+	uint32_t page = handle >> CLI_KREF_PAGE_SHIFT;
+	unsigned nr = pcli->kref_nr ? pcli->kref_nr : 1;
+
+	if (page >= pcli->kref_nr) {
+		while (nr <= page)
+			nr *= 2;
+		kref = realloc(pcli->kref, sizeof(*kref) * nr);
+		if (!kref)
+			return NULL;
+		memset(kref + pcli->kref_nr, 0,
+		       sizeof(*kref) * (nr - pcli->kref_nr));
+		pcli->kref = kref;
+		pcli->kref_nr = nr;
+	}
+
+	if (!pcli->kref[page]) {
+		pcli->kref[page] = calloc(CLI_KREF_PAGE_SIZE,
+					  sizeof(**pcli->kref));
+		if (!pcli->kref[page])
+			return NULL;
+	}
+	return &pcli->kref[page][handle & (CLI_KREF_PAGE_SIZE - 1)];
+}
+
 void
 nouveau_client_del(struct nouveau_client **pclient)
 {
 	struct nouveau_client_priv *pcli = nouveau_client(*pclient);
 	struct nouveau_device_priv *nvdev;
+	unsigned i;
 	if (pcli) {
 		int id = pcli->base.id;
 		nvdev = nouveau_device(pcli->base.device);
 		pthread_mutex_lock(&nvdev->lock);
 		nvdev->client[id / 32] &= ~(1 << (id % 32));
 		pthread_mutex_unlock(&nvdev->lock);
+		for (i = 0; i < pcli->kref_nr; i++)
+			free(pcli->kref[i]);
 		free(pcli->kref);
 		free(pcli);
 	}
@@ -342,6 +618,185 @@ nouveau_object_find(struct nouveau_object *obj, uint32_t pclass)
 	return obj;
 }
 
+/*
+ * Every live bo is looked up by handle, shared ones also by flink name, both
+ * under the device lock.  Prime imports without a name are only in the
+ * handle index.
+ */
+static inline bool
+bo_index_named(uint32_t name)
+{
+	return name && name != ~0U;
+}
+
+static inline struct nouveau_bo_priv **
+bo_index_next(struct nouveau_bo_priv *nvbo, bool by_name)
+{
+	return by_name ? &nvbo->name_next : &nvbo->handle_next;
+}
+
+static inline uint32_t
+bo_index_key(struct nouveau_bo_priv *nvbo, bool by_name)
+{
+	return by_name ? nvbo->name : nvbo->base.handle;
+}
+
+static inline struct nouveau_bo_priv **
+bo_index_slot(struct nouveau_bo_index *index, uint32_t key)
+{
+	return &index->slot[(key * 0x9e3779b1u) >> (32 - index->order)];
+}
+
+static int
+bo_index_grow(struct nouveau_bo_index *index, bool by_name)
+{
+	struct nouveau_bo_priv **old = index->slot, **slot, *nvbo, *next;
+	int i, old_size = old ? 1 << index->order : 0;
+
+	index->slot = calloc(old ? old_size * 2 : 64, sizeof(*index->slot));
+	if (!index->slot) {
+		index->slot = old;
+		return -ENOMEM;
+	}
+	index->order = old ? index->order + 1 : 6;
+
+	for (i = 0; i < old_size; i++) {
+		for (nvbo = old[i]; nvbo; nvbo = next) {
+			next = *bo_index_next(nvbo, by_name);
+			slot = bo_index_slot(index, bo_index_key(nvbo, by_name));
+			*bo_index_next(nvbo, by_name) = *slot;
+			*slot = nvbo;
+		}
+	}
+	free(old);
+	return 0;
+}
+
+static int
+bo_index_add(struct nouveau_bo_index *index, struct nouveau_bo_priv *nvbo,
+	     bool by_name)
+{
+	struct nouveau_bo_priv **slot;
+	int ret;
+
+	if (!index->slot || index->count >= (1 << index->order)) {
+		ret = bo_index_grow(index, by_name);
+		if (ret)
+			return ret;
+	}
+
+	slot = bo_index_slot(index, bo_index_key(nvbo, by_name));
+	*bo_index_next(nvbo, by_name) = *slot;
+	*slot = nvbo;
+	index->count++;
+	return 0;
+}
+
+static void
+bo_index_del(struct nouveau_bo_index *index, struct nouveau_bo_priv *nvbo,
+	     bool by_name)
+{
+	struct nouveau_bo_priv **slot;
+
+	slot = bo_index_slot(index, bo_index_key(nvbo, by_name));
+	while (*slot != nvbo)
+		slot = bo_index_next(*slot, by_name);
+	*slot = *bo_index_next(nvbo, by_name);
+	index->count--;
+}
+
+static struct nouveau_bo_priv *
+bo_index_find(struct nouveau_bo_index *index, uint32_t key, bool by_name)
+{
+	struct nouveau_bo_priv *nvbo;
+
+	if (!index->count)
+		return NULL;
+
+	nvbo = *bo_index_slot(index, key);
+	while (nvbo && bo_index_key(nvbo, by_name) != key)
+		nvbo = *bo_index_next(nvbo, by_name);
+	return nvbo;
+}
+
+/*
+ * Take a reference on an indexed bo, unless its last one is already gone:
+ * then it is on its way out of the index and must not be revived, or its
+ * handle would be closed under whoever picked it up.  Device lock held,
+ * dropped while waiting for the bo to go.
+ */
+static struct nouveau_bo_priv *
+bo_index_get(struct nouveau_device_priv *nvdev, struct nouveau_bo_index *index,
+	     uint32_t key, bool by_name)
+{
+	struct nouveau_bo_priv *nvbo;
+	int refcnt;
+
+	while ((nvbo = bo_index_find(index, key, by_name))) {
+		do {
+			refcnt = atomic_read(&nvbo->refcnt);
+		} while (refcnt && atomic_cmpxchg(&nvbo->refcnt, refcnt,
+						  refcnt + 1) != refcnt);
+		if (refcnt)
+			break;
+
+		pthread_mutex_unlock(&nvdev->lock);
+		sched_yield();
+		pthread_mutex_lock(&nvdev->lock);
+	}
+	return nvbo;
+}
+
+/* mark a bo shared, and add it to the name index once flinked */
+static int
+bo_share_locked(struct nouveau_device_priv *nvdev, struct nouveau_bo_priv *nvbo,
+		uint32_t name)
+{
+	int ret;
+
+	nvbo->shared = true;
+	if (bo_index_named(name) && !bo_index_named(nvbo->name)) {
+		uint32_t prev = nvbo->name;
+
+		nvbo->name = name;
+		ret = bo_index_add(&nvdev->by_name, nvbo, true);
+		if (ret) {
+			nvbo->name = prev;
+			return ret;
+		}
+	} else if (!nvbo->name) {
+		nvbo->name = name;
+	}
+	return 0;
+}
+
+/* every live bo is in the handle index, for nouveau_bo_wrap to find */
+static int
+bo_index_new(struct nouveau_device_priv *nvdev, struct nouveau_bo_priv *nvbo,
+	     struct nouveau_bo **pbo)
+{
+	int ret;
+
+	pthread_mutex_lock(&nvdev->lock);
+	ret = bo_index_add(&nvdev->by_handle, nvbo, false);
+	pthread_mutex_unlock(&nvdev->lock);
+	if (ret) {
+		bo_close(nvbo);
+		return ret;
+	}
+	*pbo = &nvbo->base;
+	return 0;
+}
+
+static void
+bo_unindex_locked(struct nouveau_device_priv *nvdev,
+		  struct nouveau_bo_priv *nvbo)
+{
+	if (bo_index_named(nvbo->name))
+		bo_index_del(&nvdev->by_name, nvbo, true);
+	bo_index_del(&nvdev->by_handle, nvbo, false);
+}
+
 static void
 nouveau_bo_del(struct nouveau_bo *bo)
 {
@@ -350,36 +805,21 @@ nouveau_bo_del(struct nouveau_bo *bo)
 	struct drm_gem_close req = { bo->handle };
 
 	pthread_mutex_lock(&nvdev->lock);
-	if (nvbo->name) {
-		if (atomic_read(&nvbo->refcnt)) {
-			/*
-			 * bo has been revived by a race with
-			 * nouveau_bo_prime_handle_ref, or nouveau_bo_name_ref.
-			 *
-			 * In theory there's still a race possible with
-			 * nouveau_bo_wrap, but when using this function
-			 * the lifetime of the handle is probably already
-			 * handled in another way. If there are races
-			 * you're probably using nouveau_bo_wrap wrong.
-			 */
-			pthread_mutex_unlock(&nvdev->lock);
-			return;
-		}
-		DRMLISTDEL(&nvbo->head);
-		/*
-		 * This bo has to be closed with the lock held because gem
-		 * handles are not refcounted. If a shared bo is closed and
-		 * re-opened in another thread a race against
-		 * DRM_IOCTL_GEM_OPEN or drmPrimeFDToHandle might cause the
-		 * bo to be closed accidentally while re-importing.
-		 */
-		drmIoctl(bo->device->fd, DRM_IOCTL_GEM_CLOSE, &req);
-		pthread_mutex_unlock(&nvdev->lock);
-	} else {
-		DRMLISTDEL(&nvbo->head);
+	bo_unindex_locked(nvdev, nvbo);
+	/* private, nothing else can find it now */
+	if (!nvbo->shared && nvbo->reusable && bo_cache_put(nvdev, nvbo)) {
 		pthread_mutex_unlock(&nvdev->lock);
-		drmIoctl(bo->device->fd, DRM_IOCTL_GEM_CLOSE, &req);
+		return;
 	}
+	/*
+	 * This bo has to be closed with the lock held because gem
+	 * handles are not refcounted. If a shared bo is closed and
+	 * re-opened in another thread a race against
+	 * DRM_IOCTL_GEM_OPEN or drmPrimeFDToHandle might cause the
+	 * bo to be closed accidentally while re-importing.
+	 */
+	drmIoctl(bo->device->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	pthread_mutex_unlock(&nvdev->lock);
 	if (bo->map)
 		munmap(bo->map, bo->size);
 	free(nvbo);
@@ -391,29 +831,55 @@ nouveau_bo_new(struct nouveau_device *dev, uint32_t flags, uint32_t align,
 	       struct nouveau_bo **pbo)
 {
 	struct nouveau_device_priv *nvdev = nouveau_device(dev);
-	struct nouveau_bo_priv *nvbo = calloc(1, sizeof(*nvbo));
-	struct nouveau_bo *bo = &nvbo->base;
+	struct nouveau_bo_bucket *bucket = NULL;
+	struct nouveau_bo_priv *nvbo;
+	struct nouveau_bo *bo;
 	int ret;
 
+	if (nvdev->cache_max_bytes)
+		bucket = bo_cache_bucket(nvdev, size);
+	if (bucket) {
+		nvbo = bo_cache_find(nvdev, bucket, flags, align, config);
+		if (nvbo) {
+			atomic_set(&nvbo->refcnt, 1);
+			return bo_index_new(nvdev, nvbo, pbo);
+		}
+		size = bucket->size;
+	}
+
+	nvbo = calloc(1, sizeof(*nvbo));
 	if (!nvbo)
 		return -ENOMEM;
+	bo = &nvbo->base;
 	atomic_set(&nvbo->refcnt, 1);
 	bo->device = dev;
 	bo->flags = flags;
 	bo->size = size;
 
 	ret = abi16_bo_init(bo, align, config);
+	if (ret && bucket) {
+		/* give the memory held by the cache back and try again */
+		pthread_mutex_lock(&nvdev->cache_lock);
+		bo_cache_trim(nvdev, 0, 0);
+		pthread_mutex_unlock(&nvdev->cache_lock);
+		bo->flags = flags;
+		bo->size = size;
+		ret = abi16_bo_init(bo, align, config);
+	}
 	if (ret) {
 		free(nvbo);
 		return ret;
 	}
 
-	pthread_mutex_lock(&nvdev->lock);
-	DRMLISTADD(&nvbo->head, &nvdev->bo_list);
-	pthread_mutex_unlock(&nvdev->lock);
-
-	*pbo = bo;
-	return 0;
+	if (bucket) {
+		nvbo->reusable = true;
+		nvbo->new_flags = flags;
+		nvbo->new_align = align;
+		nvbo->has_config = config != NULL;
+		if (config)
+			nvbo->new_config = *config;
+	}
+	return bo_index_new(nvdev, nvbo, pbo);
 }
 
 static int
@@ -425,12 +891,10 @@ nouveau_bo_wrap_locked(struct nouveau_device *dev, uint32_t handle,
 	struct nouveau_bo_priv *nvbo;
 	int ret;
 
-	DRMLISTFOREACHENTRY(nvbo, &nvdev->bo_list, head) {
-		if (nvbo->base.handle == handle) {
-			*pbo = NULL;
-			nouveau_bo_ref(&nvbo->base, pbo);
-			return 0;
-		}
+	nvbo = bo_index_get(nvdev, &nvdev->by_handle, handle, false);
+	if (nvbo) {
+		*pbo = &nvbo->base;
+		return 0;
 	}
 
 	ret = drmCommandWriteRead(dev->fd, DRM_NOUVEAU_GEM_INFO,
@@ -439,16 +903,20 @@ nouveau_bo_wrap_locked(struct nouveau_device *dev, uint32_t handle,
 		return ret;
 
 	nvbo = calloc(1, sizeof(*nvbo));
-	if (nvbo) {
-		atomic_set(&nvbo->refcnt, 1);
-		nvbo->base.device = dev;
-		abi16_bo_info(&nvbo->base, &req);
-		DRMLISTADD(&nvbo->head, &nvdev->bo_list);
-		*pbo = &nvbo->base;
-		return 0;
-	}
+	if (!nvbo)
+		return -ENOMEM;
 
-	return -ENOMEM;
+	atomic_set(&nvbo->refcnt, 1);
+	nvbo->base.device = dev;
+	nvbo->shared = true;
+	abi16_bo_info(&nvbo->base, &req);
+	ret = bo_index_add(&nvdev->by_handle, nvbo, false);
+	if (ret) {
+		free(nvbo);
+		return ret;
+	}
+	*pbo = &nvbo->base;
+	return 0;
 }
 
 int
@@ -469,26 +937,42 @@ nouveau_bo_name_ref(struct nouveau_device *dev, uint32_t name,
 {
 	struct nouveau_device_priv *nvdev = nouveau_device(dev);
 	struct nouveau_bo_priv *nvbo;
+	struct nouveau_bo *bo = NULL;
 	struct drm_gem_open req = { .name = name };
 	int ret;
 
 	pthread_mutex_lock(&nvdev->lock);
-	DRMLISTFOREACHENTRY(nvbo, &nvdev->bo_list, head) {
-		if (nvbo->name == name) {
-			*pbo = NULL;
-			nouveau_bo_ref(&nvbo->base, pbo);
-			pthread_mutex_unlock(&nvdev->lock);
-			return 0;
-		}
+	nvbo = bo_index_get(nvdev, &nvdev->by_name, name, true);
+	if (nvbo) {
+		*pbo = &nvbo->base;
+		pthread_mutex_unlock(&nvdev->lock);
+		return 0;
 	}
 
 	ret = drmIoctl(dev->fd, DRM_IOCTL_GEM_OPEN, &req);
-	if (ret == 0) {
-		ret = nouveau_bo_wrap_locked(dev, req.handle, pbo);
-		nouveau_bo((*pbo))->name = name;
-		pthread_mutex_unlock(&nvdev->lock);
-	}
+	if (ret == 0)
+		ret = nouveau_bo_wrap_locked(dev, req.handle, &bo);
+	if (ret == 0)
+		ret = bo_share_locked(nvdev, nouveau_bo(bo), name);
+	pthread_mutex_unlock(&nvdev->lock);
+
+	if (ret)
+		nouveau_bo_ref(NULL, &bo);
+	else
+		*pbo = bo;
+	return ret;
+}
+
+/* shared bos have to be found by nouveau_bo_name_ref and friends */
+static int
+nouveau_bo_make_global(struct nouveau_bo_priv *nvbo, uint32_t name)
+{
+	struct nouveau_device_priv *nvdev = nouveau_device(nvbo->base.device);
+	int ret;
 
+	pthread_mutex_lock(&nvdev->lock);
+	ret = bo_share_locked(nvdev, nvbo, name);
+	pthread_mutex_unlock(&nvdev->lock);
 	return ret;
 }
 
@@ -501,11 +985,13 @@ nouveau_bo_name_get(struct nouveau_bo *bo, uint32_t *name)
 	*name = nvbo->name;
 	if (!*name || *name == ~0U) {
 		int ret = drmIoctl(bo->device->fd, DRM_IOCTL_GEM_FLINK, &req);
+		if (ret == 0)
+			ret = nouveau_bo_make_global(nvbo, req.name);
 		if (ret) {
 			*name = 0;
 			return ret;
 		}
-		nvbo->name = *name = req.name;
+		*name = req.name;
 	}
 	return 0;
 }
@@ -538,16 +1024,9 @@ nouveau_bo_prime_handle_ref(struct nouveau_device *dev, int prime_fd,
 	ret = drmPrimeFDToHandle(dev->fd, prime_fd, &handle);
 	if (ret == 0) {
 		ret = nouveau_bo_wrap_locked(dev, handle, bo);
-		if (!ret) {
-			struct nouveau_bo_priv *nvbo = nouveau_bo(*bo);
-			if (!nvbo->name) {
-				/*
-				 * XXX: Force locked DRM_IOCTL_GEM_CLOSE
-				 * to rule out race conditions
-				 */
-				nvbo->name = ~0;
-			}
-		}
+		/* already indexed by handle, this only marks it exported */
+		if (!ret)
+			bo_share_locked(nvdev, nouveau_bo(*bo), ~0U);
 	}
 	pthread_mutex_unlock(&nvdev->lock);
 	return ret;
@@ -563,7 +1042,7 @@ nouveau_bo_set_prime(struct nouveau_bo *bo, int *prime_fd)
 	if (ret)
 		return ret;
 	if (!nvbo->name)
-		nvbo->name = ~0;
+		return nouveau_bo_make_global(nvbo, ~0U);
 	return 0;
 }
 
@@ -583,6 +1062,16 @@ nouveau_bo_wait(struct nouveau_bo *bo, uint32_t access,
 	if (push && push->channel)
 		nouveau_pushbuf_kick(push, push->channel);
 
+	/* the kernel can't wait for what it hasn't been given yet, and may
+	 * have rejected it */
+	if (atomic_read(&nvbo->queued) && (access & NOUVEAU_BO_NOBLOCK))
+		return -EBUSY;
+	if (nouveau_device(bo->device)->async) {
+		ret = pushbuf_async_wait(bo);
+		if (ret)
+			return ret;
+	}
+
 	if (!nvbo->name && !(nvbo->access & NOUVEAU_BO_WR) &&
 			   !(      access & NOUVEAU_BO_WR))
 		return 0;
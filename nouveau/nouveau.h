@@ -84,6 +84,19 @@ struct nouveau_device {
 int  nouveau_device_wrap(int fd, int close, struct nouveau_device **);
 int  nouveau_device_open(const char *busid, struct nouveau_device **);
 void nouveau_device_del(struct nouveau_device **);
+/* Keep freed private bos for reuse by nouveau_bo_new, up to max_bytes of
+ * them and for max_age ms at most.  Reused bos are not cleared, 0 bytes
+ * turns the cache off again.
+ */
+void nouveau_device_set_bo_cache(struct nouveau_device *, uint64_t max_bytes,
+				 uint32_t max_age);
+/* Record what pushbufs of the device submit to a capture file, replacing
+ * any capture in progress, or stop with a NULL path.  Commands queued by
+ * asynchronous pushbufs are submitted first, to the capture in progress.
+ * Not to be called while the device's pushbufs are kicked.
+ * NOUVEAU_LIBDRM_CAPTURE names a file to capture to from the start.
+ */
+int  nouveau_device_capture(struct nouveau_device *, const char *path);
 int  nouveau_getparam(struct nouveau_device *, uint64_t param, uint64_t *value);
 int  nouveau_setparam(struct nouveau_device *, uint64_t param, uint64_t value);
 
@@ -225,6 +238,33 @@ void nouveau_pushbuf_reloc(struct nouveau_pushbuf *, struct nouveau_bo *,
 int  nouveau_pushbuf_validate(struct nouveau_pushbuf *);
 uint32_t nouveau_pushbuf_refd(struct nouveau_pushbuf *, struct nouveau_bo *);
 int  nouveau_pushbuf_kick(struct nouveau_pushbuf *, struct nouveau_object *channel);
+
+/* How buffers were placed in the pushbuf's krecs so far.  VRAM|GART
+ * buffers are left in both domains while GART has space, and buffers
+ * already referenced are moved between domains to make room for more.
+ */
+struct nouveau_pushbuf_stats {
+	uint32_t placed;	/* buffers placed */
+	uint32_t vram;		/* VRAM|GART buffers planned into VRAM */
+	uint32_t moved;		/* buffers moved to make room */
+	uint64_t moved_bytes;
+	uint32_t unplaced;	/* didn't fit, each forced a flush */
+};
+
+void nouveau_pushbuf_get_stats(struct nouveau_pushbuf *,
+			       struct nouveau_pushbuf_stats *);
+
+/* Kicks of an immediate pushbuf queue its commands for a submission thread
+ * instead of waiting for the kernel, in the order they were kicked across
+ * all pushbufs of the device.  Synchronous kicks of the device's other
+ * pushbufs wait for the commands queued before them.  nouveau_bo_wait
+ * waits for the submission of queued commands referencing the bo.
+ * Turning it off waits for the pushbuf's queued commands to be submitted.
+ * A submission the kernel rejects is reported by the next kick of its
+ * pushbuf or turning it off, and by nouveau_bo_wait on its bos.  NV25 and
+ * newer only.
+ */
+int  nouveau_pushbuf_async(struct nouveau_pushbuf *, bool enable);
 struct nouveau_bufctx *
 nouveau_pushbuf_bufctx(struct nouveau_pushbuf *, struct nouveau_bufctx *);
 
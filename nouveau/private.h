@@ -4,6 +4,7 @@
 #include <xf86drm.h>
 #include <xf86atomic.h>
 #include <pthread.h>
+#include <errno.h>
 #include "nouveau_drm.h"
 
 #include "nouveau.h"
@@ -26,9 +27,13 @@ struct nouveau_client_kref {
 	struct nouveau_pushbuf *push;
 };
 
+/* krefs are looked up by bo handle, in pages allocated on first use */
+#define CLI_KREF_PAGE_SHIFT 9
+#define CLI_KREF_PAGE_SIZE  (1 << CLI_KREF_PAGE_SHIFT)
+
 struct nouveau_client_priv {
 	struct nouveau_client base;
-	struct nouveau_client_kref *kref;
+	struct nouveau_client_kref **kref;
 	unsigned kref_nr;
 };
 
@@ -38,52 +43,77 @@ nouveau_client(struct nouveau_client *client)
 	return (struct nouveau_client_priv *)client;
 }
 
+struct nouveau_client_kref *
+cli_kref_page(struct nouveau_client_priv *, uint32_t handle);
+
+static inline struct nouveau_client_kref *
+cli_kref_slot(struct nouveau_client_priv *pcli, uint32_t handle)
+{
+	uint32_t page = handle >> CLI_KREF_PAGE_SHIFT;
+	if (page >= pcli->kref_nr || !pcli->kref[page])
+		return NULL;
+	return &pcli->kref[page][handle & (CLI_KREF_PAGE_SIZE - 1)];
+}
+
 static inline struct drm_nouveau_gem_pushbuf_bo *
 cli_kref_get(struct nouveau_client *client, struct nouveau_bo *bo)
 {
-	struct nouveau_client_priv *pcli = nouveau_client(client);
-	struct drm_nouveau_gem_pushbuf_bo *kref = NULL;
-	if (pcli->kref_nr > bo->handle)
-		kref = pcli->kref[bo->handle].kref;
-	return kref;
+	struct nouveau_client_kref *slot;
+	slot = cli_kref_slot(nouveau_client(client), bo->handle);
+	return slot ? slot->kref : NULL;
 }
 
 static inline struct nouveau_pushbuf *
 cli_push_get(struct nouveau_client *client, struct nouveau_bo *bo)
 {
-	struct nouveau_client_priv *pcli = nouveau_client(client);
-	struct nouveau_pushbuf *push = NULL;
-	if (pcli->kref_nr > bo->handle)
-		push = pcli->kref[bo->handle].push;
-	return push;
+	struct nouveau_client_kref *slot;
+	slot = cli_kref_slot(nouveau_client(client), bo->handle);
+	return slot ? slot->push : NULL;
 }
 
-static inline void
+static inline int
 cli_kref_set(struct nouveau_client *client, struct nouveau_bo *bo,
 	     struct drm_nouveau_gem_pushbuf_bo *kref,
 	     struct nouveau_pushbuf *push)
 {
 	struct nouveau_client_priv *pcli = nouveau_client(client);
-	if (pcli->kref_nr <= bo->handle) {
-		pcli->kref = realloc(pcli->kref,
-				     sizeof(*pcli->kref) * bo->handle * 2);
-		while (pcli->kref_nr < bo->handle * 2) {
-			pcli->kref[pcli->kref_nr].kref = NULL;
-			pcli->kref[pcli->kref_nr].push = NULL;
-			pcli->kref_nr++;
-		}
+	struct nouveau_client_kref *slot = cli_kref_slot(pcli, bo->handle);
+	if (!slot) {
+		if (!kref && !push)
+			return 0;
+		slot = cli_kref_page(pcli, bo->handle);
+		if (!slot)
+			return -ENOMEM;
 	}
-	pcli->kref[bo->handle].kref = kref;
-	pcli->kref[bo->handle].push = push;
+	slot->kref = kref;
+	slot->push = push;
+	return 0;
 }
 
 struct nouveau_bo_priv {
 	struct nouveau_bo base;
-	struct nouveau_list head;
+	/* named, exported or wrapped, never cached */
+	bool shared;
+	struct nouveau_bo_priv *handle_next;
+	struct nouveau_bo_priv *name_next;
 	atomic_t refcnt;
 	uint64_t map_handle;
 	uint32_t name;
 	uint32_t access;
+	/* krecs referencing it that wait for the submission thread */
+	atomic_t queued;
+	/* what the kernel said to the last of them it rejected, under the
+	 * async lock */
+	int async_error;
+	/* what nouveau_bo_new was asked for, for the reuse cache */
+	bool reusable;
+	bool has_config;
+	uint32_t new_flags;
+	uint32_t new_align;
+	union nouveau_bo_config new_config;
+	struct nouveau_list bucket_head;
+	struct nouveau_list lru_head;
+	uint64_t free_time;
 };
 
 static inline struct nouveau_bo_priv *
@@ -92,15 +122,43 @@ nouveau_bo(struct nouveau_bo *bo)
 	return (struct nouveau_bo_priv *)bo;
 }
 
+/* live bos chained by handle, shared ones also by name */
+struct nouveau_bo_index {
+	struct nouveau_bo_priv **slot;
+	int order;
+	int count;
+};
+
+#define NOUVEAU_BO_CACHE_BUCKETS 64
+
+struct nouveau_bo_bucket {
+	uint64_t size;
+	struct nouveau_list list;
+};
+
+struct nouveau_pushbuf_async;
+
 struct nouveau_device_priv {
 	struct nouveau_device base;
 	int close;
 	pthread_mutex_t lock;
-	struct nouveau_list bo_list;
+	struct nouveau_bo_index by_handle;
+	struct nouveau_bo_index by_name;
 	uint32_t *client;
 	int nr_client;
 	bool have_bo_usage;
 	int gart_limit_percent, vram_limit_percent;
+	/* freed private bos, off while cache_max_bytes is 0 */
+	pthread_mutex_t cache_lock;
+	struct nouveau_bo_bucket bucket[NOUVEAU_BO_CACHE_BUCKETS];
+	int nr_bucket;
+	struct nouveau_list cache_lru;
+	uint64_t cache_bytes;
+	uint64_t cache_max_bytes;
+	uint32_t cache_max_age;
+	/* submission thread, started by the first asynchronous pushbuf */
+	struct nouveau_pushbuf_async *async;
+	struct nouveau_capture *capture;
 };
 
 static inline struct nouveau_device_priv *
@@ -109,9 +167,58 @@ nouveau_device(struct nouveau_device *dev)
 	return (struct nouveau_device_priv *)dev;
 }
 
+struct nouveau_bufref_priv {
+	struct nouveau_bufref base;
+	struct nouveau_bufctx *bufctx;
+};
+
+/* refs stay with their bin across resets, [pending, nr) await validation */
+struct nouveau_bufbin_priv {
+	struct nouveau_bufref_priv **refs;
+	int nr;
+	int nr_alloc;
+	int max;
+	int pending;
+	int relocs;
+};
+
+#define NOUVEAU_BUFCTX_ARENA 64
+
+struct nouveau_bufref_arena {
+	struct nouveau_bufref_arena *next;
+	struct nouveau_bufref_priv ref[NOUVEAU_BUFCTX_ARENA];
+};
+
+struct nouveau_bufctx_priv {
+	struct nouveau_bufctx base;
+	struct nouveau_bufref_arena *arena;
+	int arena_used;
+	int nr_refs;
+	int nr_bins;
+	struct nouveau_bufbin_priv bins[];
+};
+
+static inline struct nouveau_bufctx_priv *
+nouveau_bufctx(struct nouveau_bufctx *bctx)
+{
+	return (struct nouveau_bufctx_priv *)bctx;
+}
+
 int
 nouveau_device_open_existing(struct nouveau_device **, int, int, drm_context_t);
 
+/* capture.c */
+int  capture_open(struct nouveau_capture **, const char *path);
+int  capture_close(struct nouveau_capture *);
+void capture_submit(struct nouveau_capture *, struct drm_nouveau_gem_pushbuf *,
+		    const uint8_t *domains);
+
+/* pushbuf.c */
+int pushbuf_async_wait(struct nouveau_bo *);
+struct nouveau_pushbuf_async *pushbuf_async_drain(struct nouveau_device *);
+void pushbuf_async_unlock(struct nouveau_pushbuf_async *);
+void pushbuf_async_fini(struct nouveau_device *);
+
 /* abi16.c */
 int  abi16_chan_nv04(struct nouveau_object *);
 int  abi16_chan_nvc0(struct nouveau_object *);
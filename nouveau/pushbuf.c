@@ -33,6 +33,7 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <xf86drm.h>
 #include <xf86atomic.h>
@@ -44,14 +45,19 @@
 
 struct nouveau_pushbuf_krec {
 	struct nouveau_pushbuf_krec *next;
+	struct nouveau_pushbuf_priv *owner;
 	struct drm_nouveau_gem_pushbuf_bo buffer[NOUVEAU_GEM_MAX_BUFFERS];
 	struct drm_nouveau_gem_pushbuf_reloc reloc[NOUVEAU_GEM_MAX_RELOCS];
 	struct drm_nouveau_gem_pushbuf_push push[NOUVEAU_GEM_MAX_PUSH];
+	/* where each buffer may go, valid_domains is where it's planned */
+	uint8_t domains[NOUVEAU_GEM_MAX_BUFFERS];
 	int nr_buffer;
 	int nr_reloc;
 	int nr_push;
 	uint64_t vram_used;
 	uint64_t gart_used;
+	/* what the kernel said to it on the submission thread */
+	int error;
 };
 
 struct nouveau_pushbuf_priv {
@@ -67,9 +73,42 @@ struct nouveau_pushbuf_priv {
 	uint32_t *bgn;
 	int bo_next;
 	int bo_nr;
+	int bo_max;
+	bool async;
+	/* under the async lock: krecs queued, krecs back from the submission
+	 * thread that still hold their bos, and the first error since the
+	 * last kick */
+	int queued;
+	struct nouveau_pushbuf_krec *retired;
+	int async_error;
+	/* krecs to be used again */
+	struct nouveau_pushbuf_krec *spare;
+	struct nouveau_pushbuf_stats stats;
 	struct nouveau_bo *bos[];
 };
 
+/* an immediate pushbuf's bos may grow to this many times those asked for */
+#define PUSHBUF_BO_GROW 4
+
+/* krecs of asynchronous pushbufs, submitted in the order they were kicked */
+struct nouveau_pushbuf_async {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pthread_t thread;
+	bool exit;
+	struct nouveau_pushbuf_krec *head;
+	struct nouveau_pushbuf_krec **tail;
+	/* krecs ever queued and ever submitted: head is NULL while the last
+	 * one is in the ioctl, so these tell when the queue is drained */
+	uint64_t nr_queued;
+	uint64_t nr_submitted;
+	/* what the kernel reported last */
+	bool limits;
+	uint64_t vram_available;
+	uint64_t gart_available;
+};
+
 static inline struct nouveau_pushbuf_priv *
 nouveau_pushbuf(struct nouveau_pushbuf *push)
 {
@@ -79,79 +118,150 @@ nouveau_pushbuf(struct nouveau_pushbuf *push)
 static int pushbuf_validate(struct nouveau_pushbuf *, bool);
 static int pushbuf_flush(struct nouveau_pushbuf *);
 
-static bool
-pushbuf_kref_fits(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
-		  uint32_t *domains)
+#define PUSHBUF_DOMAIN_ANY (NOUVEAU_GEM_DOMAIN_VRAM | NOUVEAU_GEM_DOMAIN_GART)
+
+/* VRAM-only buffers are accounted to VRAM, all others to GART */
+static inline bool
+pushbuf_kref_vram(struct drm_nouveau_gem_pushbuf_bo *kref)
 {
-	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
-	struct nouveau_pushbuf_krec *krec = nvpb->krec;
-	struct nouveau_device *dev = push->client->device;
-	struct nouveau_bo *kbo;
-	struct drm_nouveau_gem_pushbuf_bo *kref;
-	int i;
+	return kref->valid_domains == NOUVEAU_GEM_DOMAIN_VRAM;
+}
 
-	/* VRAM is the only valid domain.  GART and VRAM|GART buffers
-	 * are all accounted to GART, so if this doesn't fit in VRAM
-	 * straight up, a flush is needed.
-	 */
-	if (*domains == NOUVEAU_GEM_DOMAIN_VRAM) {
-		if (krec->vram_used + bo->size > dev->vram_limit)
-			return false;
-		krec->vram_used += bo->size;
-		return true;
-	}
+static inline uint64_t
+pushbuf_kref_size(struct drm_nouveau_gem_pushbuf_bo *kref)
+{
+	return ((struct nouveau_bo *)(unsigned long)kref->user_priv)->size;
+}
 
-	/* GART or VRAM|GART buffer.  Account both of these buffer types
-	 * to GART only for the moment, which simplifies things.  If the
-	 * buffer can fit already, we're done here.
-	 */
-	if (krec->gart_used + bo->size <= dev->gart_limit) {
-		krec->gart_used += bo->size;
-		return true;
-	}
+struct pushbuf_move {
+	uint64_t size;
+	int i;
+};
 
-	/* Ran out of GART space, if it's a VRAM|GART buffer and it'll
-	 * fit into available VRAM, turn it into a VRAM buffer
-	 */
-	if ((*domains & NOUVEAU_GEM_DOMAIN_VRAM) &&
-	    krec->vram_used + bo->size <= dev->vram_limit) {
-		*domains &= NOUVEAU_GEM_DOMAIN_VRAM;
-		krec->vram_used += bo->size;
-		return true;
-	}
+static int
+pushbuf_move_cmp(const void *a, const void *b)
+{
+	const struct pushbuf_move *ma = a, *mb = b;
+	return (ma->size < mb->size) - (ma->size > mb->size);
+}
+
+/*
+ * Free at least need bytes in one domain by moving VRAM|GART buffers
+ * already in the krec to the other one, which has space bytes left.
+ * Largest buffers go first so few of them move, then the smallest of
+ * those that turn out not to be needed stay where they were.
+ */
+static bool
+pushbuf_make_room(struct nouveau_pushbuf_priv *nvpb, bool to_vram,
+		  uint64_t need, uint64_t space)
+{
+	struct nouveau_pushbuf_krec *krec = nvpb->krec;
+	struct pushbuf_move move[NOUVEAU_GEM_MAX_BUFFERS];
+	struct drm_nouveau_gem_pushbuf_bo *kref;
+	uint64_t size, total = 0;
+	int i, nr = 0, nr_move = 0;
 
-	/* Still couldn't fit the buffer in anywhere, so as a last resort;
-	 * scan the buffer list for VRAM|GART buffers and turn them into
-	 * VRAM buffers until we have enough space in GART for this one
-	 */
 	kref = krec->buffer;
 	for (i = 0; i < krec->nr_buffer; i++, kref++) {
-		if (!(kref->valid_domains & NOUVEAU_GEM_DOMAIN_GART))
+		if (krec->domains[i] != PUSHBUF_DOMAIN_ANY ||
+		    !kref->valid_domains || pushbuf_kref_vram(kref) == to_vram)
 			continue;
 
-		kbo = (void *)(unsigned long)kref->user_priv;
-		if (!(kref->valid_domains & NOUVEAU_GEM_DOMAIN_VRAM) ||
-		    krec->vram_used + kbo->size > dev->vram_limit)
+		size = pushbuf_kref_size(kref);
+		if (size > space)
 			continue;
+		move[nr].size = size;
+		move[nr].i = i;
+		total += size;
+		nr++;
+	}
+	if (total < need)
+		return false;
 
-		kref->valid_domains &= NOUVEAU_GEM_DOMAIN_VRAM;
-		krec->gart_used -= kbo->size;
-		krec->vram_used += kbo->size;
-		if (krec->gart_used + bo->size <= dev->gart_limit) {
-			krec->gart_used += bo->size;
-			return true;
+	qsort(move, nr, sizeof(*move), pushbuf_move_cmp);
+	total = 0;
+	for (i = 0; i < nr && total < need; i++) {
+		if (total + move[i].size > space)
+			continue;
+		total += move[i].size;
+		move[nr_move++] = move[i];
+	}
+	if (total < need)
+		return false;
+
+	while (nr_move && total - move[nr_move - 1].size >= need)
+		total -= move[--nr_move].size;
+	for (i = 0; i < nr_move; i++) {
+		kref = &krec->buffer[move[i].i];
+		if (to_vram) {
+			kref->valid_domains = NOUVEAU_GEM_DOMAIN_VRAM;
+			krec->gart_used -= move[i].size;
+			krec->vram_used += move[i].size;
+		} else {
+			kref->valid_domains = PUSHBUF_DOMAIN_ANY;
+			krec->vram_used -= move[i].size;
+			krec->gart_used += move[i].size;
 		}
+		nvpb->stats.moved++;
+		nvpb->stats.moved_bytes += move[i].size;
 	}
+	return true;
+}
+
+/*
+ * Plan where a buffer goes in the krec, given the domains it may be in.
+ * VRAM|GART buffers are accounted to GART and left for the kernel to
+ * place while GART has space, then planned into VRAM.  When neither
+ * fits, VRAM|GART buffers already in the krec are moved to the other
+ * domain to make room, and only if that can't be done is a flush needed.
+ */
+static bool
+pushbuf_kref_fits(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
+		  uint32_t *domains)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	struct nouveau_pushbuf_krec *krec = nvpb->krec;
+	struct nouveau_device *dev = push->client->device;
+	uint64_t vram_free = 0, gart_free = 0;
+
+	if (krec->vram_used < dev->vram_limit)
+		vram_free = dev->vram_limit - krec->vram_used;
+	if (krec->gart_used < dev->gart_limit)
+		gart_free = dev->gart_limit - krec->gart_used;
+
+	if ((*domains & NOUVEAU_GEM_DOMAIN_GART) && bo->size <= gart_free)
+		goto gart;
+	if ((*domains & NOUVEAU_GEM_DOMAIN_VRAM) && bo->size <= vram_free)
+		goto vram;
+	if ((*domains & NOUVEAU_GEM_DOMAIN_GART) &&
+	    pushbuf_make_room(nvpb, true, bo->size - gart_free, vram_free))
+		goto gart;
+	if ((*domains & NOUVEAU_GEM_DOMAIN_VRAM) &&
+	    pushbuf_make_room(nvpb, false, bo->size - vram_free, gart_free))
+		goto vram;
 
 	/* Couldn't resolve a placement, need to force a flush */
+	nvpb->stats.unplaced++;
 	return false;
+
+gart:
+	krec->gart_used += bo->size;
+	nvpb->stats.placed++;
+	return true;
+
+vram:
+	if (*domains & NOUVEAU_GEM_DOMAIN_GART)
+		nvpb->stats.vram++;
+	*domains = NOUVEAU_GEM_DOMAIN_VRAM;
+	krec->vram_used += bo->size;
+	nvpb->stats.placed++;
+	return true;
 }
 
 static struct drm_nouveau_gem_pushbuf_bo *
 pushbuf_kref(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
 	     uint32_t flags)
 {
-	struct nouveau_device *dev = push->client->device;
 	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
 	struct nouveau_pushbuf_krec *krec = nvpb->krec;
 	struct nouveau_pushbuf *fpush;
@@ -176,30 +286,51 @@ pushbuf_kref(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
 
 	kref = cli_kref_get(push->client, bo);
 	if (kref) {
+		int i = kref - krec->buffer;
+		uint32_t valid = kref->valid_domains, placed;
+		uint64_t *used = pushbuf_kref_vram(kref) ? &krec->vram_used :
+							   &krec->gart_used;
+
 		/* possible conflict in memory types - flush and retry */
-		if (!(kref->valid_domains & domains))
+		if (!(krec->domains[i] & domains))
 			return NULL;
 
-		/* VRAM|GART buffer turning into a VRAM buffer.  Make sure
-		 * it'll fit in VRAM and force a flush if not.
+		/* narrowed down to one domain, plan it again there, and
+		 * force a flush if it doesn't fit
 		 */
-		if ((kref->valid_domains  & NOUVEAU_GEM_DOMAIN_GART) &&
-		    (            domains == NOUVEAU_GEM_DOMAIN_VRAM)) {
-			if (krec->vram_used + bo->size > dev->vram_limit)
+		domains &= krec->domains[i];
+		if (domains != krec->domains[i]) {
+			*used -= bo->size;
+			kref->valid_domains = 0;
+			placed = domains;
+			if (!pushbuf_kref_fits(push, bo, &placed)) {
+				kref->valid_domains = valid;
+				*used += bo->size;
 				return NULL;
-			krec->vram_used += bo->size;
-			krec->gart_used -= bo->size;
+			}
+			kref->valid_domains = placed;
+			krec->domains[i] = domains;
 		}
 
-		kref->valid_domains &= domains;
 		kref->write_domains |= domains_wr;
 		kref->read_domains  |= domains_rd;
 	} else {
+		uint32_t allowed = domains;
+
 		if (krec->nr_buffer == NOUVEAU_GEM_MAX_BUFFERS ||
 		    !pushbuf_kref_fits(push, bo, &domains))
 			return NULL;
 
-		kref = &krec->buffer[krec->nr_buffer++];
+		kref = &krec->buffer[krec->nr_buffer];
+		if (cli_kref_set(push->client, bo, kref, push)) {
+			if (domains == NOUVEAU_GEM_DOMAIN_VRAM)
+				krec->vram_used -= bo->size;
+			else
+				krec->gart_used -= bo->size;
+			return NULL;
+		}
+		krec->domains[krec->nr_buffer++] = allowed;
+
 		kref->user_priv = (unsigned long)bo;
 		kref->handle = bo->handle;
 		kref->valid_domains = domains;
@@ -212,7 +343,6 @@ pushbuf_kref(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
 		else
 			kref->presumed.domain = NOUVEAU_GEM_DOMAIN_GART;
 
-		cli_kref_set(push->client, bo, kref, push);
 		atomic_inc(&nouveau_bo(bo)->refcnt);
 	}
 
@@ -304,84 +434,362 @@ pushbuf_dump(struct nouveau_pushbuf_krec *krec, int krec_id, int chid)
 	}
 }
 
-static int
-pushbuf_submit(struct nouveau_pushbuf *push, struct nouveau_object *chan)
+static void
+pushbuf_limits(struct nouveau_device *dev, uint64_t vram_available,
+	       uint64_t gart_available)
+{
+	dev->vram_limit = (vram_available *
+			nouveau_device(dev)->vram_limit_percent) / 100;
+	dev->gart_limit = (gart_available *
+			nouveau_device(dev)->gart_limit_percent) / 100;
+}
+
+/* that the GPU uses the bos of a krec, for nouveau_bo_wait */
+static void
+pushbuf_krec_access(struct nouveau_pushbuf_krec *krec)
+{
+	struct drm_nouveau_gem_pushbuf_bo *kref = krec->buffer;
+	struct nouveau_bo *bo;
+	int i;
+
+	for (i = 0; i < krec->nr_buffer; i++, kref++) {
+		bo = (void *)(unsigned long)kref->user_priv;
+		if (kref->write_domains)
+			nouveau_bo(bo)->access |= NOUVEAU_BO_WR;
+		if (kref->read_domains)
+			nouveau_bo(bo)->access |= NOUVEAU_BO_RD;
+	}
+}
+
+/* where the kernel placed the bos of a submitted krec */
+static void
+pushbuf_krec_placed(struct nouveau_pushbuf_krec *krec)
 {
-	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
-	struct nouveau_pushbuf_krec *krec = nvpb->list;
-	struct nouveau_device *dev = push->client->device;
 	struct drm_nouveau_gem_pushbuf_bo_presumed *info;
-	struct drm_nouveau_gem_pushbuf_bo *kref;
-	struct drm_nouveau_gem_pushbuf req;
-	struct nouveau_fifo *fifo = chan->data;
+	struct drm_nouveau_gem_pushbuf_bo *kref = krec->buffer;
 	struct nouveau_bo *bo;
-	int krec_id = 0;
-	int ret = 0, i;
+	int i;
 
-	if (chan->oclass != NOUVEAU_FIFO_CHANNEL_CLASS)
-		return -EINVAL;
+	for (i = 0; i < krec->nr_buffer; i++, kref++) {
+		bo = (void *)(unsigned long)kref->user_priv;
 
-	if (push->kick_notify)
-		push->kick_notify(push);
+		info = &kref->presumed;
+		if (!info->valid) {
+			bo->flags &= ~NOUVEAU_BO_APER;
+			if (info->domain == NOUVEAU_GEM_DOMAIN_VRAM)
+				bo->flags |= NOUVEAU_BO_VRAM;
+			else
+				bo->flags |= NOUVEAU_BO_GART;
+			bo->offset = info->offset;
+		}
+	}
+}
 
-	nouveau_pushbuf_data(push, NULL, 0, 0);
+/*
+ * With preq, the suffix and limits the kernel returns are left to the
+ * caller, and so are the bos: the submission thread must not touch what
+ * the caller's thread reads.
+ */
+static int
+pushbuf_submit_krec(struct nouveau_pushbuf_priv *nvpb,
+		    struct nouveau_pushbuf_krec *krec,
+		    struct nouveau_fifo *fifo, int krec_id,
+		    struct drm_nouveau_gem_pushbuf *preq)
+{
+	struct nouveau_device *dev = nvpb->base.client->device;
+	struct nouveau_capture *capture = nouveau_device(dev)->capture;
+	struct drm_nouveau_gem_pushbuf req;
+	int ret = 0;
 
-	while (krec && krec->nr_push) {
-		req.channel = fifo->channel;
-		req.nr_buffers = krec->nr_buffer;
-		req.buffers = (uint64_t)(unsigned long)krec->buffer;
-		req.nr_relocs = krec->nr_reloc;
-		req.nr_push = krec->nr_push;
-		req.relocs = (uint64_t)(unsigned long)krec->reloc;
-		req.push = (uint64_t)(unsigned long)krec->push;
-		req.suffix0 = nvpb->suffix0;
-		req.suffix1 = nvpb->suffix1;
-		req.vram_available = 0; /* for valgrind */
-		req.gart_available = 0;
-
-		if (dbg_on(0))
-			pushbuf_dump(krec, krec_id++, fifo->channel);
+	req.channel = fifo->channel;
+	req.nr_buffers = krec->nr_buffer;
+	req.buffers = (uint64_t)(unsigned long)krec->buffer;
+	req.nr_relocs = krec->nr_reloc;
+	req.nr_push = krec->nr_push;
+	req.relocs = (uint64_t)(unsigned long)krec->reloc;
+	req.push = (uint64_t)(unsigned long)krec->push;
+	req.suffix0 = nvpb->suffix0;
+	req.suffix1 = nvpb->suffix1;
+	req.vram_available = 0; /* for valgrind */
+	req.gart_available = 0;
+
+	if (dbg_on(0))
+		pushbuf_dump(krec, krec_id, fifo->channel);
+	if (capture)
+		capture_submit(capture, &req, krec->domains);
 
 #ifndef SIMULATE
-		ret = drmCommandWriteRead(dev->fd, DRM_NOUVEAU_GEM_PUSHBUF,
-					  &req, sizeof(req));
+	ret = drmCommandWriteRead(dev->fd, DRM_NOUVEAU_GEM_PUSHBUF,
+				  &req, sizeof(req));
+	if (preq) {
+		*preq = req;
+	} else {
 		nvpb->suffix0 = req.suffix0;
 		nvpb->suffix1 = req.suffix1;
-		dev->vram_limit = (req.vram_available *
-				nouveau_device(dev)->vram_limit_percent) / 100;
-		dev->gart_limit = (req.gart_available *
-				nouveau_device(dev)->gart_limit_percent) / 100;
+		pushbuf_limits(dev, req.vram_available, req.gart_available);
+	}
 #else
-		if (dbg_on(31))
-			ret = -EINVAL;
+	if (dbg_on(31))
+		ret = -EINVAL;
 #endif
 
-		if (ret) {
-			err("kernel rejected pushbuf: %s\n", strerror(-ret));
-			pushbuf_dump(krec, krec_id++, fifo->channel);
+	if (ret) {
+		err("kernel rejected pushbuf: %s\n", strerror(-ret));
+		pushbuf_dump(krec, krec_id, fifo->channel);
+		return ret;
+	}
+
+	if (!preq) {
+		pushbuf_krec_placed(krec);
+		pushbuf_krec_access(krec);
+	}
+	return 0;
+}
+
+static void *
+pushbuf_async_main(void *arg)
+{
+	struct nouveau_pushbuf_async *async = arg;
+	struct drm_nouveau_gem_pushbuf_bo *kref;
+	struct drm_nouveau_gem_pushbuf req;
+	struct nouveau_pushbuf_krec *krec;
+	struct nouveau_pushbuf_priv *nvpb;
+	struct nouveau_bo *bo;
+	int ret, i;
+
+	pthread_mutex_lock(&async->lock);
+	for (;;) {
+		while (!async->head && !async->exit)
+			pthread_cond_wait(&async->work, &async->lock);
+		krec = async->head;
+		if (!krec)
 			break;
+		async->head = krec->next;
+		if (!async->head)
+			async->tail = &async->head;
+		pthread_mutex_unlock(&async->lock);
+
+		nvpb = krec->owner;
+		req.nr_push = 0;
+		ret = pushbuf_submit_krec(nvpb, krec, nvpb->base.channel->data,
+					  0, &req);
+
+		/* the bos stay referenced until the pushbuf takes the krec
+		 * back, see pushbuf_async_retire */
+		pthread_mutex_lock(&async->lock);
+		kref = krec->buffer;
+		for (i = 0; i < krec->nr_buffer; i++, kref++) {
+			bo = (void *)(unsigned long)kref->user_priv;
+			if (ret)
+				nouveau_bo(bo)->async_error = ret;
+			atomic_dec(&nouveau_bo(bo)->queued, 1);
+		}
+		/* the pushbuf reports it, not the maps of its own bos */
+		for (i = 0; ret && i < krec->nr_push; i++) {
+			kref = &krec->buffer[krec->push[i].bo_index];
+			bo = (void *)(unsigned long)kref->user_priv;
+			nouveau_bo(bo)->async_error = 0;
 		}
+		krec->error = ret;
+		if (ret && !nvpb->async_error)
+			nvpb->async_error = ret;
+		krec->next = nvpb->retired;
+		nvpb->retired = krec;
+		/* suffixes stay the same, limits are applied by the next kick */
+		if (req.nr_push) {
+			async->vram_available = req.vram_available;
+			async->gart_available = req.gart_available;
+			async->limits = true;
+		}
+		nvpb->queued--;
+		async->nr_submitted++;
+		pthread_cond_broadcast(&async->done);
+	}
+	pthread_mutex_unlock(&async->lock);
+	return NULL;
+}
+
+/*
+ * Take back the krecs the submission thread is done with, on the caller's
+ * thread: the placement the kernel reported goes to their bos, and their
+ * references are dropped.
+ */
+static void
+pushbuf_async_retire(struct nouveau_pushbuf_priv *nvpb)
+{
+	struct nouveau_device_priv *nvdev =
+		nouveau_device(nvpb->base.client->device);
+	struct nouveau_pushbuf_async *async = nvdev->async;
+	struct nouveau_pushbuf_krec *krec, *next, *list = NULL;
+	struct drm_nouveau_gem_pushbuf_bo *kref;
+	struct nouveau_bo *bo;
+	int i;
 
+	pthread_mutex_lock(&async->lock);
+	krec = nvpb->retired;
+	nvpb->retired = NULL;
+	pthread_mutex_unlock(&async->lock);
+
+	/* oldest first, so the latest placement of a bo is what stays */
+	for (; krec; krec = next) {
+		next = krec->next;
+		krec->next = list;
+		list = krec;
+	}
+	for (krec = list; krec; krec = next) {
+		next = krec->next;
+		if (!krec->error)
+			pushbuf_krec_placed(krec);
 		kref = krec->buffer;
 		for (i = 0; i < krec->nr_buffer; i++, kref++) {
 			bo = (void *)(unsigned long)kref->user_priv;
+			nouveau_bo_ref(NULL, &bo);
+		}
+		krec->next = nvpb->spare;
+		nvpb->spare = krec;
+	}
+}
 
-			info = &kref->presumed;
-			if (!info->valid) {
-				bo->flags &= ~NOUVEAU_BO_APER;
-				if (info->domain == NOUVEAU_GEM_DOMAIN_VRAM)
-					bo->flags |= NOUVEAU_BO_VRAM;
-				else
-					bo->flags |= NOUVEAU_BO_GART;
-				bo->offset = info->offset;
-			}
+/* the first error the kernel gave to a queued krec since the last call */
+static int
+pushbuf_async_error(struct nouveau_pushbuf_priv *nvpb)
+{
+	struct nouveau_device_priv *nvdev =
+		nouveau_device(nvpb->base.client->device);
+	struct nouveau_pushbuf_async *async = nvdev->async;
+	int ret;
+
+	pthread_mutex_lock(&async->lock);
+	ret = nvpb->async_error;
+	nvpb->async_error = 0;
+	pthread_mutex_unlock(&async->lock);
+	return ret;
+}
+
+/* a krec taken back from the submission thread if there is one, or a new
+ * one */
+static struct nouveau_pushbuf_krec *
+pushbuf_krec_new(struct nouveau_pushbuf_priv *nvpb)
+{
+	struct nouveau_pushbuf_krec *krec = nvpb->spare;
+
+	if (!krec)
+		return calloc(1, sizeof(*krec));
+
+	nvpb->spare = krec->next;
+	krec->next = NULL;
+	return krec;
+}
+
+/* hand the current krec to the submission thread, and start a new one */
+static void
+pushbuf_queue(struct nouveau_pushbuf_priv *nvpb,
+	      struct nouveau_pushbuf_krec *next)
+{
+	struct nouveau_device_priv *nvdev =
+		nouveau_device(nvpb->base.client->device);
+	struct nouveau_pushbuf_async *async = nvdev->async;
+	struct nouveau_pushbuf_krec *krec = nvpb->krec;
+	struct drm_nouveau_gem_pushbuf_bo *kref;
+	struct nouveau_bo *bo;
+	int i;
+
+	/* the references move to the submission thread, the access is
+	 * marked now as nouveau_bo_wait only waits while the bo is queued */
+	kref = krec->buffer;
+	for (i = 0; i < krec->nr_buffer; i++, kref++) {
+		bo = (void *)(unsigned long)kref->user_priv;
+		cli_kref_set(nvpb->base.client, bo, NULL, NULL);
+		atomic_inc(&nouveau_bo(bo)->queued);
+	}
+	pushbuf_krec_access(krec);
+	krec->owner = nvpb;
+	krec->next = NULL;
+	nvpb->krec = nvpb->list = next;
+
+	pthread_mutex_lock(&async->lock);
+	if (async->limits) {
+		pushbuf_limits(nvpb->base.client->device,
+			       async->vram_available, async->gart_available);
+		async->limits = false;
+	}
+	nvpb->queued++;
+	async->nr_queued++;
+	*async->tail = krec;
+	async->tail = &krec->next;
+	pthread_cond_signal(&async->work);
+	pthread_mutex_unlock(&async->lock);
+}
+
+/*
+ * Wait until every krec queued on the device so far has been submitted,
+ * and return with the async lock held, or NULL if there's no submission
+ * thread.  Synchronous submissions go in after the queued ones this way.
+ */
+struct nouveau_pushbuf_async *
+pushbuf_async_drain(struct nouveau_device *dev)
+{
+	struct nouveau_device_priv *nvdev = nouveau_device(dev);
+	struct nouveau_pushbuf_async *async;
+	uint64_t target;
+
+	pthread_mutex_lock(&nvdev->lock);
+	async = nvdev->async;
+	pthread_mutex_unlock(&nvdev->lock);
+	if (!async)
+		return NULL;
+
+	/* not what's queued meanwhile, that would starve the caller */
+	pthread_mutex_lock(&async->lock);
+	target = async->nr_queued;
+	while (async->nr_submitted < target)
+		pthread_cond_wait(&async->done, &async->lock);
+	return async;
+}
+
+void
+pushbuf_async_unlock(struct nouveau_pushbuf_async *async)
+{
+	if (async)
+		pthread_mutex_unlock(&async->lock);
+}
+
+static int
+pushbuf_submit(struct nouveau_pushbuf *push, struct nouveau_object *chan)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	struct nouveau_pushbuf_krec *krec = nvpb->list;
+	struct nouveau_pushbuf_krec *next;
+	int krec_id = 0;
+	int ret = 0;
+
+	if (chan->oclass != NOUVEAU_FIFO_CHANNEL_CLASS)
+		return -EINVAL;
+
+	if (push->kick_notify)
+		push->kick_notify(push);
+
+	nouveau_pushbuf_data(push, NULL, 0, 0);
 
-			if (kref->write_domains)
-				nouveau_bo(bo)->access |= NOUVEAU_BO_WR;
-			if (kref->read_domains)
-				nouveau_bo(bo)->access |= NOUVEAU_BO_RD;
+	/* submitted synchronously if there's no memory for the next krec */
+	if (nvpb->async && krec->nr_push) {
+		pushbuf_async_retire(nvpb);
+		next = pushbuf_krec_new(nvpb);
+		if (next) {
+			pushbuf_queue(nvpb, next);
+			return 0;
 		}
+	}
+
+	/* after what other pushbufs queued before, which may use its bos */
+	if (krec && krec->nr_push)
+		pushbuf_async_unlock(pushbuf_async_drain(push->client->device));
 
+	while (krec && krec->nr_push) {
+		ret = pushbuf_submit_krec(nvpb, krec, chan->data, krec_id++,
+					  NULL);
+		if (ret)
+			break;
 		krec = krec->next;
 	}
 
@@ -402,16 +810,21 @@ pushbuf_flush(struct nouveau_pushbuf *push)
 		ret = pushbuf_submit(push, push->channel);
 	} else {
 		nouveau_pushbuf_data(push, NULL, 0, 0);
-		krec->next = malloc(sizeof(*krec));
+		krec->next = pushbuf_krec_new(nvpb);
+		if (!krec->next)
+			return -ENOMEM;
 		nvpb->krec = krec->next;
 	}
 
-	kref = krec->buffer;
-	for (i = 0; i < krec->nr_buffer; i++, kref++) {
-		bo = (void *)(unsigned long)kref->user_priv;
-		cli_kref_set(push->client, bo, NULL, NULL);
-		if (push->channel)
-			nouveau_bo_ref(NULL, &bo);
+	/* unless it went to the submission thread, which drops them */
+	if (krec == nvpb->krec || !push->channel) {
+		kref = krec->buffer;
+		for (i = 0; i < krec->nr_buffer; i++, kref++) {
+			bo = (void *)(unsigned long)kref->user_priv;
+			cli_kref_set(push->client, bo, NULL, NULL);
+			if (push->channel)
+				nouveau_bo_ref(NULL, &bo);
+		}
 	}
 
 	krec = nvpb->krec;
@@ -422,6 +835,9 @@ pushbuf_flush(struct nouveau_pushbuf *push)
 	krec->nr_push = 0;
 
 	DRMLISTFOREACHENTRYSAFE(bctx, btmp, &nvpb->bctx_list, head) {
+		struct nouveau_bufctx_priv *pctx = nouveau_bufctx(bctx);
+		for (i = 0; i < pctx->nr_bins; i++)
+			pctx->bins[i].pending = 0;
 		DRMLISTJOIN(&bctx->current, &bctx->pending);
 		DRMINITLISTHEAD(&bctx->current);
 		DRMLISTDELINIT(&bctx->head);
@@ -440,6 +856,10 @@ pushbuf_refn_fail(struct nouveau_pushbuf *push, int sref, int srel)
 	kref = krec->buffer + sref;
 	while (krec->nr_buffer-- > sref) {
 		struct nouveau_bo *bo = (void *)(unsigned long)kref->user_priv;
+		if (pushbuf_kref_vram(kref))
+			krec->vram_used -= bo->size;
+		else
+			krec->gart_used -= bo->size;
 		cli_kref_set(push->client, bo, NULL, NULL);
 		nouveau_bo_ref(NULL, &bo);
 		kref++;
@@ -485,9 +905,11 @@ pushbuf_validate(struct nouveau_pushbuf *push, bool retry)
 	struct nouveau_pushbuf_krec *krec = nvpb->krec;
 	struct drm_nouveau_gem_pushbuf_bo *kref;
 	struct nouveau_bufctx *bctx = push->bufctx;
+	struct nouveau_bufctx_priv *pctx;
+	struct nouveau_bufbin_priv *pbin;
 	struct nouveau_bufref *bref;
 	int relocs = bctx ? bctx->relocs * 2: 0;
-	int sref, srel, ret;
+	int sref, srel, ret, i;
 
 	ret = nouveau_pushbuf_space(push, relocs, relocs, 0);
 	if (ret || bctx == NULL)
@@ -499,20 +921,26 @@ pushbuf_validate(struct nouveau_pushbuf *push, bool retry)
 	DRMLISTDEL(&bctx->head);
 	DRMLISTADD(&bctx->head, &nvpb->bctx_list);
 
-	DRMLISTFOREACHENTRY(bref, &bctx->pending, thead) {
-		kref = pushbuf_kref(push, bref->bo, bref->flags);
-		if (!kref) {
-			ret = -ENOSPC;
-			break;
-		}
+	/* the pending list in bin order, off the bins' arrays */
+	pctx = nouveau_bufctx(bctx);
+	for (pbin = pctx->bins; pbin < pctx->bins + pctx->nr_bins; pbin++) {
+		for (i = pbin->pending; !ret && i < pbin->nr; i++) {
+			bref = &pbin->refs[i]->base;
+			kref = pushbuf_kref(push, bref->bo, bref->flags);
+			if (!kref) {
+				ret = -ENOSPC;
+				continue;
+			}
 
-		if (bref->packet) {
-			pushbuf_krel(push, bref->bo, bref->packet, 0, 0, 0);
-			*push->cur++ = 0;
-			pushbuf_krel(push, bref->bo, bref->data, bref->flags,
-					   bref->vor, bref->tor);
-			*push->cur++ = 0;
+			if (bref->packet) {
+				pushbuf_krel(push, bref->bo, bref->packet, 0, 0, 0);
+				*push->cur++ = 0;
+				pushbuf_krel(push, bref->bo, bref->data,
+					     bref->flags, bref->vor, bref->tor);
+				*push->cur++ = 0;
+			}
 		}
+		pbin->pending = pbin->nr;
 	}
 
 	DRMLISTJOIN(&bctx->pending, &bctx->current);
@@ -554,9 +982,11 @@ nouveau_pushbuf_new(struct nouveau_client *client, struct nouveau_object *chan,
 	if (ret)
 		return ret;
 
-	nvpb = calloc(1, sizeof(*nvpb) + nr * sizeof(*nvpb->bos));
+	nvpb = calloc(1, sizeof(*nvpb) + nr * sizeof(*nvpb->bos) *
+			 (immediate ? PUSHBUF_BO_GROW : 1));
 	if (!nvpb)
 		return -ENOMEM;
+	nvpb->bo_max = nr * (immediate ? PUSHBUF_BO_GROW : 1);
 
 #ifndef SIMULATE
 	nvpb->suffix0 = req.suffix0;
@@ -607,6 +1037,8 @@ nouveau_pushbuf_del(struct nouveau_pushbuf **ppush)
 	if (nvpb) {
 		struct drm_nouveau_gem_pushbuf_bo *kref;
 		struct nouveau_pushbuf_krec *krec;
+		if (nvpb->async)
+			nouveau_pushbuf_async(&nvpb->base, false);
 		while ((krec = nvpb->list)) {
 			kref = krec->buffer;
 			while (krec->nr_buffer--) {
@@ -618,6 +1050,10 @@ nouveau_pushbuf_del(struct nouveau_pushbuf **ppush)
 			nvpb->list = krec->next;
 			free(krec);
 		}
+		while ((krec = nvpb->spare)) {
+			nvpb->spare = krec->next;
+			free(krec);
+		}
 		while (nvpb->bo_nr--)
 			nouveau_bo_ref(NULL, &nvpb->bos[nvpb->bo_nr]);
 		nouveau_bo_ref(NULL, &nvpb->bo);
@@ -634,6 +1070,45 @@ nouveau_pushbuf_bufctx(struct nouveau_pushbuf *push, struct nouveau_bufctx *ctx)
 	return prev;
 }
 
+/*
+ * Map the next bo of the pushbuf for writing.  Instead of waiting for
+ * the GPU to be done with a bo of an immediate pushbuf's ring, a new one
+ * goes in the ring ahead of it, so that the ring grows to cover what the
+ * GPU has in flight and then stays that size.
+ */
+static int
+pushbuf_bo_map(struct nouveau_pushbuf *push, int i, struct nouveau_bo **pbo)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	struct nouveau_bo *bo = NULL;
+	int ret;
+
+	ret = nouveau_bo_map(*pbo, NOUVEAU_BO_WR | NOUVEAU_BO_NOBLOCK,
+			     push->client);
+	if (ret != -EBUSY)
+		return ret;
+
+	if (!push->channel || i < 0 || nvpb->bo_nr == nvpb->bo_max ||
+	    nouveau_bo_new(push->client->device, nvpb->type, 0, (*pbo)->size,
+			   NULL, &bo))
+		return nouveau_bo_map(*pbo, NOUVEAU_BO_WR, push->client);
+
+	ret = nouveau_bo_map(bo, NOUVEAU_BO_WR, push->client);
+	if (ret) {
+		nouveau_bo_ref(NULL, &bo);
+		return nouveau_bo_map(*pbo, NOUVEAU_BO_WR, push->client);
+	}
+
+	/* the busy bo is the next one to try again */
+	memmove(&nvpb->bos[i + 1], &nvpb->bos[i],
+		(nvpb->bo_nr - i) * sizeof(*nvpb->bos));
+	nvpb->bos[i] = bo;
+	nvpb->bo_nr++;
+	nvpb->bo_next = i + 1;
+	nouveau_bo_ref(bo, pbo);
+	return 0;
+}
+
 int
 nouveau_pushbuf_space(struct nouveau_pushbuf *push,
 		      uint32_t dwords, uint32_t relocs, uint32_t pushes)
@@ -643,11 +1118,12 @@ nouveau_pushbuf_space(struct nouveau_pushbuf *push,
 	struct nouveau_client *client = push->client;
 	struct nouveau_bo *bo = NULL;
 	bool flushed = false;
-	int ret = 0;
+	int ret = 0, next = -1;
 
 	/* switch to next buffer if insufficient space in the current one */
 	if (push->cur + dwords >= push->end) {
 		if (nvpb->bo_next < nvpb->bo_nr) {
+			next = nvpb->bo_next;
 			nouveau_bo_ref(nvpb->bos[nvpb->bo_next++], &bo);
 			if (nvpb->bo_next == nvpb->bo_nr && push->channel)
 				nvpb->bo_next = 0;
@@ -679,9 +1155,11 @@ nouveau_pushbuf_space(struct nouveau_pushbuf *push,
 
 	/* if necessary, switch to new buffer */
 	if (bo) {
-		ret = nouveau_bo_map(bo, NOUVEAU_BO_WR, push->client);
-		if (ret)
+		ret = pushbuf_bo_map(push, next, &bo);
+		if (ret) {
+			nouveau_bo_ref(NULL, &bo);
 			return ret;
+		}
 
 		nouveau_pushbuf_data(push, NULL, 0, 0);
 		nouveau_bo_ref(bo, &nvpb->bo);
@@ -766,11 +1244,123 @@ nouveau_pushbuf_refd(struct nouveau_pushbuf *push, struct nouveau_bo *bo)
 	return flags;
 }
 
+void
+nouveau_pushbuf_get_stats(struct nouveau_pushbuf *push,
+			  struct nouveau_pushbuf_stats *stats)
+{
+	*stats = nouveau_pushbuf(push)->stats;
+}
+
 int
 nouveau_pushbuf_kick(struct nouveau_pushbuf *push, struct nouveau_object *chan)
 {
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	int ret;
+
 	if (!push->channel)
 		return pushbuf_submit(push, chan);
 	pushbuf_flush(push);
-	return pushbuf_validate(push, false);
+	ret = pushbuf_validate(push, false);
+	/* an earlier queued submission the kernel rejected */
+	if (nvpb->async && ret == 0)
+		ret = pushbuf_async_error(nvpb);
+	return ret;
+}
+
+static int
+pushbuf_async_init(struct nouveau_device_priv *nvdev)
+{
+	struct nouveau_pushbuf_async *async;
+
+	async = calloc(1, sizeof(*async));
+	if (!async)
+		return -ENOMEM;
+
+	pthread_mutex_init(&async->lock, NULL);
+	pthread_cond_init(&async->work, NULL);
+	pthread_cond_init(&async->done, NULL);
+	async->tail = &async->head;
+	if (pthread_create(&async->thread, NULL, pushbuf_async_main, async)) {
+		pthread_cond_destroy(&async->done);
+		pthread_cond_destroy(&async->work);
+		pthread_mutex_destroy(&async->lock);
+		free(async);
+		return -EAGAIN;
+	}
+
+	nvdev->async = async;
+	return 0;
+}
+
+void
+pushbuf_async_fini(struct nouveau_device *dev)
+{
+	struct nouveau_device_priv *nvdev = nouveau_device(dev);
+	struct nouveau_pushbuf_async *async = nvdev->async;
+
+	pthread_mutex_lock(&async->lock);
+	async->exit = true;
+	pthread_cond_signal(&async->work);
+	pthread_mutex_unlock(&async->lock);
+	pthread_join(async->thread, NULL);
+
+	pthread_cond_destroy(&async->done);
+	pthread_cond_destroy(&async->work);
+	pthread_mutex_destroy(&async->lock);
+	free(async);
+	nvdev->async = NULL;
+}
+
+/* until every queued krec referencing the bo has been submitted, returns
+ * what the kernel said to the last of them it rejected since the last call */
+int
+pushbuf_async_wait(struct nouveau_bo *bo)
+{
+	struct nouveau_pushbuf_async *async = nouveau_device(bo->device)->async;
+	struct nouveau_bo_priv *nvbo = nouveau_bo(bo);
+	int ret;
+
+	pthread_mutex_lock(&async->lock);
+	while (atomic_read(&nvbo->queued))
+		pthread_cond_wait(&async->done, &async->lock);
+	ret = nvbo->async_error;
+	nvbo->async_error = 0;
+	pthread_mutex_unlock(&async->lock);
+	return ret;
+}
+
+int
+nouveau_pushbuf_async(struct nouveau_pushbuf *push, bool enable)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	struct nouveau_device *dev = push->client->device;
+	struct nouveau_device_priv *nvdev = nouveau_device(dev);
+	struct nouveau_pushbuf_async *async;
+	int ret = 0;
+
+	if (enable) {
+		/* the kernel's suffix only stays the same from nv25 on */
+		if (!push->channel || dev->chipset < 0x25)
+			return -EINVAL;
+
+		pthread_mutex_lock(&nvdev->lock);
+		if (!nvdev->async)
+			ret = pushbuf_async_init(nvdev);
+		pthread_mutex_unlock(&nvdev->lock);
+		if (ret == 0)
+			nvpb->async = true;
+		return ret;
+	}
+
+	if (nvpb->async) {
+		async = nvdev->async;
+		pthread_mutex_lock(&async->lock);
+		while (nvpb->queued)
+			pthread_cond_wait(&async->done, &async->lock);
+		pthread_mutex_unlock(&async->lock);
+		pushbuf_async_retire(nvpb);
+		ret = pushbuf_async_error(nvpb);
+		nvpb->async = false;
+	}
+	return ret;
 }
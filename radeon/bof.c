@@ -24,8 +24,12 @@
  *      Jerome Glisse
  */
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "bof.h"
 
 /*
@@ -157,6 +161,20 @@ bof_t *bof_blob(unsigned size, void *value)
 	return blob;
 }
 
+/* value is not copied, it has to stay valid until the blob is released */
+bof_t *bof_blob_borrow(unsigned size, const void *value)
+{
+	bof_t *blob = bof_object();
+
+	if (blob == NULL)
+		return NULL;
+	blob->type = BOF_TYPE_BLOB;
+	blob->value = (void *)value;
+	blob->borrowed = 1;
+	blob->size = size + 12;
+	return blob;
+}
+
 unsigned bof_blob_size(bof_t *bof)
 {
 	if (!bof_is_blob(bof))
@@ -215,7 +233,11 @@ bof_t *bof_int32(int32_t value)
 
 int32_t bof_int32_value(bof_t *bof)
 {
-	return *((uint32_t*)bof->value);
+	int32_t value;
+
+	/* may point into a mapped file, unaligned */
+	memcpy(&value, bof->value, 4);
+	return value;
 }
 
 /*
@@ -276,97 +298,417 @@ void bof_print(bof_t *bof)
 	bof_print_rec(bof, 0, 0);
 }
 
-static int bof_read(bof_t *root, FILE *file, long end, int level)
+/*
+ * memory mapped reader
+ */
+struct bof_map_entry {
+	uint64_t	offset;
+	/* parent and first entry past this one's subtree */
+	uint32_t	parent;
+	uint32_t	end;
+};
+
+struct bof_map {
+	unsigned		refcount;
+	const uint8_t		*data;
+	size_t			size;
+	struct bof_map_entry	*entries;
+	unsigned		nentries;
+};
+
+struct bof_map_open {
+	unsigned	entry;
+	uint64_t	end;
+};
+
+static void bof_map_header(bof_map_t *map, uint64_t offset, uint32_t *header)
 {
-	bof_t *bof = NULL;
-	int r;
+	memcpy(header, map->data + offset, 12);
+}
 
-	if (ftell(file) >= end) {
-		return 0;
+static int bof_map_add(bof_map_t *map, unsigned *nalloc, uint64_t offset,
+		       unsigned parent)
+{
+	struct bof_map_entry *entries;
+
+	if (map->nentries == *nalloc) {
+		*nalloc *= 2;
+		entries = realloc(map->entries, *nalloc * sizeof(*entries));
+		if (entries == NULL)
+			return -ENOMEM;
+		map->entries = entries;
 	}
-	r = bof_entry_grow(root);
-	if (r)
-		return r;
-	bof = bof_object();
-	if (bof == NULL)
-		return -ENOMEM;
-	bof->offset = ftell(file);
-	r = fread(&bof->type, 4, 1, file);
-	if (r != 1)
-		goto out_err;
-	r = fread(&bof->size, 4, 1, file);
-	if (r != 1)
-		goto out_err;
-	r = fread(&bof->array_size, 4, 1, file);
-	if (r != 1)
-		goto out_err;
-	switch (bof->type) {
+	map->entries[map->nentries].offset = offset;
+	map->entries[map->nentries].parent = parent;
+	map->entries[map->nentries].end = map->nentries + 1;
+	map->nentries++;
+	return 0;
+}
+
+/* entry at offset among the first n ones, n if there is none */
+static unsigned bof_map_find(bof_map_t *map, uint64_t offset, unsigned n)
+{
+	unsigned lo = 0, hi = n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (map->entries[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < n && map->entries[lo].offset == offset)
+		return lo;
+	return n;
+}
+
+/* blob a blob reference stands for, the index checked it exists */
+static uint64_t bof_map_resolve(bof_map_t *map, uint64_t offset)
+{
+	uint32_t header[3];
+	uint64_t target;
+
+	bof_map_header(map, offset, header);
+	if (header[0] != BOF_TYPE_BLOB_REF)
+		return offset;
+	memcpy(&target, map->data + offset + 12, 8);
+	return target;
+}
+
+/*
+ * Index every entry of the file without recursion, keeping a stack of the
+ * objects and arrays still open.  Entries must fit in their parent.
+ */
+static int bof_map_index(bof_map_t *map)
+{
+	struct bof_map_open *stack, *tmp;
+	unsigned nalloc = 256, nstack = 16, depth = 0, entry;
+	uint32_t header[3];
+	uint64_t offset, target;
+	int r = -EINVAL;
+
+	if (map->size < 12)
+		return -EINVAL;
+	bof_map_header(map, 0, header);
+	if ((header[0] != BOF_TYPE_OBJECT && header[0] != BOF_TYPE_ARRAY) ||
+	    header[1] < 12 || header[1] > map->size)
+		return -EINVAL;
+	map->entries = malloc(nalloc * sizeof(*map->entries));
+	stack = malloc(nstack * sizeof(*stack));
+	if (map->entries == NULL || stack == NULL) {
+		r = -ENOMEM;
+		goto out;
+	}
+	map->nentries = 0;
+	bof_map_add(map, &nalloc, 0, 0);
+	stack[depth].entry = 0;
+	stack[depth++].end = header[1];
+	offset = 12;
+
+	while (depth) {
+		if (offset == stack[depth - 1].end) {
+			depth--;
+			map->entries[stack[depth].entry].end = map->nentries;
+			continue;
+		}
+		if (stack[depth - 1].end - offset < 12)
+			goto out;
+		bof_map_header(map, offset, header);
+		entry = map->nentries;
+		r = bof_map_add(map, &nalloc, offset, stack[depth - 1].entry);
+		if (r)
+			goto out;
+		r = -EINVAL;
+		switch (header[0]) {
+		case BOF_TYPE_NULL:
+			offset += 12;
+			break;
+		case BOF_TYPE_STRING:
+			if (header[1] <= 12 || header[1] > stack[depth - 1].end - offset ||
+			    map->data[offset + header[1] - 1] != '\0')
+				goto out;
+			offset += header[1];
+			break;
+		case BOF_TYPE_INT32:
+			if (header[1] != 16 || header[1] > stack[depth - 1].end - offset)
+				goto out;
+			offset += header[1];
+			break;
+		case BOF_TYPE_BLOB:
+			if (header[1] < 12 || header[1] > stack[depth - 1].end - offset)
+				goto out;
+			offset += header[1];
+			break;
+		case BOF_TYPE_BLOB_REF:
+			/* only backward references to a blob */
+			if (header[1] != 20 || header[1] > stack[depth - 1].end - offset)
+				goto out;
+			memcpy(&target, map->data + offset + 12, 8);
+			if (target >= offset || bof_map_find(map, target, entry) == entry)
+				goto out;
+			bof_map_header(map, target, header);
+			if (header[0] != BOF_TYPE_BLOB)
+				goto out;
+			offset += 20;
+			break;
+		case BOF_TYPE_OBJECT:
+		case BOF_TYPE_ARRAY:
+			if (header[1] < 12 || header[1] > stack[depth - 1].end - offset)
+				goto out;
+			if (depth == nstack) {
+				nstack *= 2;
+				tmp = realloc(stack, nstack * sizeof(*stack));
+				if (tmp == NULL) {
+					r = -ENOMEM;
+					goto out;
+				}
+				stack = tmp;
+			}
+			stack[depth].entry = entry;
+			stack[depth++].end = offset + header[1];
+			offset += 12;
+			break;
+		default:
+			fprintf(stderr, "invalid type %d\n", header[0]);
+			goto out;
+		}
+	}
+	r = 0;
+out:
+	free(stack);
+	return r;
+}
+
+bof_map_t *bof_map_file(const char *filename)
+{
+	bof_map_t *map;
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size < 12) {
+		close(fd);
+		return NULL;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+	map = calloc(1, sizeof(bof_map_t));
+	if (map == NULL) {
+		munmap(data, st.st_size);
+		return NULL;
+	}
+	map->refcount = 1;
+	map->data = data;
+	map->size = st.st_size;
+	if (bof_map_index(map)) {
+		fprintf(stderr, "%s invalid bof file %s\n", __func__, filename);
+		bof_map_close(map);
+		return NULL;
+	}
+	return map;
+}
+
+void bof_map_close(bof_map_t *map)
+{
+	if (map == NULL || --map->refcount > 0)
+		return;
+	munmap((void *)map->data, map->size);
+	free(map->entries);
+	free(map);
+}
+
+unsigned bof_map_size(bof_map_t *map)
+{
+	return map->nentries;
+}
+
+uint32_t bof_map_type(bof_map_t *map, unsigned entry)
+{
+	uint32_t header[3];
+
+	bof_map_header(map, bof_map_resolve(map, map->entries[entry].offset), header);
+	return header[0];
+}
+
+unsigned bof_map_child(bof_map_t *map, unsigned entry)
+{
+	if (entry + 1 < map->entries[entry].end)
+		return entry + 1;
+	return 0;
+}
+
+unsigned bof_map_next(bof_map_t *map, unsigned entry)
+{
+	unsigned next = map->entries[entry].end;
+
+	if (entry && next < map->entries[map->entries[entry].parent].end)
+		return next;
+	return 0;
+}
+
+const void *bof_map_value(bof_map_t *map, unsigned entry, unsigned *size)
+{
+	uint64_t offset = bof_map_resolve(map, map->entries[entry].offset);
+	uint32_t header[3];
+
+	bof_map_header(map, offset, header);
+	switch (header[0]) {
 	case BOF_TYPE_STRING:
 	case BOF_TYPE_INT32:
 	case BOF_TYPE_BLOB:
-		bof->value = calloc(1, bof->size - 12);
-		if (bof->value == NULL) {
+		if (size)
+			*size = header[1] - 12;
+		return map->data + offset + 12;
+	default:
+		if (size)
+			*size = 0;
+		return NULL;
+	}
+}
+
+unsigned bof_map_object_get(bof_map_t *map, unsigned object, const char *keyname)
+{
+	unsigned key, value;
+
+	if (bof_map_type(map, object) != BOF_TYPE_OBJECT)
+		return 0;
+	for (key = bof_map_child(map, object); key; key = bof_map_next(map, value)) {
+		value = bof_map_next(map, key);
+		if (!value)
+			return 0;
+		if (bof_map_type(map, key) == BOF_TYPE_STRING &&
+		    !strcmp(bof_map_value(map, key, NULL), keyname))
+			return value;
+	}
+	return 0;
+}
+
+/*
+ * Build the bof_t tree of an entry, in file order with a stack of the
+ * objects being filled.  Values are not copied, they point into the
+ * mapping which every such bof_t keeps a reference on.  Blob references
+ * load as the blob, growing their parents by the difference.
+ */
+struct bof_map_fill {
+	bof_t		*bof;
+	unsigned	end;
+	unsigned	hint;
+	unsigned	grow;
+};
+
+static void bof_map_pop(struct bof_map_fill *stack, unsigned depth)
+{
+	stack[depth].bof->size += stack[depth].grow;
+	if (depth)
+		stack[depth - 1].grow += stack[depth].grow;
+}
+
+static int bof_map_append(bof_t *parent, bof_t *bof, unsigned hint)
+{
+	bof_t **array;
+	unsigned n;
+
+	if (parent->array_size == parent->nentry) {
+		n = parent->nentry ? parent->nentry * 2 : hint;
+		array = realloc(parent->array, n * sizeof(void *));
+		if (array == NULL)
+			return -ENOMEM;
+		parent->array = array;
+		parent->nentry = n;
+	}
+	parent->array[parent->array_size++] = bof;
+	return 0;
+}
+
+bof_t *bof_map_load(bof_map_t *map, unsigned entry)
+{
+	struct bof_map_fill *stack;
+	bof_t *root = NULL, *bof;
+	unsigned i, hint, grow, depth = 0, end = map->entries[entry].end;
+	uint32_t header[3];
+	uint64_t offset;
+
+	/* there can not be more open objects than entries */
+	stack = malloc((end - entry) * sizeof(*stack));
+	if (stack == NULL)
+		return NULL;
+	for (i = entry; i < end; i++) {
+		while (depth && i >= stack[depth - 1].end)
+			bof_map_pop(stack, --depth);
+		bof = bof_object();
+		if (bof == NULL)
 			goto out_err;
+		offset = bof_map_resolve(map, map->entries[i].offset);
+		bof_map_header(map, map->entries[i].offset, header);
+		grow = offset != map->entries[i].offset ? header[1] : 0;
+		bof_map_header(map, offset, header);
+		bof->offset = offset;
+		bof->type = header[0];
+		bof->size = header[1];
+		if (grow && depth)
+			stack[depth - 1].grow += bof->size - grow;
+		switch (bof->type) {
+		case BOF_TYPE_STRING:
+		case BOF_TYPE_INT32:
+		case BOF_TYPE_BLOB:
+			bof->value = (void *)(map->data + bof->offset + 12);
+			bof->map = map;
+			map->refcount++;
+			break;
+		case BOF_TYPE_OBJECT:
+		case BOF_TYPE_ARRAY:
+			break;
+		default:
+			bof->size = 0;
+			break;
 		}
-		r = fread(bof->value, bof->size - 12, 1, file);
-		if (r != 1) {
-			fprintf(stderr, "error reading %d\n", bof->size - 12);
+		if (root == NULL) {
+			root = bof;
+		} else if (bof_map_append(stack[depth - 1].bof, bof,
+					  stack[depth - 1].hint)) {
+			bof_decref(bof);
 			goto out_err;
 		}
-		break;
-	case BOF_TYPE_NULL:
-		return 0;
-	case BOF_TYPE_OBJECT:
-	case BOF_TYPE_ARRAY:
-		r = bof_read(bof, file, bof->offset + bof->size, level + 2);
-		if (r)
-			goto out_err;
-		break;
-	default:
-		fprintf(stderr, "invalid type %d\n", bof->type);
-		goto out_err;
+		if (bof->type == BOF_TYPE_OBJECT || bof->type == BOF_TYPE_ARRAY) {
+			/* the count in the file is only a hint, never trust it
+			 * past the number of entries below */
+			hint = map->entries[i].end - i - 1;
+			if (header[2] && header[2] < hint)
+				hint = header[2];
+			stack[depth].bof = bof;
+			stack[depth].end = map->entries[i].end;
+			stack[depth].grow = 0;
+			stack[depth++].hint = hint ? hint : 1;
+		}
 	}
-	root->array[root->centry++] = bof;
-	return bof_read(root, file, end, level);
+	while (depth)
+		bof_map_pop(stack, --depth);
+	free(stack);
+	return root;
 out_err:
-	bof_decref(bof);
-	return -EINVAL;
+	free(stack);
+	bof_decref(root);
+	return NULL;
 }
 
 bof_t *bof_load_file(const char *filename)
 {
-	bof_t *root = bof_object();
-	int r;
+	bof_map_t *map;
+	bof_t *root;
 
-	if (root == NULL) {
-		fprintf(stderr, "%s failed to create root object\n", __func__);
+	map = bof_map_file(filename);
+	if (map == NULL) {
+		fprintf(stderr, "%s failed to load %s\n", __func__, filename);
 		return NULL;
 	}
-	root->file = fopen(filename, "r");
-	if (root->file == NULL)
-		goto out_err;
-	r = fseek(root->file, 0L, SEEK_SET);
-	if (r) {
-		fprintf(stderr, "%s failed to seek into file %s\n", __func__, filename);
-		goto out_err;
-	}
-	root->offset = ftell(root->file);
-	r = fread(&root->type, 4, 1, root->file);
-	if (r != 1)
-		goto out_err;
-	r = fread(&root->size, 4, 1, root->file);
-	if (r != 1)
-		goto out_err;
-	r = fread(&root->array_size, 4, 1, root->file);
-	if (r != 1)
-		goto out_err;
-	r = bof_read(root, root->file, root->offset + root->size, 2);
-	if (r)
-		goto out_err;
+	root = bof_map_load(map, 0);
+	bof_map_close(map);
 	return root;
-out_err:
-	bof_decref(root);
-	return NULL;
 }
 
 void bof_incref(bof_t *bof)
@@ -392,7 +734,10 @@ void bof_decref(bof_t *bof)
 		bof->file = NULL;
 	}
 	free(bof->array);
-	free(bof->value);
+	if (bof->map)
+		bof_map_close(bof->map);
+	else if (!bof->borrowed)
+		free(bof->value);
 	free(bof);
 }
 
@@ -475,3 +820,403 @@ out_err:
 	bof->file = NULL;
 	return r;
 }
+
+/*
+ * streaming writer
+ *
+ * The root array header is rewritten on flush, everything else is only
+ * ever appended through one large buffer.  Blobs of at least
+ * BOF_STREAM_DEDUP bytes are looked up by size and a 64 bits hash of
+ * their content, and compared with the first copy, from the tree being
+ * appended, the buffer or the file.  A match is written as a 20 bytes
+ * reference to the first copy.
+ */
+#define BOF_STREAM_BUFFER	(1 << 20)
+#define BOF_STREAM_DEDUP	1024
+
+struct bof_stream_blob {
+	uint64_t	hash;
+	/* 0 for a free slot, no blob lives at the root */
+	uint64_t	offset;
+	uint32_t	size;
+	/* contents, only valid for blobs of the append in progress */
+	const void	*value;
+};
+
+struct bof_stream_plan {
+	/* written size, or 0 for a blob written as a reference */
+	uint32_t	size;
+	uint64_t	ref;
+};
+
+struct bof_stream {
+	int			fd;
+	int			error;
+	uint8_t			*buffer;
+	unsigned		used;
+	/* file size including what is still buffered */
+	uint64_t		offset;
+	/* where the append in progress starts */
+	uint64_t		append_offset;
+	uint32_t		count;
+	struct bof_stream_blob	*blobs;
+	unsigned		nblobs;
+	unsigned		blobs_size;
+	struct bof_stream_plan	*plan;
+	unsigned		nplan;
+	unsigned		plan_size;
+};
+
+static uint64_t bof_stream_hash(const uint8_t *data, unsigned size)
+{
+	const uint64_t k0 = 0x9e3779b97f4a7c15ULL, k1 = 0xc2b2ae3d27d4eb4fULL;
+	uint64_t h0 = size, h1 = ~(uint64_t)size, w0, w1;
+	unsigned i;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		memcpy(&w0, data + i, 8);
+		memcpy(&w1, data + i + 8, 8);
+		h0 = ((h0 ^ w0) * k0);
+		h1 = ((h1 ^ w1) * k1);
+		h0 = (h0 << 31) | (h0 >> 33);
+		h1 = (h1 << 29) | (h1 >> 35);
+	}
+	for (; i < size; i++)
+		h0 = (h0 ^ data[i]) * k0;
+	h0 ^= h1 * k1;
+	h0 ^= h0 >> 33;
+	h0 *= k0;
+	h0 ^= h0 >> 29;
+	return h0;
+}
+
+static struct bof_stream_blob *bof_stream_lookup(bof_stream_t *stream,
+						 uint64_t hash, uint32_t size)
+{
+	unsigned i, mask = stream->blobs_size - 1;
+	struct bof_stream_blob *blob;
+
+	for (i = hash & mask;; i = (i + 1) & mask) {
+		blob = &stream->blobs[i];
+		if (!blob->offset || (blob->hash == hash && blob->size == size))
+			return blob;
+	}
+}
+
+static int bof_stream_grow_blobs(bof_stream_t *stream)
+{
+	struct bof_stream_blob *old = stream->blobs, *blob;
+	unsigned i, n = stream->blobs_size;
+
+	stream->blobs = calloc(n * 2, sizeof(*stream->blobs));
+	if (stream->blobs == NULL) {
+		stream->blobs = old;
+		return -ENOMEM;
+	}
+	stream->blobs_size = n * 2;
+	for (i = 0; i < n; i++) {
+		if (!old[i].offset)
+			continue;
+		blob = bof_stream_lookup(stream, old[i].hash, old[i].size);
+		*blob = old[i];
+	}
+	free(old);
+	return 0;
+}
+
+/* whether blob holds the size - 12 bytes at value */
+static int bof_stream_same(bof_stream_t *stream, struct bof_stream_blob *blob,
+			   const uint8_t *value, uint32_t size)
+{
+	uint64_t offset = blob->offset + 12, buffered;
+	uint8_t chunk[4096];
+	unsigned n;
+
+	size -= 12;
+	if (blob->offset >= stream->append_offset)
+		return !memcmp(blob->value, value, size);
+	/* the start of the blob may already be in the file */
+	buffered = stream->offset - stream->used;
+	while (size && offset < buffered) {
+		n = size < sizeof(chunk) ? size : sizeof(chunk);
+		if (offset + n > buffered)
+			n = buffered - offset;
+		if (pread(stream->fd, chunk, n, offset) != (ssize_t)n ||
+		    memcmp(chunk, value, n))
+			return 0;
+		offset += n;
+		value += n;
+		size -= n;
+	}
+	return !size || !memcmp(stream->buffer + (offset - buffered), value, size);
+}
+
+static int bof_stream_plan_add(bof_stream_t *stream, uint32_t size, uint64_t ref)
+{
+	struct bof_stream_plan *plan;
+	unsigned n;
+
+	if (stream->nplan == stream->plan_size) {
+		n = stream->plan_size ? stream->plan_size * 2 : 64;
+		plan = realloc(stream->plan, n * sizeof(*plan));
+		if (plan == NULL)
+			return -ENOMEM;
+		stream->plan = plan;
+		stream->plan_size = n;
+	}
+	stream->plan[stream->nplan].size = size;
+	stream->plan[stream->nplan++].ref = ref;
+	return 0;
+}
+
+/*
+ * First pass, in file order: decide which blobs become references and
+ * record the size each entry takes in the file.  Blobs are entered in the
+ * table at the offset they are about to be written at, so copies within
+ * the same append are found too.
+ */
+static int bof_stream_plan_rec(bof_stream_t *stream, bof_t *bof,
+			       uint64_t offset, uint64_t *size)
+{
+	struct bof_stream_blob *blob;
+	uint64_t hash, child;
+	unsigned i, slot;
+	int r;
+
+	switch (bof->type) {
+	case BOF_TYPE_NULL:
+		*size = 12;
+		return bof_stream_plan_add(stream, 0, 0);
+	case BOF_TYPE_STRING:
+	case BOF_TYPE_INT32:
+		*size = bof->size;
+		return bof_stream_plan_add(stream, bof->size, 0);
+	case BOF_TYPE_BLOB:
+		*size = bof->size;
+		if (bof->size - 12 < BOF_STREAM_DEDUP)
+			return bof_stream_plan_add(stream, bof->size, 0);
+		if (stream->nblobs * 2 >= stream->blobs_size) {
+			r = bof_stream_grow_blobs(stream);
+			if (r)
+				return r;
+		}
+		hash = bof_stream_hash(bof->value, bof->size - 12);
+		blob = bof_stream_lookup(stream, hash, bof->size);
+		if (blob->offset) {
+			/* a hash collision is stored in full, the table
+			 * keeps the first copy */
+			if (!bof_stream_same(stream, blob, bof->value, bof->size))
+				return bof_stream_plan_add(stream, bof->size, 0);
+			*size = 20;
+			return bof_stream_plan_add(stream, 0, blob->offset);
+		}
+		blob->hash = hash;
+		blob->offset = offset;
+		blob->size = bof->size;
+		blob->value = bof->value;
+		stream->nblobs++;
+		return bof_stream_plan_add(stream, bof->size, 0);
+	case BOF_TYPE_OBJECT:
+	case BOF_TYPE_ARRAY:
+		slot = stream->nplan;
+		r = bof_stream_plan_add(stream, 0, 0);
+		if (r)
+			return r;
+		*size = 12;
+		for (i = 0; i < bof->array_size; i++) {
+			r = bof_stream_plan_rec(stream, bof->array[i],
+						offset + *size, &child);
+			if (r)
+				return r;
+			*size += child;
+		}
+		if (*size > UINT32_MAX)
+			return -EFBIG;
+		stream->plan[slot].size = *size;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int bof_stream_write_fd(int fd, const void *data, size_t size)
+{
+	const uint8_t *ptr = data;
+	ssize_t r;
+
+	while (size) {
+		r = write(fd, ptr, size);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		ptr += r;
+		size -= r;
+	}
+	return 0;
+}
+
+static int bof_stream_drain(bof_stream_t *stream)
+{
+	int r;
+
+	r = bof_stream_write_fd(stream->fd, stream->buffer, stream->used);
+	stream->used = 0;
+	return r;
+}
+
+static int bof_stream_write(bof_stream_t *stream, const void *data, unsigned size)
+{
+	int r;
+
+	stream->offset += size;
+	if (stream->used + size <= BOF_STREAM_BUFFER) {
+		memcpy(stream->buffer + stream->used, data, size);
+		stream->used += size;
+		return 0;
+	}
+	r = bof_stream_drain(stream);
+	if (r)
+		return r;
+	/* big blobs go straight to the file */
+	if (size > BOF_STREAM_BUFFER / 2)
+		return bof_stream_write_fd(stream->fd, data, size);
+	memcpy(stream->buffer, data, size);
+	stream->used = size;
+	return 0;
+}
+
+/* second pass, same order as the first one */
+static int bof_stream_write_rec(bof_stream_t *stream, bof_t *bof, unsigned *n)
+{
+	struct bof_stream_plan *plan = &stream->plan[(*n)++];
+	uint32_t header[3];
+	unsigned i;
+	int r;
+
+	header[0] = bof->type;
+	header[1] = plan->size;
+	header[2] = bof->array_size;
+	if (bof->type == BOF_TYPE_BLOB && !plan->size) {
+		header[0] = BOF_TYPE_BLOB_REF;
+		header[1] = 20;
+		r = bof_stream_write(stream, header, 12);
+		if (r)
+			return r;
+		return bof_stream_write(stream, &plan->ref, 8);
+	}
+	r = bof_stream_write(stream, header, 12);
+	if (r)
+		return r;
+	switch (bof->type) {
+	case BOF_TYPE_STRING:
+	case BOF_TYPE_INT32:
+	case BOF_TYPE_BLOB:
+		return bof_stream_write(stream, bof->value, bof->size - 12);
+	case BOF_TYPE_OBJECT:
+	case BOF_TYPE_ARRAY:
+		for (i = 0; i < bof->array_size; i++) {
+			r = bof_stream_write_rec(stream, bof->array[i], n);
+			if (r)
+				return r;
+		}
+		break;
+	}
+	return 0;
+}
+
+bof_stream_t *bof_stream_open(const char *filename)
+{
+	bof_stream_t *stream;
+	uint32_t header[3] = { BOF_TYPE_ARRAY, 12, 0 };
+
+	stream = calloc(1, sizeof(bof_stream_t));
+	if (stream == NULL)
+		return NULL;
+	stream->buffer = malloc(BOF_STREAM_BUFFER);
+	stream->blobs_size = 256;
+	stream->blobs = calloc(stream->blobs_size, sizeof(*stream->blobs));
+	/* read back to compare blobs with their first copy */
+	stream->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (stream->buffer == NULL || stream->blobs == NULL || stream->fd < 0) {
+		fprintf(stderr, "%s failed to open file %s\n", __func__, filename);
+		if (stream->fd >= 0)
+			close(stream->fd);
+		free(stream->blobs);
+		free(stream->buffer);
+		free(stream);
+		return NULL;
+	}
+	bof_stream_write(stream, header, 12);
+	return stream;
+}
+
+int bof_stream_append(bof_stream_t *stream, bof_t *bof)
+{
+	uint64_t size;
+	unsigned n = 0;
+	int r;
+
+	if (stream->error)
+		return stream->error;
+	stream->nplan = 0;
+	stream->append_offset = stream->offset;
+	r = bof_stream_plan_rec(stream, bof, stream->offset, &size);
+	if (!r && stream->offset + size > UINT32_MAX)
+		r = -EFBIG;
+	if (r) {
+		/* the table may now point past the end of the file */
+		stream->error = r;
+		return r;
+	}
+	r = bof_stream_write_rec(stream, bof, &n);
+	if (r) {
+		stream->error = r;
+		return r;
+	}
+	stream->count++;
+	return 0;
+}
+
+int bof_stream_flush(bof_stream_t *stream)
+{
+	uint32_t header[3];
+	int r;
+
+	if (stream->error)
+		return stream->error;
+	r = bof_stream_drain(stream);
+	if (r) {
+		stream->error = r;
+		return r;
+	}
+	header[0] = BOF_TYPE_ARRAY;
+	header[1] = stream->offset;
+	header[2] = stream->count;
+	if (pwrite(stream->fd, header, 12, 0) != 12) {
+		stream->error = -EIO;
+		return -EIO;
+	}
+	return 0;
+}
+
+uint64_t bof_stream_size(bof_stream_t *stream)
+{
+	return stream->offset;
+}
+
+int bof_stream_close(bof_stream_t *stream)
+{
+	int r;
+
+	if (stream == NULL)
+		return 0;
+	r = bof_stream_flush(stream);
+	close(stream->fd);
+	free(stream->plan);
+	free(stream->blobs);
+	free(stream->buffer);
+	free(stream);
+	return r;
+}
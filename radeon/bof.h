@@ -35,8 +35,13 @@
 #define BOF_TYPE_OBJECT		3
 #define BOF_TYPE_ARRAY		4
 #define BOF_TYPE_INT32		5
+/* written by bof streams in place of a blob identical to an earlier one,
+ * a 64 bits file offset of that blob follows the header, loaded back as
+ * a plain blob */
+#define BOF_TYPE_BLOB_REF	6
 
 struct bof;
+struct bof_map;
 
 typedef struct bof {
 	struct bof	**array;
@@ -49,8 +54,15 @@ typedef struct bof {
 	uint32_t	array_size;
 	void		*value;
 	long		offset;
+	/* value points into this mapping instead of being allocated */
+	struct bof_map	*map;
+	/* value belongs to the caller, see bof_blob_borrow */
+	unsigned	borrowed;
 } bof_t;
 
+typedef struct bof_map bof_map_t;
+typedef struct bof_stream bof_stream_t;
+
 extern int bof_file_flush(bof_t *root);
 extern bof_t *bof_file_new(const char *filename);
 extern int bof_object_dump(bof_t *object, const char *filename);
@@ -66,6 +78,7 @@ extern bof_t *bof_array_get(bof_t *bof, unsigned i);
 extern unsigned bof_array_size(bof_t *bof);
 /* blob */
 extern bof_t *bof_blob(unsigned size, void *value);
+extern bof_t *bof_blob_borrow(unsigned size, const void *value);
 extern unsigned bof_blob_size(bof_t *bof);
 extern void *bof_blob_value(bof_t *bof);
 /* string */
@@ -79,6 +92,24 @@ extern void bof_incref(bof_t *bof);
 extern bof_t *bof_load_file(const char *filename);
 extern int bof_dump_file(bof_t *bof, const char *filename);
 extern void bof_print(bof_t *bof);
+/* read only memory mapped file, entries are numbered in file order with
+ * the root object as entry 0, so 0 also means no such entry */
+extern bof_map_t *bof_map_file(const char *filename);
+extern void bof_map_close(bof_map_t *map);
+extern unsigned bof_map_size(bof_map_t *map);
+extern uint32_t bof_map_type(bof_map_t *map, unsigned entry);
+extern unsigned bof_map_child(bof_map_t *map, unsigned entry);
+extern unsigned bof_map_next(bof_map_t *map, unsigned entry);
+extern const void *bof_map_value(bof_map_t *map, unsigned entry, unsigned *size);
+extern unsigned bof_map_object_get(bof_map_t *map, unsigned object, const char *keyname);
+extern bof_t *bof_map_load(bof_map_t *map, unsigned entry);
+/* file growing by one root array entry per append, with buffered writes
+ * and blobs identical to one already in the file written as references */
+extern bof_stream_t *bof_stream_open(const char *filename);
+extern int bof_stream_append(bof_stream_t *stream, bof_t *bof);
+extern int bof_stream_flush(bof_stream_t *stream);
+extern uint64_t bof_stream_size(bof_stream_t *stream);
+extern int bof_stream_close(bof_stream_t *stream);
 
 static inline int bof_is_object(bof_t *bof){return (bof->type == BOF_TYPE_OBJECT);}
 static inline int bof_is_blob(bof_t *bof){return (bof->type == BOF_TYPE_BLOB);}
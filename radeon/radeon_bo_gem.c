@@ -36,8 +36,11 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include "libdrm_lists.h"
 #include "xf86drm.h"
 #include "xf86atomic.h"
 #include "drm.h"
@@ -52,14 +55,196 @@ struct radeon_bo_gem {
     int                     map_count;
     atomic_t                reloc_in_cs;
     void                    *priv_ptr;
+    /* private bo which can go back to the reuse cache */
+    int                     reusable;
+    int                     tiled;
+    drmMMListHead           bucket_list;
+    drmMMListHead           lru_list;
+    uint64_t                free_time;
+};
+
+#define BO_CACHE_MAX_SIZE       (64 * 1024 * 1024)
+#define BO_CACHE_NUM_BUCKETS    64
+#define BO_CACHE_DEFAULT_BYTES  (256 * 1024 * 1024)
+#define BO_CACHE_DEFAULT_AGE    1000
+
+struct bo_cache_bucket {
+    uint32_t                    size;
+    drmMMListHead               list;
 };
 
 struct bo_manager_gem {
     struct radeon_bo_manager    base;
+    pthread_mutex_t             cache_mutex;
+    int                         reuse;
+    unsigned                    num_buckets;
+    struct bo_cache_bucket      buckets[BO_CACHE_NUM_BUCKETS];
+    /* all cached bos, least recently freed first */
+    drmMMListHead               lru;
+    uint64_t                    cached_bytes;
+    uint64_t                    max_bytes;
+    unsigned                    max_age;
 };
 
 static int bo_wait(struct radeon_bo_int *boi);
-    
+static int bo_is_busy(struct radeon_bo_int *boi, uint32_t *domain);
+static int bo_set_tiling(struct radeon_bo_int *boi, uint32_t tiling_flags,
+                         uint32_t pitch);
+
+static uint64_t bo_cache_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void bo_cache_add_bucket(struct bo_manager_gem *bomg, uint32_t size)
+{
+    struct bo_cache_bucket *bucket = &bomg->buckets[bomg->num_buckets++];
+
+    bucket->size = size;
+    DRMINITLISTHEAD(&bucket->list);
+}
+
+/**
+ * Same bucket sizes as the other drivers use: powers of two with 3 sizes in
+ * between, so rounding up an allocation wastes at most a quarter of it.
+ */
+static void bo_cache_init(struct bo_manager_gem *bomg)
+{
+    uint32_t size;
+
+    bo_cache_add_bucket(bomg, 4096);
+    bo_cache_add_bucket(bomg, 4096 * 2);
+    bo_cache_add_bucket(bomg, 4096 * 3);
+    for (size = 4 * 4096; size <= BO_CACHE_MAX_SIZE; size *= 2) {
+        bo_cache_add_bucket(bomg, size);
+        bo_cache_add_bucket(bomg, size + size * 1 / 4);
+        bo_cache_add_bucket(bomg, size + size * 2 / 4);
+        bo_cache_add_bucket(bomg, size + size * 3 / 4);
+    }
+    DRMINITLISTHEAD(&bomg->lru);
+    bomg->max_bytes = BO_CACHE_DEFAULT_BYTES;
+    bomg->max_age = BO_CACHE_DEFAULT_AGE;
+}
+
+static struct bo_cache_bucket *bo_cache_get_bucket(struct bo_manager_gem *bomg,
+                                                   uint32_t size)
+{
+    unsigned i;
+
+    for (i = 0; i < bomg->num_buckets; i++) {
+        if (bomg->buckets[i].size >= size) {
+            return &bomg->buckets[i];
+        }
+    }
+    return NULL;
+}
+
+static void bo_destroy(struct radeon_bo_gem *bo_gem)
+{
+    struct radeon_bo_int *boi = &bo_gem->base;
+    struct drm_gem_close args;
+
+    if (bo_gem->priv_ptr) {
+        munmap(bo_gem->priv_ptr, boi->size);
+    }
+
+    /* Zero out args to make valgrind happy */
+    memset(&args, 0, sizeof(args));
+
+    /* close object */
+    args.handle = boi->handle;
+    drmIoctl(boi->bom->fd, DRM_IOCTL_GEM_CLOSE, &args);
+    memset(bo_gem, 0, sizeof(struct radeon_bo_gem));
+    free(bo_gem);
+}
+
+static void bo_cache_remove(struct bo_manager_gem *bomg,
+                            struct radeon_bo_gem *bo_gem)
+{
+    DRMLISTDEL(&bo_gem->bucket_list);
+    DRMLISTDEL(&bo_gem->lru_list);
+    bomg->cached_bytes -= bo_gem->base.size;
+}
+
+/**
+ * Undo bo_cache_remove, keeping the lru in free order.  Called with
+ * cache_mutex held.
+ */
+static void bo_cache_restore(struct bo_manager_gem *bomg,
+                             struct bo_cache_bucket *bucket,
+                             struct radeon_bo_gem *bo_gem)
+{
+    drmMMListHead *pos = bomg->lru.next;
+
+    while (pos != &bomg->lru &&
+           DRMLISTENTRY(struct radeon_bo_gem, pos, lru_list)->free_time <=
+           bo_gem->free_time) {
+        pos = pos->next;
+    }
+    DRMLISTADD(&bo_gem->bucket_list, &bucket->list);
+    DRMLISTADDTAIL(&bo_gem->lru_list, pos);
+    bomg->cached_bytes += bo_gem->base.size;
+}
+
+/**
+ * Release cached bos which are too old or over the memory budget, least
+ * recently freed first.  Called with cache_mutex held.
+ */
+static void bo_cache_trim(struct bo_manager_gem *bomg, uint64_t now,
+                          uint64_t max_bytes)
+{
+    struct radeon_bo_gem *bo_gem;
+
+    while (!DRMLISTEMPTY(&bomg->lru)) {
+        bo_gem = DRMLISTENTRY(struct radeon_bo_gem, bomg->lru.next, lru_list);
+        if (bomg->cached_bytes <= max_bytes &&
+            now - bo_gem->free_time <= bomg->max_age) {
+            break;
+        }
+        bo_cache_remove(bomg, bo_gem);
+        bo_destroy(bo_gem);
+    }
+}
+
+/**
+ * Take an idle cached bo matching the allocation.  The bucket is in free
+ * order so once the oldest match is busy the newer ones are too.  The
+ * match is taken out of the cache to be probed without cache_mutex, and
+ * goes back when busy.
+ */
+static struct radeon_bo_gem *bo_cache_find(struct bo_manager_gem *bomg,
+                                           struct bo_cache_bucket *bucket,
+                                           uint32_t alignment,
+                                           uint32_t domains,
+                                           uint32_t flags)
+{
+    struct radeon_bo_gem *bo_gem, *found = NULL;
+    uint32_t domain;
+
+    pthread_mutex_lock(&bomg->cache_mutex);
+    DRMLISTFOREACHENTRY(bo_gem, &bucket->list, bucket_list) {
+        if (bo_gem->base.alignment == alignment &&
+            bo_gem->base.domains == domains &&
+            bo_gem->base.flags == flags) {
+            bo_cache_remove(bomg, bo_gem);
+            found = bo_gem;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&bomg->cache_mutex);
+    if (found == NULL || bo_is_busy(&found->base, &domain) == 0) {
+        return found;
+    }
+
+    pthread_mutex_lock(&bomg->cache_mutex);
+    bo_cache_restore(bomg, bucket, found);
+    pthread_mutex_unlock(&bomg->cache_mutex);
+    return NULL;
+}
+
 static struct radeon_bo *bo_open(struct radeon_bo_manager *bom,
                                  uint32_t handle,
                                  uint32_t size,
@@ -67,9 +252,34 @@ static struct radeon_bo *bo_open(struct radeon_bo_manager *bom,
                                  uint32_t domains,
                                  uint32_t flags)
 {
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)bom;
+    struct bo_cache_bucket *bucket = NULL;
     struct radeon_bo_gem *bo;
     int r;
 
+    if (!handle && bomg->reuse) {
+        bucket = bo_cache_get_bucket(bomg, size);
+    }
+    if (bucket) {
+        size = bucket->size;
+        bo = bo_cache_find(bomg, bucket, alignment, domains, flags);
+        if (bo) {
+            if (bo->tiled) {
+                bo_set_tiling(&bo->base, 0, 0);
+            }
+            if (!bo->tiled) {
+                bo->map_count = 0;
+                bo->base.ptr = NULL;
+                bo->base.space_accounted = 0;
+                bo->base.referenced_in_cs = 0;
+                atomic_set(&bo->reloc_in_cs, 0);
+                radeon_bo_ref((struct radeon_bo*)bo);
+                return (struct radeon_bo*)bo;
+            }
+            bo_destroy(bo);
+        }
+    }
+
     bo = (struct radeon_bo_gem*)calloc(1, sizeof(struct radeon_bo_gem));
     if (bo == NULL) {
         return NULL;
@@ -107,7 +317,17 @@ static struct radeon_bo *bo_open(struct radeon_bo_manager *bom,
         args.handle = 0;
         r = drmCommandWriteRead(bom->fd, DRM_RADEON_GEM_CREATE,
                                 &args, sizeof(args));
+        if (r && bomg->reuse) {
+            /* give the memory held by the cache back and try again */
+            pthread_mutex_lock(&bomg->cache_mutex);
+            bo_cache_trim(bomg, bo_cache_now(), 0);
+            pthread_mutex_unlock(&bomg->cache_mutex);
+            args.handle = 0;
+            r = drmCommandWriteRead(bom->fd, DRM_RADEON_GEM_CREATE,
+                                    &args, sizeof(args));
+        }
         bo->base.handle = args.handle;
+        bo->reusable = bucket != NULL;
         if (r) {
             fprintf(stderr, "Failed to allocate :\n");
             fprintf(stderr, "   size      : %d bytes\n", size);
@@ -128,23 +348,25 @@ static void bo_ref(struct radeon_bo_int *boi)
 static struct radeon_bo *bo_unref(struct radeon_bo_int *boi)
 {
     struct radeon_bo_gem *bo_gem = (struct radeon_bo_gem*)boi;
-    struct drm_gem_close args;
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)boi->bom;
+    struct bo_cache_bucket *bucket;
 
     if (boi->cref) {
         return (struct radeon_bo *)boi;
     }
-    if (bo_gem->priv_ptr) {
-        munmap(bo_gem->priv_ptr, boi->size);
+    if (bo_gem->reusable && bomg->reuse &&
+        (bucket = bo_cache_get_bucket(bomg, boi->size)) != NULL &&
+        boi->size <= bomg->max_bytes) {
+        pthread_mutex_lock(&bomg->cache_mutex);
+        bo_gem->free_time = bo_cache_now();
+        DRMLISTADDTAIL(&bo_gem->bucket_list, &bucket->list);
+        DRMLISTADDTAIL(&bo_gem->lru_list, &bomg->lru);
+        bomg->cached_bytes += boi->size;
+        bo_cache_trim(bomg, bo_gem->free_time, bomg->max_bytes);
+        pthread_mutex_unlock(&bomg->cache_mutex);
+        return NULL;
     }
-
-    /* Zero out args to make valgrind happy */
-    memset(&args, 0, sizeof(args));
-
-    /* close object */
-    args.handle = boi->handle;
-    drmIoctl(boi->bom->fd, DRM_IOCTL_GEM_CLOSE, &args);
-    memset(bo_gem, 0, sizeof(struct radeon_bo_gem));
-    free(bo_gem);
+    bo_destroy(bo_gem);
     return NULL;
 }
 
@@ -246,6 +468,9 @@ static int bo_set_tiling(struct radeon_bo_int *boi, uint32_t tiling_flags,
                             DRM_RADEON_GEM_SET_TILING,
                             &args,
                             sizeof(args));
+    if (r == 0) {
+        ((struct radeon_bo_gem*)boi)->tiled = tiling_flags || pitch;
+    }
     return r;
 }
 
@@ -293,6 +518,8 @@ struct radeon_bo_manager *radeon_bo_manager_gem_ctor(int fd)
     }
     bomg->base.funcs = &bo_gem_funcs;
     bomg->base.fd = fd;
+    pthread_mutex_init(&bomg->cache_mutex, NULL);
+    bo_cache_init(bomg);
     return (struct radeon_bo_manager*)bomg;
 }
 
@@ -303,9 +530,51 @@ void radeon_bo_manager_gem_dtor(struct radeon_bo_manager *bom)
     if (bom == NULL) {
         return;
     }
+    bo_cache_trim(bomg, bo_cache_now(), 0);
+    pthread_mutex_destroy(&bomg->cache_mutex);
     free(bomg);
 }
 
+/**
+ * Enable reuse of freed private bos for later allocations of the same
+ * size bucket, alignment, domains and flags.  Allocations are rounded up
+ * to the bucket size and a reused bo is not cleared.
+ */
+void radeon_bo_manager_gem_enable_reuse(struct radeon_bo_manager *bom)
+{
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)bom;
+
+    bomg->reuse = 1;
+}
+
+/**
+ * Limit the memory held by idle cached bos to max_bytes, and release the
+ * ones which were not reused within max_age milliseconds.
+ */
+void radeon_bo_manager_gem_set_cache_limits(struct radeon_bo_manager *bom,
+                                            uint64_t max_bytes,
+                                            unsigned max_age)
+{
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)bom;
+
+    pthread_mutex_lock(&bomg->cache_mutex);
+    bomg->max_bytes = max_bytes;
+    bomg->max_age = max_age;
+    bo_cache_trim(bomg, bo_cache_now(), max_bytes);
+    pthread_mutex_unlock(&bomg->cache_mutex);
+}
+
+uint64_t radeon_bo_manager_gem_cached_bytes(struct radeon_bo_manager *bom)
+{
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)bom;
+    uint64_t bytes;
+
+    pthread_mutex_lock(&bomg->cache_mutex);
+    bytes = bomg->cached_bytes;
+    pthread_mutex_unlock(&bomg->cache_mutex);
+    return bytes;
+}
+
 uint32_t radeon_gem_name_bo(struct radeon_bo *bo)
 {
     struct radeon_bo_gem *bo_gem = (struct radeon_bo_gem*)bo;
@@ -334,6 +603,8 @@ int radeon_gem_get_kernel_name(struct radeon_bo *bo, uint32_t *name)
     if (r) {
         return r;
     }
+    /* others can see the bo now, it must not be reused */
+    bo_gem->reusable = 0;
     bo_gem->name = flink.name;
     *name = flink.name;
     return 0;
@@ -362,6 +633,9 @@ int radeon_gem_prime_share_bo(struct radeon_bo *bo, int *handle)
     int ret;
 
     ret = drmPrimeHandleToFD(bo_gem->base.bom->fd, bo->handle, DRM_CLOEXEC, handle);
+    if (ret == 0) {
+        bo_gem->reusable = 0;
+    }
     return ret;
 }
 
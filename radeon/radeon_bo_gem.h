@@ -36,6 +36,11 @@
 
 struct radeon_bo_manager *radeon_bo_manager_gem_ctor(int fd);
 void radeon_bo_manager_gem_dtor(struct radeon_bo_manager *bom);
+void radeon_bo_manager_gem_enable_reuse(struct radeon_bo_manager *bom);
+void radeon_bo_manager_gem_set_cache_limits(struct radeon_bo_manager *bom,
+                                            uint64_t max_bytes,
+                                            unsigned max_age);
+uint64_t radeon_bo_manager_gem_cached_bytes(struct radeon_bo_manager *bom);
 
 uint32_t radeon_gem_name_bo(struct radeon_bo *bo);
 void *radeon_gem_get_reloc_in_cs(struct radeon_bo *bo);
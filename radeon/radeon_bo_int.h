@@ -18,6 +18,8 @@ struct radeon_bo_int {
     struct radeon_bo_manager    *bom;
     uint32_t                    space_accounted;
     uint32_t                    referenced_in_cs;
+    /* space epoch of the last change to space_accounted */
+    uint32_t                    space_epoch;
 };
 
 /* bo functions */
@@ -67,6 +67,12 @@ int radeon_cs_need_flush(struct radeon_cs *cs)
     return csi->csm->funcs->cs_need_flush(csi);
 }
 
+int radeon_cs_reserve(struct radeon_cs *cs, uint32_t ndw)
+{
+    struct radeon_cs_int *csi = (struct radeon_cs_int *)cs;
+    return csi->csm->funcs->cs_reserve(csi, ndw);
+}
+
 void radeon_cs_print(struct radeon_cs *cs, FILE *file)
 {
     struct radeon_cs_int *csi = (struct radeon_cs_int *)cs;
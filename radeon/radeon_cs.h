@@ -77,6 +77,15 @@ extern int radeon_cs_emit(struct radeon_cs *cs);
 extern int radeon_cs_destroy(struct radeon_cs *cs);
 extern int radeon_cs_erase(struct radeon_cs *cs);
 extern int radeon_cs_need_flush(struct radeon_cs *cs);
+/*
+ * Make room for ndw dwords written without a section, the way
+ * radeon_cs_begin does.  When they would not fit in the submission, the
+ * callback given to radeon_cs_space_set_flush is called to flush the cs
+ * at this packet boundary.  Without a callback -ENOSPC is returned, for
+ * the driver to flush, emit its state again and retry.  Fails with
+ * -EINVAL when ndw dwords do not fit in any submission.
+ */
+extern int radeon_cs_reserve(struct radeon_cs *cs, uint32_t ndw);
 extern void radeon_cs_print(struct radeon_cs *cs, FILE *file);
 extern void radeon_cs_set_limit(struct radeon_cs *cs, uint32_t domain, uint32_t limit);
 extern void radeon_cs_space_set_flush(struct radeon_cs *cs, void (*fn)(void *), void *data);
@@ -31,6 +31,7 @@
  */
 #include <assert.h>
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
@@ -49,10 +50,35 @@
 
 #define CS_BOF_DUMP 0
 
+/* dwords the kernel is handed in one submission */
+#define CS_GEM_IB_SIZE          (64 * 1024 / 4)
+/* initial number of relocations of a cs, one page worth */
+#define CS_GEM_INITIAL_RELOCS   (4096 / (4 * 4))
+/* reloc tables kept around by the manager for later cs */
+#define CS_GEM_RELOC_CACHE      4
+/* capture files roll over before bof sizes overflow */
+#define CS_GEM_CAPTURE_MAX      (1ULL << 31)
+
+struct cs_reloc_storage {
+    unsigned                    nrelocs;
+    uint32_t                    *relocs;
+    struct radeon_bo_int        **relocs_bo;
+    uint32_t                    *reloc_hash;
+};
+
 struct radeon_cs_manager_gem {
     struct radeon_cs_manager    base;
     uint32_t                    device_id;
     unsigned                    nbof;
+    pthread_mutex_t             reloc_mutex;
+    unsigned                    nreloc_cache;
+    struct cs_reloc_storage     reloc_cache[CS_GEM_RELOC_CACHE];
+    pthread_mutex_t             capture_mutex;
+    /* whether capture is set, read without the mutex by cs_gem_capture */
+    atomic_t                    capturing;
+    bof_stream_t                *capture;
+    char                        *capture_name;
+    uint64_t                    capture_max;
 };
 
 #pragma pack(1)
@@ -73,6 +99,8 @@ struct cs_gem {
     unsigned                    nrelocs;
     uint32_t                    *relocs;
     struct radeon_bo_int        **relocs_bo;
+    /* open addressed handle -> reloc index + 1 map, 2 * nrelocs entries */
+    uint32_t                    *reloc_hash;
 };
 
 static pthread_mutex_t id_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -89,7 +117,8 @@ static uint32_t get_first_zero(const uint32_t n)
 
 /**
  * Returns a free id for cs.
- * If there is no free id we return zero
+ * If there is no free id we return zero, such a cs does not get the
+ * reloc_in_cs filter and always looks relocs up in its reloc hash.
  **/
 static uint32_t generate_id(void)
 {
@@ -119,22 +148,173 @@ static void free_id(uint32_t id)
     pthread_mutex_unlock( &id_mutex );
 }
 
+/**
+ * Get reloc tables for a new cs, preferably ones a destroyed cs left
+ * behind, so that a cs does not have to grow them again from scratch.
+ */
+static int cs_gem_get_reloc_storage(struct radeon_cs_manager_gem *csm,
+                                    struct cs_gem *csg)
+{
+    struct cs_reloc_storage *storage = NULL;
+
+    pthread_mutex_lock(&csm->reloc_mutex);
+    if (csm->nreloc_cache) {
+        storage = &csm->reloc_cache[--csm->nreloc_cache];
+        csg->nrelocs = storage->nrelocs;
+        csg->relocs = storage->relocs;
+        csg->relocs_bo = storage->relocs_bo;
+        csg->reloc_hash = storage->reloc_hash;
+    }
+    pthread_mutex_unlock(&csm->reloc_mutex);
+    if (storage) {
+        return 0;
+    }
+
+    csg->nrelocs = CS_GEM_INITIAL_RELOCS;
+    csg->relocs_bo = (struct radeon_bo_int**)calloc(1,
+                                                csg->nrelocs*sizeof(void*));
+    if (csg->relocs_bo == NULL) {
+        return -ENOMEM;
+    }
+    csg->relocs = (uint32_t*)calloc(1, csg->nrelocs * RELOC_SIZE * 4);
+    if (csg->relocs == NULL) {
+        free(csg->relocs_bo);
+        return -ENOMEM;
+    }
+    csg->reloc_hash = (uint32_t*)calloc(2 * csg->nrelocs, sizeof(uint32_t));
+    if (csg->reloc_hash == NULL) {
+        free(csg->relocs);
+        free(csg->relocs_bo);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/**
+ * Hand the reloc tables of a destroyed cs back to the manager, keeping the
+ * largest ones.
+ */
+static void cs_gem_put_reloc_storage(struct radeon_cs_manager_gem *csm,
+                                     struct cs_gem *csg)
+{
+    struct cs_reloc_storage victim, *storage;
+    unsigned i, smallest = 0;
+
+    victim.nrelocs = csg->nrelocs;
+    victim.relocs = csg->relocs;
+    victim.relocs_bo = csg->relocs_bo;
+    victim.reloc_hash = csg->reloc_hash;
+    memset(victim.reloc_hash, 0, 2 * victim.nrelocs * sizeof(uint32_t));
+
+    pthread_mutex_lock(&csm->reloc_mutex);
+    if (csm->nreloc_cache < CS_GEM_RELOC_CACHE) {
+        csm->reloc_cache[csm->nreloc_cache++] = victim;
+        victim.relocs = NULL;
+        victim.relocs_bo = NULL;
+        victim.reloc_hash = NULL;
+    } else {
+        for (i = 1; i < CS_GEM_RELOC_CACHE; i++) {
+            if (csm->reloc_cache[i].nrelocs <
+                csm->reloc_cache[smallest].nrelocs)
+                smallest = i;
+        }
+        storage = &csm->reloc_cache[smallest];
+        if (storage->nrelocs < victim.nrelocs) {
+            struct cs_reloc_storage tmp = *storage;
+            *storage = victim;
+            victim = tmp;
+        }
+    }
+    pthread_mutex_unlock(&csm->reloc_mutex);
+
+    free(victim.relocs_bo);
+    free(victim.relocs);
+    free(victim.reloc_hash);
+}
+
+static inline unsigned cs_gem_hash_slot(struct cs_gem *csg, uint32_t handle)
+{
+    return (handle * 2654435761u) & (2 * csg->nrelocs - 1);
+}
+
+/**
+ * Returns the index of the reloc of handle in the cs, or -1.
+ */
+static int cs_gem_find_reloc(struct cs_gem *csg, uint32_t handle)
+{
+    unsigned mask = 2 * csg->nrelocs - 1;
+    unsigned slot = cs_gem_hash_slot(csg, handle);
+    uint32_t idx;
+
+    while ((idx = csg->reloc_hash[slot]) != 0) {
+        if (csg->relocs[(idx - 1) * RELOC_SIZE] == handle)
+            return idx - 1;
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+static void cs_gem_hash_reloc(struct cs_gem *csg, uint32_t handle,
+                              unsigned i)
+{
+    unsigned mask = 2 * csg->nrelocs - 1;
+    unsigned slot = cs_gem_hash_slot(csg, handle);
+
+    while (csg->reloc_hash[slot] != 0)
+        slot = (slot + 1) & mask;
+    csg->reloc_hash[slot] = i + 1;
+}
+
+/**
+ * Grow the reloc tables geometrically so that building a cs with n
+ * relocations costs O(n) copies overall.
+ */
+static int cs_gem_grow_relocs(struct cs_gem *csg)
+{
+    struct radeon_bo_int **relocs_bo;
+    uint32_t *relocs, *reloc_hash;
+    unsigned i, nrelocs = csg->nrelocs * 2;
+
+    relocs_bo = (struct radeon_bo_int **)realloc(csg->relocs_bo,
+                                                 nrelocs * sizeof(void*));
+    if (relocs_bo == NULL) {
+        return -ENOMEM;
+    }
+    csg->relocs_bo = relocs_bo;
+    relocs = (uint32_t*)realloc(csg->relocs, nrelocs * RELOC_SIZE * 4);
+    if (relocs == NULL) {
+        return -ENOMEM;
+    }
+    csg->base.relocs = csg->relocs = relocs;
+    reloc_hash = (uint32_t*)calloc(2 * nrelocs, sizeof(uint32_t));
+    if (reloc_hash == NULL) {
+        return -ENOMEM;
+    }
+    free(csg->reloc_hash);
+    csg->reloc_hash = reloc_hash;
+    csg->nrelocs = nrelocs;
+    csg->chunks[1].chunk_data = (uint64_t)(uintptr_t)csg->relocs;
+    for (i = 0; i < csg->base.crelocs; i++) {
+        cs_gem_hash_reloc(csg, csg->relocs[i * RELOC_SIZE], i);
+    }
+    return 0;
+}
+
 static struct radeon_cs_int *cs_gem_create(struct radeon_cs_manager *csm,
                                        uint32_t ndw)
 {
     struct cs_gem *csg;
 
-    /* max cmd buffer size is 64Kb */
-    if (ndw > (64 * 1024 / 4)) {
-        return NULL;
-    }
+    /* submissions are flushed at CS_GEM_IB_SIZE, so that is all a cs
+     * ever holds whatever size is asked for */
+    ndw = CS_GEM_IB_SIZE;
     csg = (struct cs_gem*)calloc(1, sizeof(struct cs_gem));
     if (csg == NULL) {
         return NULL;
     }
     csg->base.csm = csm;
-    csg->base.ndw = 64 * 1024 / 4;
-    csg->base.packets = (uint32_t*)calloc(1, 64 * 1024);
+    csg->base.ndw = ndw;
+    csg->base.packets = (uint32_t*)calloc(ndw, 4);
     if (csg->base.packets == NULL) {
         free(csg);
         return NULL;
@@ -142,21 +322,13 @@ static struct radeon_cs_int *cs_gem_create(struct radeon_cs_manager *csm,
     csg->base.relocs_total_size = 0;
     csg->base.crelocs = 0;
     csg->base.id = generate_id();
-    csg->nrelocs = 4096 / (4 * 4) ;
-    csg->relocs_bo = (struct radeon_bo_int**)calloc(1,
-                                                csg->nrelocs*sizeof(void*));
-    if (csg->relocs_bo == NULL) {
-        free(csg->base.packets);
-        free(csg);
-        return NULL;
-    }
-    csg->base.relocs = csg->relocs = (uint32_t*)calloc(1, 4096);
-    if (csg->relocs == NULL) {
-        free(csg->relocs_bo);
+    if (cs_gem_get_reloc_storage((struct radeon_cs_manager_gem *)csm, csg)) {
+        free_id(csg->base.id);
         free(csg->base.packets);
         free(csg);
         return NULL;
     }
+    csg->base.relocs = csg->relocs;
     csg->chunks[0].chunk_id = RADEON_CHUNK_ID_IB;
     csg->chunks[0].length_dw = 0;
     csg->chunks[0].chunk_data = (uint64_t)(uintptr_t)csg->base.packets;
@@ -176,7 +348,7 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     struct cs_gem *csg = (struct cs_gem*)cs;
     struct cs_reloc_gem *reloc;
     uint32_t idx;
-    unsigned i;
+    int i;
 
     assert(boi->space_accounted);
 
@@ -195,65 +367,51 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     }
     /* use bit field hash function to determine
        if this bo is for sure not in this cs.*/
-    if ((atomic_read((atomic_t *)radeon_gem_get_reloc_in_cs(bo)) & cs->id)) {
-        /* check if bo is already referenced.
-         * Scanning from end to begin reduces cycles with mesa because
-         * it often relocates same shared dma bo again. */
-        for(i = cs->crelocs; i != 0;) {
-            --i;
+    if (!cs->id ||
+        (atomic_read((atomic_t *)radeon_gem_get_reloc_in_cs(bo)) & cs->id)) {
+        /* check if bo is already referenced, reloc_in_cs only tells for
+         * sure when it is not. */
+        i = cs_gem_find_reloc(csg, bo->handle);
+        if (i >= 0) {
             idx = i * RELOC_SIZE;
             reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
-            if (reloc->handle == bo->handle) {
-                /* Check domains must be in read or write. As we check already
-                 * checked that in argument one of the read or write domain was
-                 * set we only need to check that if previous reloc as the read
-                 * domain set then the read_domain should also be set for this
-                 * new relocation.
-                 */
-                /* the DDX expects to read and write from same pixmap */
-                if (write_domain && (reloc->read_domain & write_domain)) {
-                    reloc->read_domain = 0;
-                    reloc->write_domain = write_domain;
-                } else if (read_domain & reloc->write_domain) {
-                    reloc->read_domain = 0;
-                } else {
-                    if (write_domain != reloc->write_domain)
-                        return -EINVAL;
-                    if (read_domain != reloc->read_domain)
-                        return -EINVAL;
-                }
-
-                reloc->read_domain |= read_domain;
-                reloc->write_domain |= write_domain;
-                /* update flags */
-                reloc->flags |= (flags & reloc->flags);
-                /* write relocation packet */
-                radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
-                radeon_cs_write_dword((struct radeon_cs *)cs, idx);
-                return 0;
+            /* Check domains must be in read or write. As we check already
+             * checked that in argument one of the read or write domain was
+             * set we only need to check that if previous reloc as the read
+             * domain set then the read_domain should also be set for this
+             * new relocation.
+             */
+            /* the DDX expects to read and write from same pixmap */
+            if (write_domain && (reloc->read_domain & write_domain)) {
+                reloc->read_domain = 0;
+                reloc->write_domain = write_domain;
+            } else if (read_domain & reloc->write_domain) {
+                reloc->read_domain = 0;
+            } else {
+                if (write_domain != reloc->write_domain)
+                    return -EINVAL;
+                if (read_domain != reloc->read_domain)
+                    return -EINVAL;
             }
+
+            reloc->read_domain |= read_domain;
+            reloc->write_domain |= write_domain;
+            /* update flags */
+            reloc->flags |= (flags & reloc->flags);
+            /* write relocation packet */
+            radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
+            radeon_cs_write_dword((struct radeon_cs *)cs, idx);
+            return 0;
         }
     }
     /* new relocation */
     if (csg->base.crelocs >= csg->nrelocs) {
-        /* allocate more memory (TODO: should use a slab allocatore maybe) */
-        uint32_t *tmp, size;
-        size = ((csg->nrelocs + 1) * sizeof(struct radeon_bo*));
-        tmp = (uint32_t*)realloc(csg->relocs_bo, size);
-        if (tmp == NULL) {
-            return -ENOMEM;
-        }
-        csg->relocs_bo = (struct radeon_bo_int **)tmp;
-        size = ((csg->nrelocs + 1) * RELOC_SIZE * 4);
-        tmp = (uint32_t*)realloc(csg->relocs, size);
-        if (tmp == NULL) {
+        if (cs_gem_grow_relocs(csg)) {
             return -ENOMEM;
         }
-        cs->relocs = csg->relocs = tmp;
-        csg->nrelocs += 1;
-        csg->chunks[1].chunk_data = (uint64_t)(uintptr_t)csg->relocs;
     }
     csg->relocs_bo[csg->base.crelocs] = boi;
+    cs_gem_hash_reloc(csg, bo->handle, csg->base.crelocs);
     idx = (csg->base.crelocs++) * RELOC_SIZE;
     reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
     reloc->handle = bo->handle;
@@ -270,12 +428,39 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     return 0;
 }
 
+/*
+ * Make room for ndw more dwords.  Outside of a section the cs is at a
+ * packet boundary, so when they would take the submission past the ib
+ * size and the driver set a space flush callback, it is called to flush
+ * and emit its state again.  Without one nothing is submitted behind the
+ * driver's back: -ENOSPC tells it to flush and re-emit its state itself.
+ * The memory limits are left to radeon_cs_space_check.  A section which
+ * does not fit in a submission of its own is an error, as the kernel
+ * rejects ibs bigger than CS_GEM_IB_SIZE.
+ */
+static int cs_gem_reserve(struct radeon_cs_int *cs, uint32_t ndw)
+{
+    if (ndw + 7 > CS_GEM_IB_SIZE) {
+        return -EINVAL;
+    }
+    if (!cs->section_ndw && cs->cdw && cs->cdw + ndw + 7 > CS_GEM_IB_SIZE &&
+        cs->space_flush_fn) {
+        (*cs->space_flush_fn)(cs->space_flush_data);
+    }
+    /* in a section, without a callback, or the driver's state is too big */
+    if (cs->cdw + ndw + 7 > CS_GEM_IB_SIZE) {
+        return -ENOSPC;
+    }
+    return 0;
+}
+
 static int cs_gem_begin(struct radeon_cs_int *cs,
                         uint32_t ndw,
                         const char *file,
                         const char *func,
                         int line)
 {
+    int r;
 
     if (cs->section_ndw) {
         fprintf(stderr, "CS already in a section(%s,%s,%d)\n",
@@ -284,24 +469,15 @@ static int cs_gem_begin(struct radeon_cs_int *cs,
                 file, func, line);
         return -EPIPE;
     }
+    r = cs_gem_reserve(cs, ndw);
+    if (r) {
+        return r;
+    }
     cs->section_ndw = ndw;
     cs->section_cdw = 0;
     cs->section_file = file;
     cs->section_func = func;
     cs->section_line = line;
-
-    if (cs->cdw + ndw > cs->ndw) {
-        uint32_t tmp, *ptr;
-
-        /* round up the required size to a multiple of 1024 */
-        tmp = (cs->cdw + ndw + 0x3FF) & (~0x3FF);
-        ptr = (uint32_t*)realloc(cs->packets, 4 * tmp);
-        if (ptr == NULL) {
-            return -ENOMEM;
-        }
-        cs->packets = ptr;
-        cs->ndw = tmp;
-    }
     return 0;
 }
 
@@ -330,29 +506,40 @@ static int cs_gem_end(struct radeon_cs_int *cs,
     return 0;
 }
 
-#if CS_BOF_DUMP
-static void cs_gem_dump_bof(struct radeon_cs_int *cs)
+static void cs_gem_unmap_bos(struct cs_gem *csg, unsigned count)
+{
+    unsigned i;
+
+    for (i = 0; i < count; i++) {
+        radeon_bo_unmap((struct radeon_bo*)csg->relocs_bo[i]);
+    }
+}
+
+/*
+ * Describe the cs as a bof tree.  Blobs borrow the cs and the bo contents,
+ * the bos are left mapped until cs_gem_bof_release.
+ */
+static bof_t *cs_gem_bof(struct radeon_cs_int *cs)
 {
     struct cs_gem *csg = (struct cs_gem*)cs;
     struct radeon_cs_manager_gem *csm;
-    bof_t *bcs, *blob, *array, *bo, *size, *handle, *device_id, *root;
-    char tmp[256];
-    unsigned i;
+    bof_t *blob, *array, *bo, *size, *handle, *device_id, *root;
+    unsigned i, mapped = 0;
 
     csm = (struct radeon_cs_manager_gem *)cs->csm;
-    root = device_id = bcs = blob = array = bo = size = handle = NULL;
+    root = device_id = blob = array = bo = size = handle = NULL;
     root = bof_object();
     if (root == NULL)
         goto out_err;
     device_id = bof_int32(csm->device_id);
     if (device_id == NULL)
-        return;
+        goto out_err;
     if (bof_object_set(root, "device_id", device_id))
         goto out_err;
     bof_decref(device_id);
     device_id = NULL;
     /* dump relocs */
-    blob = bof_blob(csg->nrelocs * 16, csg->relocs);
+    blob = bof_blob_borrow(cs->crelocs * 16, csg->relocs);
     if (blob == NULL)
         goto out_err;
     if (bof_object_set(root, "reloc", blob))
@@ -360,7 +547,7 @@ static void cs_gem_dump_bof(struct radeon_cs_int *cs)
     bof_decref(blob);
     blob = NULL;
     /* dump cs */
-    blob = bof_blob(cs->cdw * 4, cs->packets);
+    blob = bof_blob_borrow(cs->cdw * 4, cs->packets);
     if (blob == NULL)
         goto out_err;
     if (bof_object_set(root, "pm4", blob))
@@ -389,9 +576,13 @@ static void cs_gem_dump_bof(struct radeon_cs_int *cs)
             goto out_err;
         bof_decref(handle);
         handle = NULL;
-        radeon_bo_map((struct radeon_bo*)csg->relocs_bo[i], 0);
-        blob = bof_blob(csg->relocs_bo[i]->size, csg->relocs_bo[i]->ptr);
-        radeon_bo_unmap((struct radeon_bo*)csg->relocs_bo[i]);
+        /* a bo which can not be mapped still needs its unmap */
+        mapped = i + 1;
+        if (radeon_bo_map((struct radeon_bo*)csg->relocs_bo[i], 0))
+            blob = bof_blob_borrow(0, NULL);
+        else
+            blob = bof_blob_borrow(csg->relocs_bo[i]->size,
+                                   csg->relocs_bo[i]->ptr);
         if (blob == NULL)
             goto out_err;
         if (bof_object_set(bo, "data", blob))
@@ -405,8 +596,8 @@ static void cs_gem_dump_bof(struct radeon_cs_int *cs)
     }
     if (bof_object_set(root, "bo", array))
         goto out_err;
-    sprintf(tmp, "d-0x%04X-%08d.bof", csm->device_id, csm->nbof++);
-    bof_dump_file(root, tmp);
+    bof_decref(array);
+    return root;
 out_err:
     bof_decref(blob);
     bof_decref(array);
@@ -415,14 +606,92 @@ out_err:
     bof_decref(handle);
     bof_decref(device_id);
     bof_decref(root);
+    cs_gem_unmap_bos(csg, mapped);
+    return NULL;
+}
+
+static void cs_gem_bof_release(struct radeon_cs_int *cs, bof_t *root)
+{
+    bof_decref(root);
+    cs_gem_unmap_bos((struct cs_gem*)cs, cs->crelocs);
+}
+
+#if CS_BOF_DUMP
+static void cs_gem_dump_bof(struct radeon_cs_int *cs)
+{
+    struct radeon_cs_manager_gem *csm;
+    bof_t *root;
+    char tmp[256];
+
+    csm = (struct radeon_cs_manager_gem *)cs->csm;
+    root = cs_gem_bof(cs);
+    if (root == NULL)
+        return;
+    sprintf(tmp, "d-0x%04X-%08d.bof", csm->device_id, csm->nbof++);
+    bof_dump_file(root, tmp);
+    cs_gem_bof_release(cs, root);
 }
 #endif
 
+/* keeps the previous file as <name>.old */
+static int cs_gem_capture_roll(struct radeon_cs_manager_gem *csm)
+{
+    char *old;
+
+    bof_stream_close(csm->capture);
+    csm->capture = NULL;
+    old = malloc(strlen(csm->capture_name) + 5);
+    if (old == NULL) {
+        return -ENOMEM;
+    }
+    sprintf(old, "%s.old", csm->capture_name);
+    rename(csm->capture_name, old);
+    free(old);
+    csm->capture = bof_stream_open(csm->capture_name);
+    return csm->capture ? 0 : -EINVAL;
+}
+
+static void cs_gem_capture(struct radeon_cs_int *cs)
+{
+    struct radeon_cs_manager_gem *csm = (struct radeon_cs_manager_gem *)cs->csm;
+    bof_t *root;
+    int r;
+
+    /* no locking on every emit when nothing is captured */
+    if (!atomic_read(&csm->capturing)) {
+        return;
+    }
+    pthread_mutex_lock(&csm->capture_mutex);
+    if (csm->capture == NULL) {
+        pthread_mutex_unlock(&csm->capture_mutex);
+        return;
+    }
+    root = cs_gem_bof(cs);
+    if (root == NULL) {
+        pthread_mutex_unlock(&csm->capture_mutex);
+        return;
+    }
+    r = bof_stream_append(csm->capture, root);
+    cs_gem_bof_release(cs, root);
+    if (!r && bof_stream_size(csm->capture) >= csm->capture_max) {
+        r = cs_gem_capture_roll(csm);
+    }
+    if (r) {
+        fprintf(stderr, "stopping cs capture to %s (%d)\n",
+                csm->capture_name, r);
+        bof_stream_close(csm->capture);
+        csm->capture = NULL;
+        atomic_set(&csm->capturing, 0);
+    }
+    pthread_mutex_unlock(&csm->capture_mutex);
+}
+
 static int cs_gem_emit(struct radeon_cs_int *cs)
 {
     struct cs_gem *csg = (struct cs_gem*)cs;
     uint64_t chunk_array[2];
     unsigned i;
+    uint32_t epoch;
     int r;
 
     while (cs->cdw & 7)
@@ -431,6 +700,7 @@ static int cs_gem_emit(struct radeon_cs_int *cs)
 #if CS_BOF_DUMP
     cs_gem_dump_bof(cs);
 #endif
+    cs_gem_capture(cs);
     csg->chunks[0].length_dw = cs->cdw;
 
     chunk_array[0] = (uint64_t)(uintptr_t)&csg->chunks[0];
@@ -441,8 +711,10 @@ static int cs_gem_emit(struct radeon_cs_int *cs)
 
     r = drmCommandWriteRead(cs->csm->fd, DRM_RADEON_CS,
                             &csg->cs, sizeof(struct drm_radeon_cs));
+    epoch = radeon_cs_space_invalidate();
     for (i = 0; i < csg->base.crelocs; i++) {
         csg->relocs_bo[i]->space_accounted = 0;
+        csg->relocs_bo[i]->space_epoch = epoch;
         /* bo might be referenced from another context so have to use atomic opertions */
         atomic_dec((atomic_t *)radeon_gem_get_reloc_in_cs((struct radeon_bo*)csg->relocs_bo[i]), cs->id);
         radeon_bo_unref((struct radeon_bo *)csg->relocs_bo[i]);
@@ -460,8 +732,7 @@ static int cs_gem_destroy(struct radeon_cs_int *cs)
     struct cs_gem *csg = (struct cs_gem*)cs;
 
     free_id(cs->id);
-    free(csg->relocs_bo);
-    free(cs->relocs);
+    cs_gem_put_reloc_storage((struct radeon_cs_manager_gem *)cs->csm, csg);
     free(cs->packets);
     free(cs);
     return 0;
@@ -482,6 +753,9 @@ static int cs_gem_erase(struct radeon_cs_int *cs)
             }
         }
     }
+    if (csg->base.crelocs) {
+        memset(csg->reloc_hash, 0, 2 * csg->nrelocs * sizeof(uint32_t));
+    }
     cs->relocs_total_size = 0;
     cs->cdw = 0;
     cs->section_ndw = 0;
@@ -493,7 +767,8 @@ static int cs_gem_erase(struct radeon_cs_int *cs)
 
 static int cs_gem_need_flush(struct radeon_cs_int *cs)
 {
-    return 0; //(cs->relocs_total_size > (32*1024*1024));
+    /* room left for the padding and a packet or two */
+    return cs->cdw + 64 > CS_GEM_IB_SIZE;
 }
 
 static void cs_gem_print(struct radeon_cs_int *cs, FILE *file)
@@ -518,6 +793,7 @@ static struct radeon_cs_funcs radeon_cs_gem_funcs = {
     cs_gem_erase,
     cs_gem_need_flush,
     cs_gem_print,
+    cs_gem_reserve,
 };
 
 static int radeon_get_device_id(int fd, uint32_t *device_id)
@@ -543,11 +819,58 @@ struct radeon_cs_manager *radeon_cs_manager_gem_ctor(int fd)
     }
     csm->base.funcs = &radeon_cs_gem_funcs;
     csm->base.fd = fd;
+    pthread_mutex_init(&csm->reloc_mutex, NULL);
+    pthread_mutex_init(&csm->capture_mutex, NULL);
     radeon_get_device_id(fd, &csm->device_id);
     return &csm->base;
 }
 
+int radeon_cs_manager_gem_capture(struct radeon_cs_manager *csm,
+                                  const char *filename,
+                                  uint64_t max_size)
+{
+    struct radeon_cs_manager_gem *csm_gem = (struct radeon_cs_manager_gem *)csm;
+    int r = 0;
+
+    pthread_mutex_lock(&csm_gem->capture_mutex);
+    if (csm_gem->capture) {
+        r = bof_stream_close(csm_gem->capture);
+        csm_gem->capture = NULL;
+    }
+    free(csm_gem->capture_name);
+    csm_gem->capture_name = NULL;
+    if (filename) {
+        csm_gem->capture_max = max_size;
+        if (!max_size || max_size > CS_GEM_CAPTURE_MAX) {
+            csm_gem->capture_max = CS_GEM_CAPTURE_MAX;
+        }
+        csm_gem->capture_name = strdup(filename);
+        if (csm_gem->capture_name) {
+            csm_gem->capture = bof_stream_open(filename);
+        }
+        if (csm_gem->capture == NULL) {
+            free(csm_gem->capture_name);
+            csm_gem->capture_name = NULL;
+            r = -EINVAL;
+        }
+    }
+    atomic_set(&csm_gem->capturing, csm_gem->capture != NULL);
+    pthread_mutex_unlock(&csm_gem->capture_mutex);
+    return r;
+}
+
 void radeon_cs_manager_gem_dtor(struct radeon_cs_manager *csm)
 {
+    struct radeon_cs_manager_gem *csm_gem = (struct radeon_cs_manager_gem *)csm;
+    unsigned i;
+
+    for (i = 0; i < csm_gem->nreloc_cache; i++) {
+        free(csm_gem->reloc_cache[i].relocs_bo);
+        free(csm_gem->reloc_cache[i].relocs);
+        free(csm_gem->reloc_cache[i].reloc_hash);
+    }
+    radeon_cs_manager_gem_capture(csm, NULL, 0);
+    pthread_mutex_destroy(&csm_gem->capture_mutex);
+    pthread_mutex_destroy(&csm_gem->reloc_mutex);
     free(csm);
 }
@@ -37,5 +37,12 @@
 
 struct radeon_cs_manager *radeon_cs_manager_gem_ctor(int fd);
 void radeon_cs_manager_gem_dtor(struct radeon_cs_manager *csm);
+/* Append every emitted cs to a bof file, buffered and with identical bo
+ * contents stored once.  Past max_size bytes (0 for the largest allowed)
+ * the file is renamed to <filename>.old and a new one is started.  A NULL
+ * filename stops the capture and completes the file. */
+int radeon_cs_manager_gem_capture(struct radeon_cs_manager *csm,
+                                  const char *filename,
+                                  uint64_t max_size);
 
 #endif
@@ -29,6 +29,10 @@ struct radeon_cs_int {
     void                        (*space_flush_fn)(void *);
     void                        *space_flush_data;
     uint32_t                    id;
+    /* persistent bos accounted as of this epoch */
+    int                         space_settled;
+    uint32_t                    space_epoch;
+    uint32_t                    space_bos_mask;
 };
 
 /* cs functions */
@@ -55,6 +59,7 @@ struct radeon_cs_funcs {
     int (*cs_erase)(struct radeon_cs_int *cs);
     int (*cs_need_flush)(struct radeon_cs_int *cs);
     void (*cs_print)(struct radeon_cs_int *cs, FILE *file);
+    int (*cs_reserve)(struct radeon_cs_int *cs, uint32_t ndw);
 };
 
 struct radeon_cs_manager {
@@ -64,4 +69,8 @@ struct radeon_cs_manager {
     int32_t vram_write_used, gart_write_used;
     int32_t read_used;
 };
+
+/* to be called by cs managers after changing the space_accounted of bos,
+ * returns the epoch to store in their space_epoch */
+uint32_t radeon_cs_space_invalidate(void);
 #endif
@@ -28,6 +28,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
+#include "xf86atomic.h"
 #include "radeon_cs.h"
 #include "radeon_bo_int.h"
 #include "radeon_cs_int.h"
@@ -38,7 +39,44 @@ struct rad_sizes {
     int32_t op_vram_write;
 };
 
-static inline int radeon_cs_setup_bo(struct radeon_cs_space_check *sc, struct rad_sizes *sizes)
+/* bumped whenever the space_accounted of a bo changes, the bo keeps the
+ * epoch of its last change */
+static atomic_t space_epoch;
+
+uint32_t radeon_cs_space_invalidate(void)
+{
+    atomic_inc(&space_epoch);
+    return atomic_read(&space_epoch);
+}
+
+static inline uint32_t radeon_cs_space_bo_bit(struct radeon_bo_int *bo)
+{
+    return 1u << (((uintptr_t)bo >> 6) & 31);
+}
+
+/**
+ * Whether the persistent bos of the cs are known to be accounted already,
+ * i.e. running radeon_cs_setup_bo over them would change nothing.  Bos
+ * changed by other cs only matter when they are persistent here.
+ */
+static int radeon_cs_space_settled(struct radeon_cs_int *cs)
+{
+    uint32_t epoch = atomic_read(&space_epoch);
+    int i;
+
+    if (!cs->space_settled)
+        return 0;
+    if (cs->space_epoch == epoch)
+        return 1;
+    for (i = 0; i < cs->bo_count; i++) {
+        if ((int32_t)(cs->bos[i].bo->space_epoch - cs->space_epoch) > 0)
+            return 0;
+    }
+    cs->space_epoch = epoch;
+    return 1;
+}
+
+static int radeon_cs_setup_bo(struct radeon_cs_space_check *sc, struct rad_sizes *sizes)
 {
     uint32_t read_domains, write_domain;
     struct radeon_bo_int *bo;
@@ -111,6 +149,8 @@ static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_s
     int i;
     struct radeon_bo_int *bo;
     struct rad_sizes sizes;
+    uint32_t accounted;
+    int was_settled, settled = 1;
     int ret;
 
     /* check the totals for this operation */
@@ -120,15 +160,33 @@ static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_s
 
     memset(&sizes, 0, sizeof(struct rad_sizes));
 
-    /* prepare */
-    for (i = 0; i < cs->bo_count; i++) {
-        ret = radeon_cs_setup_bo(&cs->bos[i], &sizes);
-        if (ret)
-            return ret;
+    /* prepare, persistent bos left accounted by the previous check
+     * contribute nothing so only look at them when something changed */
+    was_settled = radeon_cs_space_settled(cs);
+    if (!was_settled) {
+        for (i = 0; i < cs->bo_count; i++) {
+            bo = cs->bos[i].bo;
+            accounted = bo->space_accounted;
+            ret = radeon_cs_setup_bo(&cs->bos[i], &sizes);
+            if (bo->space_accounted != accounted)
+                bo->space_epoch = radeon_cs_space_invalidate();
+            if (ret)
+                return ret;
+            if (cs->bos[i].new_accounted != accounted)
+                settled = 0;
+        }
+        if (sizes.op_read || sizes.op_gart_write || sizes.op_vram_write)
+            settled = 0;
     }
 
     if (new_tmp) {
+        accounted = new_tmp->bo->space_accounted;
         ret = radeon_cs_setup_bo(new_tmp, &sizes);
+        if (new_tmp->bo->space_accounted != accounted) {
+            new_tmp->bo->space_epoch = radeon_cs_space_invalidate();
+            if (cs->space_bos_mask & radeon_cs_space_bo_bit(new_tmp->bo))
+                settled = 0;
+        }
         if (ret)
             return ret;
     }
@@ -151,12 +209,24 @@ static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_s
     csm->vram_write_used += sizes.op_vram_write;
     csm->read_used += sizes.op_read;
     /* commit */
-    for (i = 0; i < cs->bo_count; i++) {
-        bo = cs->bos[i].bo;
-        bo->space_accounted = cs->bos[i].new_accounted;
+    if (!was_settled) {
+        for (i = 0; i < cs->bo_count; i++) {
+            bo = cs->bos[i].bo;
+            if (bo->space_accounted != cs->bos[i].new_accounted) {
+                bo->space_accounted = cs->bos[i].new_accounted;
+                bo->space_epoch = radeon_cs_space_invalidate();
+            }
+        }
     }
-    if (new_tmp)
+    if (new_tmp && new_tmp->bo->space_accounted != new_tmp->new_accounted) {
         new_tmp->bo->space_accounted = new_tmp->new_accounted;
+        new_tmp->bo->space_epoch = radeon_cs_space_invalidate();
+        if (cs->space_bos_mask & radeon_cs_space_bo_bit(new_tmp->bo))
+            settled = 0;
+    }
+
+    cs->space_settled = settled;
+    cs->space_epoch = atomic_read(&space_epoch);
 
     return RADEON_CS_SPACE_OK;
 }
@@ -179,6 +249,8 @@ void radeon_cs_space_add_persistent_bo(struct radeon_cs *cs, struct radeon_bo *b
     csi->bos[i].write_domain = write_domain;
     csi->bos[i].new_accounted = 0;
     csi->bo_count++;
+    csi->space_settled = 0;
+    csi->space_bos_mask |= radeon_cs_space_bo_bit(boi);
 
     assert(csi->bo_count < MAX_SPACE_BOS);
 }
@@ -242,4 +314,6 @@ void radeon_cs_space_reset_bos(struct radeon_cs *cs)
         csi->bos[i].new_accounted = 0;
     }
     csi->bo_count = 0;
+    csi->space_settled = 0;
+    csi->space_bos_mask = 0;
 }
@@ -32,6 +32,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include "drm.h"
@@ -103,6 +105,8 @@ struct radeon_hw_info {
     uint32_t                        macrotile_mode_array[16];
 };
 
+struct radeon_surface_cache;
+
 struct radeon_surface_manager {
     int                         fd;
     uint32_t                    device_id;
@@ -110,6 +114,7 @@ struct radeon_surface_manager {
     unsigned                    family;
     hw_init_surface_t           surface_init;
     hw_best_surface_t           surface_best;
+    struct radeon_surface_cache *cache;
 };
 
 /* helper */
@@ -126,10 +131,10 @@ static int radeon_get_value(int fd, unsigned req, uint32_t *value)
     return r;
 }
 
-static int radeon_get_family(struct radeon_surface_manager *surf_man)
+static int radeon_get_family(uint32_t device_id, unsigned *family)
 {
-    switch (surf_man->device_id) {
-#define CHIPSET(pci_id, name, fam) case pci_id: surf_man->family = CHIP_##fam; break;
+    switch (device_id) {
+#define CHIPSET(pci_id, name, fam) case pci_id: *family = CHIP_##fam; break;
 #include "r600_pci_ids.h"
 #undef CHIPSET
     default:
@@ -189,24 +194,15 @@ static void surf_minify(struct radeon_surface *surf,
 /* ===========================================================================
  * r600/r700 family
  */
-static int r6_init_hw_info(struct radeon_surface_manager *surf_man)
+static int r6_init_hw_info(struct radeon_surface_manager *surf_man,
+                           const struct radeon_surface_hw_desc *desc)
 {
-    uint32_t tiling_config;
-    drmVersionPtr version;
-    int r;
-
-    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
-                         &tiling_config);
-    if (r) {
-        return r;
-    }
+    uint32_t tiling_config = desc->tiling_config;
 
     surf_man->hw_info.allow_2d = 0;
-    version = drmGetVersion(surf_man->fd);
-    if (version && version->version_minor >= 14) {
+    if (desc->drm_minor >= 14) {
         surf_man->hw_info.allow_2d = 1;
     }
-    drmFreeVersion(version);
 
     switch ((tiling_config & 0xe) >> 1) {
     case 0:
@@ -472,24 +468,15 @@ static int r6_surface_best(struct radeon_surface_manager *surf_man,
 /* ===========================================================================
  * evergreen family
  */
-static int eg_init_hw_info(struct radeon_surface_manager *surf_man)
+static int eg_init_hw_info(struct radeon_surface_manager *surf_man,
+                           const struct radeon_surface_hw_desc *desc)
 {
-    uint32_t tiling_config;
-    drmVersionPtr version;
-    int r;
-
-    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
-                         &tiling_config);
-    if (r) {
-        return r;
-    }
+    uint32_t tiling_config = desc->tiling_config;
 
     surf_man->hw_info.allow_2d = 0;
-    version = drmGetVersion(surf_man->fd);
-    if (version && version->version_minor >= 16) {
+    if (desc->drm_minor >= 16) {
         surf_man->hw_info.allow_2d = 1;
     }
-    drmFreeVersion(version);
 
     switch (tiling_config & 0xf) {
     case 0:
@@ -1184,26 +1171,17 @@ static void si_gb_tile_mode(uint32_t gb_tile_mode,
     }
 }
 
-static int si_init_hw_info(struct radeon_surface_manager *surf_man)
+static int si_init_hw_info(struct radeon_surface_manager *surf_man,
+                           const struct radeon_surface_hw_desc *desc)
 {
-    uint32_t tiling_config;
-    drmVersionPtr version;
-    int r;
-
-    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
-                         &tiling_config);
-    if (r) {
-        return r;
-    }
+    uint32_t tiling_config = desc->tiling_config;
 
     surf_man->hw_info.allow_2d = 0;
-    version = drmGetVersion(surf_man->fd);
-    if (version && version->version_minor >= 33) {
-        if (!radeon_get_value(surf_man->fd, RADEON_INFO_SI_TILE_MODE_ARRAY, surf_man->hw_info.tile_mode_array)) {
-            surf_man->hw_info.allow_2d = 1;
-        }
+    if (desc->drm_minor >= 33 && desc->has_tile_mode_array) {
+        memcpy(surf_man->hw_info.tile_mode_array, desc->tile_mode_array,
+               sizeof(surf_man->hw_info.tile_mode_array));
+        surf_man->hw_info.allow_2d = 1;
     }
-    drmFreeVersion(version);
 
     switch (tiling_config & 0xf) {
     case 0:
@@ -2012,27 +1990,20 @@ static void cik_get_2d_params(struct radeon_surface_manager *surf_man,
     }
 }
 
-static int cik_init_hw_info(struct radeon_surface_manager *surf_man)
+static int cik_init_hw_info(struct radeon_surface_manager *surf_man,
+                            const struct radeon_surface_hw_desc *desc)
 {
-    uint32_t tiling_config;
-    drmVersionPtr version;
-    int r;
-
-    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
-                         &tiling_config);
-    if (r) {
-        return r;
-    }
+    uint32_t tiling_config = desc->tiling_config;
 
     surf_man->hw_info.allow_2d = 0;
-    version = drmGetVersion(surf_man->fd);
-    if (version && version->version_minor >= 35) {
-        if (!radeon_get_value(surf_man->fd, RADEON_INFO_SI_TILE_MODE_ARRAY, surf_man->hw_info.tile_mode_array) &&
-	    !radeon_get_value(surf_man->fd, RADEON_INFO_CIK_MACROTILE_MODE_ARRAY, surf_man->hw_info.macrotile_mode_array)) {
-            surf_man->hw_info.allow_2d = 1;
-        }
+    if (desc->drm_minor >= 35 && desc->has_tile_mode_array) {
+        memcpy(surf_man->hw_info.tile_mode_array, desc->tile_mode_array,
+               sizeof(surf_man->hw_info.tile_mode_array));
+        memcpy(surf_man->hw_info.macrotile_mode_array,
+               desc->macrotile_mode_array,
+               sizeof(surf_man->hw_info.macrotile_mode_array));
+        surf_man->hw_info.allow_2d = 1;
     }
-    drmFreeVersion(version);
 
     switch (tiling_config & 0xf) {
     case 0:
@@ -2392,10 +2363,349 @@ static int cik_surface_best(struct radeon_surface_manager *surf_man,
 }
 
 
+/* ===========================================================================
+ * layout cache
+ */
+/* scalar fields of struct radeon_surface, the level and tiling index
+ * arrays after them are only ever written by the hw functions */
+#define SURF_CACHE_KEY_WORDS    22
+#define SURF_CACHE_ARRAY_WORDS  ((sizeof(struct radeon_surface) - \
+                                  offsetof(struct radeon_surface, level)) / 4)
+#define SURF_CACHE_MAX_RUNS     16
+#define SURF_CACHE_WAYS         4
+
+struct radeon_surface_cache_entry {
+    uint32_t                    hash;
+    unsigned long               last_use;
+    hw_init_surface_t           op;
+    uint32_t                    key[SURF_CACHE_KEY_WORDS];
+    uint32_t                    result[SURF_CACHE_KEY_WORDS];
+    /* array words written by the layout, as (start, count) runs */
+    unsigned                    nruns;
+    uint16_t                    runs[SURF_CACHE_MAX_RUNS][2];
+    uint32_t                    *words;
+};
+
+struct radeon_surface_cache {
+    pthread_mutex_t             mutex;
+    unsigned                    mask;
+    unsigned                    flags;
+    unsigned long               hits;
+    unsigned long               misses;
+    unsigned long               mismatches;
+    /* SURF_CACHE_WAYS entries per set, the least recently used one
+     * gets replaced */
+    struct radeon_surface_cache_entry *entries;
+};
+
+static void surf_cache_get_key(const struct radeon_surface *surf, uint32_t *key)
+{
+    key[0] = surf->npix_x;
+    key[1] = surf->npix_y;
+    key[2] = surf->npix_z;
+    key[3] = surf->blk_w;
+    key[4] = surf->blk_h;
+    key[5] = surf->blk_d;
+    key[6] = surf->array_size;
+    key[7] = surf->last_level;
+    key[8] = surf->bpe;
+    key[9] = surf->nsamples;
+    key[10] = surf->flags;
+    key[11] = surf->bo_size;
+    key[12] = surf->bo_size >> 32;
+    key[13] = surf->bo_alignment;
+    key[14] = surf->bo_alignment >> 32;
+    key[15] = surf->bankw;
+    key[16] = surf->bankh;
+    key[17] = surf->mtilea;
+    key[18] = surf->tile_split;
+    key[19] = surf->stencil_tile_split;
+    key[20] = surf->stencil_offset;
+    key[21] = surf->stencil_offset >> 32;
+}
+
+static void surf_cache_set_key(struct radeon_surface *surf, const uint32_t *key)
+{
+    surf->npix_x = key[0];
+    surf->npix_y = key[1];
+    surf->npix_z = key[2];
+    surf->blk_w = key[3];
+    surf->blk_h = key[4];
+    surf->blk_d = key[5];
+    surf->array_size = key[6];
+    surf->last_level = key[7];
+    surf->bpe = key[8];
+    surf->nsamples = key[9];
+    surf->flags = key[10];
+    surf->bo_size = key[11] | (uint64_t)key[12] << 32;
+    surf->bo_alignment = key[13] | (uint64_t)key[14] << 32;
+    surf->bankw = key[15];
+    surf->bankh = key[16];
+    surf->mtilea = key[17];
+    surf->tile_split = key[18];
+    surf->stencil_tile_split = key[19];
+    surf->stencil_offset = key[20] | (uint64_t)key[21] << 32;
+}
+
+static void *surf_cache_array(struct radeon_surface *surf)
+{
+    return surf->level;
+}
+
+static uint32_t surf_cache_hash(const uint32_t *key, hw_init_surface_t op)
+{
+    uint64_t a = (uintptr_t)op, b = 0;
+    unsigned i;
+
+    /* two independent lanes, this is on the hit path */
+    for (i = 0; i + 4 <= SURF_CACHE_KEY_WORDS; i += 4) {
+        a = (a ^ (key[i] | (uint64_t)key[i + 1] << 32)) * 0x9e3779b97f4a7c15ull;
+        b = (b ^ (key[i + 2] | (uint64_t)key[i + 3] << 32)) * 0xc2b2ae3d27d4eb4full;
+    }
+    for (; i < SURF_CACHE_KEY_WORDS; i++) {
+        a = (a ^ key[i]) * 0x9e3779b97f4a7c15ull;
+    }
+    a ^= b ^ (a >> 29);
+    return a >> 32;
+}
+
+static int surf_cache_match(const struct radeon_surface_cache_entry *entry,
+                            const uint32_t *key, uint32_t hash,
+                            hw_init_surface_t op)
+{
+    return entry->op == op && entry->hash == hash &&
+           !memcmp(entry->key, key, sizeof(entry->key));
+}
+
+static void surf_cache_apply(const struct radeon_surface_cache_entry *entry,
+                             struct radeon_surface *surf)
+{
+    char *array = surf_cache_array(surf);
+    const uint32_t *words = entry->words;
+    unsigned i;
+
+    surf_cache_set_key(surf, entry->result);
+    for (i = 0; i < entry->nruns; i++) {
+        memcpy(array + entry->runs[i][0] * 4, words, entry->runs[i][1] * 4);
+        words += entry->runs[i][1];
+    }
+}
+
+static int surf_cache_equal(struct radeon_surface *a, struct radeon_surface *b)
+{
+    uint32_t key_a[SURF_CACHE_KEY_WORDS], key_b[SURF_CACHE_KEY_WORDS];
+
+    surf_cache_get_key(a, key_a);
+    surf_cache_get_key(b, key_b);
+    return !memcmp(key_a, key_b, sizeof(key_a)) &&
+           !memcmp(surf_cache_array(a), surf_cache_array(b),
+                   SURF_CACHE_ARRAY_WORDS * 4);
+}
+
+/**
+ * Compute the layout twice, over arrays filled with zeros and with ones,
+ * to find which array words it writes.  Fails when the result can not be
+ * cached, the caller then computes it the usual way.
+ */
+static int surf_cache_fill(struct radeon_surface_manager *surf_man,
+                           struct radeon_surface_cache_entry *entry,
+                           hw_init_surface_t op,
+                           const struct radeon_surface *surf)
+{
+    static const unsigned nwords = SURF_CACHE_ARRAY_WORDS;
+    struct radeon_surface *tmp;
+    uint32_t *zeros, *ones, *words;
+    uint32_t key[SURF_CACHE_KEY_WORDS];
+    unsigned i, start, nruns = 0, count = 0;
+
+    /* two surfaces followed by a copy of their arrays as words */
+    tmp = malloc(2 * sizeof(struct radeon_surface) + 2 * nwords * 4);
+    if (tmp == NULL) {
+        return -ENOMEM;
+    }
+    tmp[0] = tmp[1] = *surf;
+    memset(surf_cache_array(&tmp[0]), 0, nwords * 4);
+    memset(surf_cache_array(&tmp[1]), 0xff, nwords * 4);
+    if (op(surf_man, &tmp[0]) || op(surf_man, &tmp[1])) {
+        goto fail;
+    }
+    zeros = (uint32_t *)&tmp[2];
+    ones = zeros + nwords;
+    memcpy(zeros, surf_cache_array(&tmp[0]), nwords * 4);
+    memcpy(ones, surf_cache_array(&tmp[1]), nwords * 4);
+    surf_cache_get_key(&tmp[0], entry->result);
+    surf_cache_get_key(&tmp[1], key);
+    if (memcmp(entry->result, key, sizeof(key))) {
+        goto fail;
+    }
+
+    for (i = 0; i < nwords; i++) {
+        if (zeros[i] != ones[i]) {
+            continue;
+        }
+        if (i == 0 || zeros[i - 1] != ones[i - 1]) {
+            if (nruns == SURF_CACHE_MAX_RUNS) {
+                goto fail;
+            }
+            entry->runs[nruns][0] = i;
+            entry->runs[nruns++][1] = 0;
+        }
+        entry->runs[nruns - 1][1]++;
+        count++;
+    }
+    words = malloc(count * 4 + 4);
+    if (words == NULL) {
+        goto fail;
+    }
+    free(entry->words);
+    entry->words = words;
+    entry->nruns = nruns;
+    for (i = 0; i < nruns; i++) {
+        start = entry->runs[i][0];
+        memcpy(words, zeros + start, entry->runs[i][1] * 4);
+        words += entry->runs[i][1];
+    }
+    free(tmp);
+    return 0;
+fail:
+    free(tmp);
+    return -EINVAL;
+}
+
+static int surf_cache_lookup(struct radeon_surface_manager *surf_man,
+                             hw_init_surface_t op,
+                             struct radeon_surface *surf)
+{
+    struct radeon_surface_cache *cache = surf_man->cache;
+    struct radeon_surface_cache_entry *set, *entry;
+    struct radeon_surface check;
+    uint32_t key[SURF_CACHE_KEY_WORDS], hash;
+    unsigned i;
+    int r = 0;
+
+    surf_cache_get_key(surf, key);
+    hash = surf_cache_hash(key, op);
+
+    pthread_mutex_lock(&cache->mutex);
+    set = &cache->entries[(hash & cache->mask) * SURF_CACHE_WAYS];
+    entry = &set[0];
+    for (i = 0; i < SURF_CACHE_WAYS; i++) {
+        if (surf_cache_match(&set[i], key, hash, op)) {
+            entry = &set[i];
+            break;
+        }
+        if (set[i].last_use < entry->last_use) {
+            entry = &set[i];
+        }
+    }
+    if (i < SURF_CACHE_WAYS) {
+        cache->hits++;
+    } else {
+        cache->misses++;
+        entry->op = NULL;
+        if (surf_cache_fill(surf_man, entry, op, surf)) {
+            pthread_mutex_unlock(&cache->mutex);
+            return op(surf_man, surf);
+        }
+        entry->op = op;
+        entry->hash = hash;
+        memcpy(entry->key, key, sizeof(key));
+    }
+    entry->last_use = cache->hits + cache->misses;
+
+    if (cache->flags & RADEON_SURF_CACHE_VALIDATE) {
+        check = *surf;
+        r = op(surf_man, &check);
+        surf_cache_apply(entry, surf);
+        if (r || !surf_cache_equal(&check, surf)) {
+            cache->mismatches++;
+            fprintf(stderr, "radeon surface cache mismatch for %ux%ux%u "
+                    "bpe %u flags 0x%x\n", check.npix_x, check.npix_y,
+                    check.npix_z, check.bpe, check.flags);
+            *surf = check;
+        }
+    } else {
+        surf_cache_apply(entry, surf);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return r;
+}
+
+static void surf_cache_destroy(struct radeon_surface_cache *cache)
+{
+    unsigned i;
+
+    if (cache == NULL) {
+        return;
+    }
+    for (i = 0; i < (cache->mask + 1) * SURF_CACHE_WAYS; i++) {
+        free(cache->entries[i].words);
+    }
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache->entries);
+    free(cache);
+}
+
+
 /* ===========================================================================
  * public API
  */
+/* what the kernel reports about the device behind fd */
+static int radeon_surface_query_desc(int fd, struct radeon_surface_hw_desc *desc)
+{
+    drmVersionPtr version;
+    unsigned family;
+    int r;
+
+    memset(desc, 0, sizeof(*desc));
+    r = radeon_get_value(fd, RADEON_INFO_DEVICE_ID, &desc->device_id);
+    if (r) {
+        return r;
+    }
+    r = radeon_get_family(desc->device_id, &family);
+    if (r) {
+        return r;
+    }
+    r = radeon_get_value(fd, RADEON_INFO_TILING_CONFIG, &desc->tiling_config);
+    if (r) {
+        return r;
+    }
+    version = drmGetVersion(fd);
+    if (version) {
+        desc->drm_minor = version->version_minor;
+    }
+    drmFreeVersion(version);
+
+    if (family >= CHIP_BONAIRE && desc->drm_minor >= 35) {
+        if (!radeon_get_value(fd, RADEON_INFO_SI_TILE_MODE_ARRAY, desc->tile_mode_array) &&
+            !radeon_get_value(fd, RADEON_INFO_CIK_MACROTILE_MODE_ARRAY, desc->macrotile_mode_array)) {
+            desc->has_tile_mode_array = 1;
+        }
+    } else if (family >= CHIP_TAHITI && desc->drm_minor >= 33) {
+        if (!radeon_get_value(fd, RADEON_INFO_SI_TILE_MODE_ARRAY, desc->tile_mode_array)) {
+            desc->has_tile_mode_array = 1;
+        }
+    }
+    return 0;
+}
+
 struct radeon_surface_manager *radeon_surface_manager_new(int fd)
+{
+    struct radeon_surface_manager *surf_man;
+    struct radeon_surface_hw_desc desc;
+
+    if (radeon_surface_query_desc(fd, &desc)) {
+        return NULL;
+    }
+    surf_man = radeon_surface_manager_new_from_desc(&desc);
+    if (surf_man) {
+        surf_man->fd = fd;
+    }
+    return surf_man;
+}
+
+struct radeon_surface_manager *
+radeon_surface_manager_new_from_desc(const struct radeon_surface_hw_desc *desc)
 {
     struct radeon_surface_manager *surf_man;
 
@@ -2403,34 +2713,32 @@ struct radeon_surface_manager *radeon_surface_manager_new(int fd)
     if (surf_man == NULL) {
         return NULL;
     }
-    surf_man->fd = fd;
-    if (radeon_get_value(fd, RADEON_INFO_DEVICE_ID, &surf_man->device_id)) {
-        goto out_err;
-    }
-    if (radeon_get_family(surf_man)) {
+    surf_man->fd = -1;
+    surf_man->device_id = desc->device_id;
+    if (radeon_get_family(surf_man->device_id, &surf_man->family)) {
         goto out_err;
     }
 
     if (surf_man->family <= CHIP_RV740) {
-        if (r6_init_hw_info(surf_man)) {
+        if (r6_init_hw_info(surf_man, desc)) {
             goto out_err;
         }
         surf_man->surface_init = &r6_surface_init;
         surf_man->surface_best = &r6_surface_best;
     } else if (surf_man->family <= CHIP_ARUBA) {
-        if (eg_init_hw_info(surf_man)) {
+        if (eg_init_hw_info(surf_man, desc)) {
             goto out_err;
         }
         surf_man->surface_init = &eg_surface_init;
         surf_man->surface_best = &eg_surface_best;
     } else if (surf_man->family < CHIP_BONAIRE) {
-        if (si_init_hw_info(surf_man)) {
+        if (si_init_hw_info(surf_man, desc)) {
             goto out_err;
         }
         surf_man->surface_init = &si_surface_init;
         surf_man->surface_best = &si_surface_best;
     } else {
-        if (cik_init_hw_info(surf_man)) {
+        if (cik_init_hw_info(surf_man, desc)) {
             goto out_err;
         }
         surf_man->surface_init = &cik_surface_init;
@@ -2445,9 +2753,63 @@ out_err:
 
 void radeon_surface_manager_free(struct radeon_surface_manager *surf_man)
 {
+    if (surf_man) {
+        surf_cache_destroy(surf_man->cache);
+    }
     free(surf_man);
 }
 
+int radeon_surface_manager_enable_cache(struct radeon_surface_manager *surf_man,
+                                        unsigned size, unsigned flags)
+{
+    struct radeon_surface_cache *cache;
+    unsigned n = SURF_CACHE_WAYS;
+
+    while (n < size) {
+        n <<= 1;
+    }
+    cache = calloc(1, sizeof(struct radeon_surface_cache));
+    if (cache == NULL) {
+        return -ENOMEM;
+    }
+    cache->entries = calloc(n, sizeof(struct radeon_surface_cache_entry));
+    if (cache->entries == NULL) {
+        free(cache);
+        return -ENOMEM;
+    }
+    pthread_mutex_init(&cache->mutex, NULL);
+    cache->mask = n / SURF_CACHE_WAYS - 1;
+    cache->flags = flags;
+
+    surf_cache_destroy(surf_man->cache);
+    surf_man->cache = cache;
+    return 0;
+}
+
+void radeon_surface_manager_cache_stats(struct radeon_surface_manager *surf_man,
+                                        unsigned long *hits,
+                                        unsigned long *misses,
+                                        unsigned long *mismatches)
+{
+    struct radeon_surface_cache *cache = surf_man->cache;
+
+    if (cache) {
+        pthread_mutex_lock(&cache->mutex);
+    }
+    if (hits) {
+        *hits = cache ? cache->hits : 0;
+    }
+    if (misses) {
+        *misses = cache ? cache->misses : 0;
+    }
+    if (mismatches) {
+        *mismatches = cache ? cache->mismatches : 0;
+    }
+    if (cache) {
+        pthread_mutex_unlock(&cache->mutex);
+    }
+}
+
 static int radeon_surface_sanity(struct radeon_surface_manager *surf_man,
                                  struct radeon_surface *surf,
                                  unsigned type,
@@ -2528,6 +2890,9 @@ int radeon_surface_init(struct radeon_surface_manager *surf_man,
     if (r) {
         return r;
     }
+    if (surf_man->cache) {
+        return surf_cache_lookup(surf_man, surf_man->surface_init, surf);
+    }
     return surf_man->surface_init(surf_man, surf);
 }
 
@@ -2544,5 +2909,8 @@ int radeon_surface_best(struct radeon_surface_manager *surf_man,
     if (r) {
         return r;
     }
+    if (surf_man->cache) {
+        return surf_cache_lookup(surf_man, surf_man->surface_best, surf);
+    }
     return surf_man->surface_best(surf_man, surf);
 }
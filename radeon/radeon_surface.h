@@ -139,11 +139,43 @@ struct radeon_surface {
     uint32_t                    stencil_tiling_index[RADEON_SURF_MAX_LEVEL];
 };
 
+/* What the kernel reports about a device, enough to build a surface
+ * manager without one, e.g. to compute layouts offline.
+ */
+struct radeon_surface_hw_desc {
+    uint32_t                    device_id;
+    /* minor version of the radeon kernel driver */
+    uint32_t                    drm_minor;
+    /* RADEON_INFO_TILING_CONFIG */
+    uint32_t                    tiling_config;
+    /* si and cik, RADEON_INFO_SI_TILE_MODE_ARRAY and (cik only)
+     * RADEON_INFO_CIK_MACROTILE_MODE_ARRAY, ignored unless set */
+    unsigned                    has_tile_mode_array;
+    uint32_t                    tile_mode_array[32];
+    uint32_t                    macrotile_mode_array[16];
+};
+
 struct radeon_surface_manager *radeon_surface_manager_new(int fd);
+struct radeon_surface_manager *
+radeon_surface_manager_new_from_desc(const struct radeon_surface_hw_desc *desc);
 void radeon_surface_manager_free(struct radeon_surface_manager *surf_man);
 int radeon_surface_init(struct radeon_surface_manager *surf_man,
                         struct radeon_surface *surf);
 int radeon_surface_best(struct radeon_surface_manager *surf_man,
                         struct radeon_surface *surf);
 
+/* Cache layouts computed by radeon_surface_init/best in size entries,
+ * which should comfortably exceed the number of distinct surface shapes.
+ * With RADEON_SURF_CACHE_VALIDATE every cached result is compared against
+ * a fresh computation and the latter is returned on mismatch.
+ */
+#define RADEON_SURF_CACHE_VALIDATE              (1 << 0)
+
+int radeon_surface_manager_enable_cache(struct radeon_surface_manager *surf_man,
+                                        unsigned size, unsigned flags);
+void radeon_surface_manager_cache_stats(struct radeon_surface_manager *surf_man,
+                                        unsigned long *hits,
+                                        unsigned long *misses,
+                                        unsigned long *mismatches);
+
 #endif
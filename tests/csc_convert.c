@@ -0,0 +1,157 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "i915_drm.h"
+#include "xf86drm.h"
+#include "intel/intel_chipset.h"
+
+#define NUM_MATRICES	100000
+
+static const int devids[] = {
+	PCI_CHIP_VALLEYVIEW_PO,
+	PCI_CHIP_HASWELL_GT1,
+	0x1616, /* Broadwell ULT GT2 */
+};
+
+/* Values that sit on the clipping and exponent boundaries. */
+static const float edges[] = {
+	0.0f, -0.0f, 1.0f, -1.0f, 2.0f, 0.5f, 0.25f, 0.125f, 0.0625f,
+	0.999f, 1.999f, 2.999f, 3.5f, -3.5f, 1e-6f, 0.49999997f,
+	0.99999994f, 1.99999988f,
+};
+
+static float random_value(void)
+{
+	if (random() % 8 == 0)
+		return edges[random() % (sizeof(edges) / sizeof(edges[0]))];
+
+	/* Uniform in [-3.5, 3.5) with all mantissa bits exercised. */
+	return ((float)random() / (float)RAND_MAX) * 7.0f - 3.5f;
+}
+
+static void random_matrix(struct CSCCoeff_Matrix *m)
+{
+	int i;
+
+	memset(m, 0, sizeof(*m));
+	m->crtc_id = random() % 4;
+	m->param_valid = random() % 8;
+	m->CSCMode = random() % 2;
+	for (i = 0; i < CSC_MAX_COEFF_COUNT; i++)
+		m->CoeffMatrix[i] = random_value();
+	for (i = 0; i < CSC_MAX_OFFSET_COUNT; i++) {
+		m->CSCPreoffset[i] = random_value() / 2;
+		m->CSCPostoffset[i] = random_value() / 2;
+	}
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start->tv_sec) +
+		(end.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/**
+ * Checks that the fixed-point drmCSCConvert() and the conversion cache are
+ * bit-exact with the float reference Calc_CSC_Param() on random matrices.
+ */
+int main(int argc, char **argv)
+{
+	struct CSCCoeff_Matrix *matrices;
+	struct csc_coeff *ref, *out, *cached;
+	drmCSCCachePtr cache;
+	unsigned long hits, misses;
+	struct timeval start;
+	double t_ref, t_fast;
+	unsigned int d;
+	int i;
+
+	matrices = calloc(NUM_MATRICES, sizeof(*matrices));
+	ref = calloc(NUM_MATRICES, sizeof(*ref));
+	out = calloc(NUM_MATRICES, sizeof(*out));
+	cached = calloc(NUM_MATRICES, sizeof(*cached));
+	assert(matrices && ref && out && cached);
+
+	srandom(0x5eed);
+
+	for (d = 0; d < sizeof(devids) / sizeof(devids[0]); d++) {
+		for (i = 0; i < NUM_MATRICES; i++)
+			random_matrix(&matrices[i]);
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < NUM_MATRICES; i++) {
+			memset(&ref[i], 0, sizeof(ref[i]));
+			Calc_CSC_Param(&matrices[i], &ref[i], devids[d]);
+			ref[i].crtc_id = matrices[i].crtc_id;
+		}
+		t_ref = elapsed(&start);
+
+		gettimeofday(&start, NULL);
+		assert(drmCSCConvert(devids[d], matrices, out, NUM_MATRICES) == 0);
+		t_fast = elapsed(&start);
+
+		for (i = 0; i < NUM_MATRICES; i++) {
+			if (memcmp(&ref[i], &out[i], sizeof(ref[i]))) {
+				fprintf(stderr, "devid 0x%04x: matrix %d differs\n",
+					devids[d], i);
+				return 1;
+			}
+		}
+
+		/* A small cache over a small working set must hit. */
+		cache = drmCSCCacheCreate(256);
+		assert(cache);
+		for (i = 0; i < NUM_MATRICES; i++)
+			assert(drmCSCCacheConvert(cache, devids[d],
+						  &matrices[i % 16],
+						  &cached[i], 1) == 0);
+		for (i = 0; i < NUM_MATRICES; i++)
+			assert(!memcmp(&cached[i], &out[i % 16],
+				       sizeof(cached[i])));
+		drmCSCCacheStats(cache, &hits, &misses);
+		assert(hits + misses == NUM_MATRICES);
+		assert(hits >= NUM_MATRICES / 10 * 9);
+		drmCSCCacheDestroy(cache);
+
+		printf("devid 0x%04x: reference %.3fs, fixed-point %.3fs\n",
+		       devids[d], t_ref, t_fast);
+	}
+
+	assert(drmCSCConvert(0, matrices, out, 1) == -EINVAL);
+
+	free(matrices);
+	free(ref);
+	free(out);
+	free(cached);
+	return 0;
+}
@@ -0,0 +1,385 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include "xf86drm.h"
+
+#define NUM_CARDS	8
+#define NUM_LOOKUPS	1000
+#define MAX_FDS		1024
+
+static const char *drivers[] = { "i915", "radeon", "nouveau", "msm" };
+
+/*
+ * Fake /dev/dri/card0 to card(NUM_CARDS - 1).  stat() and open() are
+ * interposed so libdrm never touches, or as root creates, the real nodes;
+ * opening one yields a descriptor of /dev/null whose ioctls are answered
+ * below.  Like the kernel, a node only reports its bus ID once a client
+ * has set interface version 1.4 on it.
+ */
+static pthread_mutex_t mock_lock = PTHREAD_MUTEX_INITIALIZER;
+static int mock_fd_minor[MAX_FDS];	/* minor + 1, 0 if not a fake node */
+static int mock_unique_set[NUM_CARDS];
+
+static struct {
+	int opens[NUM_CARDS];
+	int probing, max_probing;
+} mock_stats;
+
+static void mock_reset(void)
+{
+	pthread_mutex_lock(&mock_lock);
+	memset(&mock_stats, 0, sizeof(mock_stats));
+	pthread_mutex_unlock(&mock_lock);
+}
+
+static int mock_total_opens(void)
+{
+	int i, total = 0;
+
+	pthread_mutex_lock(&mock_lock);
+	for (i = 0; i < NUM_CARDS; i++)
+		total += mock_stats.opens[i];
+	pthread_mutex_unlock(&mock_lock);
+	return total;
+}
+
+static int mock_node_minor(const char *path)
+{
+	int minor;
+	char end;
+
+	if (sscanf(path, DRM_DIR_NAME "/card%d%c", &minor, &end) != 1 ||
+	    minor < 0 || minor >= NUM_CARDS)
+		return -1;
+	return minor;
+}
+
+static int mock_fd_to_minor(int fd)
+{
+	int minor;
+
+	pthread_mutex_lock(&mock_lock);
+	minor = fd >= 0 && fd < MAX_FDS ? mock_fd_minor[fd] - 1 : -1;
+	pthread_mutex_unlock(&mock_lock);
+	return minor;
+}
+
+static void mock_busid(int minor, char *busid, size_t size)
+{
+	if (minor % 4 == 3)
+		busid[0] = '\0';
+	else
+		snprintf(busid, size, "pci:0000:%02x:00.0", minor + 1);
+}
+
+int stat(const char *path, struct stat *st)
+{
+	int minor;
+
+	if (!strcmp(path, DRM_DIR_NAME)) {
+		memset(st, 0, sizeof(*st));
+		st->st_mode = S_IFDIR | 0755;
+		return 0;
+	}
+	if (!strncmp(path, DRM_DIR_NAME "/", strlen(DRM_DIR_NAME) + 1)) {
+		minor = mock_node_minor(path);
+		if (minor < 0) {
+			errno = ENOENT;
+			return -1;
+		}
+		memset(st, 0, sizeof(*st));
+		st->st_mode = S_IFCHR | 0666;
+		return 0;
+	}
+	return fstatat(AT_FDCWD, path, st, 0);
+}
+
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+	int fd, minor;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	if (strncmp(path, DRM_DIR_NAME "/", strlen(DRM_DIR_NAME) + 1))
+		return syscall(SYS_openat, AT_FDCWD, path, flags, mode);
+
+	minor = mock_node_minor(path);
+	if (minor < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	fd = syscall(SYS_openat, AT_FDCWD, "/dev/null", O_RDWR, 0);
+	assert(fd >= 0 && fd < MAX_FDS);
+	pthread_mutex_lock(&mock_lock);
+	mock_fd_minor[fd] = minor + 1;
+	mock_stats.opens[minor]++;
+	pthread_mutex_unlock(&mock_lock);
+	return fd;
+}
+
+static void mock_copy(char *dst, size_t *len, const char *src)
+{
+	size_t n = strlen(src);
+
+	if (dst)
+		memcpy(dst, src, n < *len ? n : *len);
+	*len = n;
+}
+
+int drmIoctl(int fd, unsigned long request, void *arg)
+{
+	int minor = mock_fd_to_minor(fd);
+	char busid[64];
+
+	if (minor < 0) {
+		errno = ENOTTY;
+		return -1;
+	}
+
+	switch (request) {
+	case DRM_IOCTL_VERSION: {
+		drm_version_t *v = arg;
+
+		/* Stay in flight a little to see probes overlap. */
+		pthread_mutex_lock(&mock_lock);
+		if (++mock_stats.probing > mock_stats.max_probing)
+			mock_stats.max_probing = mock_stats.probing;
+		pthread_mutex_unlock(&mock_lock);
+		usleep(1000);
+		pthread_mutex_lock(&mock_lock);
+		mock_stats.probing--;
+		pthread_mutex_unlock(&mock_lock);
+
+		memset(&v->version_major, 0, 3 * sizeof(int));
+		mock_copy(v->name, &v->name_len, drivers[minor % 4]);
+		mock_copy(v->date, &v->date_len, "20141019");
+		mock_copy(v->desc, &v->desc_len, "fake");
+		return 0;
+	}
+	case DRM_IOCTL_SET_VERSION: {
+		drm_set_version_t *sv = arg;
+
+		if (sv->drm_di_major == 1 && sv->drm_di_minor >= 4) {
+			pthread_mutex_lock(&mock_lock);
+			mock_unique_set[minor] = 1;
+			pthread_mutex_unlock(&mock_lock);
+		}
+		return 0;
+	}
+	case DRM_IOCTL_GET_UNIQUE: {
+		drm_unique_t *u = arg;
+		size_t len = u->unique_len;
+
+		busid[0] = '\0';
+		pthread_mutex_lock(&mock_lock);
+		if (mock_unique_set[minor])
+			mock_busid(minor, busid, sizeof(busid));
+		pthread_mutex_unlock(&mock_lock);
+		mock_copy(u->unique, &len, busid);
+		u->unique_len = len;
+		return 0;
+	}
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+static void make_card(const char *root, int minor)
+{
+	char path[PATH_MAX];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/class", root);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/class/drm", root);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/class/drm/card%d", root, minor);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/class/drm/card%d/device", root, minor);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/class/drm/card%d/device/uevent",
+		 root, minor);
+	f = fopen(path, "w");
+	assert(f);
+	fprintf(f, "DRIVER=%s\n", drivers[minor % 4]);
+	if (minor % 4 != 3) {
+		/* msm is a platform device without PCI information */
+		fprintf(f, "PCI_CLASS=30000\n");
+		fprintf(f, "PCI_ID=%04X:%04X\n", 0x8086 + minor, 0x100 + minor);
+		fprintf(f, "PCI_SUBSYS_ID=17AA:%04X\n", 0x2000 + minor);
+		fprintf(f, "PCI_SLOT_NAME=0000:%02x:00.0\n", minor + 1);
+	}
+	fprintf(f, "MODALIAS=pci:v00008086d00000166sv000017AAsd000021FAbc03sc00i00\n");
+	fclose(f);
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start->tv_sec) +
+		(end.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/* Open through drmOpen() and check which node and how many were opened. */
+static void check_open(const char *name, const char *busid, int minor)
+{
+	int fd;
+
+	mock_reset();
+	fd = drmOpen(name, busid);
+	assert(fd >= 0);
+	assert(mock_fd_to_minor(fd) == minor);
+	assert(mock_stats.opens[minor] == 1);
+	assert(mock_total_opens() == 1);
+	close(fd);
+}
+
+/**
+ * Checks device enumeration against a fake sysfs tree and compares the
+ * cost of a full scan with that of a cached lookup.  Then checks that
+ * drmAvailable() and drmOpen() by bus ID or by name go straight to the
+ * right node through the cache, and that nodes sysfs knows nothing about
+ * are probed in parallel.
+ */
+int main(int argc, char **argv)
+{
+	char root[] = "/tmp/drm-sysfs-XXXXXX";
+	char cmd[PATH_MAX + 16], busid[64];
+	drmDeviceInfoPtr devices;
+	struct timeval start;
+	double t_scan, t_cached;
+	int i, count, fd;
+
+	assert(mkdtemp(root));
+	for (i = 0; i < NUM_CARDS; i++)
+		make_card(root, i);
+
+	count = drmRescanDevices(root, 0);
+	assert(count == NUM_CARDS);
+
+	count = drmGetDevices(&devices);
+	assert(count == NUM_CARDS);
+	for (i = 0; i < NUM_CARDS; i++) {
+		assert(devices[i].minor == i);
+		assert(!strcmp(devices[i].name, drivers[i % 4]));
+		if (i % 4 == 3) {
+			assert(devices[i].busid[0] == '\0');
+			assert(devices[i].vendor_id == 0);
+			continue;
+		}
+		snprintf(busid, sizeof(busid), "pci:0000:%02x:00.0", i + 1);
+		assert(!strcmp(devices[i].busid, busid));
+		assert(devices[i].vendor_id == 0x8086 + i);
+		assert(devices[i].device_id == 0x100 + i);
+		assert(devices[i].subvendor_id == 0x17aa);
+		assert(devices[i].subdevice_id == 0x2000 + i);
+	}
+	drmFree(devices);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NUM_LOOKUPS; i++)
+		assert(drmRescanDevices(root, 0) >= NUM_CARDS);
+	t_scan = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NUM_LOOKUPS; i++) {
+		assert(drmGetDevices(&devices) >= NUM_CARDS);
+		drmFree(devices);
+	}
+	t_cached = elapsed(&start);
+
+	printf("%d cards: scan %.1fus, cached %.1fus per enumeration\n",
+	       NUM_CARDS, t_scan * 1e6 / NUM_LOOKUPS,
+	       t_cached * 1e6 / NUM_LOOKUPS);
+
+	/* Lookups from the sysfs information, without probing any node. */
+	mock_reset();
+	assert(drmAvailable() == 1);
+	assert(mock_total_opens() == 0);
+	check_open(NULL, "pci:0000:03:00.0", 2);
+	check_open("radeon", NULL, 1);
+	check_open("msm", NULL, 3);
+
+	/* Minor 2 reports a bus ID now, so it is in use; minor 6 is free. */
+	mock_reset();
+	fd = drmOpen("nouveau", NULL);
+	assert(mock_fd_to_minor(fd) == 6);
+	assert(mock_stats.opens[2] == 1 && mock_stats.opens[6] == 1);
+	assert(mock_total_opens() == 2);
+	close(fd);
+
+	/* Without sysfs, every node is opened once, concurrently. */
+	snprintf(cmd, sizeof(cmd), "rm -rf %s/class", root);
+	system(cmd);
+	mock_reset();
+	assert(drmRescanDevices(root, 1) == NUM_CARDS);
+	for (i = 0; i < NUM_CARDS; i++)
+		assert(mock_stats.opens[i] == 1);
+	assert(mock_stats.max_probing > 1);
+
+	assert(drmGetDevices(&devices) == NUM_CARDS);
+	for (i = 0; i < NUM_CARDS; i++) {
+		assert(devices[i].minor == i);
+		assert(!strcmp(devices[i].name, drivers[i % 4]));
+		if (i == 2)
+			mock_busid(i, busid, sizeof(busid));
+		else
+			busid[0] = '\0';
+		assert(!strcmp(devices[i].busid, busid));
+	}
+	drmFree(devices);
+
+	mock_reset();
+	assert(drmAvailable() == 1);
+	assert(mock_total_opens() == 0);
+	check_open(NULL, "pci:0000:03:00.0", 2);
+	check_open("i915", NULL, 0);
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+	system(cmd);
+	drmRescanDevices(NULL, 0);
+
+	return 0;
+}
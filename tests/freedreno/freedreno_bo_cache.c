@@ -0,0 +1,169 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freedreno_drmif.h"
+#include "freedreno_mock.h"
+
+/* how many compatible bos find_in_bucket probes */
+#define CACHE_WINDOW	4
+#define NUM_FRAMES	200
+#define FRAME_BOS	8
+#define SLOW_FRAMES	3
+
+static struct fd_device *dev;
+/* handles a frame retires, by frame */
+static uint32_t retire[NUM_FRAMES + SLOW_FRAMES + 1][FRAME_BOS];
+
+/* allocate nr bos of a size and free them again, oldest first */
+static void cache(struct fd_bo **bo, unsigned nr, uint32_t size,
+		  uint32_t flags)
+{
+	unsigned i;
+
+	for (i = 0; i < nr; i++) {
+		bo[i] = fd_bo_new(dev, size, flags);
+		assert(bo[i]);
+	}
+	for (i = 0; i < nr; i++)
+		fd_bo_del(bo[i]);
+}
+
+/* the first bo of a frame keeps the GPU busy for a few more frames */
+static void frame(unsigned f)
+{
+	struct fd_bo *bo[FRAME_BOS];
+	uint32_t handle;
+	unsigned i;
+
+	for (i = 0; i < FRAME_BOS; i++) {
+		if (retire[f][i])
+			mock_set_busy(retire[f][i], 0);
+	}
+	for (i = 0; i < FRAME_BOS; i++) {
+		bo[i] = fd_bo_new(dev, 65536, 0);
+		assert(bo[i]);
+		handle = fd_bo_handle(bo[i]);
+		mock_set_busy(handle, 1);
+		retire[f + (i ? 1 : SLOW_FRAMES)][i] = handle;
+	}
+	for (i = 0; i < FRAME_BOS; i++)
+		fd_bo_del(bo[i]);
+}
+
+/**
+ * Check that an idle bo is found behind busy ones, but only so far,
+ * that a bo is only reused for the flags it was allocated with, and
+ * that render targets come from the MRU end without a busy probe.  Then
+ * run frames that leave a busy bo at the head of the bucket.
+ */
+int main(int argc, char **argv)
+{
+	struct fd_bo *bo[CACHE_WINDOW + 1], *render;
+	struct fd_bo_cache_stats stats;
+	unsigned created, prepped, hits, f, i;
+
+	mock_reset();
+	dev = fd_device_new(MOCK_FD);
+	assert(dev);
+
+	/* idle behind busy */
+	cache(bo, CACHE_WINDOW, 4096, 0);
+	for (i = 0; i < CACHE_WINDOW - 1; i++)
+		mock_set_busy(fd_bo_handle(bo[i]), 1);
+	created = mock_stats.gem_new;
+	assert(fd_bo_new(dev, 4096, 0) == bo[CACHE_WINDOW - 1]);
+	assert(mock_stats.gem_new == created);
+	fd_device_get_bo_cache_stats(dev, &stats);
+	assert(stats.busy == CACHE_WINDOW - 1);
+	assert(stats.hits == 1);
+	for (i = 0; i < CACHE_WINDOW - 1; i++)
+		mock_set_busy(fd_bo_handle(bo[i]), 0);
+	assert(fd_bo_new(dev, 4096, 0) == bo[0]);
+	fd_bo_del(bo[0]);
+	fd_bo_del(bo[CACHE_WINDOW - 1]);
+
+	/* but not beyond the window */
+	cache(bo, CACHE_WINDOW + 1, 8192, 0);
+	for (i = 0; i < CACHE_WINDOW; i++)
+		mock_set_busy(fd_bo_handle(bo[i]), 1);
+	created = mock_stats.gem_new;
+	render = fd_bo_new(dev, 8192, 0);
+	assert(mock_stats.gem_new == created + 1);
+	fd_device_get_bo_cache_stats(dev, &stats);
+	assert(stats.busy == 2 * CACHE_WINDOW - 1);
+	assert(stats.misses == CACHE_WINDOW + (CACHE_WINDOW + 1) + 1);
+	fd_bo_del(render);
+	for (i = 0; i < CACHE_WINDOW; i++)
+		mock_set_busy(fd_bo_handle(bo[i]), 0);
+
+	/* only the same flags */
+	cache(bo, 1, 12288, DRM_FREEDRENO_GEM_CACHE_WCOMBINE);
+	render = fd_bo_new(dev, 12288, 0);
+	assert(render != bo[0]);
+	assert(fd_bo_new(dev, 12288, DRM_FREEDRENO_GEM_CACHE_WCOMBINE) ==
+	       bo[0]);
+	fd_bo_del(render);
+	fd_bo_del(bo[0]);
+
+	/* render targets: MRU first, busy or not, but the same flags */
+	cache(bo, 2, 16384, 0);
+	mock_set_busy(fd_bo_handle(bo[0]), 1);
+	mock_set_busy(fd_bo_handle(bo[1]), 1);
+	prepped = mock_stats.gem_cpu_prep;
+	assert(fd_bo_new(dev, 16384, DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER) ==
+	       bo[1]);
+	assert(fd_bo_new(dev, 16384, DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER) ==
+	       bo[0]);
+	assert(mock_stats.gem_cpu_prep == prepped);
+	mock_set_busy(fd_bo_handle(bo[0]), 0);
+	mock_set_busy(fd_bo_handle(bo[1]), 0);
+	fd_bo_del(bo[1]);
+	assert(fd_bo_new(dev, 16384, 0) == bo[1]);
+	fd_bo_del(bo[0]);
+	created = mock_stats.gem_new;
+	render = fd_bo_new(dev, 16384, DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER |
+			   DRM_FREEDRENO_GEM_CACHE_WCOMBINE);
+	assert(mock_stats.gem_new == created + 1);
+	fd_bo_del(render);
+	fd_bo_del(bo[1]);
+
+	/* steady state with a slow bo at the head */
+	fd_device_get_bo_cache_stats(dev, &stats);
+	created = mock_stats.gem_new;
+	hits = stats.hits;
+	for (f = 0; f < NUM_FRAMES; f++)
+		frame(f);
+	fd_device_get_bo_cache_stats(dev, &stats);
+	printf("%d frames of %d bos: %u hits, %u bos created\n", NUM_FRAMES,
+	       FRAME_BOS, stats.hits - hits, mock_stats.gem_new - created);
+	assert(mock_stats.gem_new - created <= FRAME_BOS + SLOW_FRAMES);
+
+	fd_device_del(dev);
+	assert(mock_stats.bo_open == 0);
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "freedreno_drmif.h"
+#include "freedreno_mock.h"
+
+#define NUM_THREADS	4
+#define NUM_ITERATIONS	500
+#define THREAD_BOS	8
+#define CPU_PREP_US	20
+
+struct worker {
+	struct fd_device *dev, *peer;
+	pthread_t thread;
+};
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* allocate and free through the cache, sharing a bo with the peer now
+ * and then */
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	struct fd_bo *bo[THREAD_BOS], *imported;
+	uint32_t name;
+	unsigned i, j;
+
+	for (i = 0; i < NUM_ITERATIONS; i++) {
+		for (j = 0; j < THREAD_BOS; j++) {
+			bo[j] = fd_bo_new(w->dev, 4096 << (j % 4), 0);
+			assert(bo[j]);
+		}
+		if (i % 16 == 0) {
+			assert(fd_bo_get_name(bo[0], &name) == 0);
+			imported = fd_bo_from_name(w->peer, name);
+			assert(imported);
+			assert(fd_bo_size(imported) == fd_bo_size(bo[0]));
+			assert(fd_bo_from_name(w->peer, name) == imported);
+			fd_bo_del(imported);
+			fd_bo_del(imported);
+		}
+		for (j = 0; j < THREAD_BOS; j++)
+			fd_bo_del(bo[j]);
+	}
+	return NULL;
+}
+
+static double run(struct worker *w)
+{
+	double start;
+	unsigned i;
+
+	start = now();
+	for (i = 0; i < NUM_THREADS; i++)
+		assert(pthread_create(&w[i].thread, NULL, worker, &w[i]) == 0);
+	for (i = 0; i < NUM_THREADS; i++)
+		pthread_join(w[i].thread, NULL);
+	return now() - start;
+}
+
+/**
+ * Check that the bo cache hands back idle bos, passes over busy ones
+ * and keeps shared ones out, and that names import once per device.
+ * Then time threads allocating, freeing and importing, all on one
+ * device and each on its own, with the idle probe taking a while.
+ */
+int main(int argc, char **argv)
+{
+	struct fd_device *dev[NUM_THREADS + 1];
+	struct worker w[NUM_THREADS];
+	struct fd_bo *bo, *busy, *imported;
+	unsigned created, closed, i;
+	double shared, separate;
+	uint32_t name;
+
+	mock_reset();
+	for (i = 0; i < NUM_THREADS + 1; i++) {
+		dev[i] = fd_device_new(MOCK_FD);
+		assert(dev[i]);
+	}
+
+	/* a freed bo comes back, unless busy */
+	bo = fd_bo_new(dev[0], 4096, 0);
+	assert(bo);
+	fd_bo_del(bo);
+	assert(mock_stats.gem_close == 0);
+	assert(fd_bo_new(dev[0], 4096, 0) == bo);
+	assert(mock_stats.gem_new == 1);
+	fd_bo_del(bo);
+	mock_bo_busy = 1;
+	busy = fd_bo_new(dev[0], 4096, 0);
+	assert(busy != bo);
+	assert(mock_stats.gem_new == 2);
+	mock_bo_busy = 0;
+	assert(fd_bo_new(dev[0], 4096, 0) == bo);
+	fd_bo_del(busy);
+	fd_bo_del(bo);
+
+	/* a named bo imports once per device and is never cached */
+	bo = fd_bo_new(dev[0], 4096, 0);
+	assert(fd_bo_get_name(bo, &name) == 0);
+	assert(fd_bo_from_name(dev[0], name) == bo);
+	assert(mock_stats.gem_open == 0);
+	imported = fd_bo_from_name(dev[1], name);
+	assert(imported && imported != bo);
+	assert(fd_bo_from_name(dev[1], name) == imported);
+	assert(mock_stats.gem_open == 1);
+	fd_bo_del(imported);
+	fd_bo_del(imported);
+	fd_bo_del(bo);
+	closed = mock_stats.gem_close;
+	fd_bo_del(bo);
+	assert(mock_stats.gem_close == closed + 1);
+
+	mock_cpu_prep_us = CPU_PREP_US;
+	for (i = 0; i < NUM_THREADS; i++) {
+		w[i].dev = dev[0];
+		w[i].peer = dev[NUM_THREADS];
+	}
+	created = mock_stats.gem_new;
+	shared = run(w);
+	printf("%d threads on one device: %.3fs, %u bos created\n",
+	       NUM_THREADS, shared, mock_stats.gem_new - created);
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		w[i].dev = dev[i];
+		w[i].peer = dev[(i + 1) % NUM_THREADS];
+	}
+	created = mock_stats.gem_new;
+	separate = run(w);
+	printf("%d threads on their own devices: %.3fs, %u bos created\n",
+	       NUM_THREADS, separate, mock_stats.gem_new - created);
+
+	for (i = 0; i < NUM_THREADS + 1; i++)
+		fd_device_del(dev[i]);
+	assert(mock_stats.bo_open == 0);
+	return 0;
+}
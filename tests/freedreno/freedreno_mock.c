@@ -0,0 +1,313 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Replacements for the libdrm ioctl entry points, so that libdrm_freedreno
+ * can be exercised without an msm device.  Symbols defined in the
+ * executable take precedence over the ones in libdrm.so.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "xf86drm.h"
+
+#ifndef __user
+#  define __user
+#endif
+
+#include "msm_drm.h"
+#include "freedreno_mock.h"
+
+struct mock_stats mock_stats;
+int mock_bo_busy;
+unsigned mock_cpu_prep_us;
+
+/* ioctls may come from several threads, the cpu_prep latency is outside it */
+static pthread_mutex_t mock_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* like the kernel, GEM_OPEN makes a new handle for an object every time */
+static uint32_t next_handle = 1;
+static uint32_t *handle_obj;
+static uint32_t *handle_busy;
+static uint32_t handle_nr;
+
+static uint32_t next_fence;
+
+static uint32_t next_obj = 1;
+static uint32_t *obj_size;
+static uint32_t obj_nr;
+
+void mock_reset(void)
+{
+	memset(&mock_stats, 0, sizeof(mock_stats));
+	mock_bo_busy = 0;
+	mock_cpu_prep_us = 0;
+}
+
+static int grow(uint32_t **array, uint32_t *nr, uint32_t index)
+{
+	uint32_t *grown, n = 2 * (index + 1);
+
+	if (index < *nr)
+		return 0;
+	grown = realloc(*array, n * sizeof(*grown));
+	if (!grown)
+		return -ENOMEM;
+	memset(grown + *nr, 0, (n - *nr) * sizeof(*grown));
+	*array = grown;
+	*nr = n;
+	return 0;
+}
+
+static int mock_handle_new(uint32_t obj, uint32_t *handle)
+{
+	uint32_t nr = handle_nr;
+
+	if (grow(&handle_busy, &nr, next_handle) ||
+	    grow(&handle_obj, &handle_nr, next_handle))
+		return -ENOMEM;
+	*handle = next_handle++;
+	handle_obj[*handle] = obj;
+	handle_busy[*handle] = 0;
+	mock_stats.bo_open++;
+	return 0;
+}
+
+static uint32_t mock_handle_obj(uint32_t handle)
+{
+	return handle < handle_nr ? handle_obj[handle] : 0;
+}
+
+void mock_set_busy(uint32_t handle, int busy)
+{
+	pthread_mutex_lock(&mock_lock);
+	if (mock_handle_obj(handle))
+		handle_busy[handle] = busy;
+	pthread_mutex_unlock(&mock_lock);
+}
+
+static int mock_gem_new(struct drm_msm_gem_new *req)
+{
+	if (!req->size || grow(&obj_size, &obj_nr, next_obj))
+		return -EINVAL;
+	obj_size[next_obj] = req->size;
+	mock_stats.gem_new++;
+	return mock_handle_new(next_obj++, &req->handle);
+}
+
+/* checks what the kernel would, and that each cmd got its own relocs */
+static int mock_gem_submit(struct drm_msm_gem_submit *req)
+{
+	struct drm_msm_gem_submit_bo *bos = (void *)(unsigned long)req->bos;
+	struct drm_msm_gem_submit_cmd *cmds = (void *)(unsigned long)req->cmds;
+	struct drm_msm_gem_submit_reloc *relocs;
+	uint32_t i, j, last;
+
+	for (i = 0; i < req->nr_bos; i++) {
+		if (!mock_handle_obj(bos[i].handle) ||
+		    (bos[i].flags & ~MSM_SUBMIT_BO_FLAGS))
+			return -EINVAL;
+	}
+	for (i = 0; i < req->nr_cmds; i++) {
+		if (cmds[i].submit_idx >= req->nr_bos)
+			return -EINVAL;
+		relocs = (void *)(unsigned long)cmds[i].relocs;
+		for (j = 0, last = 0; j < cmds[i].nr_relocs; j++) {
+			if (relocs[j].reloc_idx >= req->nr_bos ||
+			    relocs[j].submit_offset < last ||
+			    relocs[j].submit_offset < cmds[i].submit_offset ||
+			    relocs[j].submit_offset >= cmds[i].submit_offset +
+						       cmds[i].size)
+				return -EINVAL;
+			last = relocs[j].submit_offset;
+		}
+		mock_stats.submit_relocs += cmds[i].nr_relocs;
+	}
+	mock_stats.submit_cmds += req->nr_cmds;
+	mock_stats.gem_submit++;
+	req->fence = ++next_fence;
+	return 0;
+}
+
+static int mock_write_read(unsigned long drmCommandIndex, void *data)
+{
+	switch (drmCommandIndex) {
+	case DRM_MSM_GET_PARAM: {
+		struct drm_msm_param *req = data;
+
+		switch (req->param) {
+		case MSM_PARAM_GPU_ID:
+			req->value = 320;
+			return 0;
+		case MSM_PARAM_GMEM_SIZE:
+			req->value = 512 * 1024;
+			return 0;
+		case MSM_PARAM_CHIP_ID:
+			req->value = 0x03020000;
+			return 0;
+		default:
+			return -EINVAL;
+		}
+	}
+	case DRM_MSM_GEM_SUBMIT:
+		return mock_gem_submit(data);
+	case DRM_MSM_GEM_NEW:
+		return mock_gem_new(data);
+	case DRM_MSM_GEM_INFO: {
+		struct drm_msm_gem_info *req = data;
+
+		if (!mock_handle_obj(req->handle))
+			return -ENOENT;
+		req->offset = (uint64_t)req->handle * MOCK_BO_MMAP_STRIDE;
+		mock_stats.gem_info++;
+		return 0;
+	}
+	default:
+		return -EINVAL;
+	}
+}
+
+int drmCommandWriteRead(int fd, unsigned long drmCommandIndex, void *data,
+			unsigned long size)
+{
+	int ret;
+
+	pthread_mutex_lock(&mock_lock);
+	ret = mock_write_read(drmCommandIndex, data);
+	pthread_mutex_unlock(&mock_lock);
+	return ret;
+}
+
+static int mock_write(unsigned long drmCommandIndex, void *data)
+{
+	switch (drmCommandIndex) {
+	case DRM_MSM_GEM_CPU_PREP: {
+		struct drm_msm_gem_cpu_prep *req = data;
+
+		if (!mock_handle_obj(req->handle))
+			return -ENOENT;
+		mock_stats.gem_cpu_prep++;
+		return mock_bo_busy || handle_busy[req->handle] ? -EBUSY : 0;
+	}
+	case DRM_MSM_GEM_CPU_FINI:
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+int drmCommandWrite(int fd, unsigned long drmCommandIndex, void *data,
+		    unsigned long size)
+{
+	int ret;
+
+	pthread_mutex_lock(&mock_lock);
+	ret = mock_write(drmCommandIndex, data);
+	pthread_mutex_unlock(&mock_lock);
+	if (drmCommandIndex == DRM_MSM_GEM_CPU_PREP && mock_cpu_prep_us)
+		usleep(mock_cpu_prep_us);
+	return ret;
+}
+
+/* like drmIoctl these fail with -1 and errno set */
+static int mock_ioctl(unsigned long request, void *arg)
+{
+	switch (request) {
+	case DRM_IOCTL_VERSION: {
+		drm_version_t *version = arg;
+
+		version->version_major = 1;
+		version->version_minor = 0;
+		version->version_patchlevel = 0;
+		/* drmGetVersion asks for the lengths first */
+		if (version->name)
+			memcpy(version->name, "msm", 3);
+		if (version->date)
+			memcpy(version->date, "0", 1);
+		if (version->desc)
+			memcpy(version->desc, "mock", 4);
+		version->name_len = 3;
+		version->date_len = 1;
+		version->desc_len = 4;
+		return 0;
+	}
+	case DRM_IOCTL_GEM_CLOSE: {
+		struct drm_gem_close *req = arg;
+
+		if (!mock_handle_obj(req->handle)) {
+			errno = EINVAL;
+			return -1;
+		}
+		handle_obj[req->handle] = 0;
+		mock_stats.bo_open--;
+		mock_stats.gem_close++;
+		return 0;
+	}
+	case DRM_IOCTL_GEM_FLINK: {
+		struct drm_gem_flink *req = arg;
+		uint32_t obj = mock_handle_obj(req->handle);
+
+		if (!obj) {
+			errno = ENOENT;
+			return -1;
+		}
+		req->name = obj + MOCK_NAME_BASE;
+		mock_stats.gem_flink++;
+		return 0;
+	}
+	case DRM_IOCTL_GEM_OPEN: {
+		struct drm_gem_open *req = arg;
+		uint32_t obj = req->name - MOCK_NAME_BASE;
+
+		/* objects stay around once named, whether open or not */
+		if (req->name < MOCK_NAME_BASE || obj >= next_obj) {
+			errno = ENOENT;
+			return -1;
+		}
+		if (mock_handle_new(obj, &req->handle)) {
+			errno = ENOMEM;
+			return -1;
+		}
+		req->size = obj_size[obj];
+		mock_stats.gem_open++;
+		return 0;
+	}
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+int drmIoctl(int fd, unsigned long request, void *arg)
+{
+	int ret;
+
+	pthread_mutex_lock(&mock_lock);
+	ret = mock_ioctl(request, arg);
+	pthread_mutex_unlock(&mock_lock);
+	return ret;
+}
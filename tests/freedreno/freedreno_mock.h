@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef FREEDRENO_MOCK_H
+#define FREEDRENO_MOCK_H
+
+#include <stdint.h>
+
+/* Fake device fd, the mocked ioctls ignore it */
+#define MOCK_FD		-1
+
+/* bo n is mapped at n times this offset of the device fd, mapping bos
+ * needs a regular file big enough passed as the fd instead of MOCK_FD */
+#define MOCK_BO_MMAP_STRIDE	(1 << 20)
+
+/* flink names are the bo's object number plus this */
+#define MOCK_NAME_BASE		0x10000
+
+struct mock_stats {
+	unsigned gem_new;
+	unsigned gem_info;
+	unsigned gem_cpu_prep;
+	unsigned gem_close;
+	unsigned gem_flink;
+	unsigned gem_open;
+	unsigned gem_submit;
+	/* what the submissions carried, not ioctls */
+	unsigned submit_cmds;
+	unsigned submit_relocs;
+	/* handles currently open, not an ioctl */
+	unsigned bo_open;
+};
+
+extern struct mock_stats mock_stats;
+
+/* When set, DRM_MSM_GEM_CPU_PREP reports every bo as busy */
+extern int mock_bo_busy;
+
+/* Whether DRM_MSM_GEM_CPU_PREP reports a handle as busy */
+void mock_set_busy(uint32_t handle, int busy);
+
+/* How long DRM_MSM_GEM_CPU_PREP blocks the calling thread, in us */
+extern unsigned mock_cpu_prep_us;
+
+void mock_reset(void);
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "freedreno_drmif.h"
+#include "freedreno_ringbuffer.h"
+#include "freedreno_mock.h"
+
+#define NUM_TILES	512
+#define TILE_RELOCS	8
+#define NUM_FLUSHES	20
+#define NUM_BOS		16
+#define RING_SIZE	0x10000
+
+static struct fd_bo *bo[NUM_BOS];
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void reloc(struct fd_ringbuffer *ring, unsigned i)
+{
+	fd_ringbuffer_reloc(ring, &(struct fd_reloc){
+		.bo = bo[i % NUM_BOS],
+		.flags = FD_RELOC_READ,
+		.offset = i * 4,
+	});
+}
+
+/* a range of the tiles ring per tile, each with its relocs and an IB to
+ * it from the main ring, like per tile draw cmds */
+static void tiles(struct fd_ringbuffer *ring, struct fd_ringbuffer *target,
+		  struct fd_ringmarker *start, struct fd_ringmarker *end)
+{
+	unsigned t, i;
+
+	for (t = 0; t < NUM_TILES; t++) {
+		fd_ringmarker_mark(start);
+		for (i = 0; i < TILE_RELOCS; i++) {
+			fd_ringbuffer_emit(target, 0x1000 | i);
+			reloc(target, t + i);
+		}
+		fd_ringmarker_mark(end);
+		fd_ringbuffer_emit(ring, 0x2000 | t);
+		fd_ringbuffer_emit_reloc_ring(ring, start, end);
+	}
+}
+
+/**
+ * Check that a flush hands the kernel each IB target's relocs, sorted
+ * even when emitted out of order, and a single cmd for an IB emitted
+ * twice.  Then time flushes of a few hundred IBs into one ring.
+ */
+int main(int argc, char **argv)
+{
+	char device[] = "/tmp/freedreno_ringbuffer.XXXXXX";
+	struct fd_ringbuffer *ring, *target;
+	struct fd_ringmarker *start, *end;
+	struct fd_device *dev;
+	struct fd_pipe *pipe;
+	unsigned cmds, relocs, i;
+	double elapsed;
+	int fd;
+
+	mock_reset();
+	fd = mkstemp(device);
+	assert(fd >= 0);
+	assert(ftruncate(fd, 256 * MOCK_BO_MMAP_STRIDE) == 0);
+	dev = fd_device_new(fd);
+	assert(dev);
+	pipe = fd_pipe_new(dev, FD_PIPE_3D);
+	assert(pipe);
+	for (i = 0; i < NUM_BOS; i++) {
+		bo[i] = fd_bo_new(dev, 4096, 0);
+		assert(bo[i]);
+	}
+	ring = fd_ringbuffer_new(pipe, RING_SIZE);
+	target = fd_ringbuffer_new(pipe, RING_SIZE);
+	assert(ring && target);
+	fd_ringbuffer_set_parent(target, ring);
+	start = fd_ringmarker_new(target);
+	end = fd_ringmarker_new(target);
+
+	/* a reloc emitted before an earlier one */
+	fd_ringbuffer_emit(ring, 0);
+	fd_ringbuffer_emit(ring, 0);
+	reloc(ring, 2);
+	ring->cur = ring->start;
+	reloc(ring, 0);
+	ring->cur += 2;
+	reloc(ring, 3);
+	assert(fd_ringbuffer_flush(ring) == 0);
+	assert(mock_stats.gem_submit == 1);
+	assert(mock_stats.submit_relocs == 3);
+	fd_ringbuffer_reset(ring);
+
+	/* every tile's relocs, and one cmd per IB target range */
+	tiles(ring, target, start, end);
+	fd_ringbuffer_emit_reloc_ring(ring, start, end);
+	cmds = mock_stats.submit_cmds;
+	relocs = mock_stats.submit_relocs;
+	assert(fd_ringbuffer_flush(ring) == 0);
+	assert(mock_stats.submit_cmds - cmds == NUM_TILES + 1);
+	assert(mock_stats.submit_relocs - relocs ==
+	       NUM_TILES * TILE_RELOCS + NUM_TILES + 1);
+	fd_ringbuffer_reset(ring);
+	fd_ringbuffer_reset(target);
+
+	elapsed = now();
+	for (i = 0; i < NUM_FLUSHES; i++) {
+		tiles(ring, target, start, end);
+		assert(fd_ringbuffer_flush(ring) == 0);
+		fd_ringbuffer_reset(ring);
+		fd_ringbuffer_reset(target);
+	}
+	elapsed = now() - elapsed;
+	printf("%d IBs of %d relocs: %.1f us per flush\n", NUM_TILES,
+	       TILE_RELOCS, elapsed * 1e6 / NUM_FLUSHES);
+
+	fd_ringmarker_del(start);
+	fd_ringmarker_del(end);
+	fd_ringbuffer_del(target);
+	fd_ringbuffer_del(ring);
+	for (i = 0; i < NUM_BOS; i++)
+		fd_bo_del(bo[i]);
+	fd_pipe_del(pipe);
+	fd_device_del(dev);
+	assert(mock_stats.bo_open == 0);
+	close(fd);
+	unlink(device);
+	return 0;
+}
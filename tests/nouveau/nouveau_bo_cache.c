@@ -0,0 +1,204 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "nouveau.h"
+#include "nouveau_mock.h"
+
+#define NUM_LIVE	64
+#define NUM_ALLOCS	200000
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static struct nouveau_bo *new_bo(struct nouveau_device *dev, uint32_t flags,
+				 uint64_t size, union nouveau_bo_config *config)
+{
+	struct nouveau_bo *bo = NULL;
+
+	assert(nouveau_bo_new(dev, flags, 0, size, config, &bo) == 0);
+	assert(bo && bo->size >= size);
+	return bo;
+}
+
+static void del_bo(struct nouveau_bo *bo)
+{
+	nouveau_bo_ref(NULL, &bo);
+}
+
+/* a driver's allocation pattern: a set of live bos, one replaced at a time */
+static double churn(struct nouveau_device *dev)
+{
+	struct nouveau_bo *live[NUM_LIVE] = {};
+	double start = now();
+	unsigned i, slot;
+
+	srand(0);
+	for (i = 0; i < NUM_ALLOCS; i++) {
+		slot = rand() % NUM_LIVE;
+		nouveau_bo_ref(NULL, &live[slot]);
+		live[slot] = new_bo(dev, NOUVEAU_BO_GART | NOUVEAU_BO_MAP,
+				    4096 * (1 + rand() % 64), NULL);
+	}
+	for (i = 0; i < NUM_LIVE; i++)
+		nouveau_bo_ref(NULL, &live[i]);
+	return now() - start;
+}
+
+/**
+ * Check what the bo cache hands back: only idle private bos allocated with
+ * the same flags, alignment and config, still mapped, and never named
+ * ones, within its memory budget.  Then time a churn of allocations with
+ * and without the cache.
+ */
+int main(int argc, char **argv)
+{
+	char device[] = "/tmp/nouveau_bo_cache.XXXXXX";
+	union nouveau_bo_config config = { .nvc0 = { 0xfe, 0x10 } };
+	struct nouveau_device *dev;
+	struct nouveau_client *client;
+	struct nouveau_bo *bo, *bo2, *named;
+	unsigned gem_new;
+	double plain, cached;
+	uint32_t handle, name;
+	void *map;
+	int fd;
+
+	mock_reset();
+	fd = mkstemp(device);
+	assert(fd >= 0);
+	assert(ftruncate(fd, 64 * MOCK_BO_MMAP_STRIDE) == 0);
+	assert(nouveau_device_wrap(fd, 0, &dev) == 0);
+	assert(nouveau_client_new(dev, &client) == 0);
+
+	/* off by default */
+	bo = new_bo(dev, NOUVEAU_BO_GART, 4096, NULL);
+	del_bo(bo);
+	bo = new_bo(dev, NOUVEAU_BO_GART, 4096, NULL);
+	del_bo(bo);
+	assert(mock_stats.gem_new == 2 && mock_stats.gem_close == 2);
+
+	nouveau_device_set_bo_cache(dev, 16 << 20, 10000);
+
+	/* sizes round up to a bucket, mappings survive */
+	bo = new_bo(dev, NOUVEAU_BO_GART | NOUVEAU_BO_MAP, 5000, NULL);
+	assert(bo->size == 8192);
+	assert(nouveau_bo_map(bo, NOUVEAU_BO_WR, client) == 0);
+	map = bo->map;
+	memset(map, 0xa5, bo->size);
+	handle = bo->handle;
+	del_bo(bo);
+	assert(mock_stats.gem_close == 2);
+	bo = new_bo(dev, NOUVEAU_BO_GART | NOUVEAU_BO_MAP, 6000, NULL);
+	assert(bo->handle == handle && bo->map == map);
+	assert(((uint8_t *)bo->map)[8191] == 0xa5);
+	assert(mock_stats.gem_new == 3);
+
+	/* other flags, alignment or config get a new bo */
+	del_bo(bo);
+	bo = new_bo(dev, NOUVEAU_BO_VRAM | NOUVEAU_BO_MAP, 6000, NULL);
+	assert(bo->handle != handle);
+	del_bo(bo);
+	assert(nouveau_bo_new(dev, NOUVEAU_BO_GART | NOUVEAU_BO_MAP, 4096,
+			      6000, NULL, &bo) == 0);
+	assert(bo->handle != handle);
+	del_bo(bo);
+	bo = new_bo(dev, NOUVEAU_BO_GART | NOUVEAU_BO_MAP, 6000, &config);
+	assert(bo->handle != handle);
+	bo2 = new_bo(dev, NOUVEAU_BO_GART | NOUVEAU_BO_MAP, 6000, NULL);
+	assert(bo2->handle == handle);
+	del_bo(bo2);
+	del_bo(bo);
+	bo = new_bo(dev, NOUVEAU_BO_GART | NOUVEAU_BO_MAP, 6000, &config);
+	assert(bo->config.nvc0.memtype == 0xfe);
+	del_bo(bo);
+	assert(mock_stats.gem_new == 6);
+
+	/* busy bos stay in the cache */
+	mock_bo_busy = 1;
+	bo = new_bo(dev, NOUVEAU_BO_GART | NOUVEAU_BO_MAP, 6000, NULL);
+	assert(bo->handle != handle);
+	assert(mock_stats.gem_new == 7);
+	mock_bo_busy = 0;
+	bo2 = new_bo(dev, NOUVEAU_BO_GART | NOUVEAU_BO_MAP, 6000, NULL);
+	assert(bo2->handle == handle);
+	del_bo(bo2);
+	del_bo(bo);
+
+	/* named bos are closed, and found again by name until then */
+	named = new_bo(dev, NOUVEAU_BO_GART, 4096, NULL);
+	assert(nouveau_bo_name_get(named, &name) == 0);
+	bo = NULL;
+	assert(nouveau_bo_name_ref(dev, name, &bo) == 0);
+	assert(bo == named && mock_stats.gem_open == 0);
+	del_bo(bo);
+	gem_new = mock_stats.gem_close;
+	del_bo(named);
+	assert(mock_stats.gem_close == gem_new + 1);
+
+	/* the budget holds, turning the cache off empties it */
+	bo = new_bo(dev, NOUVEAU_BO_GART, 12 << 20, NULL);
+	bo2 = new_bo(dev, NOUVEAU_BO_GART, 12 << 20, NULL);
+	handle = bo2->handle;
+	del_bo(bo);
+	del_bo(bo2);
+	gem_new = mock_stats.gem_new;
+	bo = new_bo(dev, NOUVEAU_BO_GART, 12 << 20, NULL);
+	assert(bo->handle == handle);
+	bo2 = new_bo(dev, NOUVEAU_BO_GART, 12 << 20, NULL);
+	assert(mock_stats.gem_new == gem_new + 1);
+	del_bo(bo2);
+	del_bo(bo);
+	nouveau_device_set_bo_cache(dev, 0, 0);
+	assert(mock_stats.gem_close == mock_stats.gem_new);
+
+	gem_new = mock_stats.gem_new;
+	plain = churn(dev);
+	printf("%u allocations: %.3f ms, %u GEM_NEW\n", NUM_ALLOCS,
+	       plain * 1000.0, mock_stats.gem_new - gem_new);
+	nouveau_device_set_bo_cache(dev, 64 << 20, 1000);
+	gem_new = mock_stats.gem_new;
+	cached = churn(dev);
+	printf("with the bo cache: %.3f ms, %u GEM_NEW\n", cached * 1000.0,
+	       mock_stats.gem_new - gem_new);
+	assert((mock_stats.gem_new - gem_new) * 100 < NUM_ALLOCS);
+
+	nouveau_client_del(&client);
+	nouveau_device_del(&dev);
+	assert(mock_stats.gem_close == mock_stats.gem_new);
+	close(fd);
+	unlink(device);
+	return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "nouveau.h"
+#include "nouveau_mock.h"
+
+#define NUM_THREADS	4
+#define NUM_IMPORTS	200000
+#define NUM_PRIVATE	20000
+
+struct importer {
+	pthread_t thread;
+	struct nouveau_device *dev;
+	uint32_t *names;
+	unsigned nr_names;
+	unsigned seed;
+};
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static struct nouveau_bo *new_bo(struct nouveau_device *dev)
+{
+	struct nouveau_bo *bo = NULL;
+
+	assert(nouveau_bo_new(dev, NOUVEAU_BO_GART, 0, 4096, NULL, &bo) == 0);
+	return bo;
+}
+
+static void del_bo(struct nouveau_bo *bo)
+{
+	nouveau_bo_ref(NULL, &bo);
+}
+
+/*
+ * Import random names, keeping the last few alive so both lookups of held
+ * bos and reopens of released ones race with the other importers.
+ */
+static void *import(void *arg)
+{
+	struct importer *imp = arg;
+	struct nouveau_bo *held[4] = {};
+	unsigned i;
+
+	for (i = 0; i < NUM_IMPORTS; i++) {
+		uint32_t name = imp->names[rand_r(&imp->seed) % imp->nr_names];
+		struct nouveau_bo **bo = &held[i % 4];
+		uint32_t check;
+
+		nouveau_bo_ref(NULL, bo);
+		assert(nouveau_bo_name_ref(imp->dev, name, bo) == 0);
+		assert(nouveau_bo_name_get(*bo, &check) == 0 && check == name);
+	}
+	for (i = 0; i < 4; i++)
+		nouveau_bo_ref(NULL, &held[i]);
+	return NULL;
+}
+
+/* ns per import with nr_names shared bos, half of them kept alive */
+static double contend(struct nouveau_device *dev, unsigned nr_names)
+{
+	struct importer imp[NUM_THREADS];
+	struct nouveau_bo **bos = calloc(nr_names, sizeof(*bos));
+	uint32_t *names = calloc(nr_names, sizeof(*names));
+	double start;
+	unsigned i;
+
+	assert(bos && names);
+	for (i = 0; i < nr_names; i++) {
+		bos[i] = new_bo(dev);
+		assert(nouveau_bo_name_get(bos[i], &names[i]) == 0);
+		if (i & 1)
+			nouveau_bo_ref(NULL, &bos[i]);
+	}
+
+	start = now();
+	for (i = 0; i < NUM_THREADS; i++) {
+		imp[i].dev = dev;
+		imp[i].names = names;
+		imp[i].nr_names = nr_names;
+		imp[i].seed = i;
+		assert(pthread_create(&imp[i].thread, NULL, import,
+				      &imp[i]) == 0);
+	}
+	for (i = 0; i < NUM_THREADS; i++)
+		pthread_join(imp[i].thread, NULL);
+	start = now() - start;
+
+	for (i = 0; i < nr_names; i++)
+		nouveau_bo_ref(NULL, &bos[i]);
+	free(names);
+	free(bos);
+	return start * 1e9 / (NUM_THREADS * NUM_IMPORTS);
+}
+
+/**
+ * Check that imports by name, handle and prime fd find the bo already open
+ * on the device, whatever way it was shared or not, and that closed ones are
+ * reopened.  Then time concurrent importers against few and many shared
+ * bos, with plenty of private ones around.
+ */
+int main(int argc, char **argv)
+{
+	char device[] = "/tmp/nouveau_bo_import.XXXXXX";
+	struct nouveau_device *dev;
+	struct nouveau_bo *bo, *bo2, *private[NUM_PRIVATE];
+	double few, many;
+	uint32_t name, name2;
+	unsigned info, closed;
+	int fd, prime_fd, i;
+
+	mock_reset();
+	fd = mkstemp(device);
+	assert(fd >= 0);
+	assert(nouveau_device_wrap(fd, 0, &dev) == 0);
+
+	/* named bos are found while open, reopened once closed */
+	bo = new_bo(dev);
+	assert(nouveau_bo_name_get(bo, &name) == 0);
+	bo2 = NULL;
+	assert(nouveau_bo_name_ref(dev, name, &bo2) == 0);
+	assert(bo2 == bo && mock_stats.gem_open == 0);
+	del_bo(bo);
+	bo = NULL;
+	assert(nouveau_bo_wrap(dev, bo2->handle, &bo) == 0);
+	assert(bo == bo2 && mock_stats.gem_info == 0);
+	del_bo(bo);
+	del_bo(bo2);
+	assert(mock_stats.gem_close == 1);
+	bo = NULL;
+	assert(nouveau_bo_name_ref(dev, name, &bo) == 0);
+	assert(mock_stats.gem_open == 1 && bo->size == 4096);
+	assert(nouveau_bo_name_get(bo, &name2) == 0 && name2 == name);
+	assert(mock_stats.gem_flink == 1);
+	del_bo(bo);
+
+	/* exported bos are found by prime fd, and by name once flinked */
+	bo = new_bo(dev);
+	assert(nouveau_bo_set_prime(bo, &prime_fd) == 0);
+	bo2 = NULL;
+	assert(nouveau_bo_prime_handle_ref(dev, prime_fd, &bo2) == 0);
+	assert(bo2 == bo);
+	assert(nouveau_bo_name_get(bo, &name) == 0);
+	del_bo(bo);
+	bo = NULL;
+	assert(nouveau_bo_name_ref(dev, name, &bo) == 0);
+	assert(bo == bo2 && mock_stats.gem_open == 1);
+	del_bo(bo);
+	del_bo(bo2);
+	bo = NULL;
+	assert(nouveau_bo_prime_handle_ref(dev, prime_fd, &bo) == 0);
+	assert(bo->size == 4096 && mock_stats.prime_import == 2);
+	bo2 = NULL;
+	assert(nouveau_bo_name_ref(dev, name, &bo2) == 0);
+	assert(bo2 == bo && mock_stats.gem_open == 2);
+	del_bo(bo2);
+	del_bo(bo);
+
+	/* private bos are found by handle, and closed once */
+	bo = new_bo(dev);
+	bo2 = NULL;
+	info = mock_stats.gem_info;
+	assert(nouveau_bo_wrap(dev, bo->handle, &bo2) == 0);
+	assert(bo2 == bo && mock_stats.gem_info == info);
+	closed = mock_stats.gem_close;
+	del_bo(bo);
+	del_bo(bo2);
+	assert(mock_stats.gem_close == closed + 1);
+
+	/* private bos are not shared, and don't slow imports down */
+	for (i = 0; i < NUM_PRIVATE; i++)
+		private[i] = new_bo(dev);
+	few = contend(dev, 16);
+	printf("%d threads importing 16 shared bos: %.0f ns per import\n",
+	       NUM_THREADS, few);
+	many = contend(dev, 16384);
+	printf("%d threads importing 16384 shared bos: %.0f ns per import\n",
+	       NUM_THREADS, many);
+	assert(many < few * 8);
+	for (i = 0; i < NUM_PRIVATE; i++)
+		del_bo(private[i]);
+
+	nouveau_device_del(&dev);
+	assert(mock_stats.bo_open == 0);
+	close(fd);
+	unlink(device);
+	return 0;
+}
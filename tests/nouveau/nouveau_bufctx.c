@@ -0,0 +1,223 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "nouveau.h"
+#include "nouveau_mock.h"
+
+#define NUM_BINS	8
+#define NUM_BOS		32
+#define NUM_FRAMES	2000
+#define BIN_REFS	64
+#define MTHD_BIN	3
+
+static struct nouveau_device *dev;
+static struct nouveau_client *client;
+static struct nouveau_object *chan;
+static struct nouveau_bo *bo[NUM_BOS];
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static unsigned list_count(struct nouveau_list *head)
+{
+	struct nouveau_list *item;
+	unsigned n = 0;
+
+	for (item = head->next; item != head; item = item->next)
+		n++;
+	return n;
+}
+
+static unsigned refd_count(struct nouveau_pushbuf *push)
+{
+	unsigned i, n = 0;
+
+	for (i = 0; i < NUM_BOS; i++)
+		n += nouveau_pushbuf_refd(push, bo[i]) != 0;
+	return n;
+}
+
+/* bin b holds b + 1 refs, the ones of MTHD_BIN with a method each */
+static unsigned fill(struct nouveau_bufctx *bctx)
+{
+	unsigned b, i, n = 0;
+
+	for (b = 0; b < NUM_BINS; b++) {
+		for (i = 0; i <= b; i++, n++) {
+			if (b == MTHD_BIN)
+				assert(nouveau_bufctx_mthd(bctx, b, 0x20000000 | i,
+						bo[(b + i) % NUM_BOS], 0,
+						NOUVEAU_BO_GART | NOUVEAU_BO_RD |
+						NOUVEAU_BO_LOW, 0, 0));
+			else
+				assert(nouveau_bufctx_refn(bctx, b,
+						bo[(b + i) % NUM_BOS],
+						NOUVEAU_BO_GART | NOUVEAU_BO_RD));
+		}
+	}
+	return n;
+}
+
+/* what a state tracker does per draw: re-emit every bin, validate */
+static double bench(struct nouveau_pushbuf *push, struct nouveau_bufctx *bctx)
+{
+	unsigned f, b, i;
+	double start;
+
+	start = now();
+	for (f = 0; f < NUM_FRAMES; f++) {
+		for (b = 0; b < NUM_BINS; b++) {
+			nouveau_bufctx_reset(bctx, b);
+			for (i = 0; i < BIN_REFS; i++)
+				nouveau_bufctx_refn(bctx, b,
+						    bo[(f + b + i) % NUM_BOS],
+						    NOUVEAU_BO_GART |
+						    NOUVEAU_BO_RD);
+		}
+		assert(nouveau_pushbuf_validate(push) == 0);
+		if (f % 16 == 15)
+			assert(nouveau_pushbuf_kick(push, chan) == 0);
+	}
+	return now() - start;
+}
+
+/**
+ * Check that refs land on the pending list and move to the current one
+ * when validated, that resetting a bin drops exactly its refs and
+ * relocations, that a flush makes every ref pending again, and that
+ * refs are reused across resets rather than allocated again.  Then time
+ * re-emitting every bin per draw.
+ */
+int main(int argc, char **argv)
+{
+	char device[] = "/tmp/nouveau_bufctx.XXXXXX";
+	struct nvc0_fifo nvc0 = {};
+	struct nouveau_bufref *ref[BIN_REFS];
+	struct nouveau_pushbuf *push;
+	struct nouveau_bufctx *bctx;
+	unsigned total, b, i;
+	double elapsed;
+	int fd;
+
+	mock_reset();
+	fd = mkstemp(device);
+	assert(fd >= 0);
+	assert(ftruncate(fd, 64 * MOCK_BO_MMAP_STRIDE) == 0);
+	assert(nouveau_device_wrap(fd, 0, &dev) == 0);
+	assert(nouveau_client_new(dev, &client) == 0);
+	assert(nouveau_object_new(&dev->object, 0, NOUVEAU_FIFO_CHANNEL_CLASS,
+				  &nvc0, sizeof(nvc0), &chan) == 0);
+	assert(nouveau_pushbuf_new(client, chan, 1, 32768, true, &push) == 0);
+	for (i = 0; i < NUM_BOS; i++)
+		assert(nouveau_bo_new(dev, NOUVEAU_BO_GART, 0, 4096, NULL,
+				      &bo[i]) == 0);
+	assert(nouveau_bufctx_new(client, NUM_BINS, &bctx) == 0);
+
+	total = fill(bctx);
+	assert(list_count(&bctx->pending) == total);
+	assert(list_count(&bctx->current) == 0);
+	assert(bctx->relocs == MTHD_BIN + 1);
+
+	nouveau_bufctx_reset(bctx, MTHD_BIN);
+	total -= MTHD_BIN + 1;
+	assert(list_count(&bctx->pending) == total);
+	assert(bctx->relocs == 0);
+
+	/* validated refs are current, later ones pending until validated */
+	nouveau_pushbuf_bufctx(push, bctx);
+	assert(nouveau_pushbuf_validate(push) == 0);
+	assert(list_count(&bctx->pending) == 0);
+	assert(list_count(&bctx->current) == total);
+	assert(refd_count(push) == 2 * NUM_BINS - 1);
+	assert(nouveau_bufctx_refn(bctx, 0, bo[NUM_BOS - 1], NOUVEAU_BO_GART |
+				   NOUVEAU_BO_WR));
+	total++;
+	assert(list_count(&bctx->pending) == 1);
+	assert(nouveau_pushbuf_validate(push) == 0);
+	assert(nouveau_pushbuf_refd(push, bo[NUM_BOS - 1]) == NOUVEAU_BO_WR);
+	assert(list_count(&bctx->current) == total);
+
+	/* a flush without the bufctx attached leaves it all pending */
+	nouveau_pushbuf_bufctx(push, NULL);
+	assert(nouveau_pushbuf_kick(push, chan) == 0);
+	assert(refd_count(push) == 0);
+	assert(list_count(&bctx->pending) == total);
+	assert(list_count(&bctx->current) == 0);
+	nouveau_pushbuf_bufctx(push, bctx);
+	assert(nouveau_pushbuf_validate(push) == 0);
+	assert(refd_count(push) == 2 * NUM_BINS);
+	assert(list_count(&bctx->current) == total);
+
+	/* resetting one bin leaves the others' refs where they were */
+	total = fill(bctx) + total;
+	assert(list_count(&bctx->pending) == total - list_count(&bctx->current));
+	for (b = 0; b < NUM_BINS; b++) {
+		nouveau_bufctx_reset(bctx, b);
+		total -= b + 1 + (b == 0) + (b != MTHD_BIN ? b + 1 : 0);
+		assert(list_count(&bctx->pending) +
+		       list_count(&bctx->current) == total);
+	}
+	assert(total == 0);
+	assert(bctx->relocs == 0);
+
+	/* the same refs come back after a reset */
+	for (i = 0; i < BIN_REFS; i++)
+		ref[i] = nouveau_bufctx_refn(bctx, 0, bo[i % NUM_BOS],
+					     NOUVEAU_BO_GART);
+	nouveau_bufctx_reset(bctx, 0);
+	for (i = 0; i < BIN_REFS; i++)
+		assert(nouveau_bufctx_refn(bctx, 0, bo[i % NUM_BOS],
+					   NOUVEAU_BO_GART) == ref[i]);
+	nouveau_bufctx_reset(bctx, 0);
+	assert(list_count(&bctx->pending) == 0);
+
+	elapsed = bench(push, bctx);
+	printf("%d bins of %d refs: %.1f ns per ref\n", NUM_BINS, BIN_REFS,
+	       elapsed * 1e9 / (NUM_FRAMES * NUM_BINS * BIN_REFS));
+
+	nouveau_pushbuf_bufctx(push, NULL);
+	nouveau_pushbuf_del(&push);
+	nouveau_bufctx_del(&bctx);
+	for (i = 0; i < NUM_BOS; i++)
+		nouveau_bo_ref(NULL, &bo[i]);
+	nouveau_object_del(&chan);
+	nouveau_client_del(&client);
+	nouveau_device_del(&dev);
+	assert(mock_stats.bo_open == 0);
+	close(fd);
+	unlink(device);
+	return 0;
+}
@@ -0,0 +1,433 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nouveau_capture.h"
+
+int capture_file_open(struct capture_file *file, const char *path)
+{
+	const struct nouveau_capture_header *header;
+	struct stat st;
+	void *map;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	ret = fstat(fd, &st);
+	if (ret || st.st_size < (off_t)sizeof(*header)) {
+		close(fd);
+		return ret ? -errno : -EINVAL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	header = map;
+	if (header->magic != NOUVEAU_CAPTURE_MAGIC ||
+	    header->version != NOUVEAU_CAPTURE_VERSION) {
+		munmap(map, st.st_size);
+		return -EINVAL;
+	}
+
+	file->map = map;
+	file->size = st.st_size;
+	file->pos = sizeof(*header);
+	return 0;
+}
+
+void capture_file_close(struct capture_file *file)
+{
+	munmap((void *)file->map, file->size);
+	file->map = NULL;
+}
+
+int capture_file_next(struct capture_file *file, struct capture_record *rec)
+{
+	const struct nouveau_capture_krec *krec;
+	const char *ptr;
+	uint64_t size, contents = 0;
+	uint32_t i;
+
+	if (file->pos == file->size)
+		return 0;
+	if (file->size - file->pos < sizeof(*krec))
+		return -EINVAL;
+
+	krec = (const void *)(file->map + file->pos);
+	if (krec->magic != NOUVEAU_CAPTURE_KREC ||
+	    krec->size > file->size - file->pos - sizeof(*krec) ||
+	    krec->nr_buffer > NOUVEAU_GEM_MAX_BUFFERS ||
+	    krec->nr_reloc > NOUVEAU_GEM_MAX_RELOCS ||
+	    krec->nr_push > NOUVEAU_GEM_MAX_PUSH)
+		return -EINVAL;
+
+	size = krec->nr_buffer * sizeof(*rec->bo) +
+	       NOUVEAU_CAPTURE_ALIGN(krec->nr_reloc * sizeof(*rec->reloc)) +
+	       krec->nr_push * sizeof(*rec->push);
+	if (size > krec->size)
+		return -EINVAL;
+
+	ptr = (const char *)(krec + 1);
+	rec->krec = krec;
+	rec->bo = (const void *)ptr;
+	ptr += krec->nr_buffer * sizeof(*rec->bo);
+	rec->reloc = (const void *)ptr;
+	ptr += NOUVEAU_CAPTURE_ALIGN(krec->nr_reloc * sizeof(*rec->reloc));
+	rec->push = (const void *)ptr;
+	ptr += krec->nr_push * sizeof(*rec->push);
+	rec->contents = (const void *)ptr;
+
+	for (i = 0; i < krec->nr_reloc; i++) {
+		if (rec->reloc[i].reloc_bo_index >= krec->nr_buffer ||
+		    rec->reloc[i].bo_index >= krec->nr_buffer)
+			return -EINVAL;
+	}
+	for (i = 0; i < krec->nr_push; i++) {
+		if (rec->push[i].bo_index >= krec->nr_buffer ||
+		    rec->push[i].length & 3)
+			return -EINVAL;
+		if (rec->bo[rec->push[i].bo_index].flags &
+		    NOUVEAU_CAPTURE_BO_MAPPED)
+			contents += rec->push[i].length;
+	}
+	if (size + NOUVEAU_CAPTURE_ALIGN(contents) != krec->size)
+		return -EINVAL;
+
+	file->pos += sizeof(*krec) + krec->size;
+	return 1;
+}
+
+/* in the format of the pushbuf dumps of NOUVEAU_LIBDRM_DEBUG */
+void capture_record_print(FILE *f, const struct capture_record *rec)
+{
+	const struct nouveau_capture_krec *krec = rec->krec;
+	const struct drm_nouveau_gem_pushbuf_reloc *krel;
+	const struct drm_nouveau_gem_pushbuf_push *kpsh;
+	const struct nouveau_capture_bo *cbo;
+	const uint32_t *data = rec->contents;
+	uint32_t i, j, chid = krec->channel;
+
+	fprintf(f, "ch%d: pushes %d bufs %d relocs %d\n", chid,
+		krec->nr_push, krec->nr_buffer, krec->nr_reloc);
+
+	for (i = 0, cbo = rec->bo; i < krec->nr_buffer; i++, cbo++) {
+		fprintf(f, "ch%d: buf %08x %08x %08x %08x %08x %08x %010llx\n",
+			chid, i, cbo->handle, cbo->domains, cbo->valid_domains,
+			cbo->read_domains, cbo->write_domains,
+			(unsigned long long)cbo->size);
+	}
+
+	for (i = 0, krel = rec->reloc; i < krec->nr_reloc; i++, krel++) {
+		fprintf(f, "ch%d: rel %08x %08x %08x %08x %08x %08x %08x\n",
+			chid, krel->reloc_bo_index, krel->reloc_bo_offset,
+			krel->bo_index, krel->flags, krel->data,
+			krel->vor, krel->tor);
+	}
+
+	for (i = 0, kpsh = rec->push; i < krec->nr_push; i++, kpsh++) {
+		fprintf(f, "ch%d: psh %08x %010llx %010llx\n", chid,
+			kpsh->bo_index, (unsigned long long)kpsh->offset,
+			(unsigned long long)(kpsh->offset + kpsh->length));
+		if (!(rec->bo[kpsh->bo_index].flags &
+		      NOUVEAU_CAPTURE_BO_MAPPED))
+			continue;
+		for (j = 0; j < kpsh->length / 4; j++)
+			fprintf(f, "\t0x%08x\n", *data++);
+	}
+}
+
+struct replay {
+	struct nouveau_device *dev;
+	struct nouveau_client *client;
+	struct nouveau_object *chan;
+	struct nouveau_pushbuf *push;
+	struct nouveau_bufctx *bctx;
+	uint32_t size;
+	/* bos created again and their domains, by captured handle */
+	struct nouveau_bo **bo;
+	uint32_t *domains;
+	uint32_t nr_bo;
+};
+
+int replay_new(struct nouveau_device *dev, struct nouveau_object *chan,
+	       uint32_t pushbuf_size, struct replay **preplay)
+{
+	struct replay *r;
+	int ret;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+	r->dev = dev;
+	r->chan = chan;
+	r->size = pushbuf_size;
+
+	ret = nouveau_client_new(dev, &r->client);
+	if (ret == 0)
+		ret = nouveau_pushbuf_new(r->client, chan, 4, pushbuf_size,
+					  true, &r->push);
+	if (ret == 0)
+		ret = nouveau_bufctx_new(r->client, 1, &r->bctx);
+	if (ret) {
+		replay_del(&r);
+		return ret;
+	}
+
+	nouveau_pushbuf_bufctx(r->push, r->bctx);
+	*preplay = r;
+	return 0;
+}
+
+void replay_del(struct replay **preplay)
+{
+	struct replay *r = *preplay;
+	uint32_t i;
+
+	if (!r)
+		return;
+	if (r->push) {
+		nouveau_pushbuf_bufctx(r->push, NULL);
+		nouveau_pushbuf_del(&r->push);
+	}
+	nouveau_bufctx_del(&r->bctx);
+	for (i = 0; i < r->nr_bo; i++)
+		nouveau_bo_ref(NULL, &r->bo[i]);
+	free(r->bo);
+	free(r->domains);
+	nouveau_client_del(&r->client);
+	free(r);
+	*preplay = NULL;
+}
+
+static uint32_t replay_domains(uint32_t domains)
+{
+	uint32_t flags = 0;
+
+	if (domains & NOUVEAU_GEM_DOMAIN_VRAM)
+		flags |= NOUVEAU_BO_VRAM;
+	if (domains & NOUVEAU_GEM_DOMAIN_GART)
+		flags |= NOUVEAU_BO_GART;
+	return flags;
+}
+
+/* the bo standing for a captured one, created when first seen, and again
+ * when referenced for domains it wasn't created for
+ */
+static int replay_bo(struct replay *r, const struct nouveau_capture_bo *cbo,
+		     struct nouveau_bo **pbo)
+{
+	struct nouveau_bo **bo;
+	uint32_t *domains, flags, nr;
+	int ret;
+
+	if (cbo->handle >= r->nr_bo) {
+		nr = 2 * cbo->handle + 16;
+		bo = realloc(r->bo, nr * sizeof(*bo));
+		if (!bo)
+			return -ENOMEM;
+		memset(bo + r->nr_bo, 0, (nr - r->nr_bo) * sizeof(*bo));
+		r->bo = bo;
+		domains = realloc(r->domains, nr * sizeof(*domains));
+		if (!domains)
+			return -ENOMEM;
+		memset(domains + r->nr_bo, 0,
+		       (nr - r->nr_bo) * sizeof(*domains));
+		r->domains = domains;
+		r->nr_bo = nr;
+	}
+
+	bo = &r->bo[cbo->handle];
+	domains = &r->domains[cbo->handle];
+
+	/* the handle was closed and used again */
+	if (*bo && (*bo)->size != cbo->size) {
+		nouveau_bo_ref(NULL, bo);
+		*domains = 0;
+	}
+
+	if (!*bo || (cbo->domains & ~*domains)) {
+		nouveau_bo_ref(NULL, bo);
+		*domains |= cbo->domains;
+		flags = replay_domains(*domains);
+		if (cbo->flags & NOUVEAU_CAPTURE_BO_MAPPED)
+			flags |= NOUVEAU_BO_MAP;
+		ret = nouveau_bo_new(r->dev, flags, 0, cbo->size, NULL, bo);
+		if (ret)
+			return ret;
+		if (flags & NOUVEAU_BO_MAP) {
+			ret = nouveau_bo_map(*bo, 0, r->client);
+			if (ret) {
+				nouveau_bo_ref(NULL, bo);
+				return ret;
+			}
+		}
+	}
+
+	*pbo = *bo;
+	return 0;
+}
+
+static int reloc_cmp(const void *a, const void *b)
+{
+	const struct drm_nouveau_gem_pushbuf_reloc *ra, *rb;
+
+	ra = *(const struct drm_nouveau_gem_pushbuf_reloc **)a;
+	rb = *(const struct drm_nouveau_gem_pushbuf_reloc **)b;
+	return (ra->reloc_bo_offset > rb->reloc_bo_offset) -
+	       (ra->reloc_bo_offset < rb->reloc_bo_offset);
+}
+
+/* a push of the captured pushbuf, written again with its relocs */
+static int replay_push(struct replay *r, const struct capture_record *rec,
+		       const struct drm_nouveau_gem_pushbuf_push *kpsh,
+		       const uint32_t *data, struct nouveau_bo **bo,
+		       const uint32_t *flags)
+{
+	const struct nouveau_capture_krec *krec = rec->krec;
+	const struct drm_nouveau_gem_pushbuf_reloc *rel[NOUVEAU_GEM_MAX_RELOCS];
+	const struct drm_nouveau_gem_pushbuf_reloc *krel;
+	uint32_t dwords = kpsh->length / 4;
+	uint32_t i, j, nr = 0, rflags;
+	uint64_t offset;
+	int ret;
+
+	/* the pushbuf appends its own */
+	if ((krec->suffix0 || krec->suffix1) && dwords >= 2 &&
+	    data[dwords - 2] == krec->suffix0 &&
+	    data[dwords - 1] == krec->suffix1)
+		dwords -= 2;
+	if (dwords + 4 > r->size / 4)
+		return -E2BIG;
+
+	for (i = 0, krel = rec->reloc; i < krec->nr_reloc; i++, krel++) {
+		if (krel->reloc_bo_index != kpsh->bo_index ||
+		    !bo[krel->bo_index])
+			continue;
+		if (krel->reloc_bo_offset < kpsh->offset ||
+		    krel->reloc_bo_offset >= kpsh->offset + dwords * 4)
+			continue;
+		rel[nr++] = krel;
+	}
+	qsort(rel, nr, sizeof(*rel), reloc_cmp);
+
+	ret = nouveau_pushbuf_space(r->push, dwords, nr, 0);
+	if (ret)
+		return ret;
+
+	for (i = 0, j = 0; i < dwords; i++) {
+		offset = kpsh->offset + i * 4;
+		if (j == nr || rel[j]->reloc_bo_offset != offset) {
+			*r->push->cur++ = data[i];
+			continue;
+		}
+
+		krel = rel[j++];
+		rflags = flags[krel->bo_index];
+		if (krel->flags & NOUVEAU_GEM_RELOC_LOW)
+			rflags |= NOUVEAU_BO_LOW;
+		if (krel->flags & NOUVEAU_GEM_RELOC_HIGH)
+			rflags |= NOUVEAU_BO_HIGH;
+		if (krel->flags & NOUVEAU_GEM_RELOC_OR)
+			rflags |= NOUVEAU_BO_OR;
+		nouveau_pushbuf_reloc(r->push, bo[krel->bo_index], krel->data,
+				      rflags, krel->vor, krel->tor);
+	}
+	return 0;
+}
+
+/*
+ * The mapped bos pushes come from are taken to be the captured pushbuf's
+ * own, their contents are written to the replaying pushbuf.  Pushes from
+ * other bos are pushed from the bos created again, as they were.
+ */
+int replay_krec(struct replay *r, const struct capture_record *rec)
+{
+	const struct nouveau_capture_krec *krec = rec->krec;
+	const struct drm_nouveau_gem_pushbuf_push *kpsh;
+	const struct nouveau_capture_bo *cbo;
+	const uint32_t *data = rec->contents;
+	struct nouveau_bo *bo[NOUVEAU_GEM_MAX_BUFFERS];
+	uint32_t flags[NOUVEAU_GEM_MAX_BUFFERS];
+	bool cmd[NOUVEAU_GEM_MAX_BUFFERS] = {};
+	uint32_t i;
+	int ret;
+
+	for (i = 0, kpsh = rec->push; i < krec->nr_push; i++, kpsh++) {
+		if (rec->bo[kpsh->bo_index].flags & NOUVEAU_CAPTURE_BO_MAPPED)
+			cmd[kpsh->bo_index] = true;
+	}
+
+	nouveau_bufctx_reset(r->bctx, 0);
+	for (i = 0, cbo = rec->bo; i < krec->nr_buffer; i++, cbo++) {
+		bo[i] = NULL;
+		if (cmd[i])
+			continue;
+
+		ret = replay_bo(r, cbo, &bo[i]);
+		if (ret)
+			return ret;
+		flags[i] = replay_domains(cbo->domains);
+		if (cbo->read_domains)
+			flags[i] |= NOUVEAU_BO_RD;
+		if (cbo->write_domains)
+			flags[i] |= NOUVEAU_BO_WR;
+		if (!nouveau_bufctx_refn(r->bctx, 0, bo[i], flags[i]))
+			return -ENOMEM;
+	}
+
+	ret = nouveau_pushbuf_validate(r->push);
+	if (ret)
+		return ret;
+
+	for (i = 0, kpsh = rec->push; i < krec->nr_push; i++, kpsh++) {
+		if (!cmd[kpsh->bo_index]) {
+			ret = nouveau_pushbuf_space(r->push, 0, 0, 1);
+			if (ret)
+				return ret;
+			nouveau_pushbuf_data(r->push, bo[kpsh->bo_index],
+					     kpsh->offset, kpsh->length);
+			continue;
+		}
+
+		ret = replay_push(r, rec, kpsh, data, bo, flags);
+		if (ret)
+			return ret;
+		data += kpsh->length / 4;
+	}
+
+	/* the next krec gets the next record's bos, not these again */
+	nouveau_pushbuf_bufctx(r->push, NULL);
+	ret = nouveau_pushbuf_kick(r->push, r->chan);
+	nouveau_pushbuf_bufctx(r->push, r->bctx);
+	return ret;
+}
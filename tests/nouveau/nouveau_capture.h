@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Reading pushbuf capture files, and replaying them through a pushbuf of
+ * another device: the bos are created again, referenced through a bufctx
+ * and validated, and the pushes are written again with their relocs.
+ */
+
+#ifndef NOUVEAU_CAPTURE_H
+#define NOUVEAU_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "nouveau_drm.h"
+#include "nouveau.h"
+#include "capture.h"
+
+struct capture_file {
+	const char *map;
+	size_t size;
+	size_t pos;
+};
+
+struct capture_record {
+	const struct nouveau_capture_krec *krec;
+	const struct nouveau_capture_bo *bo;
+	const struct drm_nouveau_gem_pushbuf_reloc *reloc;
+	const struct drm_nouveau_gem_pushbuf_push *push;
+	/* of the pushes of mapped bos, one after the other */
+	const uint32_t *contents;
+};
+
+int  capture_file_open(struct capture_file *, const char *path);
+void capture_file_close(struct capture_file *);
+/* 1 and the next record, 0 at the end, or -EINVAL */
+int  capture_file_next(struct capture_file *, struct capture_record *);
+void capture_record_print(FILE *, const struct capture_record *);
+
+struct replay;
+
+int  replay_new(struct nouveau_device *, struct nouveau_object *chan,
+		uint32_t pushbuf_size, struct replay **);
+void replay_del(struct replay **);
+int  replay_krec(struct replay *, const struct capture_record *);
+
+#endif
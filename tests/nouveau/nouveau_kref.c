@@ -0,0 +1,149 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "private.h"
+#include "nouveau_mock.h"
+
+#define NUM_LIVE	2048
+#define NUM_LOOKUPS	(1 << 24)
+
+static struct drm_nouveau_gem_pushbuf_bo kref[NUM_LIVE];
+static struct nouveau_bo bo[NUM_LIVE];
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* what the kref table of a client takes, directory and pages */
+static size_t table_size(struct nouveau_client *client)
+{
+	struct nouveau_client_priv *pcli = nouveau_client(client);
+	size_t size = pcli->kref_nr * sizeof(*pcli->kref);
+	unsigned i;
+
+	for (i = 0; i < pcli->kref_nr; i++) {
+		if (pcli->kref[i])
+			size += CLI_KREF_PAGE_SIZE * sizeof(**pcli->kref);
+	}
+	return size;
+}
+
+/* reference the live bos, check they are found, then drop them */
+static void fill(struct nouveau_client *client, uint32_t base, uint32_t step)
+{
+	struct nouveau_pushbuf *push = (void *)client;
+	struct nouveau_bo none = { .handle = base + step * NUM_LIVE };
+	unsigned i;
+
+	for (i = 0; i < NUM_LIVE; i++) {
+		bo[i].handle = base + step * i;
+		assert(cli_kref_set(client, &bo[i], &kref[i], push) == 0);
+	}
+	for (i = 0; i < NUM_LIVE; i++) {
+		assert(cli_kref_get(client, &bo[i]) == &kref[i]);
+		assert(cli_push_get(client, &bo[i]) == push);
+	}
+	assert(!cli_kref_get(client, &none) && !cli_push_get(client, &none));
+	for (i = 0; i < NUM_LIVE; i++)
+		assert(cli_kref_set(client, &bo[i], NULL, NULL) == 0);
+	for (i = 0; i < NUM_LIVE; i++)
+		assert(!cli_kref_get(client, &bo[i]));
+}
+
+/**
+ * Check that krefs are found by handle however sparse the handles are,
+ * and that the table only takes memory for the handle ranges in use.
+ * Then time lookups, the pushbuf_kref hot path.
+ */
+int main(int argc, char **argv)
+{
+	char device[] = "/tmp/nouveau_kref.XXXXXX";
+	struct nouveau_device *dev;
+	struct nouveau_client *client;
+	struct nouveau_bo high = { .handle = 0xfffffffe };
+	size_t size, flat;
+	double start;
+	unsigned i, found = 0;
+	int fd;
+
+	mock_reset();
+	fd = mkstemp(device);
+	assert(fd >= 0);
+	assert(nouveau_device_wrap(fd, 0, &dev) == 0);
+	assert(nouveau_client_new(dev, &client) == 0);
+
+	/* clearing a handle never seen allocates nothing */
+	assert(cli_kref_set(client, &high, NULL, NULL) == 0);
+	assert(table_size(client) == 0);
+
+	/* low handles, dense */
+	fill(client, 1, 1);
+	size = table_size(client);
+	assert(size < (NUM_LIVE / CLI_KREF_PAGE_SIZE + 2) *
+		      CLI_KREF_PAGE_SIZE * sizeof(struct nouveau_client_kref));
+
+	/*
+	 * A long running client: the handles in use have crept up to a
+	 * million.  A table indexed directly by handle would be twice
+	 * that long.
+	 */
+	fill(client, 1 << 20, 1);
+	size = table_size(client);
+	flat = 2 * ((1 << 20) + NUM_LIVE) * sizeof(struct nouveau_client_kref);
+	printf("%u krefs at handle 1M: %zu KiB table, %zu KiB flat\n",
+	       NUM_LIVE, size >> 10, flat >> 10);
+	assert(size * 50 < flat);
+
+	/* one bo at the top of the handle space */
+	assert(cli_kref_set(client, &high, &kref[0], NULL) == 0);
+	assert(cli_kref_get(client, &high) == &kref[0]);
+	assert(cli_kref_set(client, &high, NULL, NULL) == 0);
+
+	fill(client, 1 << 20, 1);
+	for (i = 0; i < NUM_LIVE; i++)
+		assert(cli_kref_set(client, &bo[i], &kref[i], NULL) == 0);
+	start = now();
+	for (i = 0; i < NUM_LOOKUPS; i++)
+		found += cli_kref_get(client, &bo[(i * 7) % NUM_LIVE]) != NULL;
+	start = now() - start;
+	assert(found == NUM_LOOKUPS);
+	printf("%u lookups: %.2f ns each\n", NUM_LOOKUPS,
+	       start * 1e9 / NUM_LOOKUPS);
+
+	nouveau_client_del(&client);
+	nouveau_device_del(&dev);
+	close(fd);
+	unlink(device);
+	return 0;
+}
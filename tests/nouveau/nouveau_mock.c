@@ -0,0 +1,402 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Replacements for the libdrm ioctl entry points, so that libdrm_nouveau
+ * can be exercised without a nouveau device.  Symbols defined in the
+ * executable take precedence over the ones in libdrm.so.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "xf86drm.h"
+#include "nouveau_drm.h"
+#include "nouveau_mock.h"
+
+struct mock_stats mock_stats;
+uint32_t mock_chipset;
+int mock_bo_busy;
+int mock_pushbuf_error;
+unsigned mock_pushbuf_us;
+unsigned mock_gpu_lag;
+uint64_t mock_vram_available;
+uint64_t mock_gart_available;
+uint64_t mock_pushbuf_vram_max;
+uint64_t mock_pushbuf_gart_max;
+uint32_t mock_pushbuf_log[MOCK_PUSHBUF_LOG];
+
+/* ioctls may come from several threads, the pushbuf latency is outside it */
+static pthread_mutex_t mock_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t next_channel;
+
+static uint32_t next_handle = 1;
+/* size of every bo created, by handle */
+static uint64_t *bo_size;
+/* size of every bo flinked or exported, kept after the handle is closed */
+static uint64_t *bo_shared_size;
+/* the domains every bo was created for */
+static uint32_t *bo_domain;
+/* the submission every bo is busy until */
+static uint32_t *bo_busy;
+static uint32_t bo_size_nr;
+
+void mock_reset(void)
+{
+	memset(&mock_stats, 0, sizeof(mock_stats));
+	mock_chipset = 0xc0;
+	mock_bo_busy = 0;
+	mock_pushbuf_error = 0;
+	mock_pushbuf_us = 0;
+	mock_gpu_lag = 0;
+	mock_vram_available = 1ULL << 30;
+	mock_gart_available = 512ULL << 20;
+	mock_pushbuf_vram_max = mock_pushbuf_gart_max = 0;
+}
+
+static int mock_gem_info(struct drm_nouveau_gem_info *info)
+{
+	if (info->handle >= bo_size_nr || !bo_size[info->handle])
+		return -ENOENT;
+	info->size = bo_size[info->handle];
+	info->domain = NOUVEAU_GEM_DOMAIN_VRAM;
+	info->offset = (uint64_t)info->handle << 32;
+	info->map_handle = (uint64_t)info->handle * MOCK_BO_MMAP_STRIDE;
+	return 0;
+}
+
+static int mock_gem_new(struct drm_nouveau_gem_new *req)
+{
+	struct drm_nouveau_gem_info *info = &req->info;
+	uint32_t domain = info->domain;
+	uint64_t *sizes, *shared;
+	uint32_t *domains, *busy;
+	uint32_t nr = 2 * (next_handle + 1);
+
+	if (next_handle >= bo_size_nr) {
+		sizes = realloc(bo_size, nr * sizeof(*sizes));
+		if (!sizes)
+			return -ENOMEM;
+		bo_size = sizes;
+		shared = realloc(bo_shared_size, nr * sizeof(*shared));
+		if (!shared)
+			return -ENOMEM;
+		bo_shared_size = shared;
+		domains = realloc(bo_domain, nr * sizeof(*domains));
+		if (!domains)
+			return -ENOMEM;
+		bo_domain = domains;
+		busy = realloc(bo_busy, nr * sizeof(*busy));
+		if (!busy)
+			return -ENOMEM;
+		bo_busy = busy;
+		memset(sizes + bo_size_nr, 0,
+		       (nr - bo_size_nr) * sizeof(*sizes));
+		memset(shared + bo_size_nr, 0,
+		       (nr - bo_size_nr) * sizeof(*shared));
+		memset(domains + bo_size_nr, 0,
+		       (nr - bo_size_nr) * sizeof(*domains));
+		memset(busy + bo_size_nr, 0,
+		       (nr - bo_size_nr) * sizeof(*busy));
+		bo_size_nr = nr;
+	}
+	info->handle = next_handle++;
+	bo_size[info->handle] = info->size;
+	bo_domain[info->handle] = domain;
+	mock_stats.bo_open++;
+	mock_gem_info(info);
+	info->domain = domain & (NOUVEAU_GEM_DOMAIN_VRAM |
+				 NOUVEAU_GEM_DOMAIN_GART);
+	mock_stats.gem_new++;
+	return 0;
+}
+
+/* like drmIoctl these fail with -1 and errno set */
+static int mock_gem_import(uint32_t handle)
+{
+	/* a name or prime fd keeps its bo around, reopen it if closed */
+	if (handle >= bo_size_nr || !bo_shared_size[handle]) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (!bo_size[handle])
+		mock_stats.bo_open++;
+	bo_size[handle] = bo_shared_size[handle];
+	return 0;
+}
+
+static int mock_gem_export(uint32_t handle)
+{
+	if (handle >= bo_size_nr || !bo_size[handle]) {
+		errno = ENOENT;
+		return -1;
+	}
+	bo_shared_size[handle] = bo_size[handle];
+	return 0;
+}
+
+/* checks what the kernel would, without relocating anything */
+static int mock_gem_pushbuf(struct drm_nouveau_gem_pushbuf *req)
+{
+	struct drm_nouveau_gem_pushbuf_bo *buffer =
+		(void *)(unsigned long)req->buffers;
+	struct drm_nouveau_gem_pushbuf_push *push =
+		(void *)(unsigned long)req->push;
+	uint32_t i;
+
+	uint64_t vram = 0, gart = 0;
+	uint32_t handle, valid;
+
+	req->suffix0 = req->suffix1 = 0;
+	req->vram_available = mock_vram_available;
+	req->gart_available = mock_gart_available;
+	if (!req->nr_push)
+		return 0;
+
+	if (mock_pushbuf_error)
+		return mock_pushbuf_error;
+	if (req->channel >= next_channel)
+		return -ENOENT;
+	for (i = 0; i < req->nr_buffers; i++) {
+		handle = buffer[i].handle;
+		if (handle >= bo_size_nr || !bo_size[handle])
+			return -ENOENT;
+		/* bos created without a domain may go anywhere */
+		valid = buffer[i].valid_domains;
+		if (!valid || (bo_domain[handle] &&
+			       (valid & ~bo_domain[handle])))
+			return -EINVAL;
+		if (valid == NOUVEAU_GEM_DOMAIN_VRAM)
+			vram += bo_size[handle];
+		else
+			gart += bo_size[handle];
+		buffer[i].presumed.valid = 1;
+	}
+	for (i = 0; i < req->nr_push; i++) {
+		if (push[i].bo_index >= req->nr_buffers)
+			return -EINVAL;
+	}
+
+	if (vram > mock_pushbuf_vram_max)
+		mock_pushbuf_vram_max = vram;
+	if (gart > mock_pushbuf_gart_max)
+		mock_pushbuf_gart_max = gart;
+	if (mock_stats.gem_pushbuf < MOCK_PUSHBUF_LOG)
+		mock_pushbuf_log[mock_stats.gem_pushbuf] = req->channel;
+	mock_stats.gem_pushbuf++;
+	for (i = 0; i < req->nr_buffers; i++) {
+		handle = buffer[i].handle;
+		bo_busy[handle] = mock_stats.gem_pushbuf + mock_gpu_lag;
+	}
+	return 0;
+}
+
+static int mock_write_read(unsigned long drmCommandIndex, void *data)
+{
+	switch (drmCommandIndex) {
+	case DRM_NOUVEAU_GETPARAM: {
+		struct drm_nouveau_getparam *req = data;
+
+		switch (req->param) {
+		case NOUVEAU_GETPARAM_CHIPSET_ID:
+			req->value = mock_chipset;
+			return 0;
+		case NOUVEAU_GETPARAM_FB_SIZE:
+			req->value = 1ULL << 30;
+			return 0;
+		case NOUVEAU_GETPARAM_AGP_SIZE:
+			req->value = 512ULL << 20;
+			return 0;
+		case NOUVEAU_GETPARAM_HAS_BO_USAGE:
+			req->value = 1;
+			return 0;
+		default:
+			return -EINVAL;
+		}
+	}
+	case DRM_NOUVEAU_CHANNEL_ALLOC: {
+		struct drm_nouveau_channel_alloc *req = data;
+
+		req->channel = next_channel++;
+		req->pushbuf_domains = NOUVEAU_GEM_DOMAIN_GART;
+		req->notifier_handle = 0xd0000000 | req->channel;
+		return 0;
+	}
+	case DRM_NOUVEAU_GEM_PUSHBUF: {
+		int ret = mock_gem_pushbuf(data);
+
+		if (ret)
+			mock_stats.gem_pushbuf_rejected++;
+		return ret;
+	}
+	case DRM_NOUVEAU_GEM_NEW:
+		return mock_gem_new(data);
+	case DRM_NOUVEAU_GEM_INFO:
+		mock_stats.gem_info++;
+		return mock_gem_info(data);
+	default:
+		return -EINVAL;
+	}
+}
+
+int drmCommandWriteRead(int fd, unsigned long drmCommandIndex, void *data,
+			unsigned long size)
+{
+	int ret;
+
+	pthread_mutex_lock(&mock_lock);
+	ret = mock_write_read(drmCommandIndex, data);
+	pthread_mutex_unlock(&mock_lock);
+	if (drmCommandIndex == DRM_NOUVEAU_GEM_PUSHBUF && mock_pushbuf_us)
+		usleep(mock_pushbuf_us);
+	return ret;
+}
+
+static int mock_write(unsigned long drmCommandIndex, void *data)
+{
+	switch (drmCommandIndex) {
+	case DRM_NOUVEAU_GEM_CPU_PREP: {
+		struct drm_nouveau_gem_cpu_prep *req = data;
+
+		bool busy;
+
+		mock_stats.gem_cpu_prep++;
+		busy = req->handle < bo_size_nr &&
+		       bo_busy[req->handle] > mock_stats.gem_pushbuf;
+		if ((mock_bo_busy || busy) &&
+		    (req->flags & NOUVEAU_GEM_CPU_PREP_NOWAIT))
+			return -EBUSY;
+		if (busy) {
+			bo_busy[req->handle] = 0;
+			mock_stats.gem_cpu_prep_stall++;
+		}
+		mock_bo_busy = 0;
+		return 0;
+	}
+	case DRM_NOUVEAU_CHANNEL_FREE:
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+int drmCommandWrite(int fd, unsigned long drmCommandIndex, void *data,
+		    unsigned long size)
+{
+	int ret;
+
+	pthread_mutex_lock(&mock_lock);
+	ret = mock_write(drmCommandIndex, data);
+	pthread_mutex_unlock(&mock_lock);
+	return ret;
+}
+
+static int mock_ioctl(unsigned long request, void *arg)
+{
+	switch (request) {
+	case DRM_IOCTL_VERSION: {
+		drm_version_t *version = arg;
+
+		version->version_major = 1;
+		version->version_minor = 1;
+		version->version_patchlevel = 0;
+		/* drmGetVersion asks for the lengths first */
+		if (version->name)
+			memcpy(version->name, "nouveau", 7);
+		if (version->date)
+			memcpy(version->date, "0", 1);
+		if (version->desc)
+			memcpy(version->desc, "mock", 4);
+		version->name_len = 7;
+		version->date_len = 1;
+		version->desc_len = 4;
+		return 0;
+	}
+	case DRM_IOCTL_GEM_CLOSE: {
+		struct drm_gem_close *req = arg;
+
+		if (req->handle < bo_size_nr && bo_size[req->handle]) {
+			bo_size[req->handle] = 0;
+			mock_stats.bo_open--;
+		}
+		mock_stats.gem_close++;
+		return 0;
+	}
+	case DRM_IOCTL_GEM_FLINK: {
+		struct drm_gem_flink *flink = arg;
+
+		if (mock_gem_export(flink->handle))
+			return -1;
+		/* names are the handles, offset to tell them apart */
+		flink->name = flink->handle + MOCK_NAME_BASE;
+		mock_stats.gem_flink++;
+		return 0;
+	}
+	case DRM_IOCTL_GEM_OPEN: {
+		struct drm_gem_open *req = arg;
+
+		req->handle = req->name - MOCK_NAME_BASE;
+		if (mock_gem_import(req->handle))
+			return -1;
+		req->size = bo_size[req->handle];
+		mock_stats.gem_open++;
+		return 0;
+	}
+	case DRM_IOCTL_PRIME_HANDLE_TO_FD: {
+		struct drm_prime_handle *req = arg;
+
+		if (mock_gem_export(req->handle))
+			return -1;
+		/* never a real fd, nothing closes it */
+		req->fd = req->handle + MOCK_PRIME_FD_BASE;
+		mock_stats.prime_export++;
+		return 0;
+	}
+	case DRM_IOCTL_PRIME_FD_TO_HANDLE: {
+		struct drm_prime_handle *req = arg;
+
+		req->handle = req->fd - MOCK_PRIME_FD_BASE;
+		if (mock_gem_import(req->handle))
+			return -1;
+		mock_stats.prime_import++;
+		return 0;
+	}
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+int drmIoctl(int fd, unsigned long request, void *arg)
+{
+	int ret;
+
+	pthread_mutex_lock(&mock_lock);
+	ret = mock_ioctl(request, arg);
+	pthread_mutex_unlock(&mock_lock);
+	return ret;
+}
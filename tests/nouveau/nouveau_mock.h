@@ -0,0 +1,91 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef NOUVEAU_MOCK_H
+#define NOUVEAU_MOCK_H
+
+#include <stdint.h>
+
+/* Fake device fd, the mocked ioctls ignore it */
+#define MOCK_FD		-1
+
+/* bo n is mapped at n times this offset of the device fd, mapping bos
+ * needs a regular file big enough passed as the fd instead of MOCK_FD */
+#define MOCK_BO_MMAP_STRIDE	(1 << 20)
+
+/* flink names and prime fds are the handle plus these */
+#define MOCK_NAME_BASE		0x10000
+#define MOCK_PRIME_FD_BASE	0x20000
+
+struct mock_stats {
+	unsigned gem_new;
+	unsigned gem_close;
+	unsigned gem_info;
+	unsigned gem_cpu_prep;
+	/* waits for a busy bo, not an ioctl */
+	unsigned gem_cpu_prep_stall;
+	unsigned gem_flink;
+	unsigned gem_open;
+	unsigned prime_export;
+	unsigned prime_import;
+	unsigned gem_pushbuf;
+	unsigned gem_pushbuf_rejected;
+	/* handles currently open, not an ioctl */
+	unsigned bo_open;
+};
+
+extern struct mock_stats mock_stats;
+
+/* What NOUVEAU_GETPARAM_CHIPSET_ID reports, NVC0 unless changed before
+ * wrapping a device */
+extern uint32_t mock_chipset;
+
+/* When set, DRM_NOUVEAU_GEM_CPU_PREP reports every bo as busy */
+extern int mock_bo_busy;
+
+/* When set, DRM_NOUVEAU_GEM_PUSHBUF fails with it */
+extern int mock_pushbuf_error;
+
+/* How long DRM_NOUVEAU_GEM_PUSHBUF blocks the calling thread, in us */
+extern unsigned mock_pushbuf_us;
+
+/* Buffers of a submission stay busy until this many more are made */
+extern unsigned mock_gpu_lag;
+
+/* What DRM_NOUVEAU_GEM_PUSHBUF reports as available, the placement
+ * limits are a percentage of it */
+extern uint64_t mock_vram_available;
+extern uint64_t mock_gart_available;
+
+/* The most any submission asked for in VRAM only, and in GART or either */
+extern uint64_t mock_pushbuf_vram_max;
+extern uint64_t mock_pushbuf_gart_max;
+
+/* The channel of each of the first submissions, in submission order */
+#define MOCK_PUSHBUF_LOG	4096
+extern uint32_t mock_pushbuf_log[MOCK_PUSHBUF_LOG];
+
+void mock_reset(void);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "nouveau.h"
+#include "nouveau_mock.h"
+
+#define NUM_CHANNELS	2
+#define NUM_FRAMES	200
+#define FRAME_DWORDS	4096
+#define PUSHBUF_US	200
+
+struct channel {
+	struct nouveau_object *chan;
+	struct nouveau_pushbuf *push;
+	struct nouveau_bo *bo;
+};
+
+static struct nouveau_device *dev;
+static struct nouveau_client *client;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void channel_new(struct channel *ch)
+{
+	struct nvc0_fifo nvc0 = {};
+
+	assert(nouveau_object_new(&dev->object, 0, NOUVEAU_FIFO_CHANNEL_CLASS,
+				  &nvc0, sizeof(nvc0), &ch->chan) == 0);
+	assert(nouveau_pushbuf_new(client, ch->chan, 4, 32 * 1024, true,
+				   &ch->push) == 0);
+	assert(nouveau_bo_new(dev, NOUVEAU_BO_GART, 0, 4096, NULL,
+			      &ch->bo) == 0);
+}
+
+static void channel_del(struct channel *ch)
+{
+	nouveau_bo_ref(NULL, &ch->bo);
+	nouveau_pushbuf_del(&ch->push);
+	nouveau_object_del(&ch->chan);
+}
+
+/* a batch of commands writing bo, the way a driver builds one */
+static void emit(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
+		 unsigned dwords)
+{
+	struct nouveau_pushbuf_refn ref = { bo, NOUVEAU_BO_GART |
+						NOUVEAU_BO_WR };
+	uint32_t x = dwords;
+	unsigned i, j;
+
+	assert(nouveau_pushbuf_space(push, dwords, 0, 0) == 0);
+	assert(nouveau_pushbuf_refn(push, &ref, 1) == 0);
+	for (i = 0; i < dwords; i++) {
+		for (j = 0; j < 16; j++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+		}
+		*push->cur++ = x;
+	}
+}
+
+/* frames on every channel, kicked one after the other */
+static double frames(struct channel *ch, bool async)
+{
+	double start;
+	unsigned i, c;
+
+	for (c = 0; c < NUM_CHANNELS; c++)
+		assert(nouveau_pushbuf_async(ch[c].push, async) == 0);
+
+	start = now();
+	for (i = 0; i < NUM_FRAMES; i++) {
+		for (c = 0; c < NUM_CHANNELS; c++) {
+			emit(ch[c].push, ch[c].bo, FRAME_DWORDS);
+			assert(nouveau_pushbuf_kick(ch[c].push,
+						    ch[c].chan) == 0);
+		}
+	}
+	for (c = 0; c < NUM_CHANNELS; c++)
+		assert(nouveau_pushbuf_async(ch[c].push, false) == 0);
+	return now() - start;
+}
+
+/**
+ * Check that kicks of asynchronous pushbufs return before the submission,
+ * that waiting on a bo waits for it, that rejected submissions are
+ * reported, and that a bo written by one channel and used by another is
+ * submitted in order, also when the other channel's kick is synchronous.
+ * Then time building and submitting frames on two channels, with a slow
+ * submission ioctl.
+ */
+int main(int argc, char **argv)
+{
+	char device[] = "/tmp/nouveau_pushbuf_async.XXXXXX";
+	struct channel ch[NUM_CHANNELS];
+	struct nouveau_pushbuf *deferred;
+	double start, sync, async;
+	unsigned submitted;
+	int fd, c;
+
+	mock_reset();
+	fd = mkstemp(device);
+	assert(fd >= 0);
+	assert(ftruncate(fd, 256 * MOCK_BO_MMAP_STRIDE) == 0);
+	assert(nouveau_device_wrap(fd, 0, &dev) == 0);
+	assert(nouveau_client_new(dev, &client) == 0);
+	for (c = 0; c < NUM_CHANNELS; c++)
+		channel_new(&ch[c]);
+
+	/* only immediate pushbufs can be asynchronous */
+	assert(nouveau_pushbuf_new(client, ch[0].chan, 1, 4096, false,
+				   &deferred) == 0);
+	assert(nouveau_pushbuf_async(deferred, true) == -EINVAL);
+	nouveau_pushbuf_del(&deferred);
+
+	/* the kick returns right away, the wait doesn't */
+	mock_pushbuf_us = 50000;
+	assert(nouveau_pushbuf_async(ch[0].push, true) == 0);
+	submitted = mock_stats.gem_pushbuf;
+	emit(ch[0].push, ch[0].bo, 16);
+	start = now();
+	assert(nouveau_pushbuf_kick(ch[0].push, ch[0].chan) == 0);
+	assert(now() - start < 0.025);
+	assert(nouveau_bo_wait(ch[0].bo, NOUVEAU_BO_RD | NOUVEAU_BO_NOBLOCK,
+			       client) == -EBUSY);
+	assert(nouveau_bo_wait(ch[0].bo, NOUVEAU_BO_RD, client) == 0);
+	assert(mock_stats.gem_pushbuf == submitted + 1);
+
+	/* a rejected submission is reported by the next kick, by the wait
+	 * on its bo and by turning the pushbuf synchronous */
+	mock_pushbuf_us = 20000;
+	mock_pushbuf_error = -EINVAL;
+	emit(ch[0].push, ch[0].bo, 16);
+	assert(nouveau_pushbuf_kick(ch[0].push, ch[0].chan) == 0);
+	assert(nouveau_bo_wait(ch[0].bo, NOUVEAU_BO_RD, client) == -EINVAL);
+	assert(nouveau_bo_wait(ch[0].bo, NOUVEAU_BO_RD, client) == 0);
+	emit(ch[0].push, ch[0].bo, 16);
+	assert(nouveau_pushbuf_kick(ch[0].push, ch[0].chan) == -EINVAL);
+	assert(nouveau_pushbuf_async(ch[0].push, false) == -EINVAL);
+	assert(nouveau_pushbuf_async(ch[0].push, false) == 0);
+	mock_pushbuf_error = 0;
+	assert(nouveau_pushbuf_async(ch[0].push, true) == 0);
+
+	/* a bo of channel 0 used by channel 1 goes in after channel 0 */
+	mock_pushbuf_us = 1000;
+	assert(nouveau_pushbuf_async(ch[1].push, true) == 0);
+	submitted = mock_stats.gem_pushbuf;
+	emit(ch[0].push, ch[0].bo, 16);
+	emit(ch[1].push, ch[0].bo, 16);
+	assert(nouveau_pushbuf_kick(ch[1].push, ch[1].chan) == 0);
+	assert(nouveau_pushbuf_async(ch[1].push, false) == 0);
+	assert(nouveau_pushbuf_async(ch[0].push, false) == 0);
+	assert(mock_stats.gem_pushbuf == submitted + 2);
+	assert(mock_pushbuf_log[submitted] == ch[0].chan->handle);
+	assert(mock_pushbuf_log[submitted + 1] == ch[1].chan->handle);
+
+	/* synchronous kicks, immediate or deferred, of a bo written by
+	 * queued commands go in after all of them */
+	mock_pushbuf_us = 20000;
+	assert(nouveau_pushbuf_async(ch[0].push, true) == 0);
+	assert(nouveau_pushbuf_new(client, ch[1].chan, 1, 4096, false,
+				   &deferred) == 0);
+	for (c = 0; c < 2; c++) {
+		submitted = mock_stats.gem_pushbuf;
+		emit(ch[0].push, ch[0].bo, 16);
+		assert(nouveau_pushbuf_kick(ch[0].push, ch[0].chan) == 0);
+		emit(ch[0].push, ch[0].bo, 16);
+		assert(nouveau_pushbuf_kick(ch[0].push, ch[0].chan) == 0);
+		if (c == 0) {
+			emit(ch[1].push, ch[0].bo, 16);
+			assert(nouveau_pushbuf_kick(ch[1].push,
+						    ch[1].chan) == 0);
+		} else {
+			emit(deferred, ch[0].bo, 16);
+			assert(nouveau_pushbuf_kick(deferred,
+						    ch[1].chan) == 0);
+		}
+		assert(mock_stats.gem_pushbuf == submitted + 3);
+		assert(mock_pushbuf_log[submitted] == ch[0].chan->handle);
+		assert(mock_pushbuf_log[submitted + 1] == ch[0].chan->handle);
+		assert(mock_pushbuf_log[submitted + 2] == ch[1].chan->handle);
+	}
+	nouveau_pushbuf_del(&deferred);
+	assert(nouveau_pushbuf_async(ch[0].push, false) == 0);
+
+	mock_pushbuf_us = PUSHBUF_US;
+	sync = frames(ch, false);
+	printf("%d channels, %d frames, %d us per submission: %.1f ms\n",
+	       NUM_CHANNELS, NUM_FRAMES, PUSHBUF_US, sync * 1000.0);
+	async = frames(ch, true);
+	printf("submitted asynchronously: %.1f ms\n", async * 1000.0);
+	assert(async < sync);
+
+	for (c = 0; c < NUM_CHANNELS; c++)
+		channel_del(&ch[c]);
+	nouveau_client_del(&client);
+	nouveau_device_del(&dev);
+	assert(mock_stats.bo_open == 0);
+	close(fd);
+	unlink(device);
+	return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "nouveau_capture.h"
+#include "nouveau_mock.h"
+
+#define NUM_BOS		16
+#define NUM_FRAMES	256
+#define FRAME_BOS	6
+#define FRAME_DWORDS	64
+#define IB_SIZE		256
+#define NUM_ASYNC	8
+#define PUSHBUF_SIZE	(64 * 1024)
+
+static struct nouveau_device *dev;
+static struct nouveau_client *client;
+static struct nouveau_object *chan;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* what a driver does for a draw: state, relocs, and an indirect buffer */
+static void frames(struct nouveau_bo **bo, struct nouveau_bo *ib)
+{
+	static const uint32_t domains[] = {
+		NOUVEAU_BO_VRAM, NOUVEAU_BO_GART, NOUVEAU_BO_APER
+	};
+	static const uint32_t relocs[] = {
+		NOUVEAU_BO_LOW, NOUVEAU_BO_HIGH, NOUVEAU_BO_LOW | NOUVEAU_BO_OR
+	};
+	struct nouveau_pushbuf *push;
+	struct nouveau_bufctx *bctx;
+	uint32_t flags;
+	unsigned f, i, j;
+
+	assert(nouveau_pushbuf_new(client, chan, 4, PUSHBUF_SIZE, true,
+				   &push) == 0);
+	assert(nouveau_bufctx_new(client, 1, &bctx) == 0);
+	nouveau_pushbuf_bufctx(push, bctx);
+
+	for (f = 0; f < NUM_FRAMES; f++) {
+		nouveau_bufctx_reset(bctx, 0);
+		for (i = 0; i < FRAME_BOS; i++) {
+			j = (f + i * 3) % NUM_BOS;
+			flags = domains[j % 3] | (i & 1 ? NOUVEAU_BO_WR :
+							  NOUVEAU_BO_RD);
+			nouveau_bufctx_refn(bctx, 0, bo[j], flags);
+		}
+		if (f % 4 == 0)
+			nouveau_bufctx_refn(bctx, 0, ib, NOUVEAU_BO_GART |
+							 NOUVEAU_BO_RD);
+		assert(nouveau_pushbuf_validate(push) == 0);
+
+		assert(nouveau_pushbuf_space(push, FRAME_DWORDS, FRAME_BOS,
+					     1) == 0);
+		*push->cur++ = f;
+		for (i = 0; i < FRAME_BOS; i++) {
+			j = (f + i * 3) % NUM_BOS;
+			flags = domains[j % 3] | (i & 1 ? NOUVEAU_BO_WR :
+							  NOUVEAU_BO_RD);
+			*push->cur++ = 0x20000000 | i;
+			nouveau_pushbuf_reloc(push, bo[j], i * 0x100,
+					      flags | relocs[i % 3], 0x1, 0x2);
+		}
+		if (f % 4 == 0)
+			nouveau_pushbuf_data(push, ib, 0, IB_SIZE);
+		for (i = 0; i < 16; i++)
+			*push->cur++ = f * 16 + i;
+		assert(nouveau_pushbuf_kick(push, chan) == 0);
+	}
+
+	nouveau_pushbuf_bufctx(push, NULL);
+	nouveau_pushbuf_del(&push);
+	nouveau_bufctx_del(&bctx);
+}
+
+/* what the capture of a replay should be, but for relocated values */
+static void compare(const struct capture_record *a,
+		    const struct capture_record *b)
+{
+	const struct drm_nouveau_gem_pushbuf_reloc *krel;
+	const uint32_t *da = a->contents, *db = b->contents;
+	uint32_t i, j, k;
+	bool relocated;
+
+	assert(a->krec->nr_buffer == b->krec->nr_buffer);
+	assert(a->krec->nr_reloc == b->krec->nr_reloc);
+	assert(a->krec->nr_push == b->krec->nr_push);
+
+	for (i = 0; i < a->krec->nr_buffer; i++) {
+		assert(a->bo[i].flags == b->bo[i].flags);
+		assert(a->bo[i].size == b->bo[i].size);
+		assert(a->bo[i].domains == b->bo[i].domains);
+		assert(a->bo[i].valid_domains == b->bo[i].valid_domains);
+		assert(a->bo[i].read_domains == b->bo[i].read_domains);
+		assert(a->bo[i].write_domains == b->bo[i].write_domains);
+	}
+	assert(!memcmp(a->reloc, b->reloc,
+		       a->krec->nr_reloc * sizeof(*a->reloc)));
+	assert(!memcmp(a->push, b->push, a->krec->nr_push * sizeof(*a->push)));
+
+	for (i = 0; i < a->krec->nr_push; i++) {
+		if (!(a->bo[a->push[i].bo_index].flags &
+		      NOUVEAU_CAPTURE_BO_MAPPED))
+			continue;
+		for (j = 0; j < a->push[i].length / 4; j++, da++, db++) {
+			relocated = false;
+			krel = a->reloc;
+			for (k = 0; k < a->krec->nr_reloc; k++, krel++) {
+				if (krel->reloc_bo_index == a->push[i].bo_index &&
+				    krel->reloc_bo_offset ==
+				    a->push[i].offset + j * 4)
+					relocated = true;
+			}
+			assert(relocated || *da == *db);
+		}
+	}
+}
+
+/**
+ * Capture draws through a pushbuf with relocs and indirect buffers, check
+ * the capture holds every submission, then replay it with a capture going
+ * and check that capture matches the first one.  Also check stopping a
+ * capture lets queued asynchronous submissions finish into it.
+ */
+int main(int argc, char **argv)
+{
+	char device[] = "/tmp/nouveau_pushbuf_capture.XXXXXX";
+	char path[] = "/tmp/nouveau_pushbuf_capture.cap.XXXXXX";
+	char again[] = "/tmp/nouveau_pushbuf_capture.cap.XXXXXX";
+	struct nvc0_fifo nvc0 = {};
+	struct nouveau_bo *bo[NUM_BOS], *ib;
+	struct nouveau_pushbuf *push;
+	struct capture_file file, file2;
+	struct capture_record rec, rec2;
+	struct replay *r;
+	unsigned submitted, records, i;
+	double start, elapsed;
+	int fd;
+
+	mock_reset();
+	fd = mkstemp(device);
+	assert(fd >= 0);
+	assert(ftruncate(fd, 1024 * MOCK_BO_MMAP_STRIDE) == 0);
+	assert(nouveau_device_wrap(fd, 0, &dev) == 0);
+	assert(nouveau_client_new(dev, &client) == 0);
+	assert(nouveau_object_new(&dev->object, 0, NOUVEAU_FIFO_CHANNEL_CLASS,
+				  &nvc0, sizeof(nvc0), &chan) == 0);
+	for (i = 0; i < NUM_BOS; i++)
+		assert(nouveau_bo_new(dev, (i % 3) + 1, 0, (i + 1) << 16, NULL,
+				      &bo[i]) == 0);
+	assert(nouveau_bo_new(dev, NOUVEAU_BO_GART, 0, 4096, NULL, &ib) == 0);
+
+	close(mkstemp(path));
+	close(mkstemp(again));
+	assert(nouveau_device_capture(dev, path) == 0);
+	submitted = mock_stats.gem_pushbuf;
+	frames(bo, ib);
+	submitted = mock_stats.gem_pushbuf - submitted;
+	assert(nouveau_device_capture(dev, NULL) == 0);
+
+	/* every submission, with its pushbuf contents */
+	assert(capture_file_open(&file, path) == 0);
+	for (records = 0; capture_file_next(&file, &rec) == 1; records++) {
+		if (records == 0)
+			capture_record_print(stdout, &rec);
+		assert(rec.krec->channel == ((struct nouveau_fifo *)
+					     chan->data)->channel);
+		assert(rec.krec->nr_reloc == FRAME_BOS);
+		assert(rec.krec->nr_push == (records % 4 ? 1 : 3));
+		assert(rec.contents[0] == records);
+	}
+	assert(file.pos == file.size);
+	assert(records == submitted && records == NUM_FRAMES);
+	printf("%u submissions, %zu bytes captured\n", records, file.size);
+
+	/* replayed, the same comes out */
+	assert(nouveau_device_capture(dev, again) == 0);
+	assert(replay_new(dev, chan, PUSHBUF_SIZE, &r) == 0);
+	file.pos = sizeof(struct nouveau_capture_header);
+	start = now();
+	while (capture_file_next(&file, &rec) == 1)
+		assert(replay_krec(r, &rec) == 0);
+	elapsed = now() - start;
+	replay_del(&r);
+	assert(nouveau_device_capture(dev, NULL) == 0);
+	assert(mock_stats.gem_pushbuf_rejected == 0);
+	printf("replayed in %.3f ms\n", elapsed * 1000.0);
+
+	assert(capture_file_open(&file2, again) == 0);
+	file.pos = sizeof(struct nouveau_capture_header);
+	for (i = 0; capture_file_next(&file, &rec) == 1; i++) {
+		assert(capture_file_next(&file2, &rec2) == 1);
+		compare(&rec, &rec2);
+	}
+	assert(capture_file_next(&file2, &rec2) == 0);
+	capture_file_close(&file2);
+	capture_file_close(&file);
+
+	/* stopping waits for what asynchronous pushbufs queued, which all
+	 * goes to the capture being stopped */
+	assert(nouveau_device_capture(dev, path) == 0);
+	assert(nouveau_pushbuf_new(client, chan, 4, PUSHBUF_SIZE, true,
+				   &push) == 0);
+	assert(nouveau_pushbuf_async(push, true) == 0);
+	mock_pushbuf_us = 2000;
+	submitted = mock_stats.gem_pushbuf;
+	for (i = 0; i < NUM_ASYNC; i++) {
+		assert(nouveau_pushbuf_space(push, 16, 0, 0) == 0);
+		*push->cur++ = i;
+		assert(nouveau_pushbuf_kick(push, chan) == 0);
+	}
+	assert(mock_stats.gem_pushbuf < submitted + NUM_ASYNC);
+	assert(nouveau_device_capture(dev, NULL) == 0);
+	assert(mock_stats.gem_pushbuf == submitted + NUM_ASYNC);
+	mock_pushbuf_us = 0;
+	nouveau_pushbuf_del(&push);
+
+	assert(capture_file_open(&file, path) == 0);
+	for (i = 0; capture_file_next(&file, &rec) == 1; i++)
+		assert(rec.contents[0] == i);
+	assert(i == NUM_ASYNC);
+	capture_file_close(&file);
+
+	for (i = 0; i < NUM_BOS; i++)
+		nouveau_bo_ref(NULL, &bo[i]);
+	nouveau_bo_ref(NULL, &ib);
+	nouveau_object_del(&chan);
+	nouveau_client_del(&client);
+	nouveau_device_del(&dev);
+	assert(mock_stats.bo_open == 0);
+	close(fd);
+	unlink(device);
+	unlink(path);
+	unlink(again);
+	return 0;
+}
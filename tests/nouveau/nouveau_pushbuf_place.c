@@ -0,0 +1,287 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "nouveau.h"
+#include "nouveau_mock.h"
+
+#define NUM_SEEDS	4
+#define NUM_BOS		64
+#define NUM_FRAMES	500
+#define FRAME_REFS	24
+#define PUSHBUF_SIZE	(32 * 1024)
+
+#define VRAM_AVAILABLE	(320ULL << 20)
+#define GART_AVAILABLE	(160ULL << 20)
+#define VRAM_LIMIT	(VRAM_AVAILABLE * 80 / 100)
+#define GART_LIMIT	(GART_AVAILABLE * 80 / 100)
+
+#define DOMAIN_VRAM	NOUVEAU_BO_VRAM
+#define DOMAIN_GART	NOUVEAU_BO_GART
+#define DOMAIN_ANY	(NOUVEAU_BO_VRAM | NOUVEAU_BO_GART)
+
+static struct nouveau_device *dev;
+static struct nouveau_client *client;
+static struct nouveau_object *chan;
+
+static struct nouveau_bo *bo[NUM_BOS];
+static uint32_t domain[NUM_BOS];
+
+static uint32_t rng;
+
+static uint32_t rand32(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+/* a mix of VRAM, GART and VRAM|GART buffers of 1MB to 64MB, log-uniform */
+static void pool_new(uint32_t seed)
+{
+	static const uint32_t domains[] = {
+		DOMAIN_VRAM, DOMAIN_GART, DOMAIN_ANY, DOMAIN_ANY
+	};
+	uint64_t size;
+	unsigned i;
+
+	rng = seed;
+	for (i = 0; i < NUM_BOS; i++) {
+		domain[i] = domains[rand32() % 4];
+		size = (1 << 20) << (rand32() % 6);
+		size += (rand32() % size) & ~4095ULL;
+		assert(nouveau_bo_new(dev, domain[i], 0, size, NULL,
+				      &bo[i]) == 0);
+	}
+}
+
+static void pool_del(void)
+{
+	unsigned i;
+
+	for (i = 0; i < NUM_BOS; i++)
+		nouveau_bo_ref(NULL, &bo[i]);
+}
+
+/* the frames of a trace, the bo referenced by each of their commands */
+static void trace(uint32_t seed, unsigned *refs)
+{
+	unsigned i;
+
+	rng = seed * 2654435761u;
+	for (i = 0; i < NUM_FRAMES * FRAME_REFS; i++)
+		refs[i] = rand32() % NUM_BOS;
+}
+
+/* the trace through a pushbuf */
+static void replay(const unsigned *refs, struct nouveau_pushbuf_stats *stats)
+{
+	struct nouveau_pushbuf *push;
+	struct nouveau_pushbuf_refn ref;
+	unsigned i, j;
+
+	assert(nouveau_pushbuf_new(client, chan, 1, PUSHBUF_SIZE, true,
+				   &push) == 0);
+	dev->vram_limit = VRAM_LIMIT;
+	dev->gart_limit = GART_LIMIT;
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		for (j = 0; j < FRAME_REFS; j++, refs++) {
+			ref.bo = bo[*refs];
+			ref.flags = domain[*refs] | NOUVEAU_BO_RD;
+			assert(nouveau_pushbuf_space(push, 2, 0, 0) == 0);
+			assert(nouveau_pushbuf_refn(push, &ref, 1) == 0);
+			*push->cur++ = i;
+			*push->cur++ = j;
+		}
+		assert(nouveau_pushbuf_kick(push, chan) == 0);
+	}
+
+	nouveau_pushbuf_get_stats(push, stats);
+	nouveau_pushbuf_del(&push);
+}
+
+struct greedy {
+	uint32_t valid[NUM_BOS];
+	bool in_krec[NUM_BOS];
+	unsigned krec[NUM_BOS];
+	unsigned nr;
+	uint64_t vram_used;
+	uint64_t gart_used;
+};
+
+static void greedy_reset(struct greedy *g)
+{
+	memset(g->in_krec, 0, sizeof(g->in_krec));
+	g->nr = 0;
+	g->vram_used = 0;
+	g->gart_used = PUSHBUF_SIZE;
+}
+
+static bool greedy_fits(struct greedy *g, unsigned b)
+{
+	uint64_t size = bo[b]->size;
+	unsigned i, k;
+
+	g->valid[b] = domain[b];
+	if (domain[b] == DOMAIN_VRAM) {
+		if (g->vram_used + size > VRAM_LIMIT)
+			return false;
+		g->vram_used += size;
+		return true;
+	}
+
+	if (g->gart_used + size <= GART_LIMIT) {
+		g->gart_used += size;
+		return true;
+	}
+
+	if (domain[b] == DOMAIN_ANY && g->vram_used + size <= VRAM_LIMIT) {
+		g->valid[b] = DOMAIN_VRAM;
+		g->vram_used += size;
+		return true;
+	}
+
+	for (i = 0; i < g->nr; i++) {
+		k = g->krec[i];
+		if (g->valid[k] != DOMAIN_ANY ||
+		    g->vram_used + bo[k]->size > VRAM_LIMIT)
+			continue;
+
+		g->valid[k] = DOMAIN_VRAM;
+		g->gart_used -= bo[k]->size;
+		g->vram_used += bo[k]->size;
+		if (g->gart_used + size <= GART_LIMIT) {
+			g->gart_used += size;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * The same trace through the placement pushbufs used to do: buffers
+ * accounted to GART until it's full, then VRAM|GART ones to VRAM, and
+ * when neither fits, VRAM|GART buffers turned into VRAM buffers in the
+ * order they were referenced until the new one fits in GART.  Returns
+ * how many flushes that forces.
+ */
+static unsigned replay_greedy(const unsigned *refs)
+{
+	struct greedy g;
+	unsigned flushes = 0;
+	unsigned i, b;
+
+	for (i = 0; i < NUM_FRAMES * FRAME_REFS; i++) {
+		if (i % FRAME_REFS == 0)
+			greedy_reset(&g);
+
+		b = refs[i];
+		if (g.in_krec[b])
+			continue;
+		if (!greedy_fits(&g, b)) {
+			greedy_reset(&g);
+			assert(greedy_fits(&g, b));
+			flushes++;
+		}
+		g.in_krec[b] = true;
+		g.krec[g.nr++] = b;
+	}
+	return flushes;
+}
+
+/**
+ * Replay randomized traces of VRAM, GART and VRAM|GART buffers, many
+ * more than fit in one submission, through pushbufs and through a model
+ * of the greedy placement pushbufs used to do.  Check that no submission
+ * asks for more than the limits, that the planner forces fewer flushes,
+ * and that it places buffers the same way every time.
+ */
+int main(int argc, char **argv)
+{
+	char device[] = "/tmp/nouveau_pushbuf_place.XXXXXX";
+	struct nvc0_fifo nvc0 = {};
+	struct nouveau_pushbuf_stats stats, again;
+	unsigned *refs;
+	unsigned unplaced = 0, greedy = 0, flushes;
+	uint32_t seed;
+	int fd;
+
+	mock_reset();
+	mock_vram_available = VRAM_AVAILABLE;
+	mock_gart_available = GART_AVAILABLE;
+	fd = mkstemp(device);
+	assert(fd >= 0);
+	assert(ftruncate(fd, 1024 * MOCK_BO_MMAP_STRIDE) == 0);
+	assert(nouveau_device_wrap(fd, 0, &dev) == 0);
+	assert(nouveau_client_new(dev, &client) == 0);
+	assert(nouveau_object_new(&dev->object, 0, NOUVEAU_FIFO_CHANNEL_CLASS,
+				  &nvc0, sizeof(nvc0), &chan) == 0);
+	refs = malloc(NUM_FRAMES * FRAME_REFS * sizeof(*refs));
+	assert(refs);
+
+	for (seed = 1; seed <= NUM_SEEDS; seed++) {
+		pool_new(seed);
+		trace(seed, refs);
+
+		replay(refs, &stats);
+		replay(refs, &again);
+		assert(stats.placed == again.placed);
+		assert(stats.vram == again.vram);
+		assert(stats.moved == again.moved);
+		assert(stats.moved_bytes == again.moved_bytes);
+		assert(stats.unplaced == again.unplaced);
+
+		flushes = replay_greedy(refs);
+		printf("seed %u: %u placed, %u in VRAM, %u moved (%.1f MB), "
+		       "%u flushes, %u greedy\n", seed, stats.placed,
+		       stats.vram, stats.moved, stats.moved_bytes / 1048576.0,
+		       stats.unplaced, flushes);
+		unplaced += stats.unplaced;
+		greedy += flushes;
+		pool_del();
+	}
+
+	printf("%u flushes, %u greedy\n", unplaced, greedy);
+	assert(unplaced < greedy);
+	assert(mock_stats.gem_pushbuf_rejected == 0);
+	assert(mock_pushbuf_vram_max <= VRAM_LIMIT);
+	assert(mock_pushbuf_gart_max <= GART_LIMIT);
+
+	free(refs);
+	nouveau_object_del(&chan);
+	nouveau_client_del(&client);
+	nouveau_device_del(&dev);
+	assert(mock_stats.bo_open == 0);
+	close(fd);
+	unlink(device);
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "nouveau.h"
+#include "nouveau_mock.h"
+
+#define NUM_FRAMES	200
+#define WARMUP_FRAMES	20
+#define PUSHBUF_NR	2
+#define PUSHBUF_SIZE	4096
+#define FRAME_DWORDS	768
+#define GPU_LAG		5
+#define RING_MAX	(PUSHBUF_NR * 4)
+
+static struct nouveau_device *dev;
+static struct nouveau_client *client;
+static struct nouveau_object *chan;
+
+/* a frame that doesn't fit in what's left of the current bo */
+static void frame(struct nouveau_pushbuf *push, unsigned n)
+{
+	unsigned i;
+
+	assert(nouveau_pushbuf_space(push, FRAME_DWORDS, 0, 0) == 0);
+	for (i = 0; i < FRAME_DWORDS; i++)
+		*push->cur++ = n + i;
+	assert(nouveau_pushbuf_kick(push, chan) == 0);
+}
+
+/**
+ * Check that the ring of bos of an immediate pushbuf grows instead of
+ * waiting for the GPU, up to a limit, and that once it covers what the
+ * GPU has in flight, frames neither create bos nor wait.  Then run the
+ * same asynchronously, and fill a deferred pushbuf past its bos.
+ */
+int main(int argc, char **argv)
+{
+	char device[] = "/tmp/nouveau_pushbuf_pool.XXXXXX";
+	struct nvc0_fifo nvc0 = {};
+	struct nouveau_pushbuf *push;
+	unsigned created, submitted, i;
+	int fd;
+
+	mock_reset();
+	fd = mkstemp(device);
+	assert(fd >= 0);
+	assert(ftruncate(fd, 256 * MOCK_BO_MMAP_STRIDE) == 0);
+	assert(nouveau_device_wrap(fd, 0, &dev) == 0);
+	assert(nouveau_client_new(dev, &client) == 0);
+	assert(nouveau_object_new(&dev->object, 0, NOUVEAU_FIFO_CHANNEL_CLASS,
+				  &nvc0, sizeof(nvc0), &chan) == 0);
+
+	/* one submission per frame, each frame in the next bo of the ring */
+	mock_gpu_lag = GPU_LAG;
+	created = mock_stats.gem_new;
+	assert(nouveau_pushbuf_new(client, chan, PUSHBUF_NR, PUSHBUF_SIZE,
+				   true, &push) == 0);
+	submitted = mock_stats.gem_pushbuf;
+	for (i = 0; i < WARMUP_FRAMES; i++)
+		frame(push, i);
+	assert(mock_stats.gem_new - created == GPU_LAG + 1);
+	created = mock_stats.gem_new;
+	for (; i < NUM_FRAMES; i++)
+		frame(push, i);
+	assert(mock_stats.gem_new == created);
+	assert(mock_stats.gem_cpu_prep_stall == 0);
+	assert(mock_stats.gem_pushbuf - submitted == NUM_FRAMES);
+	printf("GPU %d submissions behind: ring of %d bos, no waits\n",
+	       GPU_LAG, GPU_LAG + 1);
+	nouveau_pushbuf_del(&push);
+
+	/* the ring stops growing, then frames wait for the GPU */
+	mock_gpu_lag = 100;
+	created = mock_stats.gem_new;
+	assert(nouveau_pushbuf_new(client, chan, PUSHBUF_NR, PUSHBUF_SIZE,
+				   true, &push) == 0);
+	for (i = 0; i < NUM_FRAMES; i++)
+		frame(push, i);
+	assert(mock_stats.gem_new - created == RING_MAX);
+	assert(mock_stats.gem_cpu_prep_stall > 0);
+	printf("GPU %d submissions behind: ring of %d bos, %u waits\n",
+	       mock_gpu_lag, RING_MAX, mock_stats.gem_cpu_prep_stall);
+	nouveau_pushbuf_del(&push);
+
+	/* queued bos are busy until the submission thread is done */
+	mock_gpu_lag = GPU_LAG;
+	mock_pushbuf_us = 100;
+	created = mock_stats.gem_new;
+	assert(nouveau_pushbuf_new(client, chan, PUSHBUF_NR, PUSHBUF_SIZE,
+				   true, &push) == 0);
+	assert(nouveau_pushbuf_async(push, true) == 0);
+	submitted = mock_stats.gem_pushbuf;
+	for (i = 0; i < NUM_FRAMES; i++)
+		frame(push, i);
+	assert(nouveau_pushbuf_async(push, false) == 0);
+	assert(mock_stats.gem_pushbuf - submitted == NUM_FRAMES);
+	assert(mock_stats.gem_new - created <= RING_MAX);
+	nouveau_pushbuf_del(&push);
+	mock_pushbuf_us = 0;
+
+	/* a deferred pushbuf keeps every bo and krec until it's deleted */
+	created = mock_stats.gem_new;
+	assert(nouveau_pushbuf_new(client, chan, 1, PUSHBUF_SIZE, false,
+				   &push) == 0);
+	for (i = 0; i < 8; i++) {
+		assert(nouveau_pushbuf_space(push, FRAME_DWORDS, 0, 0) == 0);
+		push->cur += FRAME_DWORDS;
+	}
+	submitted = mock_stats.gem_pushbuf;
+	assert(nouveau_pushbuf_kick(push, chan) == 0);
+	assert(nouveau_pushbuf_kick(push, chan) == 0);
+	assert(mock_stats.gem_pushbuf - submitted == 2);
+	assert(mock_stats.gem_new - created == 8);
+	nouveau_pushbuf_del(&push);
+
+	nouveau_object_del(&chan);
+	nouveau_client_del(&client);
+	nouveau_device_del(&dev);
+	assert(mock_stats.bo_open == 0);
+	close(fd);
+	unlink(device);
+	return 0;
+}
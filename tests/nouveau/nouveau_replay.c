@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Replays pushbuf captures against the mocked kernel, to time how long
+ * the library takes to validate and write them again, or prints them.
+ *
+ *	nouveau_replay [-p] [-n passes] [-s pushbuf size] capture
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "nouveau_capture.h"
+#include "nouveau_mock.h"
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int print(const char *path)
+{
+	struct capture_file file;
+	struct capture_record rec;
+	int ret;
+
+	ret = capture_file_open(&file, path);
+	if (ret)
+		return ret;
+	while ((ret = capture_file_next(&file, &rec)) > 0)
+		capture_record_print(stdout, &rec);
+	capture_file_close(&file);
+	return ret;
+}
+
+static int replay(const char *path, struct nouveau_device *dev,
+		  struct nouveau_object *chan, uint32_t size,
+		  unsigned *records)
+{
+	struct capture_file file;
+	struct capture_record rec;
+	struct replay *r;
+	int ret;
+
+	ret = capture_file_open(&file, path);
+	if (ret)
+		return ret;
+	ret = replay_new(dev, chan, size, &r);
+	if (ret) {
+		capture_file_close(&file);
+		return ret;
+	}
+
+	*records = 0;
+	while ((ret = capture_file_next(&file, &rec)) > 0) {
+		ret = replay_krec(r, &rec);
+		if (ret)
+			break;
+		(*records)++;
+	}
+
+	replay_del(&r);
+	capture_file_close(&file);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	char device[] = "/tmp/nouveau_replay.XXXXXX";
+	struct nvc0_fifo nvc0 = {};
+	struct nouveau_device *dev;
+	struct nouveau_object *chan;
+	unsigned passes = 1, records = 0, i;
+	uint32_t size = 256 * 1024;
+	double start, elapsed;
+	bool dump = false;
+	int fd, opt, ret;
+
+	while ((opt = getopt(argc, argv, "pn:s:")) != -1) {
+		switch (opt) {
+		case 'p':
+			dump = true;
+			break;
+		case 'n':
+			passes = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || !passes || size < 4096)
+		goto usage;
+
+	if (dump) {
+		ret = print(argv[optind]);
+		if (ret)
+			fprintf(stderr, "%s: %s\n", argv[optind],
+				strerror(-ret));
+		return ret ? 1 : 0;
+	}
+
+	mock_reset();
+	fd = mkstemp(device);
+	assert(fd >= 0);
+	unlink(device);
+	assert(ftruncate(fd, 4096ULL * MOCK_BO_MMAP_STRIDE) == 0);
+	assert(nouveau_device_wrap(fd, 0, &dev) == 0);
+	assert(nouveau_object_new(&dev->object, 0, NOUVEAU_FIFO_CHANNEL_CLASS,
+				  &nvc0, sizeof(nvc0), &chan) == 0);
+
+	start = now();
+	for (i = 0; i < passes; i++) {
+		ret = replay(argv[optind], dev, chan, size, &records);
+		if (ret) {
+			fprintf(stderr, "%s: record %u: %s\n", argv[optind],
+				records, strerror(-ret));
+			break;
+		}
+	}
+	elapsed = now() - start;
+
+	if (!ret) {
+		printf("%u records, %u submissions, %u rejected\n", records,
+		       mock_stats.gem_pushbuf,
+		       mock_stats.gem_pushbuf_rejected);
+		printf("%.3f ms per pass, %.2f us per record\n",
+		       elapsed * 1000.0 / passes,
+		       records ? elapsed * 1000000.0 / passes / records : 0.0);
+	}
+
+	nouveau_object_del(&chan);
+	nouveau_device_del(&dev);
+	close(fd);
+	return ret || mock_stats.gem_pushbuf_rejected ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-p] [-n passes] [-s pushbuf size] "
+		"capture\n", argv[0]);
+	return 1;
+}
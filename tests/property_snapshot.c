@@ -0,0 +1,299 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#define MOCK_FD		42
+#define MAX_PROP_ID	512
+
+/*
+ * A fake device with two CRTCs, three connectors and two planes.  Some
+ * properties are shared between objects, and the last plane has more
+ * properties than the snapshot's initial scratch buffer holds.
+ */
+static const uint32_t crtcs[] = { 10, 11 };
+static const uint32_t connectors[] = { 20, 21, 22 };
+static const uint32_t planes[] = { 30, 31 };
+
+#define NUM_OBJECTS	7
+#define NUM_DISTINCT	47	/* 100, 101, 200-202, 300, 301, 400-439 */
+
+static struct {
+	int get_resources;
+	int get_plane_resources;
+	int obj_get_properties;
+	int get_property;
+	int get_property_by_id[MAX_PROP_ID];
+} mock_stats;
+
+static void mock_reset(void)
+{
+	memset(&mock_stats, 0, sizeof(mock_stats));
+}
+
+static int mock_object_props(uint32_t obj_id, uint32_t *ids)
+{
+	int i, n = 0;
+
+	switch (obj_id) {
+	case 10:
+	case 11:
+		ids[n++] = 100;
+		ids[n++] = 101;
+		break;
+	case 22:
+		ids[n++] = 202;
+		/* fall through */
+	case 20:
+	case 21:
+		ids[n++] = 200;
+		ids[n++] = 201;
+		break;
+	case 30:
+		ids[n++] = 300;
+		ids[n++] = 301;
+		ids[n++] = 100;
+		break;
+	case 31:
+		ids[n++] = 300;
+		ids[n++] = 301;
+		for (i = 0; i < 40; i++)
+			ids[n++] = 400 + i;
+		break;
+	default:
+		return -1;
+	}
+	return n;
+}
+
+static uint64_t mock_value(uint32_t obj_id, uint32_t prop_id)
+{
+	return (uint64_t)obj_id * 1000 + prop_id;
+}
+
+static void mock_copy_ids(uint64_t ptr, uint32_t *count,
+			  const uint32_t *ids, uint32_t n)
+{
+	if (ptr && *count >= n)
+		memcpy((void *)(uintptr_t)ptr, ids, n * sizeof(uint32_t));
+	*count = n;
+}
+
+int drmIoctl(int fd, unsigned long request, void *arg)
+{
+	assert(fd == MOCK_FD);
+
+	switch (request) {
+	case DRM_IOCTL_MODE_GETRESOURCES: {
+		struct drm_mode_card_res *res = arg;
+
+		mock_stats.get_resources++;
+		mock_copy_ids(res->crtc_id_ptr, &res->count_crtcs, crtcs, 2);
+		mock_copy_ids(res->connector_id_ptr, &res->count_connectors,
+			      connectors, 3);
+		res->count_fbs = 0;
+		res->count_encoders = 0;
+		return 0;
+	}
+	case DRM_IOCTL_MODE_GETPLANERESOURCES: {
+		struct drm_mode_get_plane_res *res = arg;
+
+		mock_stats.get_plane_resources++;
+		mock_copy_ids(res->plane_id_ptr, &res->count_planes, planes, 2);
+		return 0;
+	}
+	case DRM_IOCTL_MODE_OBJ_GETPROPERTIES: {
+		struct drm_mode_obj_get_properties *props = arg;
+		uint32_t ids[64];
+		uint64_t *values;
+		int i, n;
+
+		mock_stats.obj_get_properties++;
+		n = mock_object_props(props->obj_id, ids);
+		if (n < 0) {
+			errno = ENOENT;
+			return -1;
+		}
+		if (props->prop_values_ptr && props->count_props >= (uint32_t)n) {
+			values = (uint64_t *)(uintptr_t)props->prop_values_ptr;
+			for (i = 0; i < n; i++)
+				values[i] = mock_value(props->obj_id, ids[i]);
+		}
+		mock_copy_ids(props->props_ptr, &props->count_props, ids, n);
+		return 0;
+	}
+	case DRM_IOCTL_MODE_GETPROPERTY: {
+		struct drm_mode_get_property *prop = arg;
+		uint64_t *values;
+
+		assert(prop->prop_id < MAX_PROP_ID);
+		mock_stats.get_property++;
+		mock_stats.get_property_by_id[prop->prop_id]++;
+		snprintf(prop->name, sizeof(prop->name), "prop%u", prop->prop_id);
+		prop->flags = DRM_MODE_PROP_RANGE;
+		if (prop->values_ptr && prop->count_values >= 2) {
+			values = (uint64_t *)(uintptr_t)prop->values_ptr;
+			values[0] = 0;
+			values[1] = prop->prop_id;
+		}
+		prop->count_values = 2;
+		prop->count_enum_blobs = 0;
+		return 0;
+	}
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+/* What drmModeObjectGetProperties() + drmModeGetProperty() per pair costs. */
+static int per_property_ioctls(const uint32_t *ids, const uint32_t *types)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyPtr prop;
+	uint32_t i, j;
+
+	mock_reset();
+	for (i = 0; i < NUM_OBJECTS; i++) {
+		props = drmModeObjectGetProperties(MOCK_FD, ids[i], types[i]);
+		assert(props);
+		for (j = 0; j < props->count_props; j++) {
+			prop = drmModeGetProperty(MOCK_FD, props->props[j]);
+			assert(prop);
+			drmModeFreeProperty(prop);
+		}
+		drmModeFreeObjectProperties(props);
+	}
+	return mock_stats.obj_get_properties + mock_stats.get_property;
+}
+
+/**
+ * Checks that a device property snapshot takes one OBJ_GETPROPERTIES per
+ * object, plus one retry when the scratch buffer is too small, and fetches
+ * every distinct property exactly once, and that lookups by object and
+ * property id return what the device reported.
+ */
+int main(int argc, char **argv)
+{
+	uint32_t ids[NUM_OBJECTS], types[NUM_OBJECTS], expected[64];
+	drmModePropertySnapshotPtr snap;
+	drmModeObjectPropertySetPtr obj;
+	drmModePropertyPtr prop;
+	int i, j, n, distinct, per_property;
+
+	for (i = 0, n = 0; i < 2; i++, n++) {
+		ids[n] = crtcs[i];
+		types[n] = DRM_MODE_OBJECT_CRTC;
+	}
+	for (i = 0; i < 3; i++, n++) {
+		ids[n] = connectors[i];
+		types[n] = DRM_MODE_OBJECT_CONNECTOR;
+	}
+	for (i = 0; i < 2; i++, n++) {
+		ids[n] = planes[i];
+		types[n] = DRM_MODE_OBJECT_PLANE;
+	}
+	per_property = per_property_ioctls(ids, types);
+
+	mock_reset();
+	snap = drmModeGetDevicePropertySnapshot(MOCK_FD);
+	assert(snap);
+	assert(mock_stats.obj_get_properties == NUM_OBJECTS + 1);
+	for (i = 0, distinct = 0; i < MAX_PROP_ID; i++) {
+		/* drmModeGetProperty() takes two ioctls per property. */
+		assert(mock_stats.get_property_by_id[i] == 0 ||
+		       mock_stats.get_property_by_id[i] == 2);
+		distinct += mock_stats.get_property_by_id[i] != 0;
+	}
+	assert(distinct == NUM_DISTINCT);
+	assert(mock_stats.get_property == 2 * NUM_DISTINCT);
+	assert(mock_stats.obj_get_properties + mock_stats.get_property <
+	       per_property);
+	printf("%d objects: %d property ioctls per object and property, "
+	       "%d with a snapshot\n", NUM_OBJECTS, per_property,
+	       mock_stats.obj_get_properties + mock_stats.get_property);
+
+	assert(snap->count_objects == NUM_OBJECTS);
+	assert(snap->count_properties == NUM_DISTINCT);
+	for (i = 1; i < (int)snap->count_properties; i++)
+		assert(snap->properties[i - 1]->prop_id <
+		       snap->properties[i]->prop_id);
+
+	for (i = 0; i < NUM_OBJECTS; i++) {
+		obj = drmModeSnapshotGetObject(snap, ids[i]);
+		assert(obj == &snap->objects[i]);
+		assert(obj->object_type == types[i]);
+		n = mock_object_props(ids[i], expected);
+		assert(obj->count_props == (uint32_t)n);
+		for (j = 0; j < n; j++) {
+			assert(obj->props[j] == expected[j]);
+			assert(obj->prop_values[j] ==
+			       mock_value(ids[i], expected[j]));
+
+			prop = drmModeSnapshotGetProperty(snap, expected[j]);
+			assert(prop && prop->prop_id == expected[j]);
+			assert(prop->count_values == 2);
+			assert(prop->values[1] == expected[j]);
+		}
+	}
+	prop = drmModeSnapshotGetProperty(snap, 100);
+	assert(prop && !strcmp(prop->name, "prop100"));
+	assert(drmModeSnapshotGetProperty(snap, 0) == NULL);
+	assert(drmModeSnapshotGetProperty(snap, 102) == NULL);
+	assert(drmModeSnapshotGetProperty(snap, 999) == NULL);
+	assert(drmModeSnapshotGetObject(snap, 12) == NULL);
+	drmModeFreePropertySnapshot(snap);
+
+	/* The same property on several objects is still fetched once. */
+	mock_reset();
+	snap = drmModeGetPropertySnapshot(MOCK_FD, 3, connectors, types + 2);
+	assert(snap);
+	assert(mock_stats.obj_get_properties == 3);
+	assert(mock_stats.get_property == 2 * 3);
+	assert(snap->count_properties == 3);
+	drmModeFreePropertySnapshot(snap);
+
+	/* An empty snapshot takes no ioctls. */
+	mock_reset();
+	snap = drmModeGetPropertySnapshot(MOCK_FD, 0, NULL, NULL);
+	assert(snap);
+	assert(snap->count_objects == 0 && snap->count_properties == 0);
+	assert(drmModeSnapshotGetProperty(snap, 100) == NULL);
+	assert(mock_stats.obj_get_properties == 0);
+	drmModeFreePropertySnapshot(snap);
+
+	/* A missing object fails the whole snapshot. */
+	ids[3] = 12;
+	assert(drmModeGetPropertySnapshot(MOCK_FD, NUM_OBJECTS, ids, types) ==
+	       NULL);
+	assert(drmModeGetPropertySnapshot(MOCK_FD, 1, NULL, types) == NULL);
+
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "radeon_bo.h"
+#include "radeon_bo_gem.h"
+#include "radeon_mock.h"
+
+#define NUM_LIVE	64
+#define NUM_ALLOCS	200000
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static struct radeon_bo *alloc(struct radeon_bo_manager *bom, uint32_t size,
+			       uint32_t domain)
+{
+	struct radeon_bo *bo;
+
+	bo = radeon_bo_open(bom, 0, size, 0, domain, 0);
+	assert(bo);
+	return bo;
+}
+
+/* allocate and free short lived bos of assorted sizes */
+static double churn(struct radeon_bo_manager *bom)
+{
+	struct radeon_bo *live[NUM_LIVE] = { NULL };
+	double start = now();
+	unsigned i, slot;
+
+	srand(0);
+	for (i = 0; i < NUM_ALLOCS; i++) {
+		slot = rand() % NUM_LIVE;
+		radeon_bo_unref(live[slot]);
+		live[slot] = alloc(bom, 4096 * (1 + rand() % 256),
+				   rand() & 1 ? RADEON_GEM_DOMAIN_VRAM :
+					        RADEON_GEM_DOMAIN_GTT);
+	}
+	for (i = 0; i < NUM_LIVE; i++)
+		radeon_bo_unref(live[i]);
+	return now() - start;
+}
+
+static void test_reuse(void)
+{
+	struct radeon_bo_manager *bom;
+	struct radeon_bo *bo, *bo2;
+	uint32_t handle;
+	unsigned created;
+
+	mock_reset();
+	bom = radeon_bo_manager_gem_ctor(MOCK_FD);
+	radeon_bo_manager_gem_enable_reuse(bom);
+
+	/* same bucket and key, idle: reused */
+	bo = alloc(bom, 5000, RADEON_GEM_DOMAIN_GTT);
+	handle = bo->handle;
+	radeon_bo_unref(bo);
+	assert(radeon_bo_manager_gem_cached_bytes(bom) == 8192);
+	bo = alloc(bom, 8000, RADEON_GEM_DOMAIN_GTT);
+	assert(bo->handle == handle);
+	assert(mock_stats.gem_create == 1);
+	assert(radeon_bo_manager_gem_cached_bytes(bom) == 0);
+
+	/* other domain: not reused */
+	radeon_bo_unref(bo);
+	bo = alloc(bom, 8192, RADEON_GEM_DOMAIN_VRAM);
+	assert(bo->handle != handle);
+	radeon_bo_unref(bo);
+
+	/* busy: not reused, but kept for when it is idle */
+	mock_bo_busy = 1;
+	bo = alloc(bom, 8192, RADEON_GEM_DOMAIN_GTT);
+	assert(bo->handle != handle);
+	mock_bo_busy = 0;
+	bo2 = alloc(bom, 8192, RADEON_GEM_DOMAIN_GTT);
+	assert(bo2->handle == handle);
+	radeon_bo_unref(bo2);
+	radeon_bo_unref(bo);
+
+	/* tiling is reset on reuse */
+	radeon_bo_manager_gem_set_cache_limits(bom, 0, 1000);
+	radeon_bo_manager_gem_set_cache_limits(bom, 1 << 20, 1000);
+	bo = alloc(bom, 8192, RADEON_GEM_DOMAIN_GTT);
+	radeon_bo_set_tiling(bo, 1, 256);
+	radeon_bo_unref(bo);
+	assert(mock_stats.gem_set_tiling == 1);
+	bo = alloc(bom, 8192, RADEON_GEM_DOMAIN_GTT);
+	assert(mock_stats.gem_set_tiling == 2);
+
+	/* shared bos never go to the cache */
+	assert(radeon_gem_get_kernel_name(bo, &handle) == 0);
+	created = mock_stats.gem_close;
+	radeon_bo_unref(bo);
+	assert(mock_stats.gem_close == created + 1);
+
+	/* memory budget */
+	radeon_bo_manager_gem_set_cache_limits(bom, 64 * 1024, 1000);
+	assert(radeon_bo_manager_gem_cached_bytes(bom) <= 64 * 1024);
+	bo = alloc(bom, 48 * 1024, RADEON_GEM_DOMAIN_GTT);
+	bo2 = alloc(bom, 48 * 1024, RADEON_GEM_DOMAIN_GTT);
+	radeon_bo_unref(bo);
+	radeon_bo_unref(bo2);
+	assert(radeon_bo_manager_gem_cached_bytes(bom) == 48 * 1024);
+
+	/* age */
+	radeon_bo_manager_gem_set_cache_limits(bom, 64 * 1024, 0);
+	usleep(2000);
+	bo = alloc(bom, 4096, RADEON_GEM_DOMAIN_VRAM);
+	radeon_bo_unref(bo);
+	assert(radeon_bo_manager_gem_cached_bytes(bom) == 4096);
+
+	radeon_bo_manager_gem_dtor(bom);
+	assert(mock_stats.gem_close == mock_stats.gem_create);
+}
+
+/**
+ * Check which freed bos the reuse cache hands out again, then churn short
+ * lived bos through a manager with and without the cache.
+ */
+int main(int argc, char **argv)
+{
+	struct radeon_bo_manager *bom;
+	double plain, cached;
+	unsigned plain_creates;
+
+	test_reuse();
+
+	mock_reset();
+	bom = radeon_bo_manager_gem_ctor(MOCK_FD);
+	plain = churn(bom);
+	radeon_bo_manager_gem_dtor(bom);
+	plain_creates = mock_stats.gem_create;
+	assert(plain_creates == NUM_ALLOCS);
+
+	mock_reset();
+	bom = radeon_bo_manager_gem_ctor(MOCK_FD);
+	radeon_bo_manager_gem_enable_reuse(bom);
+	cached = churn(bom);
+	radeon_bo_manager_gem_dtor(bom);
+	assert(mock_stats.gem_create < plain_creates / 4);
+	assert(mock_stats.gem_close == mock_stats.gem_create);
+
+	printf("%u allocations: %u creates %.3f ms without reuse, "
+	       "%u creates %.3f ms with reuse\n", NUM_ALLOCS,
+	       plain_creates, plain * 1000.0,
+	       mock_stats.gem_create, cached * 1000.0);
+	return 0;
+}
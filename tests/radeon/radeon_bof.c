@@ -0,0 +1,416 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "bof.h"
+
+#define NUM_BOS		32
+
+/*
+ * Reference loader, a copy of the recursive fread based one libdrm_radeon
+ * had before the mapped reader.
+ */
+static int ref_entry_grow(bof_t *bof)
+{
+	bof_t **array;
+
+	if (bof->array_size < bof->nentry)
+		return 0;
+	array = realloc(bof->array, (bof->nentry + 16) * sizeof(void*));
+	if (array == NULL)
+		return -ENOMEM;
+	bof->array = array;
+	bof->nentry += 16;
+	return 0;
+}
+
+static int ref_read(bof_t *root, FILE *file, long end)
+{
+	bof_t *bof = NULL;
+	int r;
+
+	if (ftell(file) >= end)
+		return 0;
+	r = ref_entry_grow(root);
+	if (r)
+		return r;
+	bof = bof_object();
+	if (bof == NULL)
+		return -ENOMEM;
+	bof->offset = ftell(file);
+	if (fread(&bof->type, 4, 1, file) != 1 ||
+	    fread(&bof->size, 4, 1, file) != 1 ||
+	    fread(&bof->array_size, 4, 1, file) != 1)
+		goto out_err;
+	switch (bof->type) {
+	case BOF_TYPE_STRING:
+	case BOF_TYPE_INT32:
+	case BOF_TYPE_BLOB:
+		bof->value = calloc(1, bof->size - 12);
+		if (bof->value == NULL)
+			goto out_err;
+		if (fread(bof->value, bof->size - 12, 1, file) != 1)
+			goto out_err;
+		break;
+	case BOF_TYPE_OBJECT:
+	case BOF_TYPE_ARRAY:
+		r = ref_read(bof, file, bof->offset + bof->size);
+		if (r)
+			goto out_err;
+		break;
+	default:
+		goto out_err;
+	}
+	root->array[root->centry++] = bof;
+	return ref_read(root, file, end);
+out_err:
+	bof_decref(bof);
+	return -EINVAL;
+}
+
+/* the children are counted in centry, fix array_size up for decref */
+static void ref_fixup(bof_t *bof)
+{
+	unsigned i;
+
+	bof->array_size = bof->centry;
+	for (i = 0; i < bof->array_size; i++)
+		ref_fixup(bof->array[i]);
+}
+
+static bof_t *ref_load_file(const char *filename)
+{
+	bof_t *root = bof_object();
+	FILE *file;
+	int r;
+
+	file = fopen(filename, "r");
+	assert(file);
+	if (fread(&root->type, 4, 1, file) != 1 ||
+	    fread(&root->size, 4, 1, file) != 1 ||
+	    fread(&root->array_size, 4, 1, file) != 1)
+		assert(0);
+	r = ref_read(root, file, root->size);
+	assert(r == 0);
+	fclose(file);
+	ref_fixup(root);
+	return root;
+}
+
+static void compare(bof_t *a, bof_t *b)
+{
+	unsigned i;
+
+	assert(a->type == b->type);
+	assert(a->size == b->size);
+	assert(a->array_size == b->array_size);
+	switch (a->type) {
+	case BOF_TYPE_STRING:
+	case BOF_TYPE_INT32:
+	case BOF_TYPE_BLOB:
+		assert(!memcmp(a->value, b->value, a->size - 12));
+		break;
+	}
+	for (i = 0; i < a->array_size; i++)
+		compare(a->array[i], b->array[i]);
+}
+
+/* read every blob through, as a replay would */
+static uint32_t touch(bof_t *bof)
+{
+	const uint32_t *words = bof->value;
+	uint32_t sum = 0;
+	unsigned i;
+
+	if (bof->type == BOF_TYPE_BLOB) {
+		for (i = 0; i < (bof->size - 12) / 4; i += 1024)
+			sum += words[i];
+	}
+	for (i = 0; i < bof->array_size; i++)
+		sum += touch(bof->array[i]);
+	return sum;
+}
+
+static void set(bof_t *object, const char *key, bof_t *value)
+{
+	assert(value);
+	assert(bof_object_set(object, key, value) == 0);
+	bof_decref(value);
+}
+
+/* a capture like cs_gem_dump_bof writes, with bos of random sizes */
+static bof_t *make_cs(unsigned index, void *data, unsigned max_bo_size)
+{
+	bof_t *root, *array, *bo;
+	unsigned i, size;
+
+	root = bof_object();
+	assert(root);
+	set(root, "device_id", bof_int32(0x6779));
+	set(root, "reloc", bof_blob(NUM_BOS * 16, data));
+	set(root, "pm4", bof_blob(4096 * 4, data));
+	array = bof_array();
+	assert(array);
+	for (i = 0; i < NUM_BOS; i++) {
+		size = 4096 * (1 + (index * 7 + i * 13) % (max_bo_size / 4096));
+		bo = bof_object();
+		assert(bo);
+		set(bo, "size", bof_int32(size));
+		set(bo, "handle", bof_int32(i + 1));
+		((uint32_t *)data)[0] = index ^ i;
+		set(bo, "data", bof_blob(size, data));
+		assert(bof_array_append(array, bo) == 0);
+		bof_decref(bo);
+	}
+	set(root, "bo", array);
+	return root;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void write_file(const char *filename, const void *data, size_t size)
+{
+	FILE *file = fopen(filename, "w");
+
+	assert(file);
+	assert(fwrite(data, 1, size, file) == size);
+	fclose(file);
+}
+
+/* nested arrays, too deep for a recursive parser to be comfortable */
+static void check_deep(const char *filename, unsigned depth)
+{
+	uint32_t *words = malloc(depth * 12);
+	bof_map_t *map;
+	unsigned i, entry;
+
+	assert(words);
+	for (i = 0; i < depth; i++) {
+		words[i * 3] = BOF_TYPE_ARRAY;
+		words[i * 3 + 1] = (depth - i) * 12;
+		words[i * 3 + 2] = i + 1 < depth;
+	}
+	write_file(filename, words, depth * 12);
+	map = bof_map_file(filename);
+	assert(map);
+	assert(bof_map_size(map) == depth);
+	for (i = 0, entry = 0; bof_map_child(map, entry); i++)
+		entry = bof_map_child(map, entry);
+	assert(i == depth - 1);
+	bof_map_close(map);
+
+	/* a child running past its parent */
+	words[4] += 12;
+	write_file(filename, words, depth * 12);
+	assert(bof_map_file(filename) == NULL);
+	free(words);
+}
+
+/* h0 of the stream writer's blob hash after the first 16 bytes */
+static uint64_t hash_first(uint32_t size, uint64_t w0)
+{
+	uint64_t h = ((uint64_t)size ^ w0) * 0x9e3779b97f4a7c15ULL;
+
+	return (h << 31) | (h >> 33);
+}
+
+/* a blob of 2 KB which hashes the same as another one */
+static void make_collision(uint64_t *a, uint64_t *b, unsigned size)
+{
+	unsigned i;
+
+	for (i = 0; i < size / 8; i++)
+		a[i] = b[i] = i * 0x9e3779b97f4a7c15ULL;
+	a[0] = 1;
+	b[0] = 2;
+	/* the second word pair cancels the difference the first one made */
+	b[2] ^= hash_first(size, a[0]) ^ hash_first(size, b[0]);
+}
+
+static void append_blobs(bof_stream_t *stream, void **blobs, unsigned count,
+			 unsigned size)
+{
+	bof_t *array;
+	unsigned i;
+
+	array = bof_array();
+	assert(array);
+	for (i = 0; i < count; i++) {
+		bof_t *blob = bof_blob(size, blobs[i]);
+
+		assert(blob && bof_array_append(array, blob) == 0);
+		bof_decref(blob);
+	}
+	assert(bof_stream_append(stream, array) == 0);
+	bof_decref(array);
+}
+
+/* blobs of equal size and hash are only referenced when they're equal,
+ * whether the first copy is in the same append, buffered or in the file */
+static void check_collision(const char *filename)
+{
+	uint64_t a[256], b[256];
+	void *first[] = { a, b, a }, *second[] = { b, a };
+	bof_stream_t *stream;
+	bof_t *root, *array;
+	unsigned i;
+
+	make_collision(a, b, sizeof(a));
+	assert(memcmp(a, b, sizeof(a)));
+	stream = bof_stream_open(filename);
+	assert(stream);
+	append_blobs(stream, first, 3, sizeof(a));
+	assert(bof_stream_flush(stream) == 0);
+	append_blobs(stream, second, 2, sizeof(a));
+	/* a, b and b again stored in full, a referenced twice */
+	assert(bof_stream_size(stream) > 3 * sizeof(a) &&
+	       bof_stream_size(stream) < 4 * sizeof(a));
+	assert(bof_stream_close(stream) == 0);
+
+	root = bof_load_file(filename);
+	assert(root && bof_array_size(root) == 2);
+	array = bof_array_get(root, 0);
+	for (i = 0; i < 3; i++)
+		assert(!memcmp(bof_blob_value(bof_array_get(array, i)),
+			       first[i], sizeof(a)));
+	array = bof_array_get(root, 1);
+	for (i = 0; i < 2; i++)
+		assert(!memcmp(bof_blob_value(bof_array_get(array, i)),
+			       second[i], sizeof(a)));
+	bof_decref(root);
+}
+
+/**
+ * Write a capture of many cs with bo contents, then load it with the
+ * mapped reader and the original loader and compare the trees.  Also
+ * walks it through the index only API and checks corrupted files are
+ * rejected, and that the stream writer doesn't take blobs whose hashes
+ * collide for one another.  Pass a size in MB for a bigger capture.
+ */
+int main(int argc, char **argv)
+{
+	char filename[] = "/tmp/radeon_bof.XXXXXX";
+	unsigned i, ncs, entry, bo, count, size, target;
+	bof_t *root, *ref, *array, *cs;
+	bof_map_t *map;
+	const void *value;
+	uint32_t *data, sum;
+	double start, t_ref, t_map;
+	int fd;
+
+	target = argc > 1 ? atoi(argv[1]) : 64;
+	fd = mkstemp(filename);
+	assert(fd >= 0);
+	close(fd);
+
+	data = calloc(1, 256 * 1024);
+	assert(data);
+	root = bof_object();
+	array = bof_array();
+	assert(root && array);
+	ncs = target * 1024 * 1024 / (NUM_BOS * 132 * 1024);
+	for (i = 0; i < ncs; i++) {
+		cs = make_cs(i, data, 256 * 1024);
+		assert(bof_array_append(array, cs) == 0);
+		bof_decref(cs);
+	}
+	set(root, "cs", array);
+	assert(bof_dump_file(root, filename) == 0);
+	bof_decref(root);
+
+	start = now();
+	ref = ref_load_file(filename);
+	t_ref = now() - start;
+	start = now();
+	root = bof_load_file(filename);
+	t_map = now() - start;
+	assert(root);
+	printf("%u MB capture: loaded in %.3f ms with the fread loader, "
+	       "%.3f ms mapped\n", (bof_object_get(root, "cs")->size >> 20),
+	       t_ref * 1000.0, t_map * 1000.0);
+	start = now();
+	sum = touch(ref);
+	t_ref = now() - start;
+	start = now();
+	assert(touch(root) == sum);
+	t_map = now() - start;
+	printf("read back every page in %.3f ms loaded, %.3f ms mapped\n",
+	       t_ref * 1000.0, t_map * 1000.0);
+	compare(root, ref);
+	bof_decref(ref);
+
+	/* subtrees outlive their root, the mapping stays around */
+	cs = bof_array_get(bof_object_get(root, "cs"), ncs - 1);
+	bof_incref(cs);
+	bof_decref(root);
+	assert(bof_int32_value(bof_object_get(cs, "device_id")) == 0x6779);
+	bof_decref(cs);
+
+	/* the index alone, nothing but headers touched */
+	start = now();
+	map = bof_map_file(filename);
+	assert(map);
+	entry = bof_map_object_get(map, 0, "cs");
+	assert(entry && bof_map_type(map, entry) == BOF_TYPE_ARRAY);
+	count = 0;
+	for (i = 0, entry = bof_map_child(map, entry); entry;
+	     entry = bof_map_next(map, entry), i++) {
+		bo = bof_map_object_get(map, entry, "bo");
+		for (bo = bof_map_child(map, bo); bo; bo = bof_map_next(map, bo)) {
+			value = bof_map_value(map,
+					      bof_map_object_get(map, bo, "data"),
+					      &size);
+			assert(value && size >= 4096);
+			assert(*(const uint32_t *)value == (i ^ count % NUM_BOS));
+			count++;
+		}
+	}
+	assert(i == ncs && count == ncs * NUM_BOS);
+	printf("indexed %u entries in %.3f ms\n", bof_map_size(map),
+	       (now() - start) * 1000.0);
+	bof_map_close(map);
+
+	/* truncated captures are refused */
+	assert(truncate(filename, 4096 * 8 + 100) == 0);
+	assert(bof_load_file(filename) == NULL);
+
+	check_deep(filename, 100000);
+	check_collision(filename);
+	unlink(filename);
+	free(data);
+	return 0;
+}
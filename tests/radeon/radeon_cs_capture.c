@@ -0,0 +1,242 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "bof.h"
+#include "radeon_bo.h"
+#include "radeon_bo_gem.h"
+#include "radeon_cs.h"
+#include "radeon_cs_gem.h"
+#include "radeon_mock.h"
+
+#define NUM_BOS		24
+#define BO_SIZE		(64 * 1024)
+#define NUM_CS		400
+
+static struct radeon_bo *bos[NUM_BOS];
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static uint64_t file_size(const char *filename)
+{
+	struct stat st;
+
+	assert(stat(filename, &st) == 0);
+	return st.st_size;
+}
+
+/* each cs writes its index + 1 at the start of one bo, then uses them all */
+static void emit_cs(struct radeon_cs *cs, unsigned index)
+{
+	uint32_t *ptr;
+	unsigned i;
+
+	assert(radeon_bo_map(bos[index % NUM_BOS], 1) == 0);
+	ptr = bos[index % NUM_BOS]->ptr;
+	ptr[0] = index + 1;
+	radeon_bo_unmap(bos[index % NUM_BOS]);
+	for (i = 0; i < NUM_BOS; i++) {
+		assert(radeon_cs_space_check_with_bo(cs, bos[i],
+						     RADEON_GEM_DOMAIN_GTT,
+						     0) == 0);
+		assert(radeon_cs_write_reloc(cs, bos[i], RADEON_GEM_DOMAIN_GTT,
+					     0, 0) == 0);
+	}
+	assert(radeon_cs_emit(cs) == 0);
+	radeon_cs_erase(cs);
+}
+
+/* first word bo i held when cs index was emitted */
+static uint32_t expected_word(unsigned index, unsigned i)
+{
+	unsigned last = index - (index + NUM_BOS - i) % NUM_BOS;
+
+	return last <= index ? last + 1 : 0;
+}
+
+/* check the cs of a capture, starting at cs first, returns the bytes the
+ * trees take once loaded */
+static uint64_t check_capture(const char *filename, unsigned first,
+			      unsigned count)
+{
+	bof_t *root, *cs, *array, *bo, *data;
+	const uint32_t *words;
+	uint64_t size;
+	unsigned i, j;
+
+	root = bof_load_file(filename);
+	assert(root);
+	assert(bof_array_size(root) == count);
+	for (i = 0; i < count; i++) {
+		cs = bof_array_get(root, i);
+		assert(bof_int32_value(bof_object_get(cs, "device_id")) == 0x6779);
+		assert(bof_blob_size(bof_object_get(cs, "reloc")) == NUM_BOS * 16);
+		array = bof_object_get(cs, "bo");
+		assert(bof_array_size(array) == NUM_BOS);
+		for (j = 0; j < NUM_BOS; j++) {
+			bo = bof_array_get(array, j);
+			assert(bof_int32_value(bof_object_get(bo, "handle")) ==
+			       bos[j]->handle);
+			data = bof_object_get(bo, "data");
+			assert(bof_blob_size(data) == BO_SIZE);
+			words = bof_blob_value(data);
+			assert(words[0] == expected_word(first + i, j));
+			assert(words[1] == j);
+		}
+	}
+	size = root->size;
+	bof_decref(root);
+	return size;
+}
+
+/**
+ * Capture cs emitted against the mocked kernel, with bos mapped from a
+ * sparse file standing in for the device.  Checks the bo contents read
+ * back from the capture, that unchanged bos are only stored once, and
+ * that the capture rolls over to a second file.  Also times emitting
+ * with and without capture, and against writing one bof file per cs.
+ */
+int main(int argc, char **argv)
+{
+	char device[] = "/tmp/radeon_cs_capture.XXXXXX";
+	char capture[sizeof(device) + 8], old[sizeof(capture) + 4];
+	struct radeon_bo_manager *bom;
+	struct radeon_cs_manager *csm;
+	struct radeon_cs *cs;
+	double start, t_plain, t_capture, t_files;
+	uint64_t loaded, stored, rolled;
+	bof_t *root;
+	uint32_t *ptr;
+	unsigned i, j;
+	int fd;
+
+	mock_reset();
+	fd = mkstemp(device);
+	assert(fd >= 0);
+	assert(ftruncate(fd, (uint64_t)(NUM_BOS + 2) * MOCK_BO_MMAP_STRIDE) == 0);
+	sprintf(capture, "%s.bof", device);
+	sprintf(old, "%s.old", capture);
+
+	bom = radeon_bo_manager_gem_ctor(fd);
+	csm = radeon_cs_manager_gem_ctor(fd);
+	assert(bom && csm);
+	for (i = 0; i < NUM_BOS; i++) {
+		bos[i] = radeon_bo_open(bom, 0, BO_SIZE, 0,
+					RADEON_GEM_DOMAIN_GTT, 0);
+		assert(bos[i]);
+		assert(radeon_bo_map(bos[i], 1) == 0);
+		ptr = bos[i]->ptr;
+		for (j = 0; j < BO_SIZE / 4; j++)
+			ptr[j] = j == 1 ? i : j * 2654435761u;
+		radeon_bo_unmap(bos[i]);
+	}
+	cs = radeon_cs_create(csm, 4096);
+	assert(cs);
+	radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_GTT, 1 << 30);
+	radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_VRAM, 1 << 30);
+
+	start = now();
+	for (i = 0; i < NUM_CS; i++)
+		emit_cs(cs, i);
+	t_plain = now() - start;
+
+	/* only the bo touched since the previous cs is stored again */
+	for (i = 0; i < NUM_BOS; i++) {
+		assert(radeon_bo_map(bos[i], 1) == 0);
+		((uint32_t *)bos[i]->ptr)[0] = 0;
+		radeon_bo_unmap(bos[i]);
+	}
+	assert(radeon_cs_manager_gem_capture(csm, capture, 0) == 0);
+	start = now();
+	for (i = 0; i < NUM_CS; i++)
+		emit_cs(cs, i);
+	t_capture = now() - start;
+	assert(radeon_cs_manager_gem_capture(csm, NULL, 0) == 0);
+	stored = file_size(capture);
+	loaded = check_capture(capture, 0, NUM_CS);
+	assert(stored * 10 < loaded);
+	printf("%u cs with %u bos of %u KB: %.3f ms, %.3f ms captured, "
+	       "%llu MB of captures in %llu KB\n", NUM_CS, NUM_BOS,
+	       BO_SIZE / 1024, t_plain * 1000.0, t_capture * 1000.0,
+	       (unsigned long long)(loaded >> 20),
+	       (unsigned long long)(stored >> 10));
+
+	/* one file per cs, the way CS_BOF_DUMP writes them */
+	root = bof_load_file(capture);
+	assert(root);
+	start = now();
+	for (i = 0; i < NUM_CS; i++)
+		assert(bof_dump_file(bof_array_get(root, i), old) == 0);
+	t_files = now() - start;
+	bof_decref(root);
+	printf("writing them as one bof file per cs: %.3f ms\n",
+	       t_files * 1000.0);
+
+	/* rolling over, each file is complete on its own */
+	for (i = 0; i < NUM_BOS; i++) {
+		assert(radeon_bo_map(bos[i], 1) == 0);
+		((uint32_t *)bos[i]->ptr)[0] = 0;
+		radeon_bo_unmap(bos[i]);
+	}
+	unlink(old);
+	rolled = 2 * NUM_BOS * BO_SIZE;
+	assert(radeon_cs_manager_gem_capture(csm, capture, rolled) == 0);
+	for (i = 0; access(old, F_OK) && i < NUM_CS; i++)
+		emit_cs(cs, i);
+	assert(i < NUM_CS);
+	for (j = i; j < i + 4; j++)
+		emit_cs(cs, j);
+	assert(radeon_cs_manager_gem_capture(csm, NULL, 0) == 0);
+	root = bof_load_file(old);
+	assert(root);
+	/* the cs which went past the limit is the last one of the old file */
+	i = bof_array_size(root);
+	bof_decref(root);
+	check_capture(old, 0, i);
+	check_capture(capture, i, j - i);
+
+	radeon_cs_destroy(cs);
+	for (i = 0; i < NUM_BOS; i++)
+		radeon_bo_unref(bos[i]);
+	radeon_cs_manager_gem_dtor(csm);
+	radeon_bo_manager_gem_dtor(bom);
+	close(fd);
+	unlink(device);
+	unlink(capture);
+	unlink(old);
+	return 0;
+}
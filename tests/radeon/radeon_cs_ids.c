@@ -0,0 +1,151 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "radeon_bo.h"
+#include "radeon_bo_gem.h"
+#include "radeon_cs.h"
+#include "radeon_cs_gem.h"
+#include "radeon_mock.h"
+
+#define NUM_CS		300
+#define NUM_BOS		64
+#define NUM_WRITES	20000
+#define NUM_ROUNDS	4
+
+static struct radeon_bo *bos[NUM_BOS];
+static struct radeon_cs *cs[NUM_CS];
+static unsigned char seen[NUM_CS][NUM_BOS];
+static unsigned nseen[NUM_CS];
+static unsigned submitting;
+
+static void check_cs(const struct drm_radeon_cs_reloc *relocs,
+		     unsigned nrelocs, const uint32_t *ib, unsigned ndw)
+{
+	unsigned i, j;
+
+	/* each bo shows up exactly once */
+	assert(nrelocs == nseen[submitting]);
+	for (i = 0; i < nrelocs; i++) {
+		for (j = 0; j < NUM_BOS; j++)
+			if (bos[j]->handle == relocs[i].handle)
+				break;
+		assert(j < NUM_BOS);
+		assert(seen[submitting][j] == 1);
+		seen[submitting][j] = 2;
+	}
+	for (i = 0; i < ndw; i += 2) {
+		if (ib[i] != 0xc0001000)
+			break;
+		assert(ib[i + 1] / 4 < nrelocs);
+	}
+}
+
+/**
+ * Keep hundreds of cs alive at once, far more than there are cs ids, and
+ * relocate a small set of shared bos from all of them in random order.
+ * Every cs must still submit each of its bos exactly once.
+ */
+int main(int argc, char **argv)
+{
+	struct radeon_bo_manager *bom;
+	struct radeon_cs_manager *csm;
+	unsigned i, j, round, with_id = 0;
+	uint32_t ids = 0, id;
+	int r;
+
+	mock_reset();
+	mock_cs_hook = check_cs;
+	srand(0);
+
+	bom = radeon_bo_manager_gem_ctor(MOCK_FD);
+	csm = radeon_cs_manager_gem_ctor(MOCK_FD);
+	assert(bom && csm);
+
+	for (i = 0; i < NUM_BOS; i++) {
+		bos[i] = radeon_bo_open(bom, 0, 4096, 0, RADEON_GEM_DOMAIN_GTT, 0);
+		assert(bos[i]);
+	}
+
+	for (i = 0; i < NUM_CS; i++) {
+		cs[i] = radeon_cs_create(csm, 64 * 1024 / 4);
+		assert(cs[i]);
+		id = radeon_cs_get_id(cs[i]);
+		if (id) {
+			assert(!(ids & id));
+			ids |= id;
+			with_id++;
+		}
+	}
+	radeon_cs_set_limit(cs[0], RADEON_GEM_DOMAIN_GTT, 1 << 30);
+	radeon_cs_set_limit(cs[0], RADEON_GEM_DOMAIN_VRAM, 1 << 30);
+
+	for (round = 0; round < NUM_ROUNDS; round++) {
+		for (i = 0; i < NUM_WRITES; i++) {
+			unsigned c = rand() % NUM_CS;
+			unsigned b = rand() % NUM_BOS;
+
+			r = radeon_cs_space_check_with_bo(cs[c], bos[b],
+							  RADEON_GEM_DOMAIN_GTT, 0);
+			assert(r == 0);
+			r = radeon_cs_write_reloc(cs[c], bos[b],
+						  RADEON_GEM_DOMAIN_GTT, 0, 0);
+			assert(r == 0);
+			if (!seen[c][b]) {
+				seen[c][b] = 1;
+				nseen[c]++;
+			}
+		}
+		for (i = 0; i < NUM_CS; i++) {
+			submitting = i;
+			r = radeon_cs_emit(cs[i]);
+			assert(r == 0);
+			radeon_cs_erase(cs[i]);
+			for (j = 0; j < NUM_BOS; j++)
+				assert(seen[i][j] != 1);
+			memset(seen[i], 0, sizeof(seen[i]));
+			nseen[i] = 0;
+		}
+	}
+	assert(mock_stats.cs == NUM_CS * NUM_ROUNDS);
+
+	for (i = 0; i < NUM_CS; i++)
+		radeon_cs_destroy(cs[i]);
+	for (i = 0; i < NUM_BOS; i++) {
+		/* nothing may still think it is in a cs */
+		assert(*(uint32_t *)radeon_gem_get_reloc_in_cs(bos[i]) == 0);
+		radeon_bo_unref(bos[i]);
+	}
+	assert(mock_stats.gem_close == NUM_BOS);
+
+	radeon_cs_manager_gem_dtor(csm);
+	radeon_bo_manager_gem_dtor(bom);
+
+	printf("%u live cs, %u of them with an id: %u relocs submitted\n",
+	       NUM_CS, with_id, mock_stats.cs_relocs);
+	return 0;
+}
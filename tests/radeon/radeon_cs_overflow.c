@@ -0,0 +1,260 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "radeon_bo.h"
+#include "radeon_bo_gem.h"
+#include "radeon_cs.h"
+#include "radeon_cs_gem.h"
+#include "radeon_mock.h"
+
+/* what cs_gem flushes at */
+#define IB_SIZE		(64 * 1024 / 4)
+#define NUM_BOS		64
+#define NUM_PACKETS	50000
+#define BIG_PACKET	(IB_SIZE - 16)
+
+#define PKT_NOP		0x80000000
+#define PKT_RELOC	0xc0001000
+#define PKT_DATA	0x10000000
+#define PKT_STATE	0x20000000
+
+static struct radeon_bo *bos[NUM_BOS];
+static struct radeon_cs *cs;
+/* next data packet the kernel should see */
+static unsigned next_seq;
+static unsigned nsubmit, max_ndw, nrefused;
+static int stateful, in_flush;
+
+static unsigned packet_len(unsigned seq)
+{
+	return seq == NUM_PACKETS / 2 ? BIG_PACKET : 1 + seq % 97;
+}
+
+static int packet_reloc(unsigned seq)
+{
+	return seq % 10 == 0;
+}
+
+/* every packet arrives once, in order, with relocs in its own submission */
+static void check_cs(const struct drm_radeon_cs_reloc *relocs,
+		     unsigned nrelocs, const uint32_t *ib, unsigned ndw)
+{
+	unsigned i = 0, j, seq, len;
+
+	nsubmit++;
+	assert(ndw % 8 == 0);
+	if (ndw > max_ndw)
+		max_ndw = ndw;
+	if (stateful && next_seq)
+		assert(ib[i++] == PKT_STATE);
+	while (i < ndw) {
+		if (ib[i] == PKT_NOP) {
+			i++;
+			continue;
+		}
+		assert((ib[i] & 0xf0000000) == PKT_DATA);
+		seq = ib[i++] & 0xffffff;
+		assert(seq == next_seq);
+		next_seq++;
+		len = packet_len(seq);
+		if (packet_reloc(seq)) {
+			assert(ib[i] == PKT_RELOC);
+			assert(ib[i + 1] / 4 < nrelocs);
+			assert(relocs[ib[i + 1] / 4].handle ==
+			       bos[seq % NUM_BOS]->handle);
+			i += 2;
+		}
+		for (j = 1; j < len; j++)
+			assert(ib[i++] == seq);
+	}
+	assert(i == ndw);
+}
+
+/* a driver flush, which has state to emit again at the start of a cs */
+static void flush(void *data)
+{
+	assert(!in_flush);
+	in_flush = 1;
+	assert(radeon_cs_emit(cs) == 0);
+	radeon_cs_erase(cs);
+	assert(radeon_cs_begin(cs, 1, __FILE__, __func__, __LINE__) == 0);
+	radeon_cs_write_dword(cs, PKT_STATE);
+	assert(radeon_cs_end(cs, __FILE__, __func__, __LINE__) == 0);
+	in_flush = 0;
+}
+
+static int make_room(int reserve, unsigned ndw)
+{
+	if (reserve)
+		return radeon_cs_reserve(cs, ndw);
+	return radeon_cs_begin(cs, ndw, __FILE__, __func__, __LINE__);
+}
+
+static void emit_packets(int reserve)
+{
+	unsigned seq, j, len, ndw, total = 0, submitted;
+	int r;
+
+	next_seq = 0;
+	nsubmit = max_ndw = nrefused = 0;
+	for (seq = 0; seq < NUM_PACKETS; seq++) {
+		len = packet_len(seq);
+		ndw = len + (packet_reloc(seq) ? 2 : 0);
+		total += ndw;
+		submitted = nsubmit;
+		r = make_room(reserve, ndw);
+		if (r == -ENOSPC && !stateful) {
+			/* without a flush callback, nothing was submitted and
+			 * flushing is up to the driver */
+			assert(nsubmit == submitted && cs->cdw);
+			nrefused++;
+			assert(radeon_cs_emit(cs) == 0);
+			radeon_cs_erase(cs);
+			r = make_room(reserve, ndw);
+		}
+		assert(r == 0);
+		radeon_cs_write_dword(cs, PKT_DATA | seq);
+		if (packet_reloc(seq)) {
+			assert(radeon_cs_space_check_with_bo(cs, bos[seq % NUM_BOS],
+							     RADEON_GEM_DOMAIN_GTT,
+							     0) == 0);
+			assert(radeon_cs_write_reloc(cs, bos[seq % NUM_BOS],
+						     RADEON_GEM_DOMAIN_GTT,
+						     0, 0) == 0);
+		}
+		for (j = 1; j < len; j++)
+			radeon_cs_write_dword(cs, seq);
+		if (!reserve)
+			assert(radeon_cs_end(cs, __FILE__, __func__,
+					     __LINE__) == 0);
+		/* only ever at the end of a nearly full submission */
+		if (radeon_cs_need_flush(cs))
+			assert(cs->cdw + 64 > IB_SIZE);
+	}
+	assert(radeon_cs_emit(cs) == 0);
+	radeon_cs_erase(cs);
+	assert(next_seq == NUM_PACKETS);
+	/* full submissions, with one as big as the ib allows */
+	assert(max_ndw >= BIG_PACKET && max_ndw <= IB_SIZE);
+	assert(nsubmit <= 3 + total / (IB_SIZE - 128));
+	/* the callback flushes, else the driver was told to */
+	assert(stateful ? nrefused == 0 : nrefused == nsubmit - 1);
+}
+
+/**
+ * Emit far more packets than fit in one submission, through sections and
+ * through radeon_cs_reserve, with and without a driver flush callback.
+ * Without one, a full cs is refused with -ENOSPC rather than submitted
+ * behind the driver's back.  The mocked kernel checks each submission
+ * stays within the ib size, starts with the driver state after a driver
+ * flush and holds whole packets along with the relocs they use.  One
+ * section nearly fills a submission of its own, one which cannot fit in
+ * any is refused, and the memory limits never split sections.
+ */
+int main(int argc, char **argv)
+{
+	struct radeon_bo_manager *bom;
+	struct radeon_cs_manager *csm;
+	unsigned i;
+
+	mock_reset();
+	mock_cs_hook = check_cs;
+
+	bom = radeon_bo_manager_gem_ctor(MOCK_FD);
+	csm = radeon_cs_manager_gem_ctor(MOCK_FD);
+	assert(bom && csm);
+	for (i = 0; i < NUM_BOS; i++) {
+		bos[i] = radeon_bo_open(bom, 0, 4096, 0, RADEON_GEM_DOMAIN_GTT, 0);
+		assert(bos[i]);
+	}
+
+	/* bigger than one submission is fine to ask for */
+	cs = radeon_cs_create(csm, 4 * IB_SIZE);
+	assert(cs);
+	radeon_cs_destroy(cs);
+
+	cs = radeon_cs_create(csm, 1024);
+	assert(cs);
+	radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_GTT, 1 << 30);
+	radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_VRAM, 1 << 30);
+	assert(!radeon_cs_need_flush(cs));
+
+	/* too big for a submission, and nothing flushed for it */
+	assert(radeon_cs_begin(cs, 1, __FILE__, __func__, __LINE__) == 0);
+	radeon_cs_write_dword(cs, PKT_NOP);
+	assert(radeon_cs_end(cs, __FILE__, __func__, __LINE__) == 0);
+	assert(radeon_cs_begin(cs, IB_SIZE, __FILE__, __func__,
+			       __LINE__) != 0);
+	assert(radeon_cs_reserve(cs, IB_SIZE) != 0);
+	assert(cs->cdw == 1 && mock_stats.cs == 0);
+	radeon_cs_erase(cs);
+
+	/* bos past the memory limits are for radeon_cs_space_check to
+	 * report, sections are not split for them */
+	for (i = 0; i < NUM_BOS; i++) {
+		assert(radeon_cs_begin(cs, 3, __FILE__, __func__,
+				       __LINE__) == 0);
+		radeon_cs_write_dword(cs, PKT_NOP);
+		assert(radeon_cs_space_check_with_bo(cs, bos[i],
+						     RADEON_GEM_DOMAIN_GTT,
+						     0) == 0);
+		assert(radeon_cs_write_reloc(cs, bos[i], RADEON_GEM_DOMAIN_GTT,
+					     0, 0) == 0);
+		assert(radeon_cs_end(cs, __FILE__, __func__, __LINE__) == 0);
+	}
+	radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_GTT, 4096);
+	radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_VRAM, 4096);
+	assert(!radeon_cs_need_flush(cs));
+	assert(radeon_cs_begin(cs, 1, __FILE__, __func__, __LINE__) == 0);
+	radeon_cs_write_dword(cs, PKT_NOP);
+	assert(radeon_cs_end(cs, __FILE__, __func__, __LINE__) == 0);
+	assert(mock_stats.cs == 0 && cs->cdw == 3 * NUM_BOS + 1);
+	radeon_cs_erase(cs);
+	radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_GTT, 1 << 30);
+	radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_VRAM, 1 << 30);
+
+	emit_packets(0);
+	printf("%u packets in %u submissions\n", NUM_PACKETS, nsubmit);
+	emit_packets(1);
+
+	stateful = 1;
+	radeon_cs_space_set_flush(cs, flush, NULL);
+	emit_packets(0);
+	emit_packets(1);
+	printf("%u packets in %u submissions with driver flushes\n",
+	       NUM_PACKETS, nsubmit);
+
+	radeon_cs_destroy(cs);
+	for (i = 0; i < NUM_BOS; i++)
+		radeon_bo_unref(bos[i]);
+	radeon_cs_manager_gem_dtor(csm);
+	radeon_bo_manager_gem_dtor(bom);
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "radeon_bo.h"
+#include "radeon_bo_gem.h"
+#include "radeon_cs.h"
+#include "radeon_cs_gem.h"
+#include "radeon_mock.h"
+
+#define NUM_BOS		6000
+#define NUM_CS		200
+#define NUM_WRITES	8000
+#define NUM_SHARED	2000
+
+/* what a cs is expected to hand to the kernel */
+struct cs_expect {
+	unsigned char seen[NUM_BOS];
+	uint32_t relocs[NUM_BOS];
+	unsigned nrelocs;
+	uint32_t ib[NUM_WRITES];
+	unsigned nib;
+};
+
+static struct radeon_bo *bos[NUM_BOS];
+static struct cs_expect expect[2];
+static struct cs_expect *submitting;
+
+static void check_cs(const struct drm_radeon_cs_reloc *relocs,
+		     unsigned nrelocs, const uint32_t *ib, unsigned ndw)
+{
+	unsigned i;
+
+	assert(nrelocs == submitting->nrelocs);
+	for (i = 0; i < nrelocs; i++) {
+		assert(relocs[i].handle == submitting->relocs[i]);
+		assert(relocs[i].read_domains == RADEON_GEM_DOMAIN_GTT);
+		assert(relocs[i].write_domain == 0);
+	}
+	assert(ndw >= submitting->nib * 2);
+	/* every reloc packet points at the reloc of its bo */
+	for (i = 0; i < submitting->nib; i++) {
+		assert(ib[2 * i] == 0xc0001000);
+		assert(ib[2 * i + 1] % 4 == 0);
+		assert(ib[2 * i + 1] / 4 < nrelocs);
+		assert(relocs[ib[2 * i + 1] / 4].handle == submitting->ib[i]);
+	}
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void add_reloc(struct radeon_cs *cs, struct cs_expect *e, unsigned i)
+{
+	int r;
+
+	r = radeon_cs_space_check_with_bo(cs, bos[i], RADEON_GEM_DOMAIN_GTT, 0);
+	assert(r == 0);
+	r = radeon_cs_write_reloc(cs, bos[i], RADEON_GEM_DOMAIN_GTT, 0, 0);
+	assert(r == 0);
+
+	if (!e->seen[i]) {
+		e->seen[i] = 1;
+		e->relocs[e->nrelocs++] = bos[i]->handle;
+	}
+	e->ib[e->nib++] = bos[i]->handle;
+}
+
+static void submit(struct radeon_cs *cs, struct cs_expect *e)
+{
+	int r;
+
+	submitting = e;
+	r = radeon_cs_emit(cs);
+	assert(r == 0);
+	radeon_cs_erase(cs);
+	memset(e, 0, sizeof(*e));
+}
+
+static void build_cs(struct radeon_cs *cs, unsigned nrelocs)
+{
+	unsigned i;
+
+	for (i = 0; i < nrelocs; i++)
+		add_reloc(cs, &expect[0], i);
+	submit(cs, &expect[0]);
+}
+
+/* two contexts relocating the same bos in random order */
+static double build_shared(struct radeon_cs *cs0, struct radeon_cs *cs1)
+{
+	double start = now();
+	unsigned i;
+
+	for (i = 0; i < NUM_WRITES; i++) {
+		if (rand() & 1)
+			add_reloc(cs0, &expect[0], rand() % NUM_SHARED);
+		else
+			add_reloc(cs1, &expect[1], rand() % NUM_SHARED);
+	}
+	submit(cs0, &expect[0]);
+	submit(cs1, &expect[1]);
+	return now() - start;
+}
+
+/**
+ * Build reloc heavy command streams against a mocked DRM_RADEON_CS, both
+ * reusing one cs and creating a new cs for every submission, and check what
+ * the kernel would have been handed.  Then relocate a shared set of bos
+ * many times from two cs, which exercises duplicate reloc detection.
+ */
+int main(int argc, char **argv)
+{
+	struct radeon_bo_manager *bom;
+	struct radeon_cs_manager *csm;
+	struct radeon_cs *cs, *cs1;
+	double start, reuse, create, shared = 0;
+	unsigned i;
+
+	mock_reset();
+	mock_cs_hook = check_cs;
+	srand(0);
+
+	bom = radeon_bo_manager_gem_ctor(MOCK_FD);
+	csm = radeon_cs_manager_gem_ctor(MOCK_FD);
+	assert(bom && csm);
+
+	for (i = 0; i < NUM_BOS; i++) {
+		bos[i] = radeon_bo_open(bom, 0, 4096, 0, RADEON_GEM_DOMAIN_GTT, 0);
+		assert(bos[i]);
+	}
+
+	cs = radeon_cs_create(csm, 64 * 1024 / 4);
+	assert(cs);
+	radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_GTT, 1 << 30);
+	radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_VRAM, 1 << 30);
+
+	start = now();
+	for (i = 0; i < NUM_CS; i++)
+		build_cs(cs, NUM_BOS - i);
+	reuse = now() - start;
+	radeon_cs_destroy(cs);
+
+	start = now();
+	for (i = 0; i < NUM_CS; i++) {
+		cs = radeon_cs_create(csm, 64 * 1024 / 4);
+		assert(cs);
+		build_cs(cs, NUM_BOS - i);
+		radeon_cs_destroy(cs);
+	}
+	create = now() - start;
+
+	cs = radeon_cs_create(csm, 64 * 1024 / 4);
+	cs1 = radeon_cs_create(csm, 64 * 1024 / 4);
+	assert(cs && cs1);
+	for (i = 0; i < NUM_CS / 10; i++)
+		shared += build_shared(cs, cs1);
+	radeon_cs_destroy(cs1);
+	radeon_cs_destroy(cs);
+
+	assert(mock_stats.cs == 2 * NUM_CS + NUM_CS / 10 * 2);
+
+	for (i = 0; i < NUM_BOS; i++)
+		radeon_bo_unref(bos[i]);
+	assert(mock_stats.gem_close == NUM_BOS);
+
+	radeon_cs_manager_gem_dtor(csm);
+	radeon_bo_manager_gem_dtor(bom);
+
+	printf("%u cs with ~%u relocs: reused cs %.3f ms, new cs %.3f ms\n",
+	       NUM_CS, NUM_BOS, reuse * 1000.0, create * 1000.0);
+	printf("%u cs with %u writes of %u shared bos: %.3f ms\n",
+	       NUM_CS / 10 * 2, NUM_WRITES, NUM_SHARED, shared * 1000.0);
+	return 0;
+}
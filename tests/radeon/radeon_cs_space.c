@@ -0,0 +1,461 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "radeon_bo.h"
+#include "radeon_bo_gem.h"
+#include "radeon_bo_int.h"
+#include "radeon_cs.h"
+#include "radeon_cs_gem.h"
+#include "radeon_cs_int.h"
+#include "radeon_mock.h"
+
+#define NUM_BOS		40
+#define NUM_CSM		2
+#define NUM_CS		3
+#define NUM_OPS		200000
+#define NUM_CHECKS	1000000
+
+/*
+ * Reference model of the space accounting, a straight copy of the
+ * algorithm libdrm_radeon used before it became incremental, run over
+ * shadow state next to the real thing.
+ */
+struct ref_check {
+	unsigned bo;
+	uint32_t read_domains;
+	uint32_t write_domain;
+	uint32_t new_accounted;
+};
+
+struct ref_csm {
+	int32_t vram_limit, gart_limit;
+	int32_t vram_write_used, gart_write_used;
+	int32_t read_used;
+};
+
+struct ref_cs {
+	struct ref_csm *csm;
+	struct ref_check bos[MAX_SPACE_BOS];
+	int bo_count;
+	unsigned char in_cs[NUM_BOS];
+	unsigned flushes;
+};
+
+struct ref_sizes {
+	int32_t op_read;
+	int32_t op_gart_write;
+	int32_t op_vram_write;
+};
+
+static uint32_t ref_size[NUM_BOS];
+static uint32_t ref_accounted[NUM_BOS];
+static struct ref_csm ref_csm[NUM_CSM];
+static struct ref_cs ref_cs[NUM_CS];
+
+static struct radeon_bo *bos[NUM_BOS];
+static struct radeon_cs_manager *csm[NUM_CSM];
+static struct radeon_cs *cs[NUM_CS];
+static unsigned flushes[NUM_CS];
+
+static int saved_stderr = -1;
+
+#define check(x) do {						\
+	if (!(x)) {						\
+		dup2(saved_stderr, 2);				\
+		assert(x);					\
+	}							\
+} while (0)
+
+static void ref_emit(struct ref_cs *c)
+{
+	unsigned i;
+
+	for (i = 0; i < NUM_BOS; i++) {
+		if (c->in_cs[i])
+			ref_accounted[i] = 0;
+		c->in_cs[i] = 0;
+	}
+	c->csm->read_used = 0;
+	c->csm->vram_write_used = 0;
+	c->csm->gart_write_used = 0;
+}
+
+static int ref_setup_bo(struct ref_check *sc, struct ref_sizes *sizes)
+{
+	uint32_t read_domains = sc->read_domains;
+	uint32_t write_domain = sc->write_domain;
+	uint32_t accounted = ref_accounted[sc->bo];
+	uint32_t size = ref_size[sc->bo];
+
+	sc->new_accounted = 0;
+	if (write_domain && (write_domain == accounted)) {
+		sc->new_accounted = accounted;
+		return 0;
+	}
+	if (read_domains && ((read_domains << 16) == accounted)) {
+		sc->new_accounted = accounted;
+		return 0;
+	}
+	if (accounted == 0) {
+		if (write_domain) {
+			if (write_domain == RADEON_GEM_DOMAIN_VRAM)
+				sizes->op_vram_write += size;
+			else if (write_domain == RADEON_GEM_DOMAIN_GTT)
+				sizes->op_gart_write += size;
+			sc->new_accounted = write_domain;
+		} else {
+			sizes->op_read += size;
+			sc->new_accounted = read_domains << 16;
+		}
+	} else {
+		uint16_t old_read = accounted >> 16;
+		uint16_t old_write = accounted & 0xffff;
+
+		if (write_domain && (old_read & write_domain)) {
+			sc->new_accounted = write_domain;
+			if (write_domain == RADEON_GEM_DOMAIN_VRAM) {
+				sizes->op_read -= size;
+				sizes->op_vram_write += size;
+			} else if (write_domain == RADEON_GEM_DOMAIN_GTT) {
+				sizes->op_read -= size;
+				sizes->op_gart_write += size;
+			}
+		} else if (read_domains & old_write) {
+			sc->new_accounted = accounted & 0xffff;
+		} else {
+			return RADEON_CS_SPACE_FLUSH;
+		}
+	}
+	return 0;
+}
+
+static int ref_do_space_check(struct ref_cs *c, struct ref_check *new_tmp)
+{
+	struct ref_csm *m = c->csm;
+	struct ref_sizes sizes;
+	int i, ret;
+
+	if (c->bo_count == 0 && !new_tmp)
+		return 0;
+
+	memset(&sizes, 0, sizeof(sizes));
+	for (i = 0; i < c->bo_count; i++) {
+		ret = ref_setup_bo(&c->bos[i], &sizes);
+		if (ret)
+			return ret;
+	}
+	if (new_tmp) {
+		ret = ref_setup_bo(new_tmp, &sizes);
+		if (ret)
+			return ret;
+	}
+	if (sizes.op_read < 0)
+		sizes.op_read = 0;
+	if ((sizes.op_read + sizes.op_gart_write > m->gart_limit) ||
+	    (sizes.op_vram_write > m->vram_limit))
+		return RADEON_CS_SPACE_OP_TO_BIG;
+	if (((m->vram_write_used + sizes.op_vram_write) > m->vram_limit) ||
+	    ((m->read_used + m->gart_write_used + sizes.op_gart_write +
+	      sizes.op_read) > m->gart_limit))
+		return RADEON_CS_SPACE_FLUSH;
+
+	m->gart_write_used += sizes.op_gart_write;
+	m->vram_write_used += sizes.op_vram_write;
+	m->read_used += sizes.op_read;
+	for (i = 0; i < c->bo_count; i++)
+		ref_accounted[c->bos[i].bo] = c->bos[i].new_accounted;
+	if (new_tmp)
+		ref_accounted[new_tmp->bo] = new_tmp->new_accounted;
+	return RADEON_CS_SPACE_OK;
+}
+
+static int ref_check_space(struct ref_cs *c, struct ref_check *tmp)
+{
+	int ret, flushed = 0;
+
+again:
+	ret = ref_do_space_check(c, tmp);
+	if (ret == RADEON_CS_SPACE_OP_TO_BIG)
+		return -1;
+	if (ret == RADEON_CS_SPACE_FLUSH) {
+		c->flushes++;
+		ref_emit(c);
+		if (flushed)
+			return -1;
+		flushed = 1;
+		goto again;
+	}
+	return 0;
+}
+
+static void ref_add_persistent(struct ref_cs *c, unsigned bo,
+			       uint32_t read_domains, uint32_t write_domain)
+{
+	int i;
+
+	for (i = 0; i < c->bo_count; i++) {
+		if (c->bos[i].bo == bo &&
+		    c->bos[i].read_domains == read_domains &&
+		    c->bos[i].write_domain == write_domain)
+			return;
+	}
+	c->bos[c->bo_count].bo = bo;
+	c->bos[c->bo_count].read_domains = read_domains;
+	c->bos[c->bo_count].write_domain = write_domain;
+	c->bos[c->bo_count].new_accounted = 0;
+	c->bo_count++;
+}
+
+static void flush(void *data)
+{
+	unsigned c = (uintptr_t)data;
+	int r;
+
+	flushes[c]++;
+	r = radeon_cs_emit(cs[c]);
+	check(r == 0);
+	radeon_cs_erase(cs[c]);
+}
+
+static void random_domains(uint32_t *read_domains, uint32_t *write_domain)
+{
+	static const uint32_t domains[][2] = {
+		{ RADEON_GEM_DOMAIN_GTT, 0 },
+		{ RADEON_GEM_DOMAIN_VRAM, 0 },
+		{ RADEON_GEM_DOMAIN_GTT | RADEON_GEM_DOMAIN_VRAM, 0 },
+		{ 0, RADEON_GEM_DOMAIN_GTT },
+		{ 0, RADEON_GEM_DOMAIN_VRAM },
+	};
+	unsigned i = rand() % 5;
+
+	*read_domains = domains[i][0];
+	*write_domain = domains[i][1];
+}
+
+static void compare(void)
+{
+	unsigned i;
+
+	for (i = 0; i < NUM_BOS; i++)
+		check(((struct radeon_bo_int *)bos[i])->space_accounted ==
+		      ref_accounted[i]);
+	for (i = 0; i < NUM_CSM; i++) {
+		check(csm[i]->read_used == ref_csm[i].read_used);
+		check(csm[i]->vram_write_used == ref_csm[i].vram_write_used);
+		check(csm[i]->gart_write_used == ref_csm[i].gart_write_used);
+	}
+	for (i = 0; i < NUM_CS; i++)
+		check(flushes[i] == ref_cs[i].flushes);
+}
+
+static void random_op(void)
+{
+	unsigned c = rand() % NUM_CS, b = rand() % NUM_BOS, i;
+	uint32_t read_domains, write_domain;
+	struct ref_check tmp;
+	int r, ref;
+
+	switch (rand() % 16) {
+	case 0:
+		if (ref_cs[c].bo_count >= MAX_SPACE_BOS - 2)
+			break;
+		random_domains(&read_domains, &write_domain);
+		radeon_cs_space_add_persistent_bo(cs[c], bos[b],
+						  read_domains, write_domain);
+		ref_add_persistent(&ref_cs[c], b, read_domains, write_domain);
+		break;
+	case 1:
+		if (rand() % 8)
+			break;
+		radeon_cs_space_reset_bos(cs[c]);
+		ref_cs[c].bo_count = 0;
+		break;
+	case 2:
+	case 3:
+		ref = ref_check_space(&ref_cs[c], NULL);
+		r = radeon_cs_space_check(cs[c]);
+		check(r == ref);
+		break;
+	case 4:
+		/* relocate a bo accounted for the cs */
+		if (!ref_accounted[b] || ref_cs[c].in_cs[b])
+			break;
+		r = radeon_cs_write_reloc(cs[c], bos[b],
+					  RADEON_GEM_DOMAIN_GTT, 0, 0);
+		check(r == 0);
+		ref_cs[c].in_cs[b] = 1;
+		break;
+	case 5:
+		flush((void *)(uintptr_t)c);
+		flushes[c]--;
+		ref_emit(&ref_cs[c]);
+		break;
+	case 6:
+		if (rand() % 32)
+			break;
+		i = c % NUM_CSM;
+		ref_csm[i].gart_limit = 4096 * (16 + rand() % 1024);
+		ref_csm[i].vram_limit = 4096 * (16 + rand() % 1024);
+		radeon_cs_set_limit(cs[c], RADEON_GEM_DOMAIN_GTT,
+				    ref_csm[i].gart_limit);
+		radeon_cs_set_limit(cs[c], RADEON_GEM_DOMAIN_VRAM,
+				    ref_csm[i].vram_limit);
+		break;
+	default:
+		random_domains(&read_domains, &write_domain);
+		tmp.bo = b;
+		tmp.read_domains = read_domains;
+		tmp.write_domain = write_domain;
+		ref = ref_check_space(&ref_cs[c], &tmp);
+		r = radeon_cs_space_check_with_bo(cs[c], bos[b],
+						  read_domains, write_domain);
+		check(r == ref);
+		break;
+	}
+	compare();
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/**
+ * Differential test of the space accounting against a reference model of
+ * the original algorithm: random persistent bos, checks, relocations,
+ * flushes and limits over cs sharing bos and managers.  Then time checks
+ * against a full list of persistent bos, alone and interleaved with
+ * another cs busy with other bos.
+ */
+int main(int argc, char **argv)
+{
+	struct radeon_bo_manager *bom;
+	struct radeon_bo *others[8];
+	double start;
+	unsigned i;
+	int r;
+
+	mock_reset();
+	srand(0);
+
+	bom = radeon_bo_manager_gem_ctor(MOCK_FD);
+	for (i = 0; i < NUM_BOS; i++) {
+		ref_size[i] = 4096 * (1 + rand() % 64);
+		bos[i] = radeon_bo_open(bom, 0, ref_size[i], 0,
+					RADEON_GEM_DOMAIN_GTT, 0);
+		assert(bos[i]);
+	}
+	for (i = 0; i < NUM_CSM; i++) {
+		csm[i] = radeon_cs_manager_gem_ctor(MOCK_FD);
+		assert(csm[i]);
+	}
+	for (i = 0; i < NUM_CS; i++) {
+		cs[i] = radeon_cs_create(csm[i % NUM_CSM], 64 * 1024 / 4);
+		assert(cs[i]);
+		radeon_cs_space_set_flush(cs[i], flush, (void *)(uintptr_t)i);
+		ref_cs[i].csm = &ref_csm[i % NUM_CSM];
+		ref_csm[i % NUM_CSM].gart_limit = 1 << 22;
+		ref_csm[i % NUM_CSM].vram_limit = 1 << 22;
+		radeon_cs_set_limit(cs[i], RADEON_GEM_DOMAIN_GTT, 1 << 22);
+		radeon_cs_set_limit(cs[i], RADEON_GEM_DOMAIN_VRAM, 1 << 22);
+	}
+
+	/* domain conflicts are reported on stderr, keep them out of the log */
+	saved_stderr = dup(2);
+	dup2(open("/dev/null", O_WRONLY), 2);
+	for (i = 0; i < NUM_OPS; i++)
+		random_op();
+	dup2(saved_stderr, 2);
+
+	for (i = 0; i < NUM_CS; i++) {
+		flush((void *)(uintptr_t)i);
+		radeon_cs_space_reset_bos(cs[i]);
+	}
+
+	for (i = 0; i < NUM_BOS; i++) {
+		radeon_bo_unref(bos[i]);
+		bos[i] = radeon_bo_open(bom, 0, 4096, 0,
+					RADEON_GEM_DOMAIN_GTT, 0);
+		assert(bos[i]);
+	}
+
+	/* steady state of a draw loop: everything is accounted already */
+	for (i = 0; i < MAX_SPACE_BOS - 1; i++)
+		radeon_cs_space_add_persistent_bo(cs[0], bos[i],
+						  RADEON_GEM_DOMAIN_GTT, 0);
+	start = now();
+	for (i = 0; i < NUM_CHECKS; i++) {
+		r = radeon_cs_space_check_with_bo(cs[0], bos[NUM_BOS - 1 - i % 8],
+						  RADEON_GEM_DOMAIN_GTT, 0);
+		assert(r == 0);
+	}
+	printf("%u checks with %u persistent bos: %.3f ms\n",
+	       NUM_CHECKS, MAX_SPACE_BOS - 1, (now() - start) * 1000.0);
+
+	/* the same, interleaved with a cs on other bos accounting and
+	 * flushing them, which leaves the persistent bos of the first alone */
+	for (i = 0; i < 8; i++) {
+		others[i] = radeon_bo_open(bom, 0, 4096, 0,
+					   RADEON_GEM_DOMAIN_GTT, 0);
+		assert(others[i]);
+	}
+	start = now();
+	for (i = 0; i < NUM_CHECKS / 4; i++) {
+		r = radeon_cs_space_check_with_bo(cs[1], others[i % 8],
+						  RADEON_GEM_DOMAIN_GTT, 0);
+		assert(r == 0);
+		r = radeon_cs_write_reloc(cs[1], others[i % 8],
+					  RADEON_GEM_DOMAIN_GTT, 0, 0);
+		assert(r == 0);
+		if (i % 8 == 7)
+			flush((void *)(uintptr_t)1);
+		r = radeon_cs_space_check_with_bo(cs[0], bos[NUM_BOS - 1 - i % 8],
+						  RADEON_GEM_DOMAIN_GTT, 0);
+		assert(r == 0);
+	}
+	printf("%u interleaved checks with %u persistent bos: %.3f ms\n",
+	       NUM_CHECKS / 4, MAX_SPACE_BOS - 1, (now() - start) * 1000.0);
+	for (i = 0; i < 8; i++)
+		radeon_bo_unref(others[i]);
+	radeon_cs_space_reset_bos(cs[0]);
+
+	for (i = 0; i < NUM_CS; i++)
+		radeon_cs_destroy(cs[i]);
+	for (i = 0; i < NUM_CSM; i++)
+		radeon_cs_manager_gem_dtor(csm[i]);
+	for (i = 0; i < NUM_BOS; i++)
+		radeon_bo_unref(bos[i]);
+	radeon_bo_manager_gem_dtor(bom);
+	return 0;
+}
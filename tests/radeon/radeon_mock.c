@@ -0,0 +1,212 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Replacements for the libdrm ioctl entry points, so that libdrm_radeon can
+ * be exercised without a radeon device.  Symbols defined in the executable
+ * take precedence over the ones in libdrm.so.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include "xf86drm.h"
+#include "radeon_mock.h"
+
+struct mock_stats mock_stats;
+uint32_t mock_device_id;
+uint32_t mock_tiling_config;
+uint32_t mock_tile_mode_array[32];
+uint32_t mock_macrotile_mode_array[16];
+int mock_bo_busy;
+void (*mock_cs_hook)(const struct drm_radeon_cs_reloc *relocs,
+		     unsigned nrelocs, const uint32_t *ib, unsigned ndw);
+
+static uint32_t next_handle = 1;
+
+void mock_reset(void)
+{
+	unsigned i;
+
+	memset(&mock_stats, 0, sizeof(mock_stats));
+	mock_device_id = 0x6779; /* CAICOS */
+	/* 8 pipes, 16 banks, 256B groups, 2KB rows */
+	mock_tiling_config = 0x1023;
+	/* P8_32x32_8x16, 16 banks, bank height 2, macro tile aspect 2, with
+	 * growing tile splits */
+	for (i = 0; i < 32; i++)
+		mock_tile_mode_array[i] = (10 << 6) | ((i % 7) << 11) |
+					  (1 << 16) | (1 << 18) | (3 << 20);
+	for (i = 0; i < 16; i++)
+		mock_macrotile_mode_array[i] = (1 << 2) | (1 << 4) | (3 << 6);
+	mock_bo_busy = 0;
+	mock_cs_hook = NULL;
+}
+
+static int mock_cs(struct drm_radeon_cs *cs)
+{
+	uint64_t *chunk_array = (uint64_t *)(uintptr_t)cs->chunks;
+	const struct drm_radeon_cs_reloc *relocs = NULL;
+	const uint32_t *ib = NULL;
+	unsigned i, nrelocs = 0, ndw = 0;
+
+	for (i = 0; i < cs->num_chunks; i++) {
+		struct drm_radeon_cs_chunk *chunk;
+
+		chunk = (struct drm_radeon_cs_chunk *)(uintptr_t)chunk_array[i];
+		switch (chunk->chunk_id) {
+		case RADEON_CHUNK_ID_IB:
+			ib = (const uint32_t *)(uintptr_t)chunk->chunk_data;
+			ndw = chunk->length_dw;
+			break;
+		case RADEON_CHUNK_ID_RELOCS:
+			relocs = (const struct drm_radeon_cs_reloc *)(uintptr_t)chunk->chunk_data;
+			nrelocs = chunk->length_dw * 4 / sizeof(*relocs);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+	/* the kernel's limit on an ib */
+	if (ndw > 64 * 1024 / 4)
+		return -EINVAL;
+	mock_stats.cs++;
+	mock_stats.cs_relocs += nrelocs;
+	if (mock_cs_hook)
+		mock_cs_hook(relocs, nrelocs, ib, ndw);
+	return 0;
+}
+
+int drmCommandWriteRead(int fd, unsigned long drmCommandIndex, void *data,
+			unsigned long size)
+{
+	switch (drmCommandIndex) {
+	case DRM_RADEON_GEM_CREATE: {
+		struct drm_radeon_gem_create *args = data;
+
+		args->handle = next_handle++;
+		mock_stats.gem_create++;
+		return 0;
+	}
+	case DRM_RADEON_GEM_BUSY: {
+		struct drm_radeon_gem_busy *args = data;
+
+		mock_stats.gem_busy++;
+		args->domain = RADEON_GEM_DOMAIN_GTT;
+		return mock_bo_busy ? -EBUSY : 0;
+	}
+	case DRM_RADEON_GEM_SET_TILING:
+		mock_stats.gem_set_tiling++;
+		return 0;
+	case DRM_RADEON_GEM_MMAP: {
+		struct drm_radeon_gem_mmap *args = data;
+
+		if (args->size > MOCK_BO_MMAP_STRIDE)
+			return -EINVAL;
+		args->addr_ptr = (uint64_t)args->handle * MOCK_BO_MMAP_STRIDE;
+		mock_stats.gem_mmap++;
+		return 0;
+	}
+	case DRM_RADEON_GEM_SET_DOMAIN:
+	case DRM_RADEON_GEM_GET_TILING:
+		return 0;
+	case DRM_RADEON_INFO: {
+		struct drm_radeon_info *info = data;
+		uint32_t *value = (uint32_t *)(uintptr_t)info->value;
+
+		switch (info->request) {
+		case RADEON_INFO_DEVICE_ID:
+			*value = mock_device_id;
+			return 0;
+		case RADEON_INFO_TILING_CONFIG:
+			*value = mock_tiling_config;
+			return 0;
+		case RADEON_INFO_SI_TILE_MODE_ARRAY:
+			memcpy(value, mock_tile_mode_array,
+			       sizeof(mock_tile_mode_array));
+			return 0;
+		case RADEON_INFO_CIK_MACROTILE_MODE_ARRAY:
+			memcpy(value, mock_macrotile_mode_array,
+			       sizeof(mock_macrotile_mode_array));
+			return 0;
+		default:
+			return -EINVAL;
+		}
+	}
+	case DRM_RADEON_CS:
+		return mock_cs(data);
+	default:
+		return -EINVAL;
+	}
+}
+
+int drmCommandWrite(int fd, unsigned long drmCommandIndex, void *data,
+		    unsigned long size)
+{
+	switch (drmCommandIndex) {
+	case DRM_RADEON_GEM_WAIT_IDLE:
+		mock_stats.gem_wait_idle++;
+		mock_bo_busy = 0;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+int drmIoctl(int fd, unsigned long request, void *arg)
+{
+	switch (request) {
+	case DRM_IOCTL_VERSION: {
+		drm_version_t *version = arg;
+
+		/* recent enough for 2D tiling on every family */
+		version->version_major = 2;
+		version->version_minor = 40;
+		version->version_patchlevel = 0;
+		/* drmGetVersion asks for the lengths first */
+		if (version->name)
+			memcpy(version->name, "radeon", 6);
+		if (version->date)
+			memcpy(version->date, "0", 1);
+		if (version->desc)
+			memcpy(version->desc, "mock", 4);
+		version->name_len = 6;
+		version->date_len = 1;
+		version->desc_len = 4;
+		return 0;
+	}
+	case DRM_IOCTL_GEM_CLOSE:
+		mock_stats.gem_close++;
+		return 0;
+	case DRM_IOCTL_GEM_FLINK: {
+		struct drm_gem_flink *flink = arg;
+
+		flink->name = flink->handle;
+		mock_stats.gem_flink++;
+		return 0;
+	}
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RADEON_MOCK_H
+#define RADEON_MOCK_H
+
+#include <stdint.h>
+#include "radeon_drm.h"
+
+/* Fake device fd, the mocked ioctls ignore it */
+#define MOCK_FD		-1
+
+/* DRM_RADEON_GEM_MMAP places bo n at n times this offset of the device fd,
+ * mapping bos needs a regular file big enough passed as the fd instead of
+ * MOCK_FD */
+#define MOCK_BO_MMAP_STRIDE	(1 << 20)
+
+struct mock_stats {
+	unsigned gem_create;
+	unsigned gem_close;
+	unsigned gem_busy;
+	unsigned gem_wait_idle;
+	unsigned gem_set_tiling;
+	unsigned gem_flink;
+	unsigned gem_mmap;
+	unsigned cs;
+	unsigned cs_relocs;
+};
+
+extern struct mock_stats mock_stats;
+
+/* What DRM_RADEON_INFO reports, a CAICOS with 8 pipes and 16 banks unless
+ * changed before creating a manager */
+extern uint32_t mock_device_id;
+extern uint32_t mock_tiling_config;
+extern uint32_t mock_tile_mode_array[32];
+extern uint32_t mock_macrotile_mode_array[16];
+
+/* When set, DRM_RADEON_GEM_BUSY reports every bo as busy */
+extern int mock_bo_busy;
+
+/* Called for every DRM_RADEON_CS with the reloc chunk of the submission */
+extern void (*mock_cs_hook)(const struct drm_radeon_cs_reloc *relocs,
+			    unsigned nrelocs, const uint32_t *ib, unsigned ndw);
+
+void mock_reset(void);
+
+#endif
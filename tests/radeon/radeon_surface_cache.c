@@ -0,0 +1,244 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "radeon_surface.h"
+#include "radeon_mock.h"
+
+#define NUM_SHAPES	300
+#define NUM_ROUNDS	20
+/* what callers fill in, the level arrays after it are outputs */
+#define DESC_SIZE	offsetof(struct radeon_surface, level)
+
+static const struct {
+	const char *name;
+	uint32_t device_id;
+	int si;
+} devices[] = {
+	{ "R600", 0x9400, 0 },
+	{ "RV770", 0x9440, 0 },
+	{ "CYPRESS", 0x6880, 0 },
+	{ "CAICOS", 0x6760, 0 },
+	{ "TAHITI", 0x6780, 1 },
+	{ "BONAIRE", 0x6640, 1 },
+};
+
+static struct radeon_surface shapes[NUM_SHAPES];
+
+static unsigned log2_floor(unsigned x)
+{
+	unsigned r = 0;
+
+	while (x >>= 1)
+		r++;
+	return r;
+}
+
+static void random_shape(struct radeon_surface *surf, int si)
+{
+	static const unsigned modes[] = {
+		RADEON_SURF_MODE_LINEAR_ALIGNED,
+		RADEON_SURF_MODE_1D,
+		RADEON_SURF_MODE_2D,
+		RADEON_SURF_MODE_2D,
+	};
+	unsigned type = rand() % 6, max;
+
+	memset(surf, 0, sizeof(*surf));
+	surf->npix_x = 1 + rand() % 2048;
+	surf->npix_y = 1;
+	surf->npix_z = 1;
+	surf->array_size = 1;
+	surf->blk_w = surf->blk_h = surf->blk_d = 1;
+	surf->nsamples = 1;
+	surf->bpe = 1 << (rand() % 5);
+	switch (type) {
+	case RADEON_SURF_TYPE_1D_ARRAY:
+		surf->array_size = 1 + rand() % 8;
+		break;
+	case RADEON_SURF_TYPE_2D_ARRAY:
+		surf->array_size = 1 + rand() % 8;
+		/* fall through */
+	case RADEON_SURF_TYPE_2D:
+		surf->npix_y = 1 + rand() % 2048;
+		break;
+	case RADEON_SURF_TYPE_3D:
+		surf->npix_y = 1 + rand() % 256;
+		surf->npix_z = 1 + rand() % 64;
+		break;
+	case RADEON_SURF_TYPE_CUBEMAP:
+		surf->npix_y = surf->npix_x;
+		surf->array_size = 6;
+		break;
+	}
+	if (surf->bpe >= 8 && !(rand() % 4)) {
+		/* block compressed */
+		surf->blk_w = surf->blk_h = 4;
+	}
+	max = surf->npix_x > surf->npix_y ? surf->npix_x : surf->npix_y;
+	/* mostly full mip chains, as streamed textures have */
+	if (rand() % 4)
+		surf->last_level = log2_floor(max);
+	else
+		surf->last_level = rand() % (log2_floor(max) + 1);
+
+	surf->flags = RADEON_SURF_SET(type, TYPE) |
+		      RADEON_SURF_SET(modes[rand() % 4], MODE);
+	if (type == RADEON_SURF_TYPE_2D && !(rand() % 8))
+		surf->flags |= RADEON_SURF_SCANOUT;
+	if (type == RADEON_SURF_TYPE_2D && surf->blk_w == 1 && !(rand() % 8)) {
+		surf->bpe = 4;
+		surf->flags |= RADEON_SURF_ZBUFFER;
+		if (rand() % 2)
+			surf->flags |= RADEON_SURF_SBUFFER |
+				       RADEON_SURF_HAS_SBUFFER_MIPTREE;
+	}
+	if (si && (rand() % 4))
+		surf->flags |= RADEON_SURF_HAS_TILE_MODE_INDEX;
+}
+
+static void setup_device(uint32_t device_id)
+{
+	mock_reset();
+	mock_device_id = device_id;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* same layout, and error, from the cached and uncached managers */
+static void check_shape(struct radeon_surface_manager *plain,
+			struct radeon_surface_manager *cached,
+			const struct radeon_surface *shape,
+			int best, int garbage)
+{
+	struct radeon_surface a, b;
+	int ra, rb;
+
+	a = *shape;
+	if (garbage)
+		memset(a.level, garbage,
+		       sizeof(a) - offsetof(struct radeon_surface, level));
+	b = a;
+	if (best) {
+		ra = radeon_surface_best(plain, &a);
+		rb = radeon_surface_best(cached, &b);
+	} else {
+		ra = radeon_surface_init(plain, &a);
+		rb = radeon_surface_init(cached, &b);
+	}
+	assert(ra == rb);
+	assert(!memcmp(&a, &b, sizeof(a)));
+}
+
+/**
+ * Run random shapes of every hw generation through the cached and the
+ * uncached surface managers, over zeroed and garbage filled surfaces,
+ * and check they agree bit for bit.  Then time repeated layouts of the
+ * same shapes with and without the cache.
+ */
+int main(int argc, char **argv)
+{
+	struct radeon_surface_manager *plain, *cached, *validated;
+	struct radeon_surface surf;
+	unsigned long hits, misses, mismatches;
+	unsigned d, i, round;
+	double start, t_plain, t_cached;
+
+	srand(0);
+	for (d = 0; d < sizeof(devices) / sizeof(devices[0]); d++) {
+		setup_device(devices[d].device_id);
+		plain = radeon_surface_manager_new(MOCK_FD);
+		cached = radeon_surface_manager_new(MOCK_FD);
+		validated = radeon_surface_manager_new(MOCK_FD);
+		assert(plain && cached && validated);
+		assert(radeon_surface_manager_enable_cache(cached, 4096, 0) == 0);
+		assert(radeon_surface_manager_enable_cache(validated, 4096,
+				RADEON_SURF_CACHE_VALIDATE) == 0);
+
+		/* like drivers do, init is only fed what best returned */
+		for (i = 0; i < NUM_SHAPES; i++) {
+			do {
+				random_shape(&shapes[i], devices[d].si);
+			} while (radeon_surface_best(plain, &shapes[i]));
+		}
+
+		for (round = 0; round < 4; round++) {
+			for (i = 0; i < NUM_SHAPES; i++) {
+				check_shape(plain, cached, &shapes[i],
+					    round & 1, round & 2 ? 0x5a : 0);
+				check_shape(plain, validated, &shapes[i],
+					    round & 1, round & 2 ? 0xa5 : 0);
+			}
+		}
+		radeon_surface_manager_cache_stats(validated, &hits, &misses,
+						   &mismatches);
+		assert(mismatches == 0);
+		assert(hits + misses <= 4 * NUM_SHAPES);
+		assert(hits >= NUM_SHAPES);
+
+		start = now();
+		for (round = 0; round < NUM_ROUNDS; round++) {
+			for (i = 0; i < NUM_SHAPES; i++) {
+				memcpy(&surf, &shapes[i], DESC_SIZE);
+				radeon_surface_best(plain, &surf);
+				memcpy(&surf, &shapes[i], DESC_SIZE);
+				radeon_surface_init(plain, &surf);
+			}
+		}
+		t_plain = now() - start;
+		start = now();
+		for (round = 0; round < NUM_ROUNDS; round++) {
+			for (i = 0; i < NUM_SHAPES; i++) {
+				memcpy(&surf, &shapes[i], DESC_SIZE);
+				radeon_surface_best(cached, &surf);
+				memcpy(&surf, &shapes[i], DESC_SIZE);
+				radeon_surface_init(cached, &surf);
+			}
+		}
+		t_cached = now() - start;
+		radeon_surface_manager_cache_stats(cached, &hits, &misses, NULL);
+		assert(hits > 10 * misses);
+		printf("%-8s %u layouts: %.3f ms uncached, %.3f ms cached "
+		       "(%lu hits, %lu misses)\n", devices[d].name,
+		       2 * NUM_ROUNDS * NUM_SHAPES, t_plain * 1000.0,
+		       t_cached * 1000.0, hits, misses);
+
+		radeon_surface_manager_free(plain);
+		radeon_surface_manager_free(cached);
+		radeon_surface_manager_free(validated);
+	}
+	return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Compute radeon surface layouts without hardware, for a family and
+ * tiling setup given on the command line.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "radeon_surface.h"
+#include "radeon_surface_corpus.h"
+
+static const char *types[] = {
+	"1d", "2d", "3d", "cube", "1darray", "2darray",
+};
+
+static const char *modes[] = {
+	"linear", "aligned", "1d", "2d",
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s -f family [-t tiling_config] [-m drm_minor]\n"
+		"          [-T type] [-M mode] [-b bpe] [-l last_level]\n"
+		"          [-a array_size] [-n nsamples] [-B blk_size] [-szS]\n"
+		"          [-i] WxH[xD]\n"
+		"       %s -f family [-t tiling_config] [-m drm_minor] -c count\n"
+		"\n"
+		"\t-f family\tas in r600_pci_ids.h, e.g. CAICOS or TAHITI\n"
+		"\t-t config\tRADEON_INFO_TILING_CONFIG, a typical one by default\n"
+		"\t-m minor\tradeon kernel driver minor version, 40 by default\n"
+		"\t-T type\t\t1d, 2d, 3d, cube, 1darray or 2darray\n"
+		"\t-M mode\t\tlinear, aligned, 1d or 2d\n"
+		"\t-s -z -S\tscanout, depth and stencil surface\n"
+		"\t-i\t\tskip radeon_surface_best, only run radeon_surface_init\n"
+		"\t-c count\tdigest and time the layouts of count corpus shapes\n",
+		name, name);
+	exit(1);
+}
+
+static int lookup(const char *name, const char **names, unsigned count)
+{
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		if (!strcmp(name, names[i]))
+			return i;
+	}
+	return -1;
+}
+
+static void print_level(const char *what, unsigned i,
+			const struct radeon_surface_level *level,
+			uint32_t tiling_index)
+{
+	printf("%s %2u: offset %10llu slice %10llu pix %5ux%5ux%4u "
+	       "blk %5ux%5ux%4u pitch %6u mode %-7s tile index %u\n",
+	       what, i, (unsigned long long)level->offset,
+	       (unsigned long long)level->slice_size,
+	       level->npix_x, level->npix_y, level->npix_z,
+	       level->nblk_x, level->nblk_y, level->nblk_z,
+	       level->pitch_bytes,
+	       level->mode < 4 ? modes[level->mode] : "?", tiling_index);
+}
+
+static void print_surface(const struct radeon_surface *surf)
+{
+	unsigned i;
+
+	printf("bo_size %llu bo_alignment %llu mode %s\n",
+	       (unsigned long long)surf->bo_size,
+	       (unsigned long long)surf->bo_alignment,
+	       modes[RADEON_SURF_GET(surf->flags, MODE)]);
+	printf("bankw %u bankh %u mtilea %u tile_split %u "
+	       "stencil_tile_split %u stencil_offset %llu\n",
+	       surf->bankw, surf->bankh, surf->mtilea, surf->tile_split,
+	       surf->stencil_tile_split,
+	       (unsigned long long)surf->stencil_offset);
+	for (i = 0; i <= surf->last_level; i++)
+		print_level("level", i, &surf->level[i], surf->tiling_index[i]);
+	if (!(surf->flags & RADEON_SURF_SBUFFER))
+		return;
+	for (i = 0; i <= surf->last_level; i++)
+		print_level("stencil", i, &surf->stencil_level[i],
+			    surf->stencil_tiling_index[i]);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int run_corpus(struct radeon_surface_manager *surf_man,
+		      enum corpus_gen gen, unsigned count)
+{
+	struct radeon_surface surf;
+	uint64_t digest = CORPUS_DIGEST_INIT;
+	unsigned i, failed = 0;
+	double start, elapsed = 0;
+	int r;
+
+	for (i = 0; i < count; i++) {
+		corpus_shape(i, gen, &surf);
+		start = now();
+		r = radeon_surface_best(surf_man, &surf);
+		if (!r)
+			r = radeon_surface_init(surf_man, &surf);
+		elapsed += now() - start;
+		failed += r != 0;
+		digest = corpus_digest(digest, r, &surf);
+	}
+	printf("%u shapes, %u rejected, digest 0x%016llx, %.3f us per shape\n",
+	       count, failed, (unsigned long long)digest,
+	       elapsed * 1000000.0 / count);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct radeon_surface_manager *surf_man;
+	struct radeon_surface_hw_desc desc;
+	struct radeon_surface surf;
+	enum corpus_gen gen;
+	const char *family = NULL;
+	uint32_t tiling_config = 0;
+	unsigned type = RADEON_SURF_TYPE_2D, mode = RADEON_SURF_MODE_2D;
+	unsigned drm_minor = 40, corpus = 0, init_only = 0, flags = 0, blk = 1;
+	int c, r;
+
+	memset(&surf, 0, sizeof(surf));
+	surf.npix_y = surf.npix_z = 1;
+	surf.array_size = 1;
+	surf.bpe = 4;
+	surf.nsamples = 1;
+	while ((c = getopt(argc, argv, "f:t:m:T:M:b:l:a:n:B:szSic:h")) != -1) {
+		switch (c) {
+		case 'f':
+			family = optarg;
+			break;
+		case 't':
+			tiling_config = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			drm_minor = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			r = lookup(optarg, types, 6);
+			if (r < 0)
+				usage(argv[0]);
+			type = r;
+			break;
+		case 'M':
+			r = lookup(optarg, modes, 4);
+			if (r < 0)
+				usage(argv[0]);
+			mode = r;
+			break;
+		case 'b':
+			surf.bpe = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			surf.last_level = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			surf.array_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			surf.nsamples = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			blk = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			flags |= RADEON_SURF_SCANOUT;
+			break;
+		case 'z':
+			flags |= RADEON_SURF_ZBUFFER;
+			break;
+		case 'S':
+			flags |= RADEON_SURF_SBUFFER |
+				 RADEON_SURF_HAS_SBUFFER_MIPTREE;
+			break;
+		case 'i':
+			init_only = 1;
+			break;
+		case 'c':
+			corpus = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (family == NULL || (!corpus && optind != argc - 1))
+		usage(argv[0]);
+
+	if (corpus_family_desc(family, tiling_config, &desc, &gen)) {
+		fprintf(stderr, "unknown family %s\n", family);
+		return 1;
+	}
+	desc.drm_minor = drm_minor;
+	surf_man = radeon_surface_manager_new_from_desc(&desc);
+	if (surf_man == NULL) {
+		fprintf(stderr, "failed to create a %s surface manager\n",
+			family);
+		return 1;
+	}
+	if (corpus) {
+		r = run_corpus(surf_man, gen, corpus);
+		radeon_surface_manager_free(surf_man);
+		return r;
+	}
+
+	if (sscanf(argv[optind], "%ux%ux%u", &surf.npix_x, &surf.npix_y,
+		   &surf.npix_z) < 1)
+		usage(argv[0]);
+	surf.blk_w = surf.blk_h = blk;
+	surf.blk_d = 1;
+	surf.flags = RADEON_SURF_SET(type, TYPE) | RADEON_SURF_SET(mode, MODE) |
+		     flags;
+	if (gen >= CORPUS_SI)
+		surf.flags |= RADEON_SURF_HAS_TILE_MODE_INDEX;
+
+	r = init_only ? 0 : radeon_surface_best(surf_man, &surf);
+	if (!r)
+		r = radeon_surface_init(surf_man, &surf);
+	if (r) {
+		fprintf(stderr, "layout failed: %s\n", strerror(-r));
+	} else {
+		print_surface(&surf);
+	}
+	radeon_surface_manager_free(surf_man);
+	return r ? 1 : 0;
+}
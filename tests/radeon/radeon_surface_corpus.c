@@ -0,0 +1,262 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "radeon_surface_corpus.h"
+
+static const struct {
+	const char *name;
+	enum corpus_gen gen;
+} families[] = {
+	{ "R600", CORPUS_R6 }, { "RV610", CORPUS_R6 }, { "RV630", CORPUS_R6 },
+	{ "RV670", CORPUS_R6 }, { "RV620", CORPUS_R6 }, { "RV635", CORPUS_R6 },
+	{ "RS780", CORPUS_R6 }, { "RS880", CORPUS_R6 }, { "RV770", CORPUS_R6 },
+	{ "RV730", CORPUS_R6 }, { "RV710", CORPUS_R6 }, { "RV740", CORPUS_R6 },
+	{ "CEDAR", CORPUS_EG }, { "REDWOOD", CORPUS_EG },
+	{ "JUNIPER", CORPUS_EG }, { "CYPRESS", CORPUS_EG },
+	{ "HEMLOCK", CORPUS_EG }, { "PALM", CORPUS_EG }, { "SUMO", CORPUS_EG },
+	{ "SUMO2", CORPUS_EG }, { "BARTS", CORPUS_EG }, { "TURKS", CORPUS_EG },
+	{ "CAICOS", CORPUS_EG }, { "CAYMAN", CORPUS_EG }, { "ARUBA", CORPUS_EG },
+	{ "TAHITI", CORPUS_SI }, { "PITCAIRN", CORPUS_SI },
+	{ "VERDE", CORPUS_SI }, { "OLAND", CORPUS_SI }, { "HAINAN", CORPUS_SI },
+	{ "BONAIRE", CORPUS_CIK }, { "KAVERI", CORPUS_CIK },
+	{ "KABINI", CORPUS_CIK }, { "HAWAII", CORPUS_CIK },
+	{ "MULLINS", CORPUS_CIK },
+};
+
+static const struct {
+	uint32_t device_id;
+	const char *family;
+} chipsets[] = {
+#define CHIPSET(pci_id, name, fam) { pci_id, #fam },
+#include "r600_pci_ids.h"
+#undef CHIPSET
+};
+
+int corpus_family_desc(const char *family, uint32_t tiling_config,
+		       struct radeon_surface_hw_desc *desc,
+		       enum corpus_gen *gen)
+{
+	unsigned i, pipe_config;
+
+	memset(desc, 0, sizeof(*desc));
+	for (i = 0; i < sizeof(chipsets) / sizeof(chipsets[0]); i++) {
+		if (!strcmp(chipsets[i].family, family))
+			break;
+	}
+	if (i == sizeof(chipsets) / sizeof(chipsets[0]))
+		return -1;
+	desc->device_id = chipsets[i].device_id;
+
+	for (i = 0; i < sizeof(families) / sizeof(families[0]); i++) {
+		if (!strcmp(families[i].name, family))
+			break;
+	}
+	if (i == sizeof(families) / sizeof(families[0]))
+		return -1;
+	*gen = families[i].gen;
+
+	/* new enough for 2D tiling everywhere */
+	desc->drm_minor = 40;
+	switch (*gen) {
+	case CORPUS_R6:
+		/* 4 pipes, 8 banks, 256B groups */
+		desc->tiling_config = 0x14;
+		break;
+	case CORPUS_EG:
+		/* 4 pipes, 8 banks, 256B groups, 2KB rows */
+		desc->tiling_config = 0x1012;
+		break;
+	case CORPUS_SI:
+	case CORPUS_CIK:
+		/* 8 pipes, 16 banks, 256B groups, 2KB rows */
+		desc->tiling_config = 0x1023;
+		desc->has_tile_mode_array = 1;
+		break;
+	}
+	if (tiling_config)
+		desc->tiling_config = tiling_config;
+
+	/* pipe config P2, P4_16x16 or P8_32x32_8x16 to match the pipes,
+	 * then tile splits from 64B up, bank height 2, macro tile aspect 2
+	 * and 16 banks */
+	switch (desc->tiling_config & 0xf) {
+	case 0:
+	case 1:
+		pipe_config = 0;
+		break;
+	case 2:
+		pipe_config = 5;
+		break;
+	default:
+		pipe_config = 10;
+		break;
+	}
+	for (i = 0; i < 32; i++)
+		desc->tile_mode_array[i] = (pipe_config << 6) |
+					   ((i % 7) << 11) | (1 << 16) |
+					   (1 << 18) | (3 << 20);
+	for (i = 0; i < 16; i++)
+		desc->macrotile_mode_array[i] = (1 << 2) | (1 << 4) | (3 << 6);
+	return 0;
+}
+
+/* xorshift, so the corpus does not depend on the libc rand() */
+static uint32_t next(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static unsigned log2_floor(unsigned x)
+{
+	unsigned r = 0;
+
+	while (x >>= 1)
+		r++;
+	return r;
+}
+
+void corpus_shape(unsigned index, enum corpus_gen gen,
+		  struct radeon_surface *surf)
+{
+	static const unsigned modes[] = {
+		RADEON_SURF_MODE_LINEAR_ALIGNED,
+		RADEON_SURF_MODE_1D,
+		RADEON_SURF_MODE_2D,
+		RADEON_SURF_MODE_2D,
+	};
+	uint32_t state = 0x9e3779b9u ^ (index * 2654435761u);
+	unsigned type, max;
+
+	next(&state);
+	type = next(&state) % 6;
+	memset(surf, 0, sizeof(*surf));
+	surf->npix_x = 1 + next(&state) % 4096;
+	surf->npix_y = 1;
+	surf->npix_z = 1;
+	surf->array_size = 1;
+	surf->blk_w = surf->blk_h = surf->blk_d = 1;
+	surf->nsamples = 1;
+	surf->bpe = 1 << (next(&state) % 5);
+	switch (type) {
+	case RADEON_SURF_TYPE_1D_ARRAY:
+		surf->array_size = 1 + next(&state) % 16;
+		break;
+	case RADEON_SURF_TYPE_2D_ARRAY:
+		surf->array_size = 1 + next(&state) % 16;
+		/* fall through */
+	case RADEON_SURF_TYPE_2D:
+		surf->npix_y = 1 + next(&state) % 4096;
+		break;
+	case RADEON_SURF_TYPE_3D:
+		surf->npix_y = 1 + next(&state) % 512;
+		surf->npix_z = 1 + next(&state) % 128;
+		break;
+	case RADEON_SURF_TYPE_CUBEMAP:
+		surf->npix_y = surf->npix_x;
+		surf->array_size = 6;
+		break;
+	}
+	if (surf->bpe >= 8 && !(next(&state) % 4)) {
+		/* block compressed */
+		surf->blk_w = surf->blk_h = 4;
+	}
+	max = surf->npix_x > surf->npix_y ? surf->npix_x : surf->npix_y;
+	if (next(&state) % 2)
+		surf->last_level = log2_floor(max);
+
+	surf->flags = RADEON_SURF_SET(type, TYPE) |
+		      RADEON_SURF_SET(modes[next(&state) % 4], MODE);
+	if (type == RADEON_SURF_TYPE_2D && !(next(&state) % 8))
+		surf->flags |= RADEON_SURF_SCANOUT;
+	if (type == RADEON_SURF_TYPE_2D && surf->blk_w == 1 &&
+	    !(next(&state) % 8)) {
+		surf->bpe = 4;
+		surf->flags |= RADEON_SURF_ZBUFFER;
+		if (next(&state) % 2)
+			surf->flags |= RADEON_SURF_SBUFFER |
+				       RADEON_SURF_HAS_SBUFFER_MIPTREE;
+		/* multisampled depth, which 1D can not do on si/cik */
+		if (gen >= CORPUS_SI &&
+		    RADEON_SURF_GET(surf->flags, MODE) == RADEON_SURF_MODE_2D &&
+		    !(next(&state) % 4))
+			surf->nsamples = 1 << (1 + next(&state) % 3);
+	}
+	if (gen >= CORPUS_SI)
+		surf->flags |= RADEON_SURF_HAS_TILE_MODE_INDEX;
+}
+
+static uint64_t fold(uint64_t digest, uint64_t value)
+{
+	unsigned i;
+
+	for (i = 0; i < 8; i++) {
+		digest ^= (value >> (i * 8)) & 0xff;
+		digest *= 0x100000001b3ull;
+	}
+	return digest;
+}
+
+static uint64_t fold_level(uint64_t digest,
+			   const struct radeon_surface_level *level)
+{
+	digest = fold(digest, level->offset);
+	digest = fold(digest, level->slice_size);
+	digest = fold(digest, level->npix_x | (uint64_t)level->npix_y << 32);
+	digest = fold(digest, level->npix_z | (uint64_t)level->nblk_x << 32);
+	digest = fold(digest, level->nblk_y | (uint64_t)level->nblk_z << 32);
+	return fold(digest, level->pitch_bytes | (uint64_t)level->mode << 32);
+}
+
+uint64_t corpus_digest(uint64_t digest, int r,
+		       const struct radeon_surface *surf)
+{
+	unsigned i;
+
+	digest = fold(digest, (uint32_t)r);
+	if (r)
+		return digest;
+	digest = fold(digest, surf->flags | (uint64_t)surf->nsamples << 32);
+	digest = fold(digest, surf->bo_size);
+	digest = fold(digest, surf->bo_alignment);
+	digest = fold(digest, surf->bankw | (uint64_t)surf->bankh << 32);
+	digest = fold(digest, surf->mtilea | (uint64_t)surf->tile_split << 32);
+	digest = fold(digest, surf->stencil_tile_split);
+	digest = fold(digest, surf->stencil_offset);
+	for (i = 0; i <= surf->last_level; i++) {
+		digest = fold_level(digest, &surf->level[i]);
+		digest = fold(digest, surf->tiling_index[i]);
+		if (surf->flags & RADEON_SURF_SBUFFER) {
+			digest = fold_level(digest, &surf->stencil_level[i]);
+			digest = fold(digest, surf->stencil_tiling_index[i]);
+		}
+	}
+	return digest;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RADEON_SURFACE_CORPUS_H
+#define RADEON_SURFACE_CORPUS_H
+
+#include <stdint.h>
+#include "radeon_surface.h"
+
+enum corpus_gen {
+	CORPUS_R6,
+	CORPUS_EG,
+	CORPUS_SI,
+	CORPUS_CIK,
+};
+
+/* Describe a device of the given family (name as in r600_pci_ids.h) the
+ * way the kernel would, with a typical tiling setup of its generation
+ * unless tiling_config is non zero.  Returns -1 for unknown families. */
+int corpus_family_desc(const char *family, uint32_t tiling_config,
+		       struct radeon_surface_hw_desc *desc,
+		       enum corpus_gen *gen);
+
+/* Shape number index of the corpus, the same on every host */
+void corpus_shape(unsigned index, enum corpus_gen gen,
+		  struct radeon_surface *surf);
+
+/* Fold the outcome of a layout into a running digest */
+uint64_t corpus_digest(uint64_t digest, int r,
+		       const struct radeon_surface *surf);
+
+#define CORPUS_DIGEST_INIT	0xcbf29ce484222325ull
+
+#endif
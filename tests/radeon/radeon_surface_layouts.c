@@ -0,0 +1,105 @@
+/*
+ * Copyright © 2014 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "radeon_surface.h"
+#include "radeon_surface_corpus.h"
+
+#define NUM_SHAPES	4000
+
+/*
+ * Digests of the corpus layouts per family, regenerate with
+ * "radeon_surface_calc -f <family> -t <tiling_config> -c 4000" when a
+ * layout change is intended.  A zero tiling config picks the typical one
+ * of the generation.
+ */
+static const struct {
+	const char *family;
+	uint32_t tiling_config;
+	uint64_t digest;
+} corpus[] = {
+	{ "R600", 0, 0x619973a3b9d24e43ull },
+	{ "RV770", 0x56, 0xf5a696ce27e97037ull },
+	{ "CYPRESS", 0, 0x42b2d416faf67255ull },
+	{ "CAICOS", 0x1, 0x7458bf8ffedb85f0ull },
+	{ "CAYMAN", 0x2123, 0xff7a269d4837335dull },
+	{ "TAHITI", 0, 0x7aaa9cfbbc84114eull },
+	{ "OLAND", 0x1022, 0xe0ef38183051e43bull },
+	{ "BONAIRE", 0, 0xe3bfb40474e3c7dfull },
+	{ "KABINI", 0x1011, 0x01baa92a23b08193ull },
+};
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/**
+ * Lay out the corpus shapes on surface managers built without a device
+ * for every generation, and compare the results against the known
+ * digests.  Also times the layout engines.
+ */
+int main(int argc, char **argv)
+{
+	struct radeon_surface_manager *surf_man;
+	struct radeon_surface_hw_desc desc;
+	struct radeon_surface surf;
+	enum corpus_gen gen;
+	uint64_t digest;
+	unsigned i, j, failed = 0;
+	double start;
+	int r;
+
+	for (i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++) {
+		r = corpus_family_desc(corpus[i].family, corpus[i].tiling_config,
+				       &desc, &gen);
+		assert(r == 0);
+		surf_man = radeon_surface_manager_new_from_desc(&desc);
+		assert(surf_man);
+
+		digest = CORPUS_DIGEST_INIT;
+		start = now();
+		for (j = 0; j < NUM_SHAPES; j++) {
+			corpus_shape(j, gen, &surf);
+			r = radeon_surface_best(surf_man, &surf);
+			if (!r)
+				r = radeon_surface_init(surf_man, &surf);
+			digest = corpus_digest(digest, r, &surf);
+		}
+		printf("%-8s %u shapes: %.3f ms, digest 0x%016llx%s\n",
+		       corpus[i].family, NUM_SHAPES, (now() - start) * 1000.0,
+		       (unsigned long long)digest,
+		       digest == corpus[i].digest ? "" : " MISMATCH");
+		failed += digest != corpus[i].digest;
+		radeon_surface_manager_free(surf_man);
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "xf86drm.h"
+
+#define NUM_THREADS	8
+#define NUM_ROUNDS	200
+#define NUM_TAGS	64
+
+/*
+ * Any character device works for the registry, which only needs fstat():
+ * all fds on /dev/null share one entry, like several fds on one DRM node.
+ */
+static void *stress_thread(void *arg)
+{
+	uintptr_t id = (uintptr_t)arg;
+	drm_context_t base = id * NUM_TAGS;
+	int round, i, fd;
+
+	for (round = 0; round < NUM_ROUNDS; round++) {
+		fd = open("/dev/null", O_RDWR);
+		assert(fd >= 0);
+
+		for (i = 0; i < NUM_TAGS; i++)
+			drmAddContextTag(fd, base + i, (void *)(id + i + 1));
+
+		/* Hot path: repeated lookups on a registered fd. */
+		for (i = 0; i < NUM_TAGS * 16; i++)
+			assert(drmGetContextTag(fd, base + i % NUM_TAGS) ==
+			       (void *)(id + i % NUM_TAGS + 1));
+
+		for (i = 0; i < NUM_TAGS; i += 2)
+			assert(drmDelContextTag(fd, base + i) == 0);
+		for (i = 0; i < NUM_TAGS; i++)
+			assert(drmGetContextTag(fd, base + i) ==
+			       (i % 2 ? (void *)(id + i + 1) : NULL));
+		for (i = 1; i < NUM_TAGS; i += 2)
+			assert(drmDelContextTag(fd, base + i) == 0);
+
+		assert(drmGetEntry(fd) != NULL);
+		assert(drmClose(fd) == 0);
+	}
+
+	return NULL;
+}
+
+/**
+ * Hammers the fd registry behind drmGetEntry() and the context tag
+ * functions from several threads that open and close fds concurrently,
+ * then checks that entries go away with the last fd of a device.
+ */
+int main(int argc, char **argv)
+{
+	pthread_t threads[NUM_THREADS];
+	uintptr_t i;
+	int fd;
+
+	for (i = 0; i < NUM_THREADS; i++)
+		assert(pthread_create(&threads[i], NULL, stress_thread,
+				      (void *)i) == 0);
+	for (i = 0; i < NUM_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Closing the last fd of a device drops its tags. */
+	fd = open("/dev/null", O_RDWR);
+	assert(fd >= 0);
+	assert(drmGetContextTag(fd, 1) == NULL);
+	drmAddContextTag(fd, 1, (void *)&fd);
+	assert(drmGetContextTag(fd, 1) == &fd);
+	drmClose(fd);
+
+	fd = open("/dev/null", O_RDWR);
+	assert(drmGetContextTag(fd, 1) == NULL);
+	drmClose(fd);
+
+	/*
+	 * An fd closed with plain close() and reused for another device
+	 * doesn't see the old device's tags, and the stale reference is
+	 * dropped so the old device's entry goes away.
+	 */
+	fd = open("/dev/null", O_RDWR);
+	assert(fd >= 0);
+	drmAddContextTag(fd, 1, (void *)&fd);
+	close(fd);
+	assert(open("/dev/zero", O_RDONLY) == fd);
+	assert(drmGetContextTag(fd, 1) == NULL);
+	drmClose(fd);
+
+	fd = open("/dev/null", O_RDWR);
+	assert(drmGetContextTag(fd, 1) == NULL);
+	drmClose(fd);
+
+	return 0;
+}
@@ -51,6 +51,8 @@
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <pthread.h>
 
 /* Not all systems have MAP_FAILED defined */
 #ifndef MAP_FAILED
@@ -141,6 +143,39 @@ drmSetDebugMsgFunction(debug_msg_func_t debug_msg_ptr)
 
 static void *drmHashTable = NULL; /* Context switch callbacks */
 
+/*
+ * Device registry.
+ *
+ * drmHashTable maps a device (st_rdev) to its drmHashEntry, which all fds
+ * opened on that device share.  Each fd additionally caches its entry in
+ * drmFdSlots, indexed by fd, so that lookups after the first one don't
+ * touch the hash table and can proceed in parallel under the read lock.
+ * Every fd slot holds a reference on its entry; drmClose() drops it and
+ * the entry is destroyed with the last one.  A slot also remembers the
+ * device it was filled for: an fd closed with plain close() and reused
+ * for another device no longer matches, and its stale reference is
+ * dropped when the fd is registered again.
+ *
+ * The hash tables themselves are not thread-safe: drmHashTable is only
+ * accessed with the write lock held, and each entry's tag table is
+ * protected by the entry's own mutex.
+ */
+typedef struct drmRegistryEntry {
+    drmHashEntry    base;		/* must be first */
+    unsigned long   key;
+    int             refcount;
+    pthread_mutex_t tagLock;
+} drmRegistryEntry;
+
+typedef struct drmFdSlot {
+    drmRegistryEntry *entry;
+    unsigned long    key;		/* st_rdev the slot was filled for */
+} drmFdSlot;
+
+static pthread_rwlock_t drmRegistryLock = PTHREAD_RWLOCK_INITIALIZER;
+static drmFdSlot *drmFdSlots;
+static int drmFdSlotCount;
+
 void *drmGetHashTable(void)
 {
     return drmHashTable;
@@ -183,34 +218,124 @@ static unsigned long drmGetKeyFromFd(int fd)
     return st.st_rdev;
 }
 
-drmHashEntry *drmGetEntry(int fd)
+static drmRegistryEntry *drmLookupFdSlot(int fd, unsigned long key)
 {
-    unsigned long key = drmGetKeyFromFd(fd);
-    void          *value = NULL;
-    drmHashEntry  *entry;
+    if (fd < 0 || fd >= drmFdSlotCount || drmFdSlots[fd].key != key)
+	return NULL;
+    return drmFdSlots[fd].entry;
+}
+
+/* Must be called with the write lock held. */
+static void drmReleaseFdSlot(int fd)
+{
+    drmRegistryEntry *entry;
+
+    if (fd < 0 || fd >= drmFdSlotCount || !drmFdSlots[fd].entry)
+	return;
+
+    entry = drmFdSlots[fd].entry;
+    drmFdSlots[fd].entry = NULL;
+    if (--entry->refcount == 0) {
+	drmHashDelete(drmHashTable, entry->key);
+	drmHashDestroy(entry->base.tagTable);
+	pthread_mutex_destroy(&entry->tagLock);
+	drmFree(entry);
+    }
+}
+
+static drmRegistryEntry *drmRegisterFd(int fd, unsigned long key)
+{
+    void             *value;
+    drmRegistryEntry *entry;
+
+    pthread_rwlock_wrlock(&drmRegistryLock);
+
+    /* Someone else may have registered the fd meanwhile. */
+    entry = drmLookupFdSlot(fd, key);
+    if (entry)
+	goto out;
+
+    /* The fd was closed without drmClose() and now refers to another
+     * device. */
+    drmReleaseFdSlot(fd);
+
+    if (fd >= drmFdSlotCount) {
+	int       count = drmFdSlotCount ? drmFdSlotCount : 16;
+	drmFdSlot *slots;
+
+	while (count <= fd)
+	    count *= 2;
+	slots = realloc(drmFdSlots, count * sizeof(*slots));
+	if (!slots)
+	    goto out;
+	memset(slots + drmFdSlotCount, 0,
+	       (count - drmFdSlotCount) * sizeof(*slots));
+	drmFdSlots     = slots;
+	drmFdSlotCount = count;
+    }
 
     if (!drmHashTable)
 	drmHashTable = drmHashCreate();
+    if (!drmHashTable)
+	goto out;
 
-    if (drmHashTable && drmHashLookup(drmHashTable, key, &value)) {
-	entry           = drmMalloc(sizeof(*entry));
+    if (drmHashLookup(drmHashTable, key, &value)) {
+	entry = drmMalloc(sizeof(*entry));
 	if (!entry)
-	    return NULL;
-	entry->fd       = fd;
-	entry->f        = NULL;
-	entry->tagTable = drmHashCreate();
-	if (entry->tagTable) {
-		drmHashInsert(drmHashTable, key, entry);
-	} else {
-		drmFree(entry);
-		entry = NULL;
+	    goto out;
+	entry->base.fd       = fd;
+	entry->base.f        = NULL;
+	entry->base.tagTable = drmHashCreate();
+	entry->key           = key;
+	pthread_mutex_init(&entry->tagLock, NULL);
+	if (!entry->base.tagTable ||
+	    drmHashInsert(drmHashTable, key, entry)) {
+	    if (entry->base.tagTable)
+		drmHashDestroy(entry->base.tagTable);
+	    pthread_mutex_destroy(&entry->tagLock);
+	    drmFree(entry);
+	    entry = NULL;
+	    goto out;
 	}
     } else {
 	entry = value;
     }
+
+    entry->refcount++;
+    drmFdSlots[fd].entry = entry;
+    drmFdSlots[fd].key   = key;
+
+out:
+    pthread_rwlock_unlock(&drmRegistryLock);
     return entry;
 }
 
+static drmRegistryEntry *drmGetRegistryEntry(int fd)
+{
+    unsigned long    key = drmGetKeyFromFd(fd);
+    drmRegistryEntry *entry;
+
+    pthread_rwlock_rdlock(&drmRegistryLock);
+    entry = drmLookupFdSlot(fd, key);
+    pthread_rwlock_unlock(&drmRegistryLock);
+
+    return entry ? entry : drmRegisterFd(fd, key);
+}
+
+static void drmUnregisterFd(int fd)
+{
+    pthread_rwlock_wrlock(&drmRegistryLock);
+    drmReleaseFdSlot(fd);
+    pthread_rwlock_unlock(&drmRegistryLock);
+}
+
+drmHashEntry *drmGetEntry(int fd)
+{
+    drmRegistryEntry *entry = drmGetRegistryEntry(fd);
+
+    return entry ? &entry->base : NULL;
+}
+
 /**
  * Compare two busid strings
  *
@@ -436,6 +561,237 @@ static int drmOpenMinor(int minor, int create, int type)
 }
 
 
+/*
+ * Device enumeration cache.
+ *
+ * drmOpenByName() and drmOpenByBusid() used to open every minor and query
+ * it with ioctls, in every process and on every call.  Instead, the device
+ * nodes are enumerated once, from sysfs where available, and the driver
+ * name, bus ID and PCI IDs of each are cached.  Lookups open the matching
+ * nodes first and only fall back to a full scan when none of them fits,
+ * e.g. after a hotplug, which refreshes the cache.  Nodes sysfs has nothing
+ * about are probed with ioctls, in parallel when there are several.
+ */
+#define DRM_SYSFS_ROOT "/sys"
+
+static pthread_mutex_t drmDeviceLock = PTHREAD_MUTEX_INITIALIZER;
+static drmDeviceInfo drmDevices[DRM_MAX_MINOR];
+static int drmDeviceCount = -1;	/* -1: not scanned yet */
+static char *drmSysfsRoot;
+
+/* Parse the uevent file of a DRM device's parent, e.g. a PCI function. */
+static int drmParseUevent(const char *sysfs, int minor, drmDeviceInfoPtr info)
+{
+    char         path[PATH_MAX], line[256];
+    unsigned int domain, bus, dev, func, vendor, device;
+    FILE         *f;
+    int          found = 0;
+
+    snprintf(path, sizeof(path), "%s/class/drm/card%d/device/uevent",
+	     sysfs, minor);
+    f = fopen(path, "r");
+    if (!f)
+	return 0;
+
+    while (fgets(line, sizeof(line), f)) {
+	line[strcspn(line, "\n")] = '\0';
+	if (!strncmp(line, "DRIVER=", 7)) {
+	    size_t len = strlen(line + 7);
+
+	    if (len >= sizeof(info->name))
+		len = sizeof(info->name) - 1;
+	    memcpy(info->name, line + 7, len);
+	    info->name[len] = '\0';
+	    found = 1;
+	} else if (sscanf(line, "PCI_SLOT_NAME=%x:%x:%x.%u",
+			  &domain, &bus, &dev, &func) == 4) {
+	    snprintf(info->busid, sizeof(info->busid),
+		     "pci:%04x:%02x:%02x.%u", domain, bus, dev, func);
+	} else if (sscanf(line, "PCI_ID=%x:%x", &vendor, &device) == 2) {
+	    info->vendor_id = vendor;
+	    info->device_id = device;
+	} else if (sscanf(line, "PCI_SUBSYS_ID=%x:%x", &vendor, &device) == 2) {
+	    info->subvendor_id = vendor;
+	    info->subdevice_id = device;
+	}
+    }
+    fclose(f);
+
+    return found;
+}
+
+/* Fill in name and bus ID of a node the hard way. */
+static void *drmProbeDevice(void *arg)
+{
+    drmDeviceInfoPtr info = arg;
+    drmVersionPtr    version;
+    char             *id;
+    int              fd;
+
+    fd = drmOpenMinor(info->minor, 0, DRM_NODE_RENDER);
+    if (fd < 0)
+	return NULL;
+
+    if ((version = drmGetVersion(fd))) {
+	strncpy(info->name, version->name, sizeof(info->name) - 1);
+	drmFreeVersion(version);
+    }
+    if ((id = drmGetBusid(fd))) {
+	strncpy(info->busid, id, sizeof(info->busid) - 1);
+	drmFreeBusid(id);
+    }
+    close(fd);
+
+    return NULL;
+}
+
+/* Must be called with drmDeviceLock held. */
+static void drmScanDevicesLocked(int probe)
+{
+    const char      *sysfs = drmSysfsRoot ? drmSysfsRoot : DRM_SYSFS_ROOT;
+    drmDeviceInfo   found[DRM_MAX_MINOR];
+    drmDeviceInfoPtr unknown[DRM_MAX_MINOR];
+    pthread_t       threads[DRM_MAX_MINOR];
+    char            path[PATH_MAX];
+    int             started[DRM_MAX_MINOR];
+    int             i, count = 0, nunknown = 0;
+    stat_t          st;
+
+    for (i = 0; i < DRM_MAX_MINOR; i++) {
+	drmDeviceInfoPtr info = &found[count];
+
+	memset(info, 0, sizeof(*info));
+	info->minor = i;
+	if (drmParseUevent(sysfs, i, info)) {
+	    count++;
+	    continue;
+	}
+
+	/* No sysfs information; fall back to the device node. */
+	snprintf(path, sizeof(path), DRM_DEV_NAME, DRM_DIR_NAME, i);
+	if (stat(path, &st) == 0) {
+	    count++;
+	    unknown[nunknown++] = info;
+	}
+    }
+
+    if (probe && nunknown == 1) {
+	drmProbeDevice(unknown[0]);
+    } else if (probe) {
+	for (i = 0; i < nunknown; i++)
+	    started[i] = !pthread_create(&threads[i], NULL, drmProbeDevice,
+					 unknown[i]);
+	for (i = 0; i < nunknown; i++) {
+	    if (started[i])
+		pthread_join(threads[i], NULL);
+	    else
+		drmProbeDevice(unknown[i]);
+	}
+    }
+
+    memcpy(drmDevices, found, count * sizeof(found[0]));
+    drmDeviceCount = count;
+}
+
+/**
+ * Enumerate the DRM devices of the system.
+ *
+ * \param devices set to an array of device descriptions, to be freed with
+ * drmFree().
+ *
+ * \return the number of devices found, or a negative value on error.
+ *
+ * \internal
+ * Returns a copy of the device cache, scanning the system the first time.
+ */
+int drmGetDevices(drmDeviceInfoPtr *devices)
+{
+    int count;
+
+    pthread_mutex_lock(&drmDeviceLock);
+    if (drmDeviceCount < 0)
+	drmScanDevicesLocked(1);
+    count = drmDeviceCount;
+    *devices = NULL;
+    if (count) {
+	*devices = drmMalloc(count * sizeof(drmDeviceInfo));
+	if (*devices)
+	    memcpy(*devices, drmDevices, count * sizeof(drmDeviceInfo));
+	else
+	    count = -ENOMEM;
+    }
+    pthread_mutex_unlock(&drmDeviceLock);
+
+    return count;
+}
+
+/**
+ * Discard the device cache and enumerate the devices again.
+ *
+ * \param sysfs_root directory sysfs is mounted on, NULL for the default.
+ * \param probe whether to open nodes sysfs has no information about.
+ *
+ * \return the number of devices found, or a negative value on error.
+ */
+int drmRescanDevices(const char *sysfs_root, int probe)
+{
+    int count;
+
+    pthread_mutex_lock(&drmDeviceLock);
+    free(drmSysfsRoot);
+    drmSysfsRoot = sysfs_root ? strdup(sysfs_root) : NULL;
+    drmScanDevicesLocked(probe);
+    count = drmDeviceCount;
+    pthread_mutex_unlock(&drmDeviceLock);
+
+    return count;
+}
+
+/*
+ * Collect the minors the cache associates with name or busid, in order.
+ * The cache is only a hint, callers verify the nodes they open.
+ */
+static int drmFindCachedMinors(const char *name, const char *busid,
+			       int *minors)
+{
+    int i, count = 0;
+
+    pthread_mutex_lock(&drmDeviceLock);
+    if (drmDeviceCount < 0)
+	drmScanDevicesLocked(0);
+    for (i = 0; i < drmDeviceCount; i++) {
+	if (name && strcmp(drmDevices[i].name, name))
+	    continue;
+	if (busid && (!drmDevices[i].busid[0] ||
+		      !drmMatchBusID(drmDevices[i].busid, busid, 1)))
+	    continue;
+	minors[count++] = drmDevices[i].minor;
+    }
+    pthread_mutex_unlock(&drmDeviceLock);
+
+    return count;
+}
+
+/* Record what a full scan learned about a node. */
+static void drmUpdateCachedDevice(int minor, const char *name,
+				  const char *busid)
+{
+    int i;
+
+    pthread_mutex_lock(&drmDeviceLock);
+    for (i = 0; i < drmDeviceCount; i++) {
+	if (drmDevices[i].minor != minor)
+	    continue;
+	if (name)
+	    strncpy(drmDevices[i].name, name, sizeof(drmDevices[i].name) - 1);
+	if (busid && *busid)
+	    strncpy(drmDevices[i].busid, busid,
+		    sizeof(drmDevices[i].busid) - 1);
+	break;
+    }
+    pthread_mutex_unlock(&drmDeviceLock);
+}
+
 /**
  * Determine whether the DRM kernel driver has been loaded.
  * 
@@ -452,6 +808,17 @@ int drmAvailable(void)
     int           retval = 0;
     int           fd;
 
+    /* A driver bound to minor 0 means it is loaded. */
+    pthread_mutex_lock(&drmDeviceLock);
+    if (drmDeviceCount < 0)
+	drmScanDevicesLocked(0);
+    if (drmDeviceCount > 0 && drmDevices[0].minor == 0 &&
+	drmDevices[0].name[0])
+	retval = 1;
+    pthread_mutex_unlock(&drmDeviceLock);
+    if (retval)
+	return 1;
+
     if ((fd = drmOpenMinor(0, 1, DRM_NODE_RENDER)) < 0) {
 #ifdef __linux__
 	/* Try proc for backward Linux compatibility */
@@ -471,6 +838,51 @@ int drmAvailable(void)
 }
 
 
+/* Open minor if its bus ID matches busid. */
+static int drmOpenMinorByBusid(int minor, const char *busid)
+{
+    int        pci_domain_ok = 1;
+    int        fd;
+    const char *buf;
+    drmSetVersion sv;
+
+    fd = drmOpenMinor(minor, 1, DRM_NODE_RENDER);
+    drmMsg("drmOpenByBusid: drmOpenMinor returns %d\n", fd);
+    if (fd < 0)
+	return -1;
+
+    /* We need to try for 1.4 first for proper PCI domain support
+     * and if that fails, we know the kernel is busted
+     */
+    sv.drm_di_major = 1;
+    sv.drm_di_minor = 4;
+    sv.drm_dd_major = -1;	/* Don't care */
+    sv.drm_dd_minor = -1;	/* Don't care */
+    if (drmSetInterfaceVersion(fd, &sv)) {
+#ifndef __alpha__
+	pci_domain_ok = 0;
+#endif
+	sv.drm_di_major = 1;
+	sv.drm_di_minor = 1;
+	sv.drm_dd_major = -1;       /* Don't care */
+	sv.drm_dd_minor = -1;       /* Don't care */
+	drmMsg("drmOpenByBusid: Interface 1.4 failed, trying 1.1\n");
+	drmSetInterfaceVersion(fd, &sv);
+    }
+    buf = drmGetBusid(fd);
+    drmMsg("drmOpenByBusid: drmGetBusid reports %s\n", buf);
+    if (buf && pci_domain_ok)
+	drmUpdateCachedDevice(minor, NULL, buf);
+    if (buf && drmMatchBusID(buf, busid, pci_domain_ok)) {
+	drmFreeBusid(buf);
+	return fd;
+    }
+    if (buf)
+	drmFreeBusid(buf);
+    close(fd);
+    return -1;
+}
+
 /**
  * Open the device by bus ID.
  *
@@ -480,55 +892,71 @@ int drmAvailable(void)
  *
  * \internal
  * This function attempts to open every possible minor (up to DRM_MAX_MINOR),
- * comparing the device bus ID with the one supplied.
+ * comparing the device bus ID with the one supplied.  Minors the device
+ * cache associates with the bus ID are tried first.
  *
  * \sa drmOpenMinor() and drmGetBusid().
  */
 static int drmOpenByBusid(const char *busid)
 {
-    int        i, pci_domain_ok = 1;
+    int        minors[DRM_MAX_MINOR];
+    int        tried[DRM_MAX_MINOR] = { 0 };
+    int        i, count;
     int        fd;
-    const char *buf;
-    drmSetVersion sv;
 
     drmMsg("drmOpenByBusid: Searching for BusID %s\n", busid);
+
+    /* Try the nodes the device cache points at first. */
+    count = drmFindCachedMinors(NULL, busid, minors);
+    for (i = 0; i < count; i++) {
+	fd = drmOpenMinorByBusid(minors[i], busid);
+	if (fd >= 0)
+	    return fd;
+	tried[minors[i]] = 1;
+    }
+
     for (i = 0; i < DRM_MAX_MINOR; i++) {
-	fd = drmOpenMinor(i, 1, DRM_NODE_RENDER);
-	drmMsg("drmOpenByBusid: drmOpenMinor returns %d\n", fd);
-	if (fd >= 0) {
-	    /* We need to try for 1.4 first for proper PCI domain support
-	     * and if that fails, we know the kernel is busted
-	     */
-	    sv.drm_di_major = 1;
-	    sv.drm_di_minor = 4;
-	    sv.drm_dd_major = -1;	/* Don't care */
-	    sv.drm_dd_minor = -1;	/* Don't care */
-	    if (drmSetInterfaceVersion(fd, &sv)) {
-#ifndef __alpha__
-		pci_domain_ok = 0;
-#endif
-		sv.drm_di_major = 1;
-		sv.drm_di_minor = 1;
-		sv.drm_dd_major = -1;       /* Don't care */
-		sv.drm_dd_minor = -1;       /* Don't care */
-		drmMsg("drmOpenByBusid: Interface 1.4 failed, trying 1.1\n");
-		drmSetInterfaceVersion(fd, &sv);
-	    }
-	    buf = drmGetBusid(fd);
-	    drmMsg("drmOpenByBusid: drmGetBusid reports %s\n", buf);
-	    if (buf && drmMatchBusID(buf, busid, pci_domain_ok)) {
-		drmFreeBusid(buf);
+	if (tried[i])
+	    continue;
+	fd = drmOpenMinorByBusid(i, busid);
+	if (fd >= 0)
+	    return fd;
+    }
+    return -1;
+}
+
+
+/* Open minor if it is driven by name and not in use yet. */
+static int drmOpenMinorByName(int minor, const char *name)
+{
+    int           fd;
+    drmVersionPtr version;
+    char *        id;
+
+    if ((fd = drmOpenMinor(minor, 1, DRM_NODE_RENDER)) < 0)
+	return -1;
+
+    if ((version = drmGetVersion(fd))) {
+	drmUpdateCachedDevice(minor, version->name, NULL);
+	if (!strcmp(version->name, name)) {
+	    drmFreeVersion(version);
+	    id = drmGetBusid(fd);
+	    drmMsg("drmGetBusid returned '%s'\n", id ? id : "NULL");
+	    if (!id || !*id) {
+		if (id)
+		    drmFreeBusid(id);
 		return fd;
+	    } else {
+		drmFreeBusid(id);
 	    }
-	    if (buf)
-		drmFreeBusid(buf);
-	    close(fd);
+	} else {
+	    drmFreeVersion(version);
 	}
     }
+    close(fd);
     return -1;
 }
 
-
 /**
  * Open the device by name.
  *
@@ -545,35 +973,28 @@ static int drmOpenByBusid(const char *busid)
  */
 static int drmOpenByName(const char *name)
 {
-    int           i;
+    int           minors[DRM_MAX_MINOR];
+    int           tried[DRM_MAX_MINOR] = { 0 };
+    int           i, count;
     int           fd;
-    drmVersionPtr version;
-    char *        id;
 
     /*
      * Open the first minor number that matches the driver name and isn't
      * already in use.  If it's in use it will have a busid assigned already.
+     * Nodes the device cache attributes to the driver are tried first.
      */
+    count = drmFindCachedMinors(name, NULL, minors);
+    for (i = 0; i < count; i++) {
+	if ((fd = drmOpenMinorByName(minors[i], name)) >= 0)
+	    return fd;
+	tried[minors[i]] = 1;
+    }
+
     for (i = 0; i < DRM_MAX_MINOR; i++) {
-	if ((fd = drmOpenMinor(i, 1, DRM_NODE_RENDER)) >= 0) {
-	    if ((version = drmGetVersion(fd))) {
-		if (!strcmp(version->name, name)) {
-		    drmFreeVersion(version);
-		    id = drmGetBusid(fd);
-		    drmMsg("drmGetBusid returned '%s'\n", id ? id : "NULL");
-		    if (!id || !*id) {
-			if (id)
-			    drmFreeBusid(id);
-			return fd;
-		    } else {
-			drmFreeBusid(id);
-		    }
-		} else {
-		    drmFreeVersion(version);
-		}
-	    }
-	    close(fd);
-	}
+	if (tried[i])
+	    continue;
+	if ((fd = drmOpenMinorByName(i, name)) >= 0)
+	    return fd;
     }
 
 #ifdef __linux__
@@ -1110,18 +1531,7 @@ int drmFreeBufs(int fd, int count, int *list)
  */
 int drmClose(int fd)
 {
-    unsigned long key    = drmGetKeyFromFd(fd);
-    drmHashEntry  *entry = drmGetEntry(fd);
-    if(!entry)
-	return -ENOMEM;
-
-    drmHashDestroy(entry->tagTable);
-    entry->fd       = 0;
-    entry->f        = NULL;
-    entry->tagTable = NULL;
-
-    drmHashDelete(drmHashTable, key);
-    drmFree(entry);
+    drmUnregisterFd(fd);
 
     return close(fd);
 }
@@ -2122,34 +2532,46 @@ int drmGetInterruptFromBusID(int fd, int busnum, int devnum, int funcnum)
 
 int drmAddContextTag(int fd, drm_context_t context, void *tag)
 {
-    drmHashEntry  *entry = drmGetEntry(fd);
+    drmRegistryEntry *entry = drmGetRegistryEntry(fd);
+
+    if (!entry)
+	return 0;
 
-    if (entry && drmHashInsert(entry->tagTable, context, tag)) {
-	drmHashDelete(entry->tagTable, context);
-	drmHashInsert(entry->tagTable, context, tag);
+    pthread_mutex_lock(&entry->tagLock);
+    if (drmHashInsert(entry->base.tagTable, context, tag)) {
+	drmHashDelete(entry->base.tagTable, context);
+	drmHashInsert(entry->base.tagTable, context, tag);
     }
+    pthread_mutex_unlock(&entry->tagLock);
     return 0;
 }
 
 int drmDelContextTag(int fd, drm_context_t context)
 {
-    drmHashEntry  *entry = drmGetEntry(fd);
+    drmRegistryEntry *entry = drmGetRegistryEntry(fd);
+    int              ret;
 
-    if (entry)
-	return drmHashDelete(entry->tagTable, context);
-    return -ENOMEM;
+    if (!entry)
+	return -ENOMEM;
+
+    pthread_mutex_lock(&entry->tagLock);
+    ret = drmHashDelete(entry->base.tagTable, context);
+    pthread_mutex_unlock(&entry->tagLock);
+    return ret;
 }
 
 void *drmGetContextTag(int fd, drm_context_t context)
 {
-    void          *value;
-    drmHashEntry  *entry = drmGetEntry(fd);
+    void             *value;
+    drmRegistryEntry *entry = drmGetRegistryEntry(fd);
 
     if (!entry)
         return NULL;
 
-    if (drmHashLookup(entry->tagTable, context, &value))
-	return NULL;
+    pthread_mutex_lock(&entry->tagLock);
+    if (drmHashLookup(entry->base.tagTable, context, &value))
+	value = NULL;
+    pthread_mutex_unlock(&entry->tagLock);
 
     return value;
 }
@@ -2494,6 +2916,7 @@ static struct {
 } connection[DRM_MAX_FDS];
 
 static int nr_fds = 0;
+static pthread_mutex_t connection_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int drmOpenOnce(void *unused, 
 		const char *BusID,
@@ -2502,16 +2925,19 @@ int drmOpenOnce(void *unused,
     int i;
     int fd;
    
+    pthread_mutex_lock(&connection_lock);
+
     for (i = 0; i < nr_fds; i++)
 	if (strcmp(BusID, connection[i].BusID) == 0) {
 	    connection[i].refcount++;
 	    *newlyopened = 0;
-	    return connection[i].fd;
+	    fd = connection[i].fd;
+	    goto out;
 	}
 
     fd = drmOpen(unused, BusID);
     if (fd <= 0 || nr_fds == DRM_MAX_FDS)
-	return fd;
+	goto out;
    
     connection[nr_fds].BusID = strdup(BusID);
     connection[nr_fds].fd = fd;
@@ -2525,6 +2951,8 @@ int drmOpenOnce(void *unused,
 
     nr_fds++;
 
+out:
+    pthread_mutex_unlock(&connection_lock);
     return fd;
 }
 
@@ -2532,6 +2960,8 @@ void drmCloseOnce(int fd)
 {
     int i;
 
+    pthread_mutex_lock(&connection_lock);
+
     for (i = 0; i < nr_fds; i++) {
 	if (fd == connection[i].fd) {
 	    if (--connection[i].refcount == 0) {
@@ -2541,10 +2971,12 @@ void drmCloseOnce(int fd)
 		if (i < --nr_fds) 
 		    connection[i] = connection[nr_fds];
 
-		return;
+		break;
 	    }
 	}
     }
+
+    pthread_mutex_unlock(&connection_lock);
 }
 
 int drmSetMaster(int fd)
@@ -2618,8 +3050,8 @@ int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle)
  */
 int drmCSCIoctl(int fd, struct CSCCoeff_Matrix *CSC_Matrix)
 {
-    int ret, devid, i, j;
-    struct csc_coeff *pCSCCoeff;
+    int ret, devid;
+    struct csc_coeff CSCCoeff;
     drm_i915_getparam_t gp;
 
     if ((CSC_Matrix == NULL) || (CSC_Matrix->CoeffMatrix == NULL) ||
@@ -2640,15 +3072,12 @@ int drmCSCIoctl(int fd, struct CSCCoeff_Matrix *CSC_Matrix)
 	return ret;
     }
 
-    pCSCCoeff = (struct csc_coeff *)malloc(sizeof(struct csc_coeff));
-    if (!pCSCCoeff)
-	return -ENOMEM;
-
-    Calc_CSC_Param(CSC_Matrix, pCSCCoeff, devid);
-    pCSCCoeff->crtc_id = CSC_Matrix->crtc_id;
+    ret = drmCSCConvert(devid, CSC_Matrix, &CSCCoeff, 1);
+    if (ret)
+        return ret;
 
     do {
-        ret = ioctl(fd, DRM_IOCTL_I915_SET_CSC, pCSCCoeff);
+        ret = ioctl(fd, DRM_IOCTL_I915_SET_CSC, &CSCCoeff);
     } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
 
     return ret;
@@ -112,8 +112,31 @@ typedef struct drmHashEntry {
 
 extern int drmIoctl(int fd, unsigned long request, void *arg);
 extern void *drmGetHashTable(void);
+
+/**
+ * Look up the per-device entry of an fd, creating it on first use.
+ *
+ * Each fd keeps a reference on its device's entry until it is closed with
+ * drmClose().  An fd closed with plain close() leaks that reference until
+ * the fd number is reused and looked up again.
+ */
 extern drmHashEntry *drmGetEntry(int fd);
 
+/**
+ * Device enumeration information.
+ *
+ * \sa drmGetDevices() and drmRescanDevices().
+ */
+typedef struct _drmDeviceInfo {
+    int      minor;			/**< Minor of the card node */
+    char     name[32];			/**< Driver name */
+    char     busid[64];			/**< Bus ID, empty if not a PCI device */
+    uint16_t vendor_id;			/**< PCI IDs, zero if not known */
+    uint16_t device_id;
+    uint16_t subvendor_id;
+    uint16_t subdevice_id;
+} drmDeviceInfo, *drmDeviceInfoPtr;
+
 /**
  * Driver version information.
  *
@@ -576,6 +599,10 @@ do {	register unsigned int __old __asm("o0");		\
 extern int           drmAvailable(void);
 extern int           drmOpen(const char *name, const char *busid);
 extern int drmOpenControl(int minor);
+extern int           drmGetDevices(drmDeviceInfoPtr *devices);
+extern int           drmRescanDevices(const char *sysfs_root, int probe);
+/* Close fds that were used with drmGetEntry() or the context tag functions
+ * with drmClose(), which also releases their registry entry. */
 extern int           drmClose(int fd);
 extern drmVersionPtr drmGetVersion(int fd);
 extern drmVersionPtr drmGetLibVersion(int fd);
@@ -734,6 +761,22 @@ extern int drmSetMaster(int fd);
 extern int drmDropMaster(int fd);
 extern int drmCSCIoctl(int fd, struct CSCCoeff_Matrix *CSC_Matrix);
 
+/* CSC coefficient conversion, see xf86drmCSC.c */
+struct csc_coeff;
+typedef struct _drmCSCCache *drmCSCCachePtr;
+
+extern int Calc_CSC_Param(struct CSCCoeff_Matrix *CSC_Matrix,
+			  struct csc_coeff *CSC_Coeff_t, int devid);
+extern int drmCSCConvert(int devid, const struct CSCCoeff_Matrix *CSC_Matrix,
+			 struct csc_coeff *CSC_Coeff_t, int count);
+extern drmCSCCachePtr drmCSCCacheCreate(unsigned int size);
+extern void drmCSCCacheDestroy(drmCSCCachePtr cache);
+extern int drmCSCCacheConvert(drmCSCCachePtr cache, int devid,
+			      const struct CSCCoeff_Matrix *CSC_Matrix,
+			      struct csc_coeff *CSC_Coeff_t, int count);
+extern void drmCSCCacheStats(drmCSCCachePtr cache, unsigned long *hits,
+			     unsigned long *misses);
+
 #define DRM_EVENT_CONTEXT_VERSION 2
 
 typedef struct _drmEventContext {
@@ -348,3 +348,328 @@ int Calc_CSC_Param(struct CSCCoeff_Matrix *CSC_Matrix,
 
     return 0;
 }
+
+/*
+ * Fixed-point conversion.
+ *
+ * The float loops above repeatedly double the value and peel off the
+ * integer bit.  Doubling and subtracting one are exact in binary floating
+ * point, so the bit string they produce is simply the binary expansion of
+ * the (clipped) input: scaling by a power of two and truncating to an
+ * integer yields the same bits in one step.  The helpers below do exactly
+ * that, including the original round-to-nearest on the first dropped bit
+ * and its wrap-around on overflow, and are bit-exact with Calc_CSC_Param().
+ */
+
+enum csc_format {
+    CSC_FORMAT_NONE,
+    CSC_FORMAT_VLV,	/* 1.10 two's complement */
+    CSC_FORMAT_HSW,	/* sign, 3-bit exponent, 9-bit mantissa */
+};
+
+static enum csc_format CSC_Format(int devid)
+{
+    if (IS_VALLEYVIEW(devid))
+        return CSC_FORMAT_VLV;
+    if (IS_HASWELL(devid) || IS_BROADWELL(devid))
+        return CSC_FORMAT_HSW;
+    return CSC_FORMAT_NONE;
+}
+
+/* Truncate |x| * 2^shift, |x| being clipped to max; NaN maps to 0. */
+static inline unsigned int CSC_Fixed(float x, float max, int shift)
+{
+    if (x < 0)
+        x = -x;
+    if (!(x > 0))
+        return 0;
+    if (x > max)
+        x = max;
+    return (unsigned int)(x * (float)(1 << shift));
+}
+
+/* Drop the extra guard bit and round on it, like the original loops. */
+static inline unsigned int CSC_Round(unsigned int m)
+{
+    return (m >> 1) + (m & 1);
+}
+
+static unsigned short CSC_Coeff_VLV(float coeff)
+{
+    unsigned short Binary = CSC_Fixed(coeff, VLV_CSC_COEFF_MAX_RANGE,
+                                      VLV2CSC_MAX_MANTISSA_PRECISION);
+
+    if (coeff < 0)
+        return CSC_TWOSCOMPLEMENT(Binary) & 0xFFF;
+    return Binary;
+}
+
+/*
+ * Leading-zero exponent of a coefficient in (0, 1): values below 0.125
+ * saturate at 3 and lose precision instead.
+ */
+static const float Hsw_Exponent_Limit[3] = { 0.5f, 0.25f, 0.125f };
+
+static unsigned short CSC_Coeff_HSW(float coeff)
+{
+    unsigned int m, Binary, Exponent, Int;
+    float c = coeff < 0 ? -coeff : coeff;
+
+    if (coeff == 0)
+        return 0;
+    /* The float loop never finds a set bit in a NaN. */
+    if (c != c)
+        return 3 << HSW_EXPONENT_OFFSET;
+    if (c > HSW_CSC_COEFF_MAX_RANGE)
+        c = HSW_CSC_COEFF_MAX_RANGE;
+
+    if (c >= 1) {
+        /* Mantissa MSB holds the integer part, the rest the fraction. */
+        Int = (unsigned int)c;
+        Exponent = HSW_EXPONENT_MAGIC_NO - Int;
+        m = CSC_Fixed(c - Int, 1.0f,
+                      HSW_CSC_MAX_MANTISSA_PRECISION + 1 - Int);
+        Binary = CSC_Round(m) | CSC_BIT_SHIFT(HSW_CSC_MAX_MANTISSA_PRECISION - 1);
+    } else {
+        for (Exponent = 0; Exponent < 3; Exponent++)
+            if (c >= Hsw_Exponent_Limit[Exponent])
+                break;
+        m = CSC_Fixed(c, 1.0f, HSW_CSC_MAX_MANTISSA_PRECISION + 1 + Exponent);
+        Binary = CSC_Round(m);
+    }
+
+    Binary = (Binary & HSW_MANTISSA_MASK) << HSW_MANTISSA_OFFSET;
+    Binary |= (Exponent & HSW_EXPONENT_MASK) << HSW_EXPONENT_OFFSET;
+    if (coeff < 0)
+        Binary |= CSC_BIT_SHIFT(HSW_CSC_SIGN_BIT);
+
+    return Binary;
+}
+
+static unsigned int CSC_Offset_HSW(float offset)
+{
+    unsigned int Binary;
+
+    Binary = CSC_Round(CSC_Fixed(offset, HSW_CSC_OFFSET_MAX_RANGE,
+                                 HSW_CSC_OFFSET_BITS + 1));
+    Binary &= HSW_CSC_OFFSET_MASK;
+    if (offset < 0)
+        Binary = CSC_TWOSCOMPLEMENT(Binary) & HSW_CSC_OFFSET_MASK;
+
+    return Binary;
+}
+
+static void CSC_Convert_One(const struct CSCCoeff_Matrix *CSC_Matrix,
+                            struct csc_coeff *CSC_Coeff_t,
+                            enum csc_format format)
+{
+    const float *m = CSC_Matrix->CoeffMatrix;
+    unsigned int *reg = CSC_Coeff_t->csc_coeff;
+    unsigned short c[CSC_MAX_COEFF_COUNT];
+    int i;
+
+    memset(CSC_Coeff_t, 0, sizeof(*CSC_Coeff_t));
+    CSC_Coeff_t->crtc_id = CSC_Matrix->crtc_id;
+
+    if (format == CSC_FORMAT_VLV) {
+        for (i = 0; i < CSC_MAX_COEFF_COUNT; i++)
+            c[i] = CSC_Coeff_VLV(m[i]);
+        for (i = 0; i < CSC_MAX_COEFF_COUNT / 3; i++) {
+            reg[2 * i] = c[3 * i + 1] << 16 | c[3 * i];
+            reg[2 * i + 1] = c[3 * i + 2];
+        }
+        return;
+    }
+
+    for (i = 0; i < CSC_MAX_COEFF_COUNT; i++)
+        c[i] = CSC_Coeff_HSW(m[i]);
+    for (i = 0; i < CSC_MAX_COEFF_COUNT / 3; i++) {
+        reg[2 * i] = c[3 * i] << 16 | c[3 * i + 1];
+        reg[2 * i + 1] = c[3 * i + 2] << 16;
+    }
+
+    if (CSC_Matrix->param_valid & CSC_OFFSET_VALID_MASK) {
+        for (i = 0; i < CSC_MAX_OFFSET_COUNT; i++) {
+            CSC_Coeff_t->csc_preoffset[i] =
+                CSC_Offset_HSW(CSC_Matrix->CSCPreoffset[i]);
+            CSC_Coeff_t->csc_postoffset[i] =
+                CSC_Offset_HSW(CSC_Matrix->CSCPostoffset[i]);
+        }
+    }
+    if (CSC_Matrix->param_valid & CSC_MODE_VALID_MASK)
+        CSC_Coeff_t->csc_mode = CSC_Matrix->CSCMode == 0x1 ? 0x2 : 0;
+    CSC_Coeff_t->param_valid = CSC_Matrix->param_valid;
+}
+
+/**
+ * Convert count matrices into register values for the given device.
+ *
+ * Each output is fully initialized: crtc_id is copied from the matrix and
+ * fields not selected by param_valid are zero.  Returns -EINVAL if the
+ * device has no CSC unit.
+ */
+int drmCSCConvert(int devid, const struct CSCCoeff_Matrix *CSC_Matrix,
+                  struct csc_coeff *CSC_Coeff_t, int count)
+{
+    enum csc_format format = CSC_Format(devid);
+    int i;
+
+    if (format == CSC_FORMAT_NONE)
+        return -EINVAL;
+
+    for (i = 0; i < count; i++)
+        CSC_Convert_One(&CSC_Matrix[i], &CSC_Coeff_t[i], format);
+
+    return 0;
+}
+
+/*
+ * Conversion cache.
+ *
+ * A two-way set associative table of recently converted matrices, for
+ * callers that re-apply the same few transforms every frame.  Entries are
+ * keyed by a hash of the matrix contents and the device id, and hits are
+ * confirmed against the stored matrix so collisions are harmless.
+ */
+
+struct drm_csc_cache_entry {
+    int valid;
+    int devid;
+    unsigned int hash;
+    struct CSCCoeff_Matrix key;
+    struct csc_coeff value;
+};
+
+struct _drmCSCCache {
+    unsigned int mask;		/* number of sets - 1 */
+    unsigned long hits, misses;
+    struct drm_csc_cache_entry *entries;
+};
+
+/* Copy the fields that affect the conversion; crtc_id does not. */
+static void CSC_Cache_Key(const struct CSCCoeff_Matrix *CSC_Matrix,
+                          struct CSCCoeff_Matrix *key)
+{
+    memset(key, 0, sizeof(*key));
+    key->param_valid = CSC_Matrix->param_valid;
+    memcpy(key->CoeffMatrix, CSC_Matrix->CoeffMatrix,
+           sizeof(key->CoeffMatrix));
+    if (key->param_valid & CSC_OFFSET_VALID_MASK) {
+        memcpy(key->CSCPreoffset, CSC_Matrix->CSCPreoffset,
+               sizeof(key->CSCPreoffset));
+        memcpy(key->CSCPostoffset, CSC_Matrix->CSCPostoffset,
+               sizeof(key->CSCPostoffset));
+    }
+    if (key->param_valid & CSC_MODE_VALID_MASK)
+        key->CSCMode = CSC_Matrix->CSCMode;
+}
+
+static int CSC_Cache_Match(const struct drm_csc_cache_entry *entry,
+                           const struct CSCCoeff_Matrix *key,
+                           unsigned int hash, int devid)
+{
+    return entry->valid && entry->hash == hash && entry->devid == devid &&
+           !memcmp(&entry->key, key, sizeof(*key));
+}
+
+static unsigned int CSC_Cache_Hash(const struct CSCCoeff_Matrix *key, int devid)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    unsigned int hash = 2166136261u ^ (unsigned int)devid;
+    size_t i;
+
+    for (i = 0; i < sizeof(*key); i++)
+        hash = (hash ^ p[i]) * 16777619u;
+
+    /* FNV's low bits are weak and the table index uses only those. */
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+
+    return hash;
+}
+
+drmCSCCachePtr drmCSCCacheCreate(unsigned int size)
+{
+    drmCSCCachePtr cache;
+    unsigned int n = 2;
+
+    while (n < size)
+        n <<= 1;
+
+    cache = calloc(1, sizeof(*cache));
+    if (!cache)
+        return NULL;
+    cache->entries = calloc(n, sizeof(*cache->entries));
+    if (!cache->entries) {
+        free(cache);
+        return NULL;
+    }
+    cache->mask = n / 2 - 1;
+
+    return cache;
+}
+
+void drmCSCCacheDestroy(drmCSCCachePtr cache)
+{
+    if (!cache)
+        return;
+
+    free(cache->entries);
+    free(cache);
+}
+
+int drmCSCCacheConvert(drmCSCCachePtr cache, int devid,
+                       const struct CSCCoeff_Matrix *CSC_Matrix,
+                       struct csc_coeff *CSC_Coeff_t, int count)
+{
+    enum csc_format format = CSC_Format(devid);
+    struct drm_csc_cache_entry *set, *entry, tmp;
+    struct CSCCoeff_Matrix key;
+    unsigned int hash;
+    int i;
+
+    if (format == CSC_FORMAT_NONE)
+        return -EINVAL;
+    if (!cache)
+        return drmCSCConvert(devid, CSC_Matrix, CSC_Coeff_t, count);
+
+    for (i = 0; i < count; i++) {
+        CSC_Cache_Key(&CSC_Matrix[i], &key);
+        hash = CSC_Cache_Hash(&key, devid);
+        set = &cache->entries[(hash & cache->mask) * 2];
+
+        if (CSC_Cache_Match(&set[0], &key, hash, devid)) {
+            cache->hits++;
+        } else if (CSC_Cache_Match(&set[1], &key, hash, devid)) {
+            /* Keep the most recently used entry in way 0. */
+            tmp = set[0];
+            set[0] = set[1];
+            set[1] = tmp;
+            cache->hits++;
+        } else {
+            set[1] = set[0];
+            CSC_Convert_One(&key, &set[0].value, format);
+            set[0].key = key;
+            set[0].hash = hash;
+            set[0].devid = devid;
+            set[0].valid = 1;
+            cache->misses++;
+        }
+        entry = &set[0];
+
+        CSC_Coeff_t[i] = entry->value;
+        CSC_Coeff_t[i].crtc_id = CSC_Matrix[i].crtc_id;
+    }
+
+    return 0;
+}
+
+void drmCSCCacheStats(drmCSCCachePtr cache, unsigned long *hits,
+                      unsigned long *misses)
+{
+    if (hits)
+        *hits = cache ? cache->hits : 0;
+    if (misses)
+        *misses = cache ? cache->misses : 0;
+}
@@ -165,6 +165,7 @@ void *drmHashCreate(void)
 
     table           = HASH_ALLOC(sizeof(*table));
     if (!table) return NULL;
+    HashHash(0);		/* Set up the scatter table before first use */
     table->magic    = HASH_MAGIC;
     table->entries  = 0;
     table->hits     = 0;
@@ -48,6 +48,7 @@
 #include "xf86drmMode.h"
 #include "xf86drm.h"
 #include <drm.h>
+#include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
 #include <unistd.h>
@@ -1128,3 +1129,243 @@ int drmModeObjectSetProperty(int fd, uint32_t object_id, uint32_t object_type,
 
 	return DRM_IOCTL(fd, DRM_IOCTL_MODE_OBJ_SETPROPERTY, &prop);
 }
+
+/*
+ * Property snapshots.
+ *
+ * Fetching the properties of every KMS object with
+ * drmModeObjectGetProperties() + drmModeGetProperty() costs two ioctls per
+ * object plus two ioctls per (object, property) pair.  A snapshot instead
+ * reads each object's ids/values with a single ioctl into a shared scratch
+ * buffer, and fetches the metadata of each distinct property only once.
+ */
+
+#define SNAPSHOT_INITIAL_PROPS 32
+
+static int drmModeCmpU32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int drmModeCmpPropertyId(const void *key, const void *elem)
+{
+	uint32_t id = *(const uint32_t *)key;
+	const drmModePropertyRes *prop = *(drmModePropertyPtr const *)elem;
+
+	return id < prop->prop_id ? -1 : id > prop->prop_id;
+}
+
+drmModePropertySnapshotPtr drmModeGetPropertySnapshot(int fd, uint32_t count,
+						      const uint32_t *object_ids,
+						      const uint32_t *object_types)
+{
+	struct drm_mode_obj_get_properties properties;
+	drmModePropertySnapshotPtr snap;
+	uint32_t *scratch_ids = NULL, *unique = NULL;
+	uint64_t *scratch_values = NULL;
+	uint32_t scratch_size = SNAPSHOT_INITIAL_PROPS;
+	uint32_t pool_size = 0, pool_count = 0;
+	uint32_t i, n;
+
+	if (count && (!object_ids || !object_types))
+		return NULL;
+
+	snap = drmMalloc(sizeof(*snap));
+	if (!snap)
+		return NULL;
+
+	if (count) {
+		snap->objects = drmMalloc(count * sizeof(*snap->objects));
+		scratch_ids = drmMalloc(scratch_size * sizeof(uint32_t));
+		scratch_values = drmMalloc(scratch_size * sizeof(uint64_t));
+		if (!snap->objects || !scratch_ids || !scratch_values)
+			goto err;
+	}
+	snap->count_objects = count;
+
+	for (i = 0; i < count; i++) {
+		drmModeObjectPropertySetPtr obj = &snap->objects[i];
+
+retry:
+		/* The scratch buffers are normally large enough for the
+		 * whole property list, so this takes a single ioctl. */
+		memset(&properties, 0, sizeof(properties));
+		properties.obj_id = object_ids[i];
+		properties.obj_type = object_types[i];
+		properties.count_props = scratch_size;
+		properties.props_ptr = VOID2U64(scratch_ids);
+		properties.prop_values_ptr = VOID2U64(scratch_values);
+
+		if (drmIoctl(fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &properties))
+			goto err;
+
+		if (properties.count_props > scratch_size) {
+			drmFree(scratch_ids);
+			drmFree(scratch_values);
+			scratch_size = properties.count_props * 2;
+			scratch_ids = drmMalloc(scratch_size * sizeof(uint32_t));
+			scratch_values = drmMalloc(scratch_size * sizeof(uint64_t));
+			if (!scratch_ids || !scratch_values)
+				goto err;
+			goto retry;
+		}
+
+		n = properties.count_props;
+		if (pool_count + n > pool_size) {
+			uint32_t *ids;
+			uint64_t *values;
+
+			while (pool_count + n > pool_size)
+				pool_size = pool_size ? pool_size * 2 : count * 8;
+
+			ids = realloc(snap->props_pool, pool_size * sizeof(uint32_t));
+			if (!ids)
+				goto err;
+			snap->props_pool = ids;
+			values = realloc(snap->values_pool, pool_size * sizeof(uint64_t));
+			if (!values)
+				goto err;
+			snap->values_pool = values;
+		}
+		memcpy(snap->props_pool + pool_count, scratch_ids,
+		       n * sizeof(uint32_t));
+		memcpy(snap->values_pool + pool_count, scratch_values,
+		       n * sizeof(uint64_t));
+
+		obj->object_id = object_ids[i];
+		obj->object_type = object_types[i];
+		obj->count_props = n;
+		pool_count += n;
+	}
+
+	/* The pools are final now, point each object at its slice. */
+	for (i = 0, n = 0; i < count; n += snap->objects[i++].count_props) {
+		if (!snap->objects[i].count_props)
+			continue;
+		snap->objects[i].props = snap->props_pool + n;
+		snap->objects[i].prop_values = snap->values_pool + n;
+	}
+
+	/* De-duplicate the property ids and fetch each one's metadata once. */
+	if (pool_count) {
+		unique = drmAllocCpy(snap->props_pool, pool_count, sizeof(uint32_t));
+		if (!unique)
+			goto err;
+		qsort(unique, pool_count, sizeof(uint32_t), drmModeCmpU32);
+		for (i = 1, n = 1; i < pool_count; i++)
+			if (unique[i] != unique[n - 1])
+				unique[n++] = unique[i];
+
+		snap->properties = drmMalloc(n * sizeof(drmModePropertyPtr));
+		if (!snap->properties)
+			goto err;
+		for (i = 0; i < n; i++) {
+			snap->properties[i] = drmModeGetProperty(fd, unique[i]);
+			if (!snap->properties[i])
+				goto err;
+			snap->count_properties++;
+		}
+	}
+
+	drmFree(unique);
+	drmFree(scratch_ids);
+	drmFree(scratch_values);
+	return snap;
+
+err:
+	drmFree(unique);
+	drmFree(scratch_ids);
+	drmFree(scratch_values);
+	drmModeFreePropertySnapshot(snap);
+	return NULL;
+}
+
+drmModePropertySnapshotPtr drmModeGetDevicePropertySnapshot(int fd)
+{
+	drmModePropertySnapshotPtr snap = NULL;
+	drmModePlaneResPtr planes;
+	drmModeResPtr res;
+	uint32_t *ids, *types;
+	uint32_t i, total, count = 0;
+
+	res = drmModeGetResources(fd);
+	if (!res)
+		return NULL;
+	/* Planes are optional; older kernels don't expose them. */
+	planes = drmModeGetPlaneResources(fd);
+
+	total = res->count_crtcs + res->count_connectors +
+		(planes ? planes->count_planes : 0);
+	ids = drmMalloc((total + 1) * sizeof(uint32_t));
+	types = drmMalloc((total + 1) * sizeof(uint32_t));
+	if (!ids || !types)
+		goto out;
+
+	for (i = 0; i < (uint32_t)res->count_crtcs; i++) {
+		ids[count] = res->crtcs[i];
+		types[count++] = DRM_MODE_OBJECT_CRTC;
+	}
+	for (i = 0; i < (uint32_t)res->count_connectors; i++) {
+		ids[count] = res->connectors[i];
+		types[count++] = DRM_MODE_OBJECT_CONNECTOR;
+	}
+	for (i = 0; planes && i < planes->count_planes; i++) {
+		ids[count] = planes->planes[i];
+		types[count++] = DRM_MODE_OBJECT_PLANE;
+	}
+
+	snap = drmModeGetPropertySnapshot(fd, count, ids, types);
+
+out:
+	drmFree(ids);
+	drmFree(types);
+	drmModeFreePlaneResources(planes);
+	drmModeFreeResources(res);
+	return snap;
+}
+
+drmModePropertyPtr drmModeSnapshotGetProperty(drmModePropertySnapshotPtr snap,
+					      uint32_t property_id)
+{
+	drmModePropertyPtr *prop;
+
+	if (!snap || !snap->count_properties)
+		return NULL;
+
+	prop = bsearch(&property_id, snap->properties, snap->count_properties,
+		       sizeof(drmModePropertyPtr), drmModeCmpPropertyId);
+	return prop ? *prop : NULL;
+}
+
+drmModeObjectPropertySetPtr
+drmModeSnapshotGetObject(drmModePropertySnapshotPtr snap, uint32_t object_id)
+{
+	uint32_t i;
+
+	if (!snap)
+		return NULL;
+
+	for (i = 0; i < snap->count_objects; i++)
+		if (snap->objects[i].object_id == object_id)
+			return &snap->objects[i];
+
+	return NULL;
+}
+
+void drmModeFreePropertySnapshot(drmModePropertySnapshotPtr ptr)
+{
+	uint32_t i;
+
+	if (!ptr)
+		return;
+
+	for (i = 0; i < ptr->count_properties; i++)
+		drmModeFreeProperty(ptr->properties[i]);
+	drmFree(ptr->properties);
+	free(ptr->props_pool);
+	free(ptr->values_pool);
+	drmFree(ptr->objects);
+	drmFree(ptr);
+}
@@ -330,6 +330,30 @@ typedef struct _drmModeObjectProperties {
 	uint64_t *prop_values;
 } drmModeObjectProperties, *drmModeObjectPropertiesPtr;
 
+/**
+ * Property ids and values of one KMS object inside a property snapshot.
+ * The arrays point into storage owned by the snapshot.
+ */
+typedef struct _drmModeObjectPropertySet {
+	uint32_t object_id;
+	uint32_t object_type;
+	uint32_t count_props;
+	uint32_t *props; /**< List of property ids */
+	uint64_t *prop_values; /**< List of property values */
+} drmModeObjectPropertySet, *drmModeObjectPropertySetPtr;
+
+typedef struct _drmModePropertySnapshot {
+	uint32_t count_objects;
+	drmModeObjectPropertySetPtr objects;
+
+	uint32_t count_properties;
+	drmModePropertyPtr *properties; /**< Distinct properties, sorted by id */
+
+	/* private */
+	uint32_t *props_pool;
+	uint64_t *values_pool;
+} drmModePropertySnapshot, *drmModePropertySnapshotPtr;
+
 typedef struct _drmModePlane {
 	uint32_t count_formats;
 	uint32_t *formats;
@@ -486,6 +510,25 @@ extern int drmModeObjectSetProperty(int fd, uint32_t object_id,
 				    uint32_t object_type, uint32_t property_id,
 				    uint64_t value);
 
+/**
+ * Retrieve the properties of count objects in one go.  Property metadata is
+ * fetched once per distinct property id and shared between the objects.
+ */
+extern drmModePropertySnapshotPtr drmModeGetPropertySnapshot(int fd,
+					uint32_t count,
+					const uint32_t *object_ids,
+					const uint32_t *object_types);
+
+/**
+ * Snapshot the properties of every CRTC, connector and plane of the device.
+ */
+extern drmModePropertySnapshotPtr drmModeGetDevicePropertySnapshot(int fd);
+extern drmModePropertyPtr drmModeSnapshotGetProperty(drmModePropertySnapshotPtr snap,
+						     uint32_t property_id);
+extern drmModeObjectPropertySetPtr drmModeSnapshotGetObject(drmModePropertySnapshotPtr snap,
+							    uint32_t object_id);
+extern void drmModeFreePropertySnapshot(drmModePropertySnapshotPtr ptr);
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif